@@ -0,0 +1,138 @@
+#include <stdlib.h>
+
+#include "admission.h"
+
+static void enqueue(admission* cur, admission_job* job, uint64_t bytes);
+static void let_in(admission* cur);
+
+admission* create_admission(thread_pool* pool, uint64_t budget)
+{
+	admission* to_return = calloc(1, sizeof(admission));
+	to_return->pool = pool;
+	to_return->budget = budget;
+	pthread_mutex_init(&to_return->lock, NULL);
+	pthread_cond_init(&to_return->admitted, NULL);
+
+	return to_return;
+}
+
+void free_admission(admission* to_free)
+{
+	if (to_free != NULL)
+	{
+		pthread_mutex_destroy(&to_free->lock);
+		pthread_cond_destroy(&to_free->admitted);
+		free(to_free);
+	}
+}
+
+void admission_submit(admission* cur, admission_job* job, uint64_t bytes, task_function function, void* arg)
+{
+	job->function = function;
+	job->arg = arg;
+
+	pthread_mutex_lock(&cur->lock);
+	enqueue(cur, job, bytes);
+	pthread_mutex_unlock(&cur->lock);
+}
+
+void admission_wait(admission* cur, uint64_t bytes)
+{
+	admission_job job;
+	job.function = NULL;
+	job.arg = NULL;
+
+	pthread_mutex_lock(&cur->lock);
+	enqueue(cur, &job, bytes);
+	while (!job.admitted)
+	{
+		pthread_cond_wait(&cur->admitted, &cur->lock);
+	}
+	pthread_mutex_unlock(&cur->lock);
+}
+
+void admission_release(admission* cur, uint64_t bytes)
+{
+	pthread_mutex_lock(&cur->lock);
+	cur->in_use -= bytes;
+	let_in(cur);
+	pthread_mutex_unlock(&cur->lock);
+}
+
+//add a job to the back of the line and let in whatever fits. called with the lock held
+static void enqueue(admission* cur, admission_job* job, uint64_t bytes)
+{
+	job->bytes = bytes;
+	job->admitted = 0;
+	job->passed = 0;
+	job->next = NULL;
+	if (cur->last != NULL)
+	{
+		cur->last->next = job;
+	}
+	else
+	{
+		cur->first = job;
+	}
+	cur->last = job;
+
+	let_in(cur);
+	if (!job->admitted)
+	{
+		cur->waited++;
+	}
+}
+
+//start every waiting job that fits, oldest first. called with the lock held
+static void let_in(admission* cur)
+{
+	admission_job* previous = NULL;
+	admission_job* job = cur->first;
+	while (job != NULL)
+	{
+		//the job may be reused as soon as it's started, so nothing is read from it after that
+		admission_job* next = job->next;
+		if (cur->in_use > 0 && cur->in_use + job->bytes > cur->budget)
+		{
+			//the oldest job has been passed enough times, the memory that frees up from here on is kept for it
+			if (previous == NULL && job->passed >= ADMISSION_MAX_PASSES)
+			{
+				return;
+			}
+			previous = job;
+			job = next;
+			continue;
+		}
+
+		if (previous != NULL)
+		{
+			previous->next = next;
+			cur->first->passed++;
+		}
+		else
+		{
+			cur->first = next;
+		}
+		if (cur->last == job)
+		{
+			cur->last = previous;
+		}
+
+		cur->in_use += job->bytes;
+		if (cur->in_use > cur->peak)
+		{
+			cur->peak = cur->in_use;
+		}
+
+		job->admitted = 1;
+		if (job->function != NULL)
+		{
+			pool_submit(cur->pool, job->function, job->arg);
+		}
+		else
+		{
+			pthread_cond_broadcast(&cur->admitted);
+		}
+		job = next;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+//jobs that are let in ahead of the oldest waiting job before everything waits for it instead
+#define ADMISSION_MAX_PASSES 16
+
+//a decode waiting for its memory. owned by the caller, and has to stay put until the job is let in
+typedef struct Admission_job admission_job;
+typedef struct Admission_job
+{
+	uint64_t bytes;
+
+	//run on the pool once the job is let in. NULL for admission_wait, which sets admitted instead
+	task_function function;
+	void* arg;
+	int admitted;
+
+	//jobs let in ahead of this one while it was the oldest
+	int passed;
+	admission_job* next;
+}admission_job;
+
+//keeps the memory the running decodes are predicted to need under a budget. jobs are let in oldest first, but a job
+//that doesn't fit yet doesn't hold up smaller ones behind it (up to ADMISSION_MAX_PASSES of them, so it can't starve).
+//a job bigger than the whole budget runs once nothing else is running
+typedef struct Admission
+{
+	thread_pool* pool;
+	uint64_t budget;
+
+	pthread_mutex_t lock;
+	pthread_cond_t admitted;
+
+	//bytes of the jobs that are running, and the most there ever were
+	uint64_t in_use;
+	uint64_t peak;
+
+	//jobs waiting, oldest first. waited counts every job that couldn't go in right away
+	admission_job* first;
+	admission_job* last;
+	uint64_t waited;
+}admission;
+
+//pool runs the jobs of admission_submit (it may be NULL if only admission_wait is used)
+admission* create_admission(thread_pool* pool, uint64_t budget);
+void free_admission(admission* to_free);
+
+//run function(arg, worker) on the pool once bytes more fit under the budget. returns right away
+void admission_submit(admission* cur, admission_job* job, uint64_t bytes, task_function function, void* arg);
+
+//block until bytes more fit under the budget
+void admission_wait(admission* cur, uint64_t bytes);
+
+//a job is done with the bytes it was let in with. waiting jobs that fit now are let in
+void admission_release(admission* cur, uint64_t bytes);
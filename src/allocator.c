@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+static void* libc_alloc(void* user, size_t size);
+static void* libc_realloc(void* user, void* pointer, size_t old_size, size_t new_size);
+static void libc_free(void* user, void* pointer, size_t size);
+
+const mem_allocator libc_allocator = {libc_alloc, libc_realloc, libc_free, NULL};
+
+static void* libc_alloc(void* user, size_t size)
+{
+	return malloc(size);
+}
+
+static void* libc_realloc(void* user, void* pointer, size_t old_size, size_t new_size)
+{
+	return realloc(pointer, new_size);
+}
+
+static void libc_free(void* user, void* pointer, size_t size)
+{
+	free(pointer);
+}
+
+//zeroed hooks stand for libc
+static const mem_allocator* hooks(const mem_allocator* allocator)
+{
+	if(allocator == NULL || allocator->alloc == NULL)
+	{
+		return &libc_allocator;
+	}
+
+	return allocator;
+}
+
+void* mem_alloc(const mem_allocator* allocator, size_t size)
+{
+	allocator = hooks(allocator);
+	return allocator->alloc(allocator->user, size);
+}
+
+void* mem_calloc(const mem_allocator* allocator, size_t size)
+{
+	void* to_return = mem_alloc(allocator, size);
+	if(to_return != NULL)
+	{
+		memset(to_return, 0, size);
+	}
+
+	return to_return;
+}
+
+void* mem_realloc(const mem_allocator* allocator, void* pointer, size_t old_size, size_t new_size)
+{
+	allocator = hooks(allocator);
+	if(pointer == NULL)
+	{
+		return allocator->alloc(allocator->user, new_size);
+	}
+
+	if(allocator->realloc != NULL)
+	{
+		return allocator->realloc(allocator->user, pointer, old_size, new_size);
+	}
+
+	void* to_return = allocator->alloc(allocator->user, new_size);
+	if(to_return == NULL)
+	{
+		return NULL;
+	}
+
+	memcpy(to_return, pointer, (old_size < new_size) ? old_size : new_size);
+	allocator->free(allocator->user, pointer, old_size);
+	return to_return;
+}
+
+void mem_free(const mem_allocator* allocator, void* pointer, size_t size)
+{
+	if(pointer == NULL)
+	{
+		return;
+	}
+
+	allocator = hooks(allocator);
+	allocator->free(allocator->user, pointer, size);
+}
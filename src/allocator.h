@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+//memory hooks for the decoder. every hook gets the user pointer and the size of the block, so pools,
+//size-class allocators and quota counters work without headers of their own
+//a zeroed mem_allocator means malloc/realloc/free, so structs that are calloc'd or memset use libc by default
+typedef struct Mem_allocator
+{
+	//NULL on failure
+	void* (*alloc)(void* user, size_t size);
+
+	//old_size is the size the block was allocated with. on failure return NULL and leave the block alone
+	//optional: without it blocks are moved with alloc, memcpy and free
+	void* (*realloc)(void* user, void* pointer, size_t old_size, size_t new_size);
+
+	void (*free)(void* user, void* pointer, size_t size);
+
+	void* user;
+}mem_allocator;
+
+//the libc allocator, for hooks that want to pass calls through
+extern const mem_allocator libc_allocator;
+
+//call the hooks (or libc if allocator is NULL or zeroed)
+void* mem_alloc(const mem_allocator* allocator, size_t size);
+void* mem_calloc(const mem_allocator* allocator, size_t size);
+void* mem_realloc(const mem_allocator* allocator, void* pointer, size_t old_size, size_t new_size);
+void mem_free(const mem_allocator* allocator, void* pointer, size_t size);
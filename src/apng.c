@@ -0,0 +1,671 @@
+#include <pthread.h>
+
+#include "apng.h"
+#include "thread_pool.h"
+
+//frames decoded ahead of the one being composited, per thread
+#define FRAMES_PER_THREAD 2
+
+//a run of compressed data in the file (an IDAT payload, or an fdAT payload without its sequence number)
+typedef struct Frame_data
+{
+	uint64_t offset;
+	uint64_t length;
+}frame_data;
+
+//fcTL of a frame and where its data is
+typedef struct Frame_header
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t w;
+	uint32_t h;
+	uint16_t delay_numerator;
+	uint16_t delay_denominator;
+	uint8_t dispose_op;
+	uint8_t blend_op;
+
+	uint64_t first_data;
+	uint64_t data_count;
+}frame_header;
+
+//everything the chunk walk finds. the data pointers point into the file, nothing is copied
+typedef struct Apng_file
+{
+	const uint8_t* data;
+	uint64_t size;
+	apng_info info;
+
+	frame_header* frames;
+	uint64_t frame_count;
+	uint64_t frame_capacity;
+
+	frame_data* runs;
+	uint64_t run_count;
+	uint64_t run_capacity;
+
+	//bytes of IDAT data, whether or not the default image is a frame
+	uint64_t idat_bytes;
+
+	//where the lists, the canvas and the decoders' memory come from (NULL is libc)
+	const mem_allocator* allocator;
+}apng_file;
+
+typedef struct Apng_decode apng_decode;
+
+//one frame being inflated and unfiltered on the pool. the decoder is reused by every frame that goes through the slot
+typedef struct Frame_slot
+{
+	apng_decode* decode;
+	png_decoder* decoder;
+
+	//the frame's data glued together when it is split over more than one chunk
+	dynamic_array* stream;
+
+	uint32_t frame;
+	int done;
+
+	//decoder->image once done, NULL if the decode was skipped
+	png* image;
+}frame_slot;
+
+typedef struct Apng_decode
+{
+	apng_file* file;
+
+	//slots are marked done under the lock. stopped makes frames that haven't started yet skip the work
+	pthread_mutex_t lock;
+	pthread_cond_t frame_done;
+	int stopped;
+}apng_decode;
+
+static int parse_apng(apng_file* file);
+static int add_frame(apng_file* file, const uint8_t* fcTL, uint32_t length);
+static int add_run(apng_file* file, uint64_t offset, uint64_t length);
+static int grow_list(const mem_allocator* allocator, void** list, uint64_t* capacity, uint64_t needed, size_t item_size);
+static int can_hold(uint64_t compressed_bytes, uint32_t w, uint32_t h, uint8_t bytes_per_pixel);
+static void free_lists(apng_file* file);
+static uint32_t read_u32(const uint8_t* data);
+static uint16_t read_u16(const uint8_t* data);
+
+static void start_frame(thread_pool* pool, frame_slot* slot, uint32_t frame);
+static void decode_frame(void* arg, int worker);
+static void draw_frame(uint8_t* canvas, const png* header, const frame_header* frame, const uint8_t* pixels);
+static void blend_over(uint8_t* destination, const uint8_t* source, uint32_t pixels);
+static void copy_region(uint8_t* to, uint64_t to_stride, const uint8_t* from, uint64_t from_stride, uint32_t rows, uint64_t row_size);
+
+int read_apng(const char* filename, int threads, apng_frame_callback callback, void* user, apng_info* info)
+{
+	return read_apng_using(filename, threads, callback, user, info, NULL);
+}
+
+int read_apng_memory(const uint8_t* data, uint64_t size, int threads, apng_frame_callback callback, void* user, apng_info* info)
+{
+	return read_apng_memory_using(data, size, threads, callback, user, info, NULL);
+}
+
+int read_apng_using(const char* filename, int threads, apng_frame_callback callback, void* user, apng_info* info, const mem_allocator* allocator)
+{
+	dynamic_array* file_data = create_array_using(allocator);
+	if (file_data == NULL || !read_whole_file(file_data, filename))
+	{
+		fprintf(stderr, "read_apng: Failed to open file %s.\n", filename);
+		free_array(file_data);
+		return 0;
+	}
+
+	int to_return = read_apng_memory_using(file_data->data, file_data->count, threads, callback, user, info, allocator);
+	free_array(file_data);
+	return to_return;
+}
+
+int read_apng_memory_using(const uint8_t* data, uint64_t size, int threads, apng_frame_callback callback, void* user, apng_info* info, const mem_allocator* allocator)
+{
+	apng_file file;
+	memset(&file, 0, sizeof(apng_file));
+	file.data = data;
+	file.size = size;
+	file.allocator = allocator;
+
+	int to_return = parse_apng(&file);
+	if (info != NULL)
+	{
+		*info = file.info;
+	}
+	if (!to_return)
+	{
+		free_lists(&file);
+		return 0;
+	}
+
+	png* header = &file.info.header;
+	uint64_t stride = (uint64_t)header->w * header->bytes_per_pixel;
+	uint64_t canvas_size = stride * header->h;
+
+	//saved holds the area under a frame that is disposed to the previous contents, so it's as big as the biggest of those
+	uint64_t saved_size = 0;
+	for (uint64_t i = 0; i < file.frame_count; i++)
+	{
+		uint64_t frame_size = (uint64_t)file.frames[i].w * header->bytes_per_pixel * file.frames[i].h;
+		if (file.frames[i].dispose_op == APNG_DISPOSE_PREVIOUS && frame_size > saved_size)
+		{
+			saved_size = frame_size;
+		}
+	}
+
+	//the canvas starts out transparent black
+	uint8_t* canvas = mem_calloc(allocator, canvas_size);
+	uint8_t* saved = (saved_size > 0) ? mem_alloc(allocator, saved_size) : NULL;
+	if (canvas == NULL || (saved_size > 0 && saved == NULL))
+	{
+		fprintf(stderr, "read_apng: unable to allocate a %dx%d canvas.\n", header->w, header->h);
+		mem_free(allocator, canvas, canvas_size);
+		mem_free(allocator, saved, saved_size);
+		free_lists(&file);
+		return 0;
+	}
+
+	thread_pool* pool = create_pool(threads);
+	if (pool == NULL)
+	{
+		mem_free(allocator, canvas, canvas_size);
+		mem_free(allocator, saved, saved_size);
+		free_lists(&file);
+		return 0;
+	}
+
+	apng_decode decode;
+	memset(&decode, 0, sizeof(apng_decode));
+	decode.file = &file;
+	pthread_mutex_init(&decode.lock, NULL);
+	pthread_cond_init(&decode.frame_done, NULL);
+
+	//frame i goes through slot i % slot_count, so slot_count frames are decoded ahead of the compositing
+	uint64_t slot_count = (uint64_t)pool->thread_count * FRAMES_PER_THREAD;
+	if (slot_count > file.frame_count)
+	{
+		slot_count = file.frame_count;
+	}
+	frame_slot* slots = mem_calloc(allocator, slot_count * sizeof(frame_slot));
+	if (slots == NULL)
+	{
+		slot_count = 0;
+		to_return = 0;
+	}
+	for (uint64_t i = 0; i < slot_count; i++)
+	{
+		slots[i].decode = &decode;
+		slots[i].decoder = create_decoder_using(allocator);
+		slots[i].stream = create_array_using(allocator);
+		if (slots[i].decoder == NULL || slots[i].stream == NULL)
+		{
+			to_return = 0;
+		}
+	}
+	if (!to_return)
+	{
+		fprintf(stderr, "read_apng: unable to allocate the frame decoders.\n");
+	}
+
+	for (uint64_t i = 0; to_return && i < slot_count; i++)
+	{
+		start_frame(pool, &slots[i], i);
+	}
+
+	for (uint64_t i = 0; to_return && i < file.frame_count; i++)
+	{
+		frame_slot* slot = &slots[i % slot_count];
+		pthread_mutex_lock(&decode.lock);
+		while (!slot->done)
+		{
+			pthread_cond_wait(&decode.frame_done, &decode.lock);
+		}
+		pthread_mutex_unlock(&decode.lock);
+
+		if (slot->image == NULL || !slot->image->is_valid)
+		{
+			fprintf(stderr, "read_apng: frame %lu could not be decoded.\n", i);
+			to_return = 0;
+			break;
+		}
+
+		const frame_header* frame = &file.frames[i];
+		uint64_t offset = frame->y * stride + (uint64_t)frame->x * header->bytes_per_pixel;
+		uint64_t frame_stride = (uint64_t)frame->w * header->bytes_per_pixel;
+
+		if (frame->dispose_op == APNG_DISPOSE_PREVIOUS)
+		{
+			copy_region(saved, frame_stride, canvas + offset, stride, frame->h, frame_stride);
+		}
+		draw_frame(canvas, header, frame, slot->image->pixel_data->data);
+
+		//the slot is free once the frame is on the canvas
+		if (i + slot_count < file.frame_count)
+		{
+			start_frame(pool, slot, i + slot_count);
+		}
+
+		apng_frame to_deliver;
+		to_deliver.info = &file.info;
+		to_deliver.index = i;
+		to_deliver.x = frame->x;
+		to_deliver.y = frame->y;
+		to_deliver.w = frame->w;
+		to_deliver.h = frame->h;
+		to_deliver.delay_numerator = frame->delay_numerator;
+		to_deliver.delay_denominator = frame->delay_denominator;
+		to_deliver.dispose_op = frame->dispose_op;
+		to_deliver.blend_op = frame->blend_op;
+		to_deliver.canvas = canvas;
+		if (!callback(user, &to_deliver))
+		{
+			fprintf(stderr, "read_apng: frame callback stopped the decode at frame %lu.\n", i);
+			to_return = 0;
+			break;
+		}
+
+		//get the canvas ready for the next frame
+		if (frame->dispose_op == APNG_DISPOSE_BACKGROUND)
+		{
+			for (uint32_t row = 0; row < frame->h; row++)
+			{
+				memset(canvas + offset + row * stride, 0, frame_stride);
+			}
+		}
+		else if (frame->dispose_op == APNG_DISPOSE_PREVIOUS)
+		{
+			copy_region(canvas + offset, stride, saved, frame_stride, frame->h, frame_stride);
+		}
+	}
+
+	//frames still queued after a failure don't need decoding
+	pthread_mutex_lock(&decode.lock);
+	decode.stopped = 1;
+	pthread_mutex_unlock(&decode.lock);
+	pool_wait(pool);
+	free_pool(pool);
+
+	for (uint64_t i = 0; i < slot_count; i++)
+	{
+		free_decoder(slots[i].decoder);
+		free_array(slots[i].stream);
+	}
+	mem_free(allocator, slots, slot_count * sizeof(frame_slot));
+	mem_free(allocator, canvas, canvas_size);
+	mem_free(allocator, saved, saved_size);
+	free_lists(&file);
+	pthread_mutex_destroy(&decode.lock);
+	pthread_cond_destroy(&decode.frame_done);
+
+	return to_return;
+}
+
+//walk the chunks and collect the frames. 1 is success, 0 is failure
+static int parse_apng(apng_file* file)
+{
+	png* header = &file->info.header;
+	if (!probe_png_memory(file->data, file->size, header))
+	{
+		return 0;
+	}
+
+	//frame that the IDAT data belongs to (-1 if the default image isn't shown)
+	int64_t idat_frame = -1;
+	int seen_acTL = 0;
+	int seen_IDAT = 0;
+	uint32_t next_sequence = 0;
+
+	uint64_t position = 8;
+	while (1)
+	{
+		if (file->size - position < 12)
+		{
+			fprintf(stderr, "read_apng: data ends before IEND.\n");
+			return 0;
+		}
+
+		uint32_t length = read_u32(file->data + position);
+		const char* type = (const char*)file->data + position + 4;
+		const uint8_t* body = file->data + position + 8;
+		if (length > file->size - position - 12)
+		{
+			fprintf(stderr, "read_apng: chunk %.4s runs past the end of the data.\n", type);
+			return 0;
+		}
+
+		if (strncmp(type, "IEND", 4) == 0)
+		{
+			break;
+		}
+		else if (strncmp(type, "acTL", 4) == 0)
+		{
+			if (seen_acTL || seen_IDAT || length < 8)
+			{
+				fprintf(stderr, "read_apng: misplaced or short acTL chunk.\n");
+				return 0;
+			}
+			seen_acTL = 1;
+			file->info.frame_count = read_u32(body);
+			file->info.play_count = read_u32(body + 4);
+		}
+		else if (strncmp(type, "fcTL", 4) == 0 && seen_acTL)
+		{
+			if (length < 26 || read_u32(body) != next_sequence++)
+			{
+				fprintf(stderr, "read_apng: fcTL chunk is short or out of sequence.\n");
+				return 0;
+			}
+			if (!add_frame(file, body, length))
+			{
+				return 0;
+			}
+
+			//a frame control chunk in front of IDAT makes the default image the first frame
+			if (!seen_IDAT)
+			{
+				idat_frame = file->frame_count - 1;
+				file->info.default_is_frame = 1;
+			}
+		}
+		else if (strncmp(type, "IDAT", 4) == 0)
+		{
+			//without acTL this is a plain png, and the default image is its only frame
+			if (!seen_acTL && file->frame_count == 0)
+			{
+				uint8_t whole_image[26] = {0};
+				whole_image[4] = header->w >> 24;
+				whole_image[5] = header->w >> 16;
+				whole_image[6] = header->w >> 8;
+				whole_image[7] = header->w;
+				whole_image[8] = header->h >> 24;
+				whole_image[9] = header->h >> 16;
+				whole_image[10] = header->h >> 8;
+				whole_image[11] = header->h;
+				if (!add_frame(file, whole_image, 26))
+				{
+					return 0;
+				}
+				idat_frame = 0;
+				file->info.frame_count = 1;
+				file->info.default_is_frame = 1;
+			}
+
+			if (idat_frame >= 0 && (uint64_t)idat_frame != file->frame_count - 1)
+			{
+				fprintf(stderr, "read_apng: IDAT chunks are not next to each other.\n");
+				return 0;
+			}
+			seen_IDAT = 1;
+			file->idat_bytes += length;
+			if (idat_frame >= 0 && !add_run(file, position + 8, length))
+			{
+				return 0;
+			}
+		}
+		else if (strncmp(type, "fdAT", 4) == 0 && seen_acTL)
+		{
+			if (length < 4 || read_u32(body) != next_sequence++)
+			{
+				fprintf(stderr, "read_apng: fdAT chunk is short or out of sequence.\n");
+				return 0;
+			}
+			if (!seen_IDAT || file->frame_count == 0 || (int64_t)file->frame_count - 1 == idat_frame)
+			{
+				fprintf(stderr, "read_apng: fdAT chunk without a frame control chunk in front of it.\n");
+				return 0;
+			}
+			if (!add_run(file, position + 12, length - 4))
+			{
+				return 0;
+			}
+		}
+
+		//same rule as read_png: unknown critical chunks can't be ignored
+		else if ((type[0] & 0x20) == 0 && strncmp(type, "IHDR", 4) != 0)
+		{
+			fprintf(stderr, "read_apng: PNG contains features that are not supported in chunk: %.4s\n", type);
+			return 0;
+		}
+
+		//chunk, length, type and CRC (CRC check is unsupported)
+		position += (uint64_t)length + 12;
+	}
+
+	if (!seen_IDAT)
+	{
+		fprintf(stderr, "read_apng: PNG has no image data.\n");
+		return 0;
+	}
+	if (file->frame_count != file->info.frame_count)
+	{
+		fprintf(stderr, "read_apng: acTL promises %u frames but the file holds %lu.\n", file->info.frame_count, file->frame_count);
+		return 0;
+	}
+
+	//nothing is allocated for the canvas (or a frame) that its data couldn't fill. the IDAT data is always a whole canvas
+	if (!can_hold(file->idat_bytes, header->w, header->h, header->bytes_per_pixel))
+	{
+		fprintf(stderr, "read_apng: %lu bytes of IDAT data can't hold a %dx%d image.\n", file->idat_bytes, header->w, header->h);
+		return 0;
+	}
+	for (uint64_t i = 0; i < file->frame_count; i++)
+	{
+		const frame_header* frame = &file->frames[i];
+		uint64_t compressed_bytes = 0;
+		for (uint64_t run = frame->first_data; run < frame->first_data + frame->data_count; run++)
+		{
+			compressed_bytes += file->runs[run].length;
+		}
+		if (frame->data_count == 0 || !can_hold(compressed_bytes, frame->w, frame->h, header->bytes_per_pixel))
+		{
+			fprintf(stderr, "read_apng: frame %lu has no image data, or too little for a %ux%u frame.\n", i, frame->w, frame->h);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+//deflate can't expand data by more than 1032:1 (the same bound decode_png trusts headers with)
+static int can_hold(uint64_t compressed_bytes, uint32_t w, uint32_t h, uint8_t bytes_per_pixel)
+{
+	uint64_t filtered_size = (uint64_t)h * ((uint64_t)w * bytes_per_pixel + 1);
+	return filtered_size <= compressed_bytes * 1032 + 1032;
+}
+
+static void free_lists(apng_file* file)
+{
+	mem_free(file->allocator, file->frames, file->frame_capacity * sizeof(frame_header));
+	mem_free(file->allocator, file->runs, file->run_capacity * sizeof(frame_data));
+}
+
+//add a frame from the body of an fcTL chunk. 1 is success, 0 is failure
+static int add_frame(apng_file* file, const uint8_t* fcTL, uint32_t length)
+{
+	frame_header frame;
+	memset(&frame, 0, sizeof(frame_header));
+	frame.w = read_u32(fcTL + 4);
+	frame.h = read_u32(fcTL + 8);
+	frame.x = read_u32(fcTL + 12);
+	frame.y = read_u32(fcTL + 16);
+	frame.delay_numerator = read_u16(fcTL + 20);
+	frame.delay_denominator = read_u16(fcTL + 22);
+	frame.dispose_op = fcTL[24];
+	frame.blend_op = fcTL[25];
+	frame.first_data = file->run_count;
+
+	const png* header = &file->info.header;
+	if (frame.w == 0 || frame.h == 0 || (uint64_t)frame.x + frame.w > (uint64_t)header->w || (uint64_t)frame.y + frame.h > (uint64_t)header->h)
+	{
+		fprintf(stderr, "read_apng: frame %lu (%ux%u at %u,%u) doesn't fit on the canvas.\n", file->frame_count, frame.w, frame.h, frame.x, frame.y);
+		return 0;
+	}
+	if (frame.dispose_op > APNG_DISPOSE_PREVIOUS || frame.blend_op > APNG_BLEND_OVER)
+	{
+		fprintf(stderr, "read_apng: frame %lu has an unknown dispose or blend operation.\n", file->frame_count);
+		return 0;
+	}
+
+	if (!grow_list(file->allocator, (void**)&file->frames, &file->frame_capacity, file->frame_count + 1, sizeof(frame_header)))
+	{
+		return 0;
+	}
+	file->frames[file->frame_count++] = frame;
+	return 1;
+}
+
+//add a run of compressed data to the last frame. 1 is success, 0 is failure
+static int add_run(apng_file* file, uint64_t offset, uint64_t length)
+{
+	if (!grow_list(file->allocator, (void**)&file->runs, &file->run_capacity, file->run_count + 1, sizeof(frame_data)))
+	{
+		return 0;
+	}
+
+	file->runs[file->run_count].offset = offset;
+	file->runs[file->run_count].length = length;
+	file->run_count++;
+	file->frames[file->frame_count - 1].data_count++;
+	return 1;
+}
+
+//make room for needed items (doubles the capacity). 1 is success, 0 is failure
+static int grow_list(const mem_allocator* allocator, void** list, uint64_t* capacity, uint64_t needed, size_t item_size)
+{
+	if (needed <= *capacity)
+	{
+		return 1;
+	}
+
+	uint64_t new_capacity = (*capacity < 16) ? 16 : *capacity * 2;
+	void* grown = mem_realloc(allocator, *list, *capacity * item_size, new_capacity * item_size);
+	if (grown == NULL)
+	{
+		fprintf(stderr, "read_apng: unable to allocate the frame list.\n");
+		return 0;
+	}
+
+	*list = grown;
+	*capacity = new_capacity;
+	return 1;
+}
+
+//numbers in chunks are big endian
+static uint32_t read_u32(const uint8_t* data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static uint16_t read_u16(const uint8_t* data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+//hand frame to the pool in slot
+static void start_frame(thread_pool* pool, frame_slot* slot, uint32_t frame)
+{
+	slot->frame = frame;
+	slot->done = 0;
+	slot->image = NULL;
+	pool_submit(pool, decode_frame, slot);
+}
+
+//inflate and unfilter one frame (runs on the pool, any number at once)
+static void decode_frame(void* arg, int worker)
+{
+	frame_slot* slot = arg;
+	apng_decode* decode = slot->decode;
+	apng_file* file = decode->file;
+
+	pthread_mutex_lock(&decode->lock);
+	int stopped = decode->stopped;
+	pthread_mutex_unlock(&decode->lock);
+
+	png* image = NULL;
+	if (!stopped)
+	{
+		const frame_header* frame = &file->frames[slot->frame];
+		const frame_data* runs = file->runs + frame->first_data;
+
+		//data from a single chunk is decoded where it is
+		const uint8_t* data = file->data + runs[0].offset;
+		uint64_t size = runs[0].length;
+		if (frame->data_count > 1)
+		{
+			array_clear(slot->stream);
+			for (uint64_t i = 0; i < frame->data_count; i++)
+			{
+				array_add(slot->stream, file->data + runs[i].offset, runs[i].length);
+			}
+			data = slot->stream->data;
+			size = slot->stream->count;
+		}
+
+		png frame_format = file->info.header;
+		frame_format.w = frame->w;
+		frame_format.h = frame->h;
+		image = decoder_read_stream(slot->decoder, &frame_format, data, size);
+	}
+
+	pthread_mutex_lock(&decode->lock);
+	slot->image = image;
+	slot->done = 1;
+	pthread_cond_broadcast(&decode->frame_done);
+	pthread_mutex_unlock(&decode->lock);
+}
+
+//put the pixels of a frame on the canvas
+static void draw_frame(uint8_t* canvas, const png* header, const frame_header* frame, const uint8_t* pixels)
+{
+	uint8_t bytes_per_pixel = header->bytes_per_pixel;
+	uint64_t stride = (uint64_t)header->w * bytes_per_pixel;
+	uint64_t frame_stride = (uint64_t)frame->w * bytes_per_pixel;
+	uint8_t* destination = canvas + frame->y * stride + (uint64_t)frame->x * bytes_per_pixel;
+
+	//without alpha, blending over is the same as replacing
+	if (frame->blend_op == APNG_BLEND_SOURCE || bytes_per_pixel != 4)
+	{
+		copy_region(destination, stride, pixels, frame_stride, frame->h, frame_stride);
+		return;
+	}
+
+	for (uint32_t row = 0; row < frame->h; row++)
+	{
+		blend_over(destination + row * stride, pixels + row * frame_stride, frame->w);
+	}
+}
+
+//alpha compositing of straight (not premultiplied) RGBA, source over destination
+static void blend_over(uint8_t* destination, const uint8_t* source, uint32_t pixels)
+{
+	for (uint32_t i = 0; i < pixels; i++, destination += 4, source += 4)
+	{
+		uint32_t source_alpha = source[3];
+		if (source_alpha == 255)
+		{
+			memcpy(destination, source, 4);
+			continue;
+		}
+		if (source_alpha == 0)
+		{
+			continue;
+		}
+
+		//alphas scaled by 255 so everything stays in integers
+		uint32_t destination_alpha = destination[3] * (255 - source_alpha);
+		uint32_t alpha = source_alpha * 255 + destination_alpha;
+		for (int c = 0; c < 3; c++)
+		{
+			destination[c] = (source[c] * source_alpha * 255 + destination[c] * destination_alpha + alpha / 2) / alpha;
+		}
+		destination[3] = (alpha + 127) / 255;
+	}
+}
+
+static void copy_region(uint8_t* to, uint64_t to_stride, const uint8_t* from, uint64_t from_stride, uint32_t rows, uint64_t row_size)
+{
+	for (uint32_t row = 0; row < rows; row++)
+	{
+		memcpy(to + row * to_stride, from + row * from_stride, row_size);
+	}
+}
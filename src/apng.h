@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+
+//what happens to a frame's area before the next frame is drawn
+enum
+{
+	APNG_DISPOSE_NONE = 0,
+	APNG_DISPOSE_BACKGROUND = 1,
+	APNG_DISPOSE_PREVIOUS = 2
+};
+
+//how a frame is drawn onto the canvas
+enum
+{
+	APNG_BLEND_SOURCE = 0,
+	APNG_BLEND_OVER = 1
+};
+
+typedef struct Apng_info
+{
+	//IHDR of the file (w and h are the size of the canvas)
+	png header;
+
+	//from acTL. a png without acTL is one frame, the default image. play_count 0 means forever
+	uint32_t frame_count;
+	uint32_t play_count;
+
+	//0 if the default image isn't part of the animation (it's only shown by decoders without apng support)
+	int default_is_frame;
+}apng_info;
+
+typedef struct Apng_frame
+{
+	const apng_info* info;
+	uint32_t index;
+
+	//area of the canvas the frame covers
+	uint32_t x;
+	uint32_t y;
+	uint32_t w;
+	uint32_t h;
+
+	//seconds the frame is shown for is delay_numerator / delay_denominator (a denominator of 0 means 100)
+	uint16_t delay_numerator;
+	uint16_t delay_denominator;
+
+	uint8_t dispose_op;
+	uint8_t blend_op;
+
+	//whole canvas with this frame drawn on it (info->header.w * info->header.h pixels of bytes_per_pixel)
+	//only valid during the callback
+	const uint8_t* canvas;
+}apng_frame;
+
+//gets every frame in order once it has been composited. return 1 to keep going or 0 to stop the decode
+typedef int (*apng_frame_callback)(void* user, const apng_frame* frame);
+
+//decode every frame of an apng. frames are inflated and unfiltered on threads (<= 0 is one per core), only
+//disposing and blending happen in order. info (can be NULL) is filled from the headers
+//1 is success, 0 if the file is corrupt, unsupported or the callback stopped it
+int read_apng(const char* filename, int threads, apng_frame_callback callback, void* user, apng_info* info);
+int read_apng_memory(const uint8_t* data, uint64_t size, int threads, apng_frame_callback callback, void* user, apng_info* info);
+
+//same as above with every allocation (canvas, frame decoders and their buffers) from allocator (NULL is libc)
+int read_apng_using(const char* filename, int threads, apng_frame_callback callback, void* user, apng_info* info, const mem_allocator* allocator);
+int read_apng_memory_using(const uint8_t* data, uint64_t size, int threads, apng_frame_callback callback, void* user, apng_info* info, const mem_allocator* allocator);
@@ -0,0 +1,685 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "async_io.h"
+
+//a single read or write is never bigger than this (the kernel caps them just under 2GB anyway)
+#define IO_CHUNK (1u << 30)
+
+enum
+{
+	STAGE_QUEUED,
+	STAGE_OPEN,
+	STAGE_TRANSFER,
+	STAGE_CLOSE
+};
+
+//the io_uring rings, mapped from the kernel. only the engine thread touches them
+typedef struct Uring
+{
+	int fd;
+
+	//other threads wake the engine thread by writing here (a read of it is always queued on the ring)
+	int event_fd;
+	uint64_t event_value;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned to_submit;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_map;
+	void* cq_map;
+	size_t sq_map_size;
+	size_t cq_map_size;
+	size_t sqes_size;
+}uring;
+
+static uring* create_uring(int depth);
+static void free_uring(uring* ring);
+static void* uring_main(void* arg);
+static void uring_queue(uring* ring, const struct io_uring_sqe* sqe);
+static void uring_arm_event(uring* ring);
+static void uring_next(io_engine* engine, io_file* file, int32_t result);
+static void uring_transfer(uring* ring, io_file* file);
+static void uring_close(uring* ring, io_file* file);
+
+static void* thread_main(void* arg);
+static void blocking_transfer(io_file* file);
+
+static void queue_file(io_engine* engine, io_file* file);
+static io_file* take_queued(io_engine* engine);
+static void finish_file(io_engine* engine, io_file* file);
+static void account(io_engine* engine);
+static uint64_t now_nanoseconds();
+static int prepare_read(io_file* file);
+
+io_engine* create_io_engine(io_backend backend, int depth)
+{
+	if (backend == IO_SYNC)
+	{
+		return NULL;
+	}
+	if (depth < 1)
+	{
+		depth = 1;
+	}
+
+	io_engine* to_return = calloc(1, sizeof(io_engine));
+	to_return->depth = depth;
+	pthread_mutex_init(&to_return->lock, NULL);
+	pthread_cond_init(&to_return->work_ready, NULL);
+	to_return->started_at = now_nanoseconds();
+	to_return->accounted_at = to_return->started_at;
+
+	if (backend == IO_AUTO || backend == IO_URING)
+	{
+		to_return->ring = create_uring(depth);
+		if (to_return->ring != NULL)
+		{
+			to_return->backend = IO_URING;
+			to_return->threads = calloc(1, sizeof(pthread_t));
+			if (pthread_create(&to_return->threads[0], NULL, uring_main, to_return) == 0)
+			{
+				to_return->thread_count = 1;
+				return to_return;
+			}
+
+			free_uring(to_return->ring);
+			to_return->ring = NULL;
+			free(to_return->threads);
+		}
+
+		if (backend == IO_URING)
+		{
+			fprintf(stderr, "async_io: io_uring is not available, using threads\n");
+		}
+	}
+
+	//plain threads doing blocking calls, one per file in flight
+	to_return->backend = IO_THREADS;
+	to_return->threads = calloc(depth, sizeof(pthread_t));
+	for (int i = 0; i < depth; i++)
+	{
+		if (pthread_create(&to_return->threads[i], NULL, thread_main, to_return) != 0)
+		{
+			break;
+		}
+		to_return->thread_count++;
+	}
+
+	if (to_return->thread_count == 0)
+	{
+		fprintf(stderr, "async_io: failed to start any I/O threads\n");
+		free(to_return->threads);
+		free(to_return);
+		return NULL;
+	}
+
+	to_return->depth = to_return->thread_count;
+	return to_return;
+}
+
+void free_io_engine(io_engine* engine)
+{
+	if (engine == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&engine->lock);
+	engine->shutting_down = 1;
+	pthread_cond_broadcast(&engine->work_ready);
+	pthread_mutex_unlock(&engine->lock);
+
+	if (engine->ring != NULL)
+	{
+		uint64_t wake = 1;
+		if (write(((uring*)engine->ring)->event_fd, &wake, sizeof(wake)) < 0)
+		{
+			fprintf(stderr, "async_io: failed to wake the io_uring thread\n");
+		}
+	}
+
+	for (int i = 0; i < engine->thread_count; i++)
+	{
+		pthread_join(engine->threads[i], NULL);
+	}
+
+	free_uring(engine->ring);
+	pthread_mutex_destroy(&engine->lock);
+	pthread_cond_destroy(&engine->work_ready);
+	free(engine->threads);
+	free(engine);
+}
+
+void io_read(io_engine* engine, io_file* file)
+{
+	file->is_write = 0;
+	queue_file(engine, file);
+}
+
+void io_write(io_engine* engine, io_file* file)
+{
+	file->is_write = 1;
+	queue_file(engine, file);
+}
+
+double io_average_depth(io_engine* engine)
+{
+	pthread_mutex_lock(&engine->lock);
+	account(engine);
+	uint64_t elapsed = engine->accounted_at - engine->started_at;
+	double to_return = (elapsed > 0) ? (double)engine->in_flight_nanoseconds / elapsed : 0;
+	pthread_mutex_unlock(&engine->lock);
+
+	return to_return;
+}
+
+const char* io_backend_name(io_backend backend)
+{
+	switch (backend)
+	{
+	case IO_URING:
+		return "io_uring";
+	case IO_THREADS:
+		return "threads";
+	case IO_SYNC:
+		return "sync";
+	default:
+		return "auto";
+	}
+}
+
+static void queue_file(io_engine* engine, io_file* file)
+{
+	file->stage = STAGE_QUEUED;
+	file->fd = -1;
+	file->done = 0;
+	file->succeeded = 1;
+	file->next = NULL;
+
+	pthread_mutex_lock(&engine->lock);
+	if (engine->queue_tail == NULL)
+	{
+		engine->queue_head = file;
+	}
+	else
+	{
+		engine->queue_tail->next = file;
+	}
+	engine->queue_tail = file;
+	pthread_cond_signal(&engine->work_ready);
+	pthread_mutex_unlock(&engine->lock);
+
+	if (engine->ring != NULL)
+	{
+		uint64_t wake = 1;
+		if (write(((uring*)engine->ring)->event_fd, &wake, sizeof(wake)) < 0)
+		{
+			fprintf(stderr, "async_io: failed to wake the io_uring thread\n");
+		}
+	}
+}
+
+//pop the next queued file if there is room for it (call with the lock held). NULL if there's nothing to start
+static io_file* take_queued(io_engine* engine)
+{
+	io_file* to_return = engine->queue_head;
+	if (to_return == NULL || engine->in_flight >= engine->depth)
+	{
+		return NULL;
+	}
+
+	engine->queue_head = to_return->next;
+	if (engine->queue_head == NULL)
+	{
+		engine->queue_tail = NULL;
+	}
+
+	account(engine);
+	engine->in_flight++;
+	return to_return;
+}
+
+static void finish_file(io_engine* engine, io_file* file)
+{
+	pthread_mutex_lock(&engine->lock);
+	account(engine);
+	engine->in_flight--;
+	engine->files++;
+	engine->bytes += file->is_write ? file->done : file->data->count;
+	pthread_mutex_unlock(&engine->lock);
+
+	file->callback(file);
+}
+
+//add the time since the last change of in_flight (call with the lock held)
+static void account(io_engine* engine)
+{
+	uint64_t now = now_nanoseconds();
+	engine->in_flight_nanoseconds += (now - engine->accounted_at) * engine->in_flight;
+	engine->accounted_at = now;
+}
+
+static uint64_t now_nanoseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//empty the read buffer and make room for the whole file plus a byte, so end of file shows up as a short read
+static int prepare_read(io_file* file)
+{
+	array_clear(file->data);
+	return array_reserve(file->data, file->size_hint + 1);
+}
+
+//thread backend: each thread carries one file from open to close with blocking calls
+static void* thread_main(void* arg)
+{
+	io_engine* engine = arg;
+
+	pthread_mutex_lock(&engine->lock);
+	while (1)
+	{
+		io_file* file = take_queued(engine);
+		if (file == NULL)
+		{
+			if (engine->shutting_down && engine->queue_head == NULL)
+			{
+				break;
+			}
+			pthread_cond_wait(&engine->work_ready, &engine->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&engine->lock);
+
+		blocking_transfer(file);
+		finish_file(engine, file);
+
+		pthread_mutex_lock(&engine->lock);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+static void blocking_transfer(io_file* file)
+{
+	int flags = file->is_write ? (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC) : (O_RDONLY | O_CLOEXEC);
+	file->fd = open(file->path, flags, 0666);
+	if (file->fd < 0 || (!file->is_write && !prepare_read(file)))
+	{
+		file->succeeded = 0;
+	}
+
+	while (file->succeeded)
+	{
+		dynamic_array* data = file->data;
+		ssize_t result;
+		if (file->is_write)
+		{
+			if (file->done == data->count)
+			{
+				break;
+			}
+			uint64_t length = data->count - file->done;
+			result = write(file->fd, data->data + file->done, (length > IO_CHUNK) ? IO_CHUNK : length);
+			if (result > 0)
+			{
+				file->done += result;
+			}
+		}
+		else
+		{
+			if (data->count == data->capacity && !array_grow(data, 1))
+			{
+				file->succeeded = 0;
+				break;
+			}
+			uint64_t length = data->capacity - data->count;
+			result = read(file->fd, data->data + data->count, (length > IO_CHUNK) ? IO_CHUNK : length);
+			if (result == 0)
+			{
+				break;
+			}
+			if (result > 0)
+			{
+				data->count += result;
+			}
+		}
+
+		if (result < 0 && errno != EINTR)
+		{
+			file->succeeded = 0;
+		}
+	}
+
+	if (file->fd >= 0 && close(file->fd) != 0 && file->is_write)
+	{
+		file->succeeded = 0;
+	}
+	file->fd = -1;
+}
+
+static uring* create_uring(int depth)
+{
+	//every file has at most one operation on the ring, plus the read of the wake up eventfd
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int ring_fd = syscall(__NR_io_uring_setup, depth + 1, &params);
+	if (ring_fd < 0)
+	{
+		return NULL;
+	}
+
+	uring* to_return = calloc(1, sizeof(uring));
+	to_return->fd = ring_fd;
+	to_return->event_fd = eventfd(0, EFD_CLOEXEC);
+
+	to_return->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	to_return->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	to_return->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	//newer kernels map both rings at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (to_return->cq_map_size > to_return->sq_map_size)
+		{
+			to_return->sq_map_size = to_return->cq_map_size;
+		}
+		to_return->cq_map_size = 0;
+	}
+
+	to_return->sq_map = mmap(NULL, to_return->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	to_return->cq_map = to_return->sq_map;
+	if (to_return->cq_map_size > 0 && to_return->sq_map != MAP_FAILED)
+	{
+		to_return->cq_map = mmap(NULL, to_return->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	}
+	to_return->sqes = mmap(NULL, to_return->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+	if (to_return->event_fd < 0 || to_return->sq_map == MAP_FAILED || to_return->cq_map == MAP_FAILED || to_return->sqes == MAP_FAILED)
+	{
+		free_uring(to_return);
+		return NULL;
+	}
+
+	uint8_t* sq = to_return->sq_map;
+	to_return->sq_head = (unsigned*)(sq + params.sq_off.head);
+	to_return->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	to_return->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	to_return->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	uint8_t* cq = to_return->cq_map;
+	to_return->cq_head = (unsigned*)(cq + params.cq_off.head);
+	to_return->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	to_return->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	to_return->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return to_return;
+}
+
+static void free_uring(uring* ring)
+{
+	if (ring == NULL)
+	{
+		return;
+	}
+
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+	{
+		munmap(ring->cq_map, ring->cq_map_size);
+	}
+	if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+	{
+		munmap(ring->sq_map, ring->sq_map_size);
+	}
+	if (ring->event_fd >= 0)
+	{
+		close(ring->event_fd);
+	}
+	close(ring->fd);
+	free(ring);
+}
+
+//io_uring backend: one thread keeps up to depth files moving through open, read/write and close on the ring
+static void* uring_main(void* arg)
+{
+	io_engine* engine = arg;
+	uring* ring = engine->ring;
+	uring_arm_event(ring);
+
+	while (1)
+	{
+		//start whatever fits, and stop once everything is done after a shutdown
+		pthread_mutex_lock(&engine->lock);
+		io_file* started = NULL;
+		io_file* file;
+		while ((file = take_queued(engine)) != NULL)
+		{
+			file->next = started;
+			started = file;
+		}
+		int finished = engine->shutting_down && engine->queue_head == NULL && engine->in_flight == 0;
+		pthread_mutex_unlock(&engine->lock);
+
+		if (finished && started == NULL)
+		{
+			break;
+		}
+
+		while (started != NULL)
+		{
+			file = started;
+			started = started->next;
+			uring_next(engine, file, 0);
+		}
+
+		int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			fprintf(stderr, "async_io: io_uring_enter failed (%s)\n", strerror(errno));
+			break;
+		}
+		ring->to_submit -= submitted;
+
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+			uint64_t user_data = cqe->user_data;
+			int32_t result = cqe->res;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+			if (user_data == 0)
+			{
+				uring_arm_event(ring);
+			}
+			else
+			{
+				uring_next(engine, (io_file*)(uintptr_t)user_data, result);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+//move a file on to its next operation, given the result of the last one
+static void uring_next(io_engine* engine, io_file* file, int32_t result)
+{
+	uring* ring = engine->ring;
+
+	switch (file->stage)
+	{
+	case STAGE_QUEUED:
+	{
+		struct io_uring_sqe sqe;
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_OPENAT;
+		sqe.fd = AT_FDCWD;
+		sqe.addr = (uintptr_t)file->path;
+		sqe.len = 0666;
+		sqe.open_flags = file->is_write ? (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC) : (O_RDONLY | O_CLOEXEC);
+		sqe.user_data = (uintptr_t)file;
+		file->stage = STAGE_OPEN;
+		uring_queue(ring, &sqe);
+		return;
+	}
+
+	case STAGE_OPEN:
+		if (result < 0)
+		{
+			file->succeeded = 0;
+			finish_file(engine, file);
+			return;
+		}
+
+		file->fd = result;
+		if (!file->is_write && !prepare_read(file))
+		{
+			file->succeeded = 0;
+			uring_close(ring, file);
+			return;
+		}
+
+		file->stage = STAGE_TRANSFER;
+		uring_transfer(ring, file);
+		return;
+
+	case STAGE_TRANSFER:
+		if (result < 0)
+		{
+			if (result == -EINTR || result == -EAGAIN)
+			{
+				uring_transfer(ring, file);
+				return;
+			}
+			file->succeeded = 0;
+			uring_close(ring, file);
+			return;
+		}
+
+		if (file->is_write)
+		{
+			file->done += result;
+			if (file->done < file->data->count && result > 0)
+			{
+				uring_transfer(ring, file);
+				return;
+			}
+			file->succeeded = (file->done == file->data->count);
+			uring_close(ring, file);
+			return;
+		}
+
+		//a short read once the expected size is in means the end of the file
+		file->data->count += result;
+		if (result == 0 || (file->data->count >= file->size_hint && result < file->requested))
+		{
+			uring_close(ring, file);
+			return;
+		}
+		if (file->data->count == file->data->capacity && !array_grow(file->data, 1))
+		{
+			file->succeeded = 0;
+			uring_close(ring, file);
+			return;
+		}
+		uring_transfer(ring, file);
+		return;
+
+	case STAGE_CLOSE:
+		if (result < 0 && file->is_write)
+		{
+			file->succeeded = 0;
+		}
+		file->fd = -1;
+		finish_file(engine, file);
+		return;
+	}
+}
+
+static void uring_transfer(uring* ring, io_file* file)
+{
+	dynamic_array* data = file->data;
+	uint64_t position = file->is_write ? file->done : data->count;
+	uint64_t length = file->is_write ? data->count - file->done : data->capacity - data->count;
+	file->requested = (length > IO_CHUNK) ? IO_CHUNK : length;
+
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = file->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe.fd = file->fd;
+	sqe.addr = (uintptr_t)(data->data + position);
+	sqe.len = file->requested;
+	sqe.off = position;
+	sqe.user_data = (uintptr_t)file;
+	uring_queue(ring, &sqe);
+}
+
+static void uring_close(uring* ring, io_file* file)
+{
+	file->stage = STAGE_CLOSE;
+
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_CLOSE;
+	sqe.fd = file->fd;
+	sqe.user_data = (uintptr_t)file;
+	uring_queue(ring, &sqe);
+}
+
+//wait for the next wake up (user_data 0 marks the eventfd)
+static void uring_arm_event(uring* ring)
+{
+	struct io_uring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_READ;
+	sqe.fd = ring->event_fd;
+	sqe.addr = (uintptr_t)&ring->event_value;
+	sqe.len = sizeof(ring->event_value);
+	sqe.off = (uint64_t)-1;
+	sqe.user_data = 0;
+	uring_queue(ring, &sqe);
+}
+
+//the ring is sized for every operation that can be outstanding, so there is always a free entry
+static void uring_queue(uring* ring, const struct io_uring_sqe* sqe)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	ring->sqes[index] = *sqe;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "dynamic_array.h"
+
+//how an io_engine talks to the disk
+typedef enum Io_backend
+{
+	//io_uring if the kernel allows it, threads otherwise
+	IO_AUTO = 0,
+	IO_URING = 1,
+	IO_THREADS = 2,
+
+	//no engine: callers do blocking reads and writes themselves
+	IO_SYNC = 3
+}io_backend;
+
+typedef struct Io_file io_file;
+
+//runs on the engine's thread once a file is done. it shouldn't block (hand the data to a thread pool instead)
+typedef void (*io_callback)(io_file* file);
+
+//one whole-file read or write. the caller owns it (and data) and must keep it alive until the callback has run
+typedef struct Io_file
+{
+	const char* path;
+
+	//reads replace the contents with the file (the array only grows). writes write all of it
+	dynamic_array* data;
+
+	//size the file is expected to have (reads are still correct if it's wrong, just slower)
+	uint64_t size_hint;
+
+	io_callback callback;
+	void* user;
+
+	//set before the callback runs
+	int succeeded;
+
+	//engine state
+	int is_write;
+	int stage;
+	int fd;
+	uint64_t done;
+	uint64_t requested;
+	io_file* next;
+}io_file;
+
+typedef struct Io_engine
+{
+	io_backend backend;
+
+	//most files that are read or written at once
+	int depth;
+
+	//files waiting for a free slot, and files being read or written
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	io_file* queue_head;
+	io_file* queue_tail;
+	int in_flight;
+	int shutting_down;
+
+	//IO_URING runs one thread around the ring, IO_THREADS runs depth threads doing blocking calls
+	pthread_t* threads;
+	int thread_count;
+
+	//io_uring state (see async_io.c)
+	void* ring;
+
+	//files in flight integrated over time, for the average queue depth
+	uint64_t started_at;
+	uint64_t accounted_at;
+	uint64_t in_flight_nanoseconds;
+	uint64_t files;
+	uint64_t bytes;
+}io_engine;
+
+//backend IO_AUTO tries io_uring first. NULL for IO_SYNC or if no backend could be started
+io_engine* create_io_engine(io_backend backend, int depth);
+
+//wait for every queued file, then stop the engine
+void free_io_engine(io_engine* engine);
+
+//queue a read or write. the callback always runs, with succeeded set to 0 if the file couldn't be read or written
+void io_read(io_engine* engine, io_file* file);
+void io_write(io_engine* engine, io_file* file);
+
+//files in flight averaged over the life of the engine so far
+double io_average_depth(io_engine* engine);
+
+const char* io_backend_name(io_backend backend);
@@ -0,0 +1,780 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "batch.h"
+#include "thread_pool.h"
+#include "admission.h"
+#include "png.h"
+#include "bmp.h"
+
+//images with more decoded bytes than this have their bmp conversion split into row bands
+#define SPLIT_BYTES (8 << 20)
+#define BAND_BYTES (2 << 20)
+
+//input files read ahead of the decoders (and bmps written behind them) when an io engine is used
+#define DEFAULT_IO_DEPTH 8
+
+//with a memory budget an image only counts while it's converted, so buffers that grew past this for it aren't kept
+#define RETAINED_BYTES (16 << 20)
+
+//state owned by a single worker and reused for every image it converts
+typedef struct Batch_worker
+{
+	png_decoder* decoder;
+	uint8_t* output;
+	uint64_t output_capacity;
+}batch_worker;
+
+typedef struct Batch_run batch_run;
+
+//an input file being read by the io engine and then decoded. the buffer is reused for the next file
+typedef struct Read_slot
+{
+	io_file file;
+	batch_run* run;
+	batch_item* item;
+	admission_job job;
+}read_slot;
+
+//a bmp being built and then written by the io engine. slots go back on the free list once written
+typedef struct Write_slot write_slot;
+typedef struct Write_slot
+{
+	io_file file;
+	batch_run* run;
+	batch_item* item;
+	write_slot* next;
+}write_slot;
+
+typedef struct Batch_run
+{
+	thread_pool* pool;
+	batch_worker* workers;
+	atomic_uint_fast64_t failed;
+
+	batch* items;
+
+	//NULL when the workers read and write files themselves
+	io_engine* io;
+	atomic_uint_fast64_t next_read;
+	read_slot* reads;
+	write_slot* writes;
+
+	//free write slots, and items that are completely done (written or failed)
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	write_slot* free_writes;
+	uint64_t finished;
+
+	//NULL without a memory budget. reserved has the bytes each item was let in with (same order as items)
+	admission* admission;
+	uint64_t* reserved;
+}batch_run;
+
+typedef struct Batch_task
+{
+	batch_run* run;
+	batch_item* item;
+	admission_job job;
+}batch_task;
+
+//a big image whose conversion is spread over the pool. the last band to finish writes the file
+typedef struct Split_image
+{
+	batch_run* run;
+	batch_item* item;
+	png* image;
+
+	uint8_t* output;
+	uint64_t output_size;
+
+	//the write slot output lives in when the io engine writes it (NULL means output was malloc'd)
+	write_slot* slot;
+
+	atomic_int remaining_bands;
+}split_image;
+
+typedef struct Band_task
+{
+	split_image* parent;
+	int first_row;
+	int row_count;
+}band_task;
+
+static void convert_task(void* arg, int worker);
+static void decode_task(void* arg, int worker);
+static void convert_image(batch_run* run, int worker, batch_item* item, png* image);
+static void band_task_run(void* arg, int worker);
+static void start_read(read_slot* slot);
+static void read_done(io_file* file);
+static void write_done(io_file* file);
+static write_slot* take_write_slot(batch_run* run);
+static void release_write_slot(batch_run* run, write_slot* slot);
+static void finish_output(batch_run* run, batch_item* item, write_slot* slot, const uint8_t* data, uint64_t size);
+static void item_done(batch_run* run, batch_item* item, int succeeded);
+static void fail_output(batch_run* run, batch_item* item, write_slot* slot);
+static void submit_decode(batch_run* run, batch_item* item, const png* header, admission_job* job, task_function function, void* arg);
+static void trim_worker(batch_run* run, batch_worker* state, batch_item* item);
+static void trim_buffer(batch_run* run, batch_item* item, dynamic_array** buffer);
+static int write_file(const char* filename, const uint8_t* data, uint64_t size);
+static int compare_items(const void* a, const void* b);
+static char* copy_string(const char* input);
+
+batch_options default_batch_options()
+{
+	batch_options to_return;
+	to_return.threads = 0;
+	to_return.io = IO_AUTO;
+	to_return.io_depth = DEFAULT_IO_DEPTH;
+	to_return.max_memory_bytes = 0;
+
+	return to_return;
+}
+
+batch* create_batch()
+{
+	batch* to_return = calloc(1, sizeof(batch));
+	to_return->capacity = 16;
+	to_return->items = calloc(to_return->capacity, sizeof(batch_item));
+	return to_return;
+}
+
+void free_batch(batch* to_free)
+{
+	if (to_free != NULL)
+	{
+		for (uint64_t i = 0; i < to_free->count; i++)
+		{
+			free(to_free->items[i].input);
+			free(to_free->items[i].output);
+		}
+		free(to_free->items);
+		free(to_free);
+	}
+}
+
+void batch_add(batch* cur, const char* input, const char* output)
+{
+	if (cur->count == cur->capacity)
+	{
+		cur->capacity *= 2;
+		cur->items = realloc(cur->items, cur->capacity * sizeof(batch_item));
+	}
+
+	batch_item* item = &cur->items[cur->count++];
+	item->input = copy_string(input);
+	item->output = copy_string(output);
+	item->succeeded = 0;
+
+	struct stat info;
+	item->input_size = (stat(input, &info) == 0) ? (uint64_t)info.st_size : 0;
+}
+
+int batch_add_directory(batch* cur, const char* input_dir, const char* output_dir)
+{
+	DIR* directory = opendir(input_dir);
+	if (directory == NULL)
+	{
+		fprintf(stderr, "batch: failed to open directory %s\n", input_dir);
+		return 0;
+	}
+
+	if (mkdir(output_dir, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "batch: failed to create output directory %s\n", output_dir);
+		closedir(directory);
+		return 0;
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		size_t length = strlen(entry->d_name);
+		if (length <= 4 || strcasecmp(entry->d_name + length - 4, ".png") != 0)
+		{
+			continue;
+		}
+
+		size_t input_length = strlen(input_dir) + length + 2;
+		size_t output_length = strlen(output_dir) + length + 2;
+		char* input = malloc(input_length);
+		char* output = malloc(output_length);
+
+		snprintf(input, input_length, "%s/%s", input_dir, entry->d_name);
+		snprintf(output, output_length, "%s/%.*s.bmp", output_dir, (int)(length - 4), entry->d_name);
+
+		batch_add(cur, input, output);
+		free(input);
+		free(output);
+	}
+
+	closedir(directory);
+	return 1;
+}
+
+int batch_add_manifest(batch* cur, const char* manifest)
+{
+	FILE* file = fopen(manifest, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "batch: failed to open manifest %s\n", manifest);
+		return 0;
+	}
+
+	char line[8192];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		line_number++;
+
+		//blank lines and comments are skipped
+		char* input = strtok(line, " \t\r\n");
+		if (input == NULL || input[0] == '#')
+		{
+			continue;
+		}
+
+		char* output = strtok(NULL, " \t\r\n");
+		if (output == NULL)
+		{
+			fprintf(stderr, "batch: manifest line %d has no output file, skipping\n", line_number);
+			continue;
+		}
+
+		batch_add(cur, input, output);
+	}
+
+	fclose(file);
+	return 1;
+}
+
+uint64_t run_batch(batch* cur, const batch_options* options)
+{
+	if (cur->count == 0)
+	{
+		return 0;
+	}
+
+	batch_options defaults = default_batch_options();
+	if (options == NULL)
+	{
+		options = &defaults;
+	}
+
+	struct timespec wall_start;
+	struct rusage usage_start;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	getrusage(RUSAGE_SELF, &usage_start);
+
+	//biggest files first so a huge image doesn't start last and hold up the end of the batch
+	qsort(cur->items, cur->count, sizeof(batch_item), compare_items);
+
+	batch_run run;
+	memset(&run, 0, sizeof(run));
+	run.items = cur;
+	run.pool = create_pool(options->threads);
+	if (run.pool == NULL)
+	{
+		fprintf(stderr, "batch: no workers to convert with\n");
+		return cur->count;
+	}
+	run.workers = calloc(run.pool->thread_count, sizeof(batch_worker));
+	atomic_init(&run.failed, 0);
+	atomic_init(&run.next_read, 0);
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.changed, NULL);
+	if (options->max_memory_bytes > 0)
+	{
+		run.admission = create_admission(run.pool, options->max_memory_bytes);
+		run.reserved = calloc(cur->count, sizeof(uint64_t));
+	}
+
+	run.io = create_io_engine(options->io, options->io_depth);
+	int depth = (run.io != NULL) ? run.io->depth : 0;
+	batch_task* tasks = NULL;
+	if (run.io != NULL)
+	{
+		//the engine keeps depth reads going, and every decode that finishes starts the next one
+		run.reads = calloc(depth, sizeof(read_slot));
+		run.writes = calloc(depth, sizeof(write_slot));
+		for (int i = 0; i < depth; i++)
+		{
+			run.reads[i].run = &run;
+			run.reads[i].file.data = create_array();
+			run.reads[i].file.callback = read_done;
+			run.reads[i].file.user = &run.reads[i];
+
+			run.writes[i].run = &run;
+			run.writes[i].file.data = create_array();
+			run.writes[i].file.callback = write_done;
+			run.writes[i].file.user = &run.writes[i];
+			run.writes[i].next = run.free_writes;
+			run.free_writes = &run.writes[i];
+		}
+
+		for (int i = 0; i < depth; i++)
+		{
+			start_read(&run.reads[i]);
+		}
+
+		//reads and writes happen outside the pool, so the pool can be idle before the batch is done
+		pthread_mutex_lock(&run.lock);
+		while (run.finished < cur->count)
+		{
+			pthread_cond_wait(&run.changed, &run.lock);
+		}
+		pthread_mutex_unlock(&run.lock);
+	}
+	else
+	{
+		tasks = calloc(cur->count, sizeof(batch_task));
+		for (uint64_t i = 0; i < cur->count; i++)
+		{
+			tasks[i].run = &run;
+			tasks[i].item = &cur->items[i];
+
+			//the header is all it takes to predict the memory (a png that can't be probed fails in the decode)
+			png header;
+			if (run.admission != NULL && !probe_png(tasks[i].item->input, &header))
+			{
+				memset(&header, 0, sizeof(png));
+			}
+			submit_decode(&run, tasks[i].item, &header, &tasks[i].job, convert_task, &tasks[i]);
+		}
+	}
+
+	pool_wait(run.pool);
+
+	//how busy the disk and the cores were
+	struct timespec wall_end;
+	struct rusage usage_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	getrusage(RUSAGE_SELF, &usage_end);
+	double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	double cpu = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) + (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1e6
+		+ (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) + (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1e6;
+	double cpu_percent = (wall > 0) ? 100 * cpu / (wall * run.pool->thread_count) : 0;
+
+	if (run.io != NULL)
+	{
+		fprintf(stderr, "batch: io %s, depth %d, %.1f files in flight on average, cpu %.0f%% of %d workers, %.3f s\n",
+			io_backend_name(run.io->backend), depth, io_average_depth(run.io), cpu_percent, run.pool->thread_count, wall);
+
+		free_io_engine(run.io);
+		for (int i = 0; i < depth; i++)
+		{
+			free_array(run.reads[i].file.data);
+			free_array(run.writes[i].file.data);
+		}
+		free(run.reads);
+		free(run.writes);
+	}
+	else
+	{
+		fprintf(stderr, "batch: io sync, cpu %.0f%% of %d workers, %.3f s\n", cpu_percent, run.pool->thread_count, wall);
+	}
+
+	if (run.admission != NULL)
+	{
+		fprintf(stderr, "batch: memory budget %lu MB, at most %lu MB predicted at once, %lu files waited for memory\n",
+			run.admission->budget >> 20, run.admission->peak >> 20, run.admission->waited);
+		free_admission(run.admission);
+		free(run.reserved);
+	}
+
+	for (int i = 0; i < run.pool->thread_count; i++)
+	{
+		free_decoder(run.workers[i].decoder);
+		free(run.workers[i].output);
+	}
+	free(run.workers);
+	free_pool(run.pool);
+	pthread_mutex_destroy(&run.lock);
+	pthread_cond_destroy(&run.changed);
+
+	free(tasks);
+	return atomic_load(&run.failed);
+}
+
+//decode one png and convert it to bmp (the worker reads and writes the files itself)
+static void convert_task(void* arg, int worker)
+{
+	batch_task* cur = arg;
+	batch_run* run = cur->run;
+	batch_worker* state = &run->workers[worker];
+
+	if (state->decoder == NULL)
+	{
+		state->decoder = create_decoder();
+	}
+
+	png* image = decoder_read(state->decoder, cur->item->input);
+	if (!image->is_valid)
+	{
+		fprintf(stderr, "batch: failed to decode %s\n", cur->item->input);
+		item_done(run, cur->item, 0);
+	}
+	else
+	{
+		convert_image(run, worker, cur->item, image);
+	}
+
+	trim_worker(run, state, cur->item);
+}
+
+//decode a png the io engine has read, then hand the buffer back for the next file
+static void decode_task(void* arg, int worker)
+{
+	read_slot* slot = arg;
+	batch_run* run = slot->run;
+	batch_worker* state = &run->workers[worker];
+	batch_item* item = slot->item;
+
+	if (state->decoder == NULL)
+	{
+		state->decoder = create_decoder();
+	}
+
+	png* image = decoder_read_memory(state->decoder, slot->file.data->data, slot->file.data->count);
+	trim_buffer(run, item, &slot->file.data);
+	start_read(slot);
+
+	if (!image->is_valid)
+	{
+		fprintf(stderr, "batch: failed to decode %s\n", item->input);
+		item_done(run, item, 0);
+	}
+	else
+	{
+		convert_image(run, worker, item, image);
+	}
+
+	trim_worker(run, state, item);
+}
+
+//turn the decoded image (which belongs to the worker's decoder) into a bmp file
+static void convert_image(batch_run* run, int worker, batch_item* item, png* image)
+{
+	batch_worker* state = &run->workers[worker];
+	uint64_t output_size = bmp_file_size(image->w, image->h);
+	uint64_t pixel_bytes = (uint64_t)image->w * image->h * image->bytes_per_pixel;
+
+	//with an io engine the bmp is built in a write slot, so the worker can move on while it's written
+	write_slot* slot = NULL;
+	uint8_t* output = NULL;
+	if (run->io != NULL)
+	{
+		slot = take_write_slot(run);
+		if (!array_resize(slot->file.data, output_size))
+		{
+			fprintf(stderr, "batch: unable to allocate %lu bytes for %s\n", output_size, item->output);
+			fail_output(run, item, slot);
+			return;
+		}
+		output = slot->file.data->data;
+	}
+
+	//big images get their own output buffer and are converted in bands by whichever workers are free
+	if (pixel_bytes >= SPLIT_BYTES && run->pool->thread_count > 1)
+	{
+		uint64_t band_rows = BAND_BYTES / ((uint64_t)image->w * image->bytes_per_pixel);
+		if (band_rows < 1)
+		{
+			band_rows = 1;
+		}
+		int band_count = (image->h + band_rows - 1) / band_rows;
+
+		//the pixels have to outlive this task, so they are taken away from the worker's decoder (once nothing else can fail)
+		split_image* split = malloc(sizeof(split_image) + band_count * sizeof(band_task));
+		uint8_t* split_output = (slot != NULL) ? output : malloc(output_size);
+		png* detached = (split != NULL && split_output != NULL) ? decoder_detach(state->decoder) : NULL;
+		if (detached == NULL)
+		{
+			fprintf(stderr, "batch: unable to allocate %lu bytes for %s\n", output_size, item->output);
+			free(split);
+			if (slot == NULL)
+			{
+				free(split_output);
+			}
+			fail_output(run, item, slot);
+			return;
+		}
+
+		band_task* bands = (band_task*)(split + 1);
+		split->run = run;
+		split->item = item;
+		split->image = detached;
+		image = split->image;
+		split->output_size = output_size;
+		split->slot = slot;
+		split->output = split_output;
+		atomic_init(&split->remaining_bands, band_count);
+
+		bmp_write_header(split->output, image->w, image->h);
+		for (int i = 0; i < band_count; i++)
+		{
+			bands[i].parent = split;
+			bands[i].first_row = i * band_rows;
+			bands[i].row_count = (i == band_count - 1) ? image->h - bands[i].first_row : band_rows;
+			pool_submit(run->pool, band_task_run, &bands[i]);
+		}
+		return;
+	}
+
+	//small images go through the worker's reusable buffer
+	if (slot == NULL)
+	{
+		if (output_size > state->output_capacity)
+		{
+			free(state->output);
+			state->output = malloc(output_size);
+			state->output_capacity = (state->output != NULL) ? output_size : 0;
+		}
+		if (state->output == NULL)
+		{
+			fprintf(stderr, "batch: unable to allocate %lu bytes for %s\n", output_size, item->output);
+			fail_output(run, item, slot);
+			return;
+		}
+		output = state->output;
+	}
+
+	bmp_write_header(output, image->w, image->h);
+	bmp_write_rows(image->pixel_data->data, image->w, image->h, image->bytes_per_pixel, 0, image->h, output);
+
+	finish_output(run, item, slot, output, output_size);
+}
+
+static void band_task_run(void* arg, int worker)
+{
+	band_task* cur = arg;
+	split_image* split = cur->parent;
+	png* image = split->image;
+
+	bmp_write_rows(image->pixel_data->data, image->w, image->h, image->bytes_per_pixel, cur->first_row, cur->row_count, split->output);
+
+	if (atomic_fetch_sub(&split->remaining_bands, 1) != 1)
+	{
+		return;
+	}
+
+	//last band finished, write the file and release the image
+	finish_output(split->run, split->item, split->slot, split->output, split->output_size);
+
+	free_png(split->image);
+	if (split->slot == NULL)
+	{
+		free(split->output);
+	}
+	free(split);
+}
+
+//read the next item of the batch into slot (nothing happens once every item has been started)
+static void start_read(read_slot* slot)
+{
+	batch_run* run = slot->run;
+	uint64_t index = atomic_fetch_add(&run->next_read, 1);
+	if (index >= run->items->count)
+	{
+		return;
+	}
+
+	slot->item = &run->items->items[index];
+	slot->file.path = slot->item->input;
+	slot->file.size_hint = slot->item->input_size;
+	io_read(run->io, &slot->file);
+}
+
+//runs on the io engine's thread
+static void read_done(io_file* file)
+{
+	read_slot* slot = file->user;
+	if (!file->succeeded)
+	{
+		fprintf(stderr, "batch: failed to read %s\n", slot->item->input);
+		item_done(slot->run, slot->item, 0);
+		start_read(slot);
+		return;
+	}
+
+	png header;
+	if (slot->run->admission != NULL && !probe_png_memory(file->data->data, file->data->count, &header))
+	{
+		memset(&header, 0, sizeof(png));
+	}
+	submit_decode(slot->run, slot->item, &header, &slot->job, decode_task, slot);
+}
+
+//runs on the io engine's thread
+static void write_done(io_file* file)
+{
+	write_slot* slot = file->user;
+	batch_run* run = slot->run;
+	batch_item* item = slot->item;
+	if (!file->succeeded)
+	{
+		fprintf(stderr, "batch: failed to write %s\n", item->output);
+	}
+
+	trim_buffer(run, item, &slot->file.data);
+	release_write_slot(run, slot);
+	item_done(run, item, file->succeeded);
+}
+
+//wait for a free write slot. they come back as the io engine finishes writes, which keeps finished bmps from piling up
+static write_slot* take_write_slot(batch_run* run)
+{
+	pthread_mutex_lock(&run->lock);
+	while (run->free_writes == NULL)
+	{
+		pthread_cond_wait(&run->changed, &run->lock);
+	}
+	write_slot* to_return = run->free_writes;
+	run->free_writes = to_return->next;
+	pthread_mutex_unlock(&run->lock);
+
+	return to_return;
+}
+
+static void release_write_slot(batch_run* run, write_slot* slot)
+{
+	pthread_mutex_lock(&run->lock);
+	slot->next = run->free_writes;
+	run->free_writes = slot;
+	pthread_cond_broadcast(&run->changed);
+	pthread_mutex_unlock(&run->lock);
+}
+
+//write a finished bmp: queued on the io engine if there's a slot, written right here otherwise
+static void finish_output(batch_run* run, batch_item* item, write_slot* slot, const uint8_t* data, uint64_t size)
+{
+	if (slot != NULL)
+	{
+		slot->item = item;
+		slot->file.path = item->output;
+		io_write(run->io, &slot->file);
+		return;
+	}
+
+	item_done(run, item, write_file(item->output, data, size));
+}
+
+//an item whose bmp couldn't be built. the write slot (if it had one) goes back unused
+static void fail_output(batch_run* run, batch_item* item, write_slot* slot)
+{
+	if (slot != NULL)
+	{
+		release_write_slot(run, slot);
+	}
+	item_done(run, item, 0);
+}
+
+static void item_done(batch_run* run, batch_item* item, int succeeded)
+{
+	item->succeeded = succeeded;
+	if (!succeeded)
+	{
+		atomic_fetch_add(&run->failed, 1);
+	}
+
+	//the memory goes back before the item counts as finished, run_batch may tear everything down right after that
+	if (run->admission != NULL)
+	{
+		admission_release(run->admission, run->reserved[item - run->items->items]);
+	}
+
+	pthread_mutex_lock(&run->lock);
+	run->finished++;
+	pthread_cond_broadcast(&run->changed);
+	pthread_mutex_unlock(&run->lock);
+}
+
+//start a decode once the memory it's predicted to need (decode and bmp) fits under the budget. a zeroed header counts as nothing
+static void submit_decode(batch_run* run, batch_item* item, const png* header, admission_job* job, task_function function, void* arg)
+{
+	if (run->admission == NULL)
+	{
+		pool_submit(run->pool, function, arg);
+		return;
+	}
+
+	uint64_t bytes = 0;
+	if (header->w > 0 && header->h > 0)
+	{
+		//the workers' decoders are never pipelined or color managed. a file is read by name when there's no io engine
+		bytes = estimate_decode_memory(NULL, header, item->input_size, DECODE_MODE_FULL, run->io == NULL) + bmp_file_size(header->w, header->h);
+	}
+	run->reserved[item - run->items->items] = bytes;
+	admission_submit(run->admission, job, bytes, function, arg);
+}
+
+//drop a worker's buffers once an image that needed more than RETAINED_BYTES is done (budgeted runs only)
+static void trim_worker(batch_run* run, batch_worker* state, batch_item* item)
+{
+	if (run->admission == NULL || run->reserved[item - run->items->items] < RETAINED_BYTES)
+	{
+		return;
+	}
+
+	free_decoder(state->decoder);
+	state->decoder = NULL;
+	free(state->output);
+	state->output = NULL;
+	state->output_capacity = 0;
+}
+
+//same for the buffer of a read or write slot
+static void trim_buffer(batch_run* run, batch_item* item, dynamic_array** buffer)
+{
+	if (run->admission == NULL || (*buffer)->capacity < RETAINED_BYTES || run->reserved[item - run->items->items] < RETAINED_BYTES)
+	{
+		return;
+	}
+
+	free_array(*buffer);
+	*buffer = create_array();
+}
+
+static int write_file(const char* filename, const uint8_t* data, uint64_t size)
+{
+	FILE* out = fopen(filename, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "batch: failed to open %s for writing\n", filename);
+		return 0;
+	}
+
+	int to_return = (fwrite(data, 1, size, out) == size);
+	if (fclose(out) != 0)
+	{
+		to_return = 0;
+	}
+	if (!to_return)
+	{
+		fprintf(stderr, "batch: failed to write %s\n", filename);
+	}
+	return to_return;
+}
+
+//sort by input size, largest first
+static int compare_items(const void* a, const void* b)
+{
+	uint64_t x = ((const batch_item*)a)->input_size;
+	uint64_t y = ((const batch_item*)b)->input_size;
+	return (x < y) - (x > y);
+}
+
+static char* copy_string(const char* input)
+{
+	size_t length = strlen(input) + 1;
+	char* to_return = malloc(length);
+	memcpy(to_return, input, length);
+	return to_return;
+}
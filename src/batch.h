@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "async_io.h"
+
+//one input/output pair of a batch conversion
+typedef struct Batch_item
+{
+	char* input;
+	char* output;
+
+	//size of the input file, used to start the biggest files first
+	uint64_t input_size;
+
+	int succeeded;
+}batch_item;
+
+typedef struct Batch
+{
+	batch_item* items;
+	uint64_t count;
+	uint64_t capacity;
+}batch;
+
+typedef struct Batch_options
+{
+	//workers (<= 0 uses every core)
+	int threads;
+
+	//how files are read and written. with an io engine, io_depth input files are read ahead of the
+	//decoders and up to io_depth finished bmps are written while the workers go on
+	io_backend io;
+	int io_depth;
+
+	//with a budget, every png's header is read first and its decode (and bmp) only starts while the memory all running
+	//conversions are predicted to need stays under max_memory_bytes. smaller images go ahead of one that doesn't fit yet.
+	//0 is no budget
+	uint64_t max_memory_bytes;
+}batch_options;
+
+batch_options default_batch_options();
+
+batch* create_batch();
+void free_batch(batch* to_free);
+
+void batch_add(batch* cur, const char* input, const char* output);
+
+//add every .png in input_dir, writing input_dir/name.png to output_dir/name.bmp. 1 is success, 0 is failure
+int batch_add_directory(batch* cur, const char* input_dir, const char* output_dir);
+
+//add pairs from a manifest file, one "input output" pair per line. 1 is success, 0 is failure
+int batch_add_manifest(batch* cur, const char* manifest);
+
+//convert every item on a work stealing pool. returns the number of failed items
+uint64_t run_batch(batch* cur, const batch_options* options);
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "png.h"
+#include "bmp.h"
+#include "png_encoder.h"
+#include "corpus.h"
+
+//end to end benchmarks over a generated corpus. every file is measured in its own process
+//so the peak RSS reported for it belongs to that file alone. output is one JSON object per line
+
+//measurements for one file, sent from the child process to the parent
+typedef struct Bench_result
+{
+	int ok;
+	int w;
+	int h;
+	uint8_t bytes_per_pixel;
+
+	uint64_t compressed_bytes;
+	uint64_t decoded_bytes;
+
+	//read_png only, read_png + write_bmp, and encode_png of the decoded pixels
+	uint64_t decode_runs;
+	double decode_seconds;
+	uint64_t convert_runs;
+	double convert_seconds;
+	uint64_t encode_runs;
+	double encode_seconds;
+	uint64_t encoded_bytes;
+}bench_result;
+
+typedef struct Bench_file
+{
+	const char* path;
+	png* image;
+	dynamic_array* encoded;
+}bench_file;
+
+typedef int (*bench_step)(bench_file* file);
+
+static void print_usage()
+{
+	fprintf(stderr, "Example usage: png_bench generate [corpus_dir] [--max-size N]\n");
+	fprintf(stderr, "               png_bench run [corpus_dir] [--min-time seconds] [--no-encode]\n");
+	fprintf(stderr, "generate writes every image up to N pixels wide (default %d, up to 16384)\n", CORPUS_DEFAULT_MAX_SIZE);
+}
+
+static double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int decode_step(bench_file* file)
+{
+	png* image = read_png(file->path);
+	int to_return = image->is_valid;
+	free_png(image);
+	return to_return;
+}
+
+static int convert_step(bench_file* file)
+{
+	png* image = read_png(file->path);
+	int to_return = image->is_valid && write_bmp(image->pixel_data->data, image->w, image->h, image->bytes_per_pixel, "/dev/null");
+	free_png(image);
+	return to_return;
+}
+
+static int encode_step(bench_file* file)
+{
+	encode_options options = default_encode_options();
+	array_clear(file->encoded);
+	return encode_png(file->image, &options, file->encoded);
+}
+
+//run step until min_time has passed. the first run only warms up, unless it alone takes longer than min_time
+static int time_step(bench_step step, bench_file* file, double min_time, uint64_t* runs, double* seconds)
+{
+	double start = now_seconds();
+	if (!step(file))
+	{
+		return 0;
+	}
+	double elapsed = now_seconds() - start;
+	if (elapsed >= min_time)
+	{
+		*runs = 1;
+		*seconds = elapsed;
+		return 1;
+	}
+
+	*runs = 0;
+	start = now_seconds();
+	do
+	{
+		if (!step(file))
+		{
+			return 0;
+		}
+		(*runs)++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < min_time);
+
+	*seconds = elapsed;
+	return 1;
+}
+
+static void bench_one(const char* path, double min_time, int encode, bench_result* result)
+{
+	memset(result, 0, sizeof(bench_result));
+
+	struct stat info;
+	if (stat(path, &info) != 0)
+	{
+		return;
+	}
+	result->compressed_bytes = info.st_size;
+
+	bench_file file;
+	file.path = path;
+	file.image = read_png(path);
+	file.encoded = create_array();
+
+	if (file.image->is_valid)
+	{
+		result->w = file.image->w;
+		result->h = file.image->h;
+		result->bytes_per_pixel = file.image->bytes_per_pixel;
+		result->decoded_bytes = (uint64_t)file.image->w * file.image->h * file.image->bytes_per_pixel;
+
+		result->ok = time_step(decode_step, &file, min_time, &result->decode_runs, &result->decode_seconds)
+			&& time_step(convert_step, &file, min_time, &result->convert_runs, &result->convert_seconds);
+
+		if (result->ok && encode)
+		{
+			result->ok = time_step(encode_step, &file, min_time, &result->encode_runs, &result->encode_seconds);
+			result->encoded_bytes = file.encoded->count;
+		}
+	}
+
+	free_array(file.encoded);
+	free_png(file.image);
+}
+
+//MB/s with MB = 1000000 bytes
+static double mb_per_second(uint64_t bytes, uint64_t runs, double seconds)
+{
+	return seconds > 0 ? (double)bytes * runs / seconds / 1e6 : 0;
+}
+
+static void print_result(const char* name, const bench_result* result, long peak_rss_kb)
+{
+	if (!result->ok)
+	{
+		printf("{\"file\":\"%s\",\"error\":\"decode failed\",\"peak_rss_kb\":%ld}\n", name, peak_rss_kb);
+		return;
+	}
+
+	printf("{\"file\":\"%s\",\"width\":%d,\"height\":%d,\"bytes_per_pixel\":%u,\"compressed_bytes\":%lu,\"decoded_bytes\":%lu,",
+		name, result->w, result->h, result->bytes_per_pixel, result->compressed_bytes, result->decoded_bytes);
+	printf("\"decode_runs\":%lu,\"decode_ms\":%.4f,\"decode_compressed_mb_s\":%.2f,\"decode_mb_s\":%.2f,\"decode_images_s\":%.2f,",
+		result->decode_runs, result->decode_seconds * 1000.0 / result->decode_runs,
+		mb_per_second(result->compressed_bytes, result->decode_runs, result->decode_seconds),
+		mb_per_second(result->decoded_bytes, result->decode_runs, result->decode_seconds),
+		result->decode_runs / result->decode_seconds);
+	printf("\"convert_runs\":%lu,\"convert_ms\":%.4f,\"convert_mb_s\":%.2f,\"convert_images_s\":%.2f,",
+		result->convert_runs, result->convert_seconds * 1000.0 / result->convert_runs,
+		mb_per_second(result->decoded_bytes, result->convert_runs, result->convert_seconds),
+		result->convert_runs / result->convert_seconds);
+	if (result->encode_runs > 0)
+	{
+		printf("\"encode_runs\":%lu,\"encode_ms\":%.4f,\"encode_mb_s\":%.2f,\"encoded_bytes\":%lu,",
+			result->encode_runs, result->encode_seconds * 1000.0 / result->encode_runs,
+			mb_per_second(result->decoded_bytes, result->encode_runs, result->encode_seconds),
+			result->encoded_bytes);
+	}
+	printf("\"peak_rss_kb\":%ld}\n", peak_rss_kb);
+	fflush(stdout);
+}
+
+static int is_png(const struct dirent* entry)
+{
+	size_t length = strlen(entry->d_name);
+	return length > 4 && strcasecmp(entry->d_name + length - 4, ".png") == 0;
+}
+
+static int run_main(int argc, char* argv[])
+{
+	const char* directory = NULL;
+	double min_time = 0.5;
+	int encode = 1;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+		{
+			min_time = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-encode") == 0)
+		{
+			encode = 0;
+		}
+		else if (directory == NULL)
+		{
+			directory = argv[i];
+		}
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+	if (directory == NULL)
+	{
+		print_usage();
+		return 1;
+	}
+
+	//sorted by name so runs are always in the same order
+	struct dirent** files;
+	int file_count = scandir(directory, &files, is_png, alphasort);
+	if (file_count < 0)
+	{
+		fprintf(stderr, "png_bench: failed to open directory %s\n", directory);
+		return 1;
+	}
+
+	//totals for the summary line
+	uint64_t failed = 0;
+	uint64_t compressed_bytes = 0;
+	uint64_t decoded_bytes = 0;
+	double decode_seconds = 0;
+	double convert_seconds = 0;
+	double encode_seconds = 0;
+	uint64_t encoded_bytes = 0;
+	long peak_rss_kb = 0;
+
+	for (int i = 0; i < file_count; i++)
+	{
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", directory, files[i]->d_name);
+		fflush(stdout);
+
+		int result_pipe[2];
+		if (pipe(result_pipe) != 0)
+		{
+			fprintf(stderr, "png_bench: failed to create pipe\n");
+			return 1;
+		}
+
+		pid_t child = fork();
+		if (child == 0)
+		{
+			close(result_pipe[0]);
+			bench_result result;
+			bench_one(path, min_time, encode, &result);
+			int written = write(result_pipe[1], &result, sizeof(result)) == sizeof(result);
+			_exit(written ? 0 : 1);
+		}
+		close(result_pipe[1]);
+
+		bench_result result;
+		memset(&result, 0, sizeof(result));
+		if (child < 0 || read(result_pipe[0], &result, sizeof(result)) != sizeof(result))
+		{
+			result.ok = 0;
+		}
+		close(result_pipe[0]);
+
+		int status = 0;
+		struct rusage usage;
+		memset(&usage, 0, sizeof(usage));
+		if (child > 0)
+		{
+			wait4(child, &status, 0, &usage);
+		}
+
+		print_result(files[i]->d_name, &result, usage.ru_maxrss);
+		if (usage.ru_maxrss > peak_rss_kb)
+		{
+			peak_rss_kb = usage.ru_maxrss;
+		}
+
+		//the summary adds up the time of one run per file, so every file counts the same
+		if (!result.ok)
+		{
+			failed++;
+			continue;
+		}
+		compressed_bytes += result.compressed_bytes;
+		decoded_bytes += result.decoded_bytes;
+		decode_seconds += result.decode_seconds / result.decode_runs;
+		convert_seconds += result.convert_seconds / result.convert_runs;
+		if (result.encode_runs > 0)
+		{
+			encode_seconds += result.encode_seconds / result.encode_runs;
+			encoded_bytes += result.decoded_bytes;
+		}
+	}
+
+	printf("{\"summary\":true,\"files\":%d,\"failed\":%lu,\"compressed_bytes\":%lu,\"decoded_bytes\":%lu,", file_count, failed, compressed_bytes, decoded_bytes);
+	printf("\"decode_compressed_mb_s\":%.2f,\"decode_mb_s\":%.2f,\"decode_images_s\":%.2f,",
+		mb_per_second(compressed_bytes, 1, decode_seconds), mb_per_second(decoded_bytes, 1, decode_seconds),
+		decode_seconds > 0 ? (file_count - failed) / decode_seconds : 0);
+	printf("\"convert_mb_s\":%.2f,\"convert_images_s\":%.2f,",
+		mb_per_second(decoded_bytes, 1, convert_seconds), convert_seconds > 0 ? (file_count - failed) / convert_seconds : 0);
+	if (encode)
+	{
+		printf("\"encode_mb_s\":%.2f,", mb_per_second(encoded_bytes, 1, encode_seconds));
+	}
+	printf("\"peak_rss_kb\":%ld}\n", peak_rss_kb);
+
+	for (int i = 0; i < file_count; i++)
+	{
+		free(files[i]);
+	}
+	free(files);
+
+	return failed == 0 ? 0 : 1;
+}
+
+static int generate_main(int argc, char* argv[])
+{
+	const char* directory = NULL;
+	int max_size = CORPUS_DEFAULT_MAX_SIZE;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+		{
+			max_size = atoi(argv[++i]);
+		}
+		else if (directory == NULL)
+		{
+			directory = argv[i];
+		}
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+	if (directory == NULL)
+	{
+		print_usage();
+		return 1;
+	}
+
+	return generate_corpus(directory, max_size) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "generate") == 0)
+	{
+		return generate_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "run") == 0)
+	{
+		return run_main(argc, argv);
+	}
+
+	print_usage();
+	return 1;
+}
@@ -0,0 +1,63 @@
+#include "bit_stream.h"
+
+void bits_init(bit_stream* stream, const uint8_t* data, uint64_t size)
+{
+	stream->data = data;
+	stream->size = size;
+	stream->byte_position = 0;
+	stream->bit_position = 0;
+}
+
+//pull a single bit out of the bit stream. keeps track of position
+char pull_bit(bit_stream* to_pull)
+{
+	uint8_t data = (to_pull->byte_position < to_pull->size) ? to_pull->data[to_pull->byte_position] : 0;
+	uint8_t to_and = 1;
+	to_and <<= (to_pull->bit_position);
+
+	//increment bit counter
+	to_pull->bit_position++;
+
+	//move to the next boundry once the end of the byte is reached
+	if(to_pull->bit_position == 8)
+	{
+		next_boundry(to_pull);
+	}
+
+	return ((data & to_and) > 0);
+}
+
+//pull length number of bits from the current position in the bit stream
+//original bit order is preserved (for interpretation as a number)
+uint32_t pull_bits(bit_stream* to_pull, uint8_t length)
+{
+	uint32_t to_return = 0;
+	if(length == 0)
+	{
+		return 0;
+	}
+
+	uint32_t to_add = 1;
+	to_add <<= (length - 1);
+	for(int i = 0; i < length; i++)
+	{
+		if(pull_bit(to_pull) > 0)
+		{
+			to_return += to_add;
+		}
+
+		if(i < (length - 1))
+		{
+			to_return >>= 1;
+		}
+	}
+
+	return to_return;
+}
+
+//skip the rest of the unread bits in a byte
+void next_boundry(bit_stream* cur)
+{
+	cur->bit_position = 0;
+	cur->byte_position++;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+//read cursor over a deflate stream (bits are read least significant first)
+//the stream doesn't own the data, so one buffer can be read by any number of cursors
+typedef struct Bit_stream
+{
+	const uint8_t* data;
+	uint64_t size;
+
+	//position in the bit stream
+	uint64_t byte_position;
+	uint64_t bit_position;
+}bit_stream;
+
+void bits_init(bit_stream* stream, const uint8_t* data, uint64_t size);
+
+//reads past the end return 0 bits. callers check byte_position against size to find truncated data
+char pull_bit(bit_stream* to_pull);
+uint32_t pull_bits(bit_stream* to_pull, uint8_t length);
+
+//skip the rest of the unread bits in a byte
+void next_boundry(bit_stream* cur);
@@ -1,40 +1,58 @@
+#include <sys/stat.h>
+
 #include "bmp.h"
 
+static void convert_row(const uint8_t* source, int width, uint8_t bytes_per_pixel, uint8_t* output);
+
+static size_t pixel_bytes(const bmp* image)
+{
+	return (size_t)image->w * image->h * image->pixel_width;
+}
+
 void free_bmp(bmp* to_free)
 {
 	if(to_free != NULL)
 	{
+		mem_allocator allocator = to_free->allocator;
 		if(to_free->pixel_data != NULL)
 		{
-			free(to_free->pixel_data);
+			mem_free(&allocator, to_free->pixel_data, pixel_bytes(to_free));
 			to_free->pixel_data = NULL;
 		}
 
-		free(to_free);
+		mem_free(&allocator, to_free, sizeof(bmp));
 		to_free = NULL;
 	}
 }
 
-//write bmp file given a pixel array. only supports RGB pixel format.
-//mostly meant as a validation that the file format readers work properly
-void write_bmp(const void* pixel_data, int width, int height, const char* filename)
+//size of the file write_bmp produces (56 bytes of headers plus padded rows)
+uint64_t bmp_file_size(int width, int height)
 {
-	//construct bmp file in memory first
-	uint32_t filesize = 0;
+	uint64_t row_size = 3 * (uint64_t)width;
+
+	//rows are padded to a multiple of 4 bytes
+	uint64_t padding_size = (4 - (row_size % 4)) % 4;
 
-	uint32_t row_size = 3 * width;
-	uint32_t padding_size = (row_size % 4);
+	return 56 + (row_size + padding_size) * height;
+}
 
+//write the bmp headers into the first 56 bytes of output
+void bmp_write_header(uint8_t* output, int width, int height)
+{
+	uint32_t filesize = 0;
 	uint32_t data = 0;
 
-	//allocate far more data than we need
-	uint8_t* output = calloc(width * height * 3 * 2, 1);
+	memset(output, 0, 56);
 
 	output[0] = 'B';
 	output[1] = 'M';
 	filesize += 2;
 
-	//these 4 bytes need to contain the size of the bmp file in bytes
+	//these 4 bytes need to contain the size of the bmp file in bytes. files too big for the field get 0 (readers
+	//take the size from the file itself anyway)
+	uint64_t size = bmp_file_size(width, height);
+	data = (size <= UINT32_MAX) ? (uint32_t)size : 0;
+	memcpy(output+filesize, &data, 4);
 	filesize += 4;
 
 	//skip 2 reserved data segments
@@ -68,61 +86,179 @@ void write_bmp(const void* pixel_data, int width, int height, const char* filena
 	memcpy(output+filesize, &bits_per_pixel, 2);
 	filesize += 2;
 
-	//compression method being used
-	filesize += 4;
+	//compression method, image size, horizontal/vertical resolution and palette size are all left as 0
+	//the last 6 bytes are always ignored but sill present for some reason
+}
 
-	//image size
-	filesize += 4;
+//convert source rows [first_row, first_row + row_count) into their place in a bmp file
+//rows are independent, so different bands of one image can be converted on different threads
+void bmp_write_rows(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, int first_row, int row_count, uint8_t* output)
+{
+	uint64_t row_size = 3 * (uint64_t)width;
+	uint64_t padding_size = (4 - (row_size % 4)) % 4;
+	uint64_t source_row_size = (uint64_t)bytes_per_pixel * width;
 
-	//horizontal resolution
-	filesize += 4;
+	for(int y = first_row; y < first_row + row_count; y++)
+	{
+		//bmp rows are stored bottom up
+		const uint8_t* data_index = (uint8_t*)pixel_data + (y * source_row_size);
+		uint8_t* output_index = output + 56 + (uint64_t)(height - 1 - y) * (row_size + padding_size);
+		convert_row(data_index, width, bytes_per_pixel, output_index);
+	}
+}
 
-	//vertical resolution
-	filesize += 4;
+//one row of RGB(A) pixels to a padded bmp row
+static void convert_row(const uint8_t* source, int width, uint8_t bytes_per_pixel, uint8_t* output)
+{
+	uint64_t padding_size = (4 - ((3 * (uint64_t)width) % 4)) % 4;
 
-	//number of colors in color palette
-	filesize += 4;
+	for(int x = 0; x < width; x++)
+	{
+		//write RGB backwards because this is the worst file format known to man
+		output[0] = source[2];
+		output[1] = source[1];
+		output[2] = source[0];
 
-	//always ignored but sill present for some reason
-	filesize += 4;
-	filesize += 2;
+		output += 3;
+		source += bytes_per_pixel;
+	}
+
+	//add padding if necessary(if it's not it'll just be 0)
+	memset(output, 0, padding_size);
+}
 
-	for(int y = height - 1; y >= 0; y--)
+bmp_writer* open_bmp_writer(const char* filename, int width, int height)
+{
+	return open_bmp_writer_using(filename, width, height, NULL);
+}
+
+bmp_writer* open_bmp_writer_using(const char* filename, int width, int height, const mem_allocator* allocator)
+{
+	bmp_writer* to_return = mem_calloc(allocator, sizeof(bmp_writer));
+	if(to_return == NULL)
+	{
+		return NULL;
+	}
+	if(allocator != NULL)
 	{
-		int row_index = 0;
-		for(int x = 0; x < width; x++)
+		to_return->allocator = *allocator;
+	}
+
+	to_return->width = width;
+	to_return->height = height;
+	to_return->row_size = (bmp_file_size(width, height) - 56) / height;
+	to_return->row = mem_alloc(allocator, to_return->row_size);
+	to_return->file = fopen(filename, "wb");
+	if(to_return->file == NULL || to_return->row == NULL)
+	{
+		fprintf(stderr, "open_bmp_writer: Failed to open file %s for writing.\n", filename);
+		if(to_return->file != NULL)
 		{
-			const uint8_t* data_index = (uint8_t*)pixel_data + (y * row_size) + x * 3;
-			uint8_t* output_index = output + filesize;
+			fclose(to_return->file);
+		}
+		mem_free(allocator, to_return->row, to_return->row_size);
+		mem_free(allocator, to_return, sizeof(bmp_writer));
+		return NULL;
+	}
 
-			//write RGB backwards because this is the worst file format known to man
-			output_index[0] = data_index[2];
-			output_index[1] = data_index[1];
-			output_index[2] = data_index[0];
+	uint8_t header[56];
+	bmp_write_header(header, width, height);
+	to_return->is_valid = (fwrite(header, 1, 56, to_return->file) == 56);
+	return to_return;
+}
 
-			filesize += 3;
-		}
+int bmp_writer_row(bmp_writer* writer, const void* pixels, uint8_t bytes_per_pixel, int row)
+{
+	if(!writer->is_valid || row < 0 || row >= writer->height)
+	{
+		writer->is_valid = 0;
+		return 0;
+	}
+
+	//bmp rows are stored bottom up
+	convert_row(pixels, writer->width, bytes_per_pixel, writer->row);
+	uint64_t offset = 56 + (uint64_t)(writer->height - 1 - row) * writer->row_size;
+	if(fseeko(writer->file, offset, SEEK_SET) != 0 || fwrite(writer->row, 1, writer->row_size, writer->file) != writer->row_size)
+	{
+		writer->is_valid = 0;
+	}
+
+	return writer->is_valid;
+}
+
+int close_bmp_writer(bmp_writer* writer)
+{
+	int to_return = writer->is_valid;
+	if(fclose(writer->file) != 0)
+	{
+		to_return = 0;
+	}
 
-		//add padding if necessary(if it's not it'll just be 0)
-		filesize += padding_size;
+	mem_allocator allocator = writer->allocator;
+	mem_free(&allocator, writer->row, writer->row_size);
+	mem_free(&allocator, writer, sizeof(bmp_writer));
+	return to_return;
+}
+
+//write bmp file given a pixel array. RGB and RGBA (alpha is dropped) pixel formats are supported.
+//mostly meant as a validation that the file format readers work properly
+//returns 1 on success, 0 on failure
+int write_bmp(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, const char* filename)
+{
+	return write_bmp_using(pixel_data, width, height, bytes_per_pixel, filename, NULL);
+}
+
+int write_bmp_using(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, const char* filename, const mem_allocator* allocator)
+{
+	//construct bmp file in memory first
+	uint64_t filesize = bmp_file_size(width, height);
+	uint8_t* output = mem_alloc(allocator, filesize);
+	if(output == NULL)
+	{
+		fprintf(stderr, "write_bmp: unable to allocate %lu bytes for %s.\n", filesize, filename);
+		return 0;
 	}
 
-	//update filesize parameter
-	memcpy(output+2, &filesize, 4);
+	bmp_write_header(output, width, height);
+	bmp_write_rows(pixel_data, width, height, bytes_per_pixel, 0, height, output);
 
-	//write png to disk
+	//write bmp to disk
 	FILE* out = fopen(filename, "wb");
-	fwrite(output, 1, filesize, out);
-	fclose(out);
+	if(out == NULL)
+	{
+		fprintf(stderr, "write_bmp: Failed to open file %s for writing.\n", filename);
+		mem_free(allocator, output, filesize);
+		return 0;
+	}
+	int to_return = (fwrite(output, 1, filesize, out) == filesize);
+	if(fclose(out) != 0)
+	{
+		to_return = 0;
+	}
 
-	free(output);
+	mem_free(allocator, output, filesize);
+	return to_return;
 }
 
 bmp* read_bmp(const char* filename)
 {
-	bmp* to_return = calloc(1, sizeof(bmp));
+	return read_bmp_using(filename, NULL);
+}
+
+bmp* read_bmp_using(const char* filename, const mem_allocator* allocator)
+{
+	bmp* to_return = mem_calloc(allocator, sizeof(bmp));
+	if(to_return == NULL)
+	{
+		fprintf(stderr, "read_bmp: unable to allocate the bmp for %s.\n", filename);
+		return NULL;
+	}
+	if(allocator != NULL)
+	{
+		to_return->allocator = *allocator;
+	}
 
-	FILE* input = fopen(filename, "r");
+	FILE* input = fopen(filename, "rb");
 	if(input == NULL)
 	{
 		fprintf(stderr, "read_bmp: Failed to open file %s. BMP creation aborted.\n", filename);
@@ -141,30 +277,34 @@ bmp* read_bmp(const char* filename)
 	int is_bmp = strncmp("BM", header, 2);
 	if(is_bmp != 0)
 	{
-		printf("File is invalid bmp image\n");
-		exit(1);
+		fclose(input);
+		fprintf(stderr, "read_bmp: '%s' is not a valid bmp image. BMP creation aborted.\n", filename);
+		return to_return;
 	}
 
-	int filesize = 0;
-	if(fread(&filesize, 4, 1, input) != 0)
+	//the size field of the header is only 32 bits (and 0 in files bigger than that), so the real size comes from the file
+	struct stat info;
+	uint64_t filesize = (fstat(fileno(input), &info) == 0) ? info.st_size : 0;
+	if(filesize < 54 || fseeko(input, 0, SEEK_SET) != 0)
 	{
 		fclose(input);
 		fprintf(stderr, "read_bmp: Failed to read '%s'. BMP creation aborted\n", filename);
 		return to_return;
 	}
-	fseek(input, 0, SEEK_SET);
-	
+
 	//read entire file into memory
-	uint8_t* bmp_data = malloc(filesize);
-	if(fread(bmp_data, filesize, 1, input) != 1)
+	uint8_t* bmp_data = mem_alloc(allocator, filesize);
+	if(bmp_data == NULL || fread(bmp_data, filesize, 1, input) != 1)
 	{
+		mem_free(allocator, bmp_data, filesize);
 		fclose(input);
 		fprintf(stderr, "read_bmp: Failed to read '%s'. BMP creation aborted\n", filename);
 		return to_return;
 	}
 	fclose(input);
 
-	int pixel_offset = (int)*(bmp_data + 10);
+	uint32_t pixel_offset = 0;
+	memcpy(&pixel_offset, bmp_data + 10, 4);
 	memcpy(&to_return->w, bmp_data+18, 4);
 	memcpy(&to_return->h, bmp_data+22, 4);
 	
@@ -174,6 +314,7 @@ bmp* read_bmp(const char* filename)
 
 	if(to_return->pixel_width != 3)
 	{
+		mem_free(allocator, bmp_data, filesize);
 		fprintf(stderr, "read_bmp: unsupported pixel format: %d. BMP creation aborted.\n", to_return->pixel_width);
 		return to_return;
 	}
@@ -182,20 +323,35 @@ bmp* read_bmp(const char* filename)
 
 	if(compression_method != 0)
 	{
+		mem_free(allocator, bmp_data, filesize);
 		fprintf(stderr, "unsupported compression method: %d. BMP creation aborted.\n", compression_method);
 		return to_return;
 	}
 
-	//array our pixels are going to be stored in. RGB format
-	to_return->pixel_data = calloc(to_return->w * to_return->h * to_return->pixel_width, 1);
+	uint64_t row_size = (uint64_t)to_return->pixel_width * to_return->w;
+	uint64_t padding_size = (4 - (row_size % 4)) % 4;
 
-	int index = 0;
-	int row_size = to_return->pixel_width * to_return->w;
-	int padding_size = (row_size % 4);
+	//the rows have to be in the file
+	if(pixel_offset > filesize || (to_return->h > 0 && row_size + padding_size > (filesize - pixel_offset) / to_return->h))
+	{
+		mem_free(allocator, bmp_data, filesize);
+		fprintf(stderr, "read_bmp: '%s' is too short for a %ux%u image. BMP creation aborted.\n", filename, to_return->w, to_return->h);
+		return to_return;
+	}
+
+	//array our pixels are going to be stored in. RGB format
+	to_return->pixel_data = mem_calloc(allocator, pixel_bytes(to_return));
+	if(to_return->pixel_data == NULL)
+	{
+		mem_free(allocator, bmp_data, filesize);
+		fprintf(stderr, "read_bmp: unable to allocate the pixels of '%s'. BMP creation aborted.\n", filename);
+		return to_return;
+	}
 
-	for(int y = to_return->h - 1; y >= 0; y--)
+	uint64_t index = 0;
+	for(int64_t y = (int64_t)to_return->h - 1; y >= 0; y--)
 	{
-		for(int x = 0; x < to_return->w; x++)
+		for(uint32_t x = 0; x < to_return->w; x++)
 		{
 			uint8_t* output_index = to_return->pixel_data + (y * row_size) + x * to_return->pixel_width;
 			uint8_t* data_index = bmp_data + pixel_offset + index;
@@ -211,7 +367,7 @@ bmp* read_bmp(const char* filename)
 		index += padding_size;
 	}
 
-	free(bmp_data);
+	mem_free(allocator, bmp_data, filesize);
 
 	to_return->is_valid = 1;
 	return to_return;
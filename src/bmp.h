@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
+
 typedef struct Bmp
 {
 	uint32_t w;
@@ -14,8 +16,46 @@ typedef struct Bmp
 	uint8_t* pixel_data;
 
 	int is_valid;
+
+	//where the bmp and its pixels came from (free_bmp uses it). zeroed means libc
+	mem_allocator allocator;
 }bmp;
 
-void write_bmp(const void* pixel_data, int width, int height, const char* filename);
+//writes a bmp one row at a time (in any order), so the image never has to be in memory as a whole
+typedef struct Bmp_writer
+{
+	FILE* file;
+	int width;
+	int height;
+
+	//one padded bmp row
+	uint8_t* row;
+	uint64_t row_size;
+
+	//0 once any write failed
+	int is_valid;
+
+	//where the writer and its row came from. zeroed means libc
+	mem_allocator allocator;
+}bmp_writer;
+
+int write_bmp(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, const char* filename);
 bmp* read_bmp(const char* filename);
-void free_bmp(bmp* to_free);
\ No newline at end of file
+void free_bmp(bmp* to_free);
+
+//same as above with the memory from allocator (NULL is libc)
+int write_bmp_using(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, const char* filename, const mem_allocator* allocator);
+bmp* read_bmp_using(const char* filename, const mem_allocator* allocator);
+
+//NULL if the file can't be created. rows that are never written read back as black
+bmp_writer* open_bmp_writer(const char* filename, int width, int height);
+bmp_writer* open_bmp_writer_using(const char* filename, int width, int height, const mem_allocator* allocator);
+//pixels is one RGB or RGBA row of the image (row 0 is the top). 1 is success, 0 is failure
+int bmp_writer_row(bmp_writer* writer, const void* pixels, uint8_t bytes_per_pixel, int row);
+//1 if every write went through
+int close_bmp_writer(bmp_writer* writer);
+
+//pieces of write_bmp for callers that manage their own output buffer
+uint64_t bmp_file_size(int width, int height);
+void bmp_write_header(uint8_t* output, int width, int height);
+void bmp_write_rows(const void* pixel_data, int width, int height, uint8_t bytes_per_pixel, int first_row, int row_count, uint8_t* output);
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include <pthread.h>
+
+#include "checksum.h"
+
+#define ADLER_BASE 65521
+
+//largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits
+#define ADLER_NMAX 5552
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+//generate the crc lookup table (only done once per process)
+static void generate_crc_table()
+{
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+		{
+			if (c & 1)
+			{
+				c = 0xEDB88320 ^ (c >> 1);
+			}
+			else
+			{
+				c >>= 1;
+			}
+		}
+		crc_table[n] = c;
+	}
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint64_t length)
+{
+	pthread_once(&crc_table_once, generate_crc_table);
+
+	crc = ~crc;
+	for (uint64_t i = 0; i < length; i++)
+	{
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+uint32_t adler32_update(uint32_t adler, const uint8_t* data, uint64_t length)
+{
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+
+	//the modulo is only needed once every ADLER_NMAX bytes
+	while (length > 0)
+	{
+		uint32_t block = length < ADLER_NMAX ? length : ADLER_NMAX;
+		length -= block;
+
+		for (uint32_t i = 0; i < block; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		data += block;
+
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+
+	return (b << 16) | a;
+}
+
+//same math as zlib's adler32_combine
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t length2)
+{
+	uint32_t remainder = length2 % ADLER_BASE;
+	uint32_t sum1 = adler1 & 0xFFFF;
+	uint32_t sum2 = (uint32_t)(((uint64_t)remainder * sum1) % ADLER_BASE);
+
+	sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+	sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + ADLER_BASE - remainder;
+
+	if (sum1 >= ADLER_BASE)
+	{
+		sum1 -= ADLER_BASE;
+	}
+	if (sum1 >= ADLER_BASE)
+	{
+		sum1 -= ADLER_BASE;
+	}
+	if (sum2 >= (ADLER_BASE << 1))
+	{
+		sum2 -= (ADLER_BASE << 1);
+	}
+	if (sum2 >= ADLER_BASE)
+	{
+		sum2 -= ADLER_BASE;
+	}
+
+	return sum1 | (sum2 << 16);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//crc32 as used by png chunks (polynomial 0xEDB88320). pass 0 as crc to start a new checksum
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint64_t length);
+
+//adler32 as used by the zlib trailer. pass 1 as adler to start a new checksum
+uint32_t adler32_update(uint32_t adler, const uint8_t* data, uint64_t length);
+
+//combine the checksums of two consecutive streams (length2 is the size of the second stream)
+uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t length2);
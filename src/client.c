@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+//small test client for png_decoder --serve
+
+static void print_usage()
+{
+	fprintf(stderr, "Example usage: png_client [--repeat N] [socket] decode [input.png] [output.raw]\n");
+	fprintf(stderr, "               png_client [--repeat N] [socket] send [input.png] [output.raw]\n");
+	fprintf(stderr, "               png_client [--repeat N] [socket] convert [input.png] [output.bmp]\n");
+	fprintf(stderr, "               png_client [--repeat N] [socket] convert-bytes [input.png] [output.bmp]\n");
+}
+
+static uint8_t* read_file(const char* filename, uint64_t* size)
+{
+	FILE* input = fopen(filename, "rb");
+	if (input == NULL)
+	{
+		return NULL;
+	}
+
+	fseek(input, 0, SEEK_END);
+	*size = ftell(input);
+	fseek(input, 0, SEEK_SET);
+
+	uint8_t* to_return = malloc(*size > 0 ? *size : 1);
+	if (fread(to_return, 1, *size, input) != *size)
+	{
+		free(to_return);
+		to_return = NULL;
+	}
+
+	fclose(input);
+	return to_return;
+}
+
+static double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	int repeat = 1;
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "--repeat") == 0)
+	{
+		repeat = atoi(argv[2]);
+		first = 3;
+	}
+
+	if (argc - first < 3)
+	{
+		print_usage();
+		return 1;
+	}
+
+	const char* socket_path = argv[first];
+	const char* command_name = argv[first + 1];
+	const char* input = argv[first + 2];
+	const char* output = (argc - first > 3) ? argv[first + 3] : NULL;
+
+	server_request request;
+	memset(&request, 0, sizeof(request));
+	request.magic = SERVER_MAGIC;
+
+	if (strcmp(command_name, "decode") == 0)
+	{
+		request.command = SERVER_DECODE_PATH;
+	}
+	else if (strcmp(command_name, "send") == 0)
+	{
+		request.command = SERVER_DECODE_BYTES;
+	}
+	else if (strcmp(command_name, "convert") == 0)
+	{
+		request.command = SERVER_CONVERT_PATH;
+	}
+	else if (strcmp(command_name, "convert-bytes") == 0)
+	{
+		request.command = SERVER_CONVERT_BYTES;
+	}
+	else
+	{
+		print_usage();
+		return 1;
+	}
+
+	int is_convert = (request.command == SERVER_CONVERT_PATH || request.command == SERVER_CONVERT_BYTES);
+	if (is_convert && output == NULL)
+	{
+		print_usage();
+		return 1;
+	}
+
+	//the server has its own working directory, so paths are sent as absolute paths
+	char input_path[PATH_MAX];
+	char output_path[PATH_MAX];
+	const uint8_t* payload = NULL;
+	uint8_t* file_data = NULL;
+
+	if (request.command == SERVER_DECODE_PATH || request.command == SERVER_CONVERT_PATH)
+	{
+		if (realpath(input, input_path) == NULL)
+		{
+			fprintf(stderr, "png_client: %s does not exist\n", input);
+			return 1;
+		}
+		payload = (const uint8_t*)input_path;
+		request.input_length = strlen(input_path);
+	}
+	else
+	{
+		file_data = read_file(input, &request.input_length);
+		if (file_data == NULL)
+		{
+			fprintf(stderr, "png_client: failed to read %s\n", input);
+			return 1;
+		}
+		payload = file_data;
+	}
+
+	if (is_convert)
+	{
+		if (output[0] == '/')
+		{
+			snprintf(output_path, sizeof(output_path), "%s", output);
+		}
+		else
+		{
+			char directory[PATH_MAX];
+			if (getcwd(directory, sizeof(directory)) == NULL)
+			{
+				directory[0] = 0;
+			}
+			snprintf(output_path, sizeof(output_path), "%s/%s", directory, output);
+		}
+		request.output_length = strlen(output_path);
+	}
+
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+
+	if (connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "png_client: failed to connect to %s\n", socket_path);
+		free(file_data);
+		return 1;
+	}
+
+	//every repeat reuses the same connection, which is how latency-sensitive callers should use the server
+	int to_return = 0;
+	double start = now_seconds();
+	for (int i = 0; i < repeat && to_return == 0; i++)
+	{
+		if (!send_all(connection, &request, sizeof(request)) || !send_all(connection, payload, request.input_length) || (is_convert && !send_all(connection, output_path, request.output_length)))
+		{
+			fprintf(stderr, "png_client: failed to send request\n");
+			to_return = 1;
+			break;
+		}
+
+		server_response response;
+		if (!receive_all(connection, &response, sizeof(response)) || response.magic != SERVER_MAGIC)
+		{
+			fprintf(stderr, "png_client: no response from server\n");
+			to_return = 1;
+			break;
+		}
+
+		uint8_t* data = malloc(response.data_length + 1);
+		if (!receive_all(connection, data, response.data_length))
+		{
+			fprintf(stderr, "png_client: response was cut short\n");
+			free(data);
+			to_return = 1;
+			break;
+		}
+		data[response.data_length] = 0;
+
+		if (response.status != SERVER_OK)
+		{
+			fprintf(stderr, "png_client: server error %u: %s\n", response.status, (char*)data);
+			to_return = 1;
+		}
+		else if (i == repeat - 1)
+		{
+			printf("%ux%u, %u bytes per pixel, %lu bytes received\n", response.width, response.height, response.bytes_per_pixel, response.data_length);
+
+			if (!is_convert && output != NULL)
+			{
+				FILE* out = fopen(output, "wb");
+				if (out == NULL || fwrite(data, 1, response.data_length, out) != response.data_length)
+				{
+					fprintf(stderr, "png_client: failed to write %s\n", output);
+					to_return = 1;
+				}
+				if (out != NULL)
+				{
+					fclose(out);
+				}
+			}
+		}
+
+		free(data);
+	}
+
+	if (repeat > 1 && to_return == 0)
+	{
+		printf("%d requests, %.3f ms per request\n", repeat, (now_seconds() - start) * 1000.0 / repeat);
+	}
+
+	close(connection);
+	free(file_data);
+	return to_return;
+}
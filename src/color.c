@@ -0,0 +1,594 @@
+#include <string.h>
+#include <math.h>
+
+#include "color.h"
+#include "metadata.h"
+
+//a transfer curve from encoded values (0-1) to linear light
+typedef enum Curve_type
+{
+	CURVE_LINEAR = 0,
+	CURVE_SRGB = 1,
+
+	//icc parametric curves (types 0 to 4 all fit the general form, see curve_value)
+	CURVE_PARAMETRIC = 2,
+
+	//icc curv with a table of uint16 points, spaced evenly over 0-1
+	CURVE_TABLE = 3
+}curve_type;
+
+typedef struct Transfer_curve
+{
+	curve_type type;
+
+	//y = (a * x + b) ^ g + e for x >= d, c * x + f below it
+	double g;
+	double a;
+	double b;
+	double c;
+	double d;
+	double e;
+	double f;
+
+	//big endian points in the profile (only valid while the transform is built)
+	const uint8_t* table;
+	uint32_t count;
+}transfer_curve;
+
+//CIE XYZ of the white point icc profiles are adapted to
+static const double d50_white[3] = {0.9642, 1.0, 0.8249};
+
+//xy of the sRGB red, green and blue primaries and its white point (D65)
+static const double srgb_primaries[8] = {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290};
+
+static int icc_transform(png_decoder* decoder, color_transform* transform);
+static int icc_curve(const uint8_t* profile, uint64_t length, const char* signature, transfer_curve* curve);
+static int icc_xyz(const uint8_t* profile, uint64_t length, const char* signature, double* xyz);
+static const uint8_t* icc_tag(const uint8_t* profile, uint64_t length, const char* signature, uint32_t* size);
+static double curve_value(const transfer_curve* curve, double x);
+static double srgb_encode(double linear);
+static void gamma_curve(transfer_curve* curve, double gamma);
+static int primaries_to_xyz(const double* xy, double* matrix);
+static void xy_to_xyz(double x, double y, double* xyz);
+static void adapt_white(const double* from, const double* to, double* matrix);
+static void multiply(const double* left, const double* right, double* output);
+static void multiply_vector(const double* matrix, const double* vector, double* output);
+static int invert(const double* matrix, double* output);
+static void build_tables(color_transform* transform, const transfer_curve* curves, const double* to_xyz, const double* white);
+static uint32_t read_u32(const uint8_t* data);
+
+void build_color_transform(png_decoder* decoder, color_transform* transform)
+{
+	memset(transform, 0, sizeof(color_transform));
+	if (icc_transform(decoder, transform))
+	{
+		transform->source = COLOR_FROM_ICC;
+		return;
+	}
+
+	uint8_t intent;
+	if (png_get_srgb(decoder, &intent))
+	{
+		transform->source = COLOR_FROM_SRGB;
+		return;
+	}
+
+	uint32_t gamma;
+	png_chromaticities chromaticities;
+	int has_gamma = png_get_gamma(decoder, &gamma);
+	int has_chromaticities = png_get_chromaticities(decoder, &chromaticities);
+	if (!has_gamma && !has_chromaticities)
+	{
+		return;
+	}
+	transform->source = COLOR_FROM_GAMMA;
+
+	//gAMA holds the exponent that encoded the image, decoding raises to its inverse. without one the curve is sRGB's
+	transfer_curve curves[3];
+	memset(curves, 0, sizeof(curves));
+	for (int c = 0; c < 3; c++)
+	{
+		curves[c].type = CURVE_SRGB;
+		if (has_gamma)
+		{
+			gamma_curve(&curves[c], 100000.0 / gamma);
+		}
+	}
+
+	//xy of the red, green and blue primaries and the white point. without cHRM they are sRGB's
+	double primaries[8];
+	memcpy(primaries, srgb_primaries, sizeof(primaries));
+	if (has_chromaticities)
+	{
+		primaries[0] = chromaticities.red_x / 100000.0;
+		primaries[1] = chromaticities.red_y / 100000.0;
+		primaries[2] = chromaticities.green_x / 100000.0;
+		primaries[3] = chromaticities.green_y / 100000.0;
+		primaries[4] = chromaticities.blue_x / 100000.0;
+		primaries[5] = chromaticities.blue_y / 100000.0;
+		primaries[6] = chromaticities.white_x / 100000.0;
+		primaries[7] = chromaticities.white_y / 100000.0;
+	}
+
+	double to_xyz[9];
+	double white[3];
+	if (!primaries_to_xyz(primaries, to_xyz))
+	{
+		fprintf(stderr, "build_color_transform: cHRM chunk has primaries that don't span a color space, it is ignored\n");
+		primaries_to_xyz(srgb_primaries, to_xyz);
+		memcpy(primaries, srgb_primaries, sizeof(primaries));
+	}
+	xy_to_xyz(primaries[6], primaries[7], white);
+	build_tables(transform, curves, to_xyz, white);
+}
+
+void apply_color(const color_transform* transform, const uint8_t* input, uint8_t* output, uint64_t pixel_count, uint8_t bytes_per_pixel)
+{
+	if (transform->kind == COLOR_CURVES)
+	{
+		const uint8_t (*curves)[256] = transform->curves;
+		for (uint64_t i = 0; i < pixel_count; i++)
+		{
+			const uint8_t* pixel = input + i * bytes_per_pixel;
+			uint8_t* corrected = output + i * bytes_per_pixel;
+			uint8_t red = curves[0][pixel[0]];
+			uint8_t green = curves[1][pixel[1]];
+			uint8_t blue = curves[2][pixel[2]];
+			corrected[0] = red;
+			corrected[1] = green;
+			corrected[2] = blue;
+			if (bytes_per_pixel == 4)
+			{
+				corrected[3] = pixel[3];
+			}
+		}
+	}
+	else if (transform->kind == COLOR_MATRIX)
+	{
+		const uint16_t (*linear)[256] = transform->linear;
+		const int32_t* m = transform->matrix;
+		for (uint64_t i = 0; i < pixel_count; i++)
+		{
+			const uint8_t* pixel = input + i * bytes_per_pixel;
+			uint8_t* corrected = output + i * bytes_per_pixel;
+			int32_t red = linear[0][pixel[0]];
+			int32_t green = linear[1][pixel[1]];
+			int32_t blue = linear[2][pixel[2]];
+
+			int32_t mixed[3];
+			for (int c = 0; c < 3; c++)
+			{
+				int32_t value = (m[c * 3] * red + m[c * 3 + 1] * green + m[c * 3 + 2] * blue + (1 << (COLOR_MATRIX_BITS - 1))) >> COLOR_MATRIX_BITS;
+				mixed[c] = (value < 0) ? 0 : ((value > COLOR_LINEAR_MAX) ? COLOR_LINEAR_MAX : value);
+			}
+			corrected[0] = transform->encode[mixed[0]];
+			corrected[1] = transform->encode[mixed[1]];
+			corrected[2] = transform->encode[mixed[2]];
+			if (bytes_per_pixel == 4)
+			{
+				corrected[3] = pixel[3];
+			}
+		}
+	}
+	else if (input != output)
+	{
+		memcpy(output, input, pixel_count * bytes_per_pixel);
+	}
+}
+
+const char* color_source_name(color_source source)
+{
+	switch (source)
+	{
+	case COLOR_FROM_SRGB:
+		return "sRGB";
+
+	case COLOR_FROM_ICC:
+		return "iCCP";
+
+	case COLOR_FROM_GAMMA:
+		return "gAMA/cHRM";
+
+	default:
+		return "none";
+	}
+}
+
+
+//build the transform of an RGB matrix/TRC icc profile. 1 if the png has one, 0 otherwise
+static int icc_transform(png_decoder* decoder, color_transform* transform)
+{
+	if (decoder_find_chunk(decoder, "iCCP", 0) < 0)
+	{
+		return 0;
+	}
+
+	dynamic_array* buffer = create_array_using(&decoder->allocator);
+	png_icc_profile icc;
+	if (buffer == NULL || !png_get_icc_profile(decoder, &icc, buffer))
+	{
+		free_array(buffer);
+		return 0;
+	}
+
+	//header: data color space at 16, connection space at 20 and the profile signature at 36, then the tag table at 128
+	const uint8_t* profile = icc.profile;
+	uint64_t length = icc.length;
+	int usable = length >= 132 && memcmp(profile + 16, "RGB ", 4) == 0 && memcmp(profile + 20, "XYZ ", 4) == 0 && memcmp(profile + 36, "acsp", 4) == 0;
+
+	//the colorants are the XYZ (adapted to D50) of full red, green and blue, so they are the columns of the matrix
+	double columns[3][3];
+	transfer_curve curves[3];
+	memset(curves, 0, sizeof(curves));
+	usable = usable && icc_xyz(profile, length, "rXYZ", columns[0]) && icc_xyz(profile, length, "gXYZ", columns[1]) && icc_xyz(profile, length, "bXYZ", columns[2]);
+	usable = usable && icc_curve(profile, length, "rTRC", &curves[0]) && icc_curve(profile, length, "gTRC", &curves[1]) && icc_curve(profile, length, "bTRC", &curves[2]);
+	if (usable)
+	{
+		double to_xyz[9];
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = 0; column < 3; column++)
+			{
+				to_xyz[row * 3 + column] = columns[column][row];
+			}
+		}
+		build_tables(transform, curves, to_xyz, d50_white);
+	}
+	else
+	{
+		fprintf(stderr, "build_color_transform: icc profile \"%s\" isn't an RGB matrix/TRC profile, it is ignored\n", icc.name);
+	}
+
+	free_array(buffer);
+	return usable;
+}
+
+//read a curv or para tag. 1 is success, 0 if it is missing or invalid
+static int icc_curve(const uint8_t* profile, uint64_t length, const char* signature, transfer_curve* curve)
+{
+	uint32_t size;
+	const uint8_t* tag = icc_tag(profile, length, signature, &size);
+	if (tag == NULL || size < 12)
+	{
+		return 0;
+	}
+
+	memset(curve, 0, sizeof(transfer_curve));
+	if (memcmp(tag, "curv", 4) == 0)
+	{
+		//no points is the identity, one is a gamma (u8Fixed8), more are a table
+		uint32_t count = read_u32(tag + 8);
+		if (count == 0)
+		{
+			curve->type = CURVE_LINEAR;
+		}
+		else if (count == 1 && size >= 14)
+		{
+			gamma_curve(curve, ((tag[12] << 8) | tag[13]) / 256.0);
+		}
+		else if (count > 1 && (size - 12) / 2 >= count)
+		{
+			curve->type = CURVE_TABLE;
+			curve->table = tag + 12;
+			curve->count = count;
+		}
+		else
+		{
+			return 0;
+		}
+		return 1;
+	}
+
+	if (memcmp(tag, "para", 4) == 0)
+	{
+		//function type, then 1, 3, 4, 5 or 7 s15Fixed16 parameters: g, a, b, c, d, e, f
+		static const int parameter_counts[5] = {1, 3, 4, 5, 7};
+		int function = (tag[8] << 8) | tag[9];
+		if (function > 4 || size < 12 + 4 * (uint32_t)parameter_counts[function])
+		{
+			return 0;
+		}
+
+		double parameters[7] = {0};
+		for (int i = 0; i < parameter_counts[function]; i++)
+		{
+			parameters[i] = (int32_t)read_u32(tag + 12 + 4 * i) / 65536.0;
+		}
+
+		//every type is the general one (type 4) with some parameters fixed. the linear part below d is only in 3 and 4
+		curve->type = CURVE_PARAMETRIC;
+		curve->g = parameters[0];
+		curve->a = (function == 0) ? 1 : parameters[1];
+		curve->b = parameters[2];
+		switch (function)
+		{
+		case 1:
+		case 2:
+			//(a * x + b) ^ g (+ c) from -b / a on, 0 (or c) below
+			curve->d = (curve->a != 0) ? -curve->b / curve->a : 0;
+			curve->e = (function == 2) ? parameters[3] : 0;
+			curve->f = curve->e;
+			break;
+
+		case 3:
+		case 4:
+			curve->c = parameters[3];
+			curve->d = parameters[4];
+			curve->e = parameters[5];
+			curve->f = parameters[6];
+			break;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+//read an XYZ tag (three s15Fixed16 numbers). 1 is success, 0 if it is missing or invalid
+static int icc_xyz(const uint8_t* profile, uint64_t length, const char* signature, double* xyz)
+{
+	uint32_t size;
+	const uint8_t* tag = icc_tag(profile, length, signature, &size);
+	if (tag == NULL || size < 20 || memcmp(tag, "XYZ ", 4) != 0)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		xyz[i] = (int32_t)read_u32(tag + 8 + 4 * i) / 65536.0;
+	}
+	return 1;
+}
+
+//find a tag in the tag table. NULL if it isn't there or doesn't fit in the profile
+static const uint8_t* icc_tag(const uint8_t* profile, uint64_t length, const char* signature, uint32_t* size)
+{
+	uint32_t count = read_u32(profile + 128);
+	for (uint64_t i = 0; i < count && 132 + i * 12 + 12 <= length; i++)
+	{
+		const uint8_t* entry = profile + 132 + i * 12;
+		uint32_t offset = read_u32(entry + 4);
+		*size = read_u32(entry + 8);
+		if (memcmp(entry, signature, 4) == 0)
+		{
+			return (offset <= length && *size <= length - offset) ? profile + offset : NULL;
+		}
+	}
+	return NULL;
+}
+
+//linear light of the encoded value x (both 0-1)
+static double curve_value(const transfer_curve* curve, double x)
+{
+	switch (curve->type)
+	{
+	case CURVE_SRGB:
+		return (x <= 0.04045) ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4);
+
+	case CURVE_PARAMETRIC:
+	{
+		if (x < curve->d)
+		{
+			return curve->c * x + curve->f;
+		}
+		double base = curve->a * x + curve->b;
+		return ((base > 0) ? pow(base, curve->g) : 0) + curve->e;
+	}
+
+	case CURVE_TABLE:
+	{
+		//linear interpolation between the two closest points
+		double position = x * (curve->count - 1);
+		uint32_t below = (uint32_t)position;
+		if (below >= curve->count - 1)
+		{
+			below = curve->count - 2;
+		}
+		double low = ((curve->table[below * 2] << 8) | curve->table[below * 2 + 1]) / 65535.0;
+		double high = ((curve->table[below * 2 + 2] << 8) | curve->table[below * 2 + 3]) / 65535.0;
+		return low + (high - low) * (position - below);
+	}
+
+	default:
+		return x;
+	}
+}
+
+//sRGB encoding of linear light (both 0-1)
+static double srgb_encode(double linear)
+{
+	return (linear <= 0.0031308) ? linear * 12.92 : 1.055 * pow(linear, 1 / 2.4) - 0.055;
+}
+
+//x ^ gamma
+static void gamma_curve(transfer_curve* curve, double gamma)
+{
+	memset(curve, 0, sizeof(transfer_curve));
+	curve->type = CURVE_PARAMETRIC;
+	curve->g = gamma;
+	curve->a = 1;
+}
+
+//RGB to XYZ matrix of a color space from the xy of its red, green and blue primaries and white point (in that order),
+//scaled so white has Y = 1. 0 if the primaries don't span a color space
+static int primaries_to_xyz(const double* xy, double* matrix)
+{
+	double primaries[9];
+	for (int c = 0; c < 3; c++)
+	{
+		double xyz[3];
+		if (xy[c * 2 + 1] <= 0)
+		{
+			return 0;
+		}
+		xy_to_xyz(xy[c * 2], xy[c * 2 + 1], xyz);
+		primaries[c] = xyz[0];
+		primaries[3 + c] = xyz[1];
+		primaries[6 + c] = xyz[2];
+	}
+
+	double inverse[9];
+	double white[3];
+	double scale[3];
+	if (xy[7] <= 0 || !invert(primaries, inverse))
+	{
+		return 0;
+	}
+	xy_to_xyz(xy[6], xy[7], white);
+	multiply_vector(inverse, white, scale);
+
+	for (int row = 0; row < 3; row++)
+	{
+		for (int column = 0; column < 3; column++)
+		{
+			matrix[row * 3 + column] = primaries[row * 3 + column] * scale[column];
+		}
+	}
+	return 1;
+}
+
+//XYZ with Y = 1 of chromaticity x, y
+static void xy_to_xyz(double x, double y, double* xyz)
+{
+	xyz[0] = x / y;
+	xyz[1] = 1;
+	xyz[2] = (1 - x - y) / y;
+}
+
+//bradford chromatic adaptation from one white point (XYZ) to another
+static void adapt_white(const double* from, const double* to, double* matrix)
+{
+	static const double bradford[9] = {0.8951, 0.2664, -0.1614, -0.7502, 1.7135, 0.0367, 0.0389, -0.0685, 1.0296};
+	double inverse[9];
+	invert(bradford, inverse);
+
+	double cone_from[3];
+	double cone_to[3];
+	multiply_vector(bradford, from, cone_from);
+	multiply_vector(bradford, to, cone_to);
+
+	double scale[9] = {0};
+	for (int c = 0; c < 3; c++)
+	{
+		scale[c * 4] = cone_to[c] / cone_from[c];
+	}
+
+	double scaled[9];
+	multiply(scale, bradford, scaled);
+	multiply(inverse, scaled, matrix);
+}
+
+static void multiply(const double* left, const double* right, double* output)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		for (int column = 0; column < 3; column++)
+		{
+			output[row * 3 + column] = left[row * 3] * right[column] + left[row * 3 + 1] * right[3 + column] + left[row * 3 + 2] * right[6 + column];
+		}
+	}
+}
+
+static void multiply_vector(const double* matrix, const double* vector, double* output)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		output[row] = matrix[row * 3] * vector[0] + matrix[row * 3 + 1] * vector[1] + matrix[row * 3 + 2] * vector[2];
+	}
+}
+
+//1 is success, 0 if the matrix is singular
+static int invert(const double* matrix, double* output)
+{
+	const double* m = matrix;
+	double cofactors[9] = {
+		m[4] * m[8] - m[5] * m[7], m[2] * m[7] - m[1] * m[8], m[1] * m[5] - m[2] * m[4],
+		m[5] * m[6] - m[3] * m[8], m[0] * m[8] - m[2] * m[6], m[2] * m[3] - m[0] * m[5],
+		m[3] * m[7] - m[4] * m[6], m[1] * m[6] - m[0] * m[7], m[0] * m[4] - m[1] * m[3]
+	};
+	double determinant = m[0] * cofactors[0] + m[1] * cofactors[3] + m[2] * cofactors[6];
+	if (fabs(determinant) < 1e-12)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < 9; i++)
+	{
+		output[i] = cofactors[i] / determinant;
+	}
+	return 1;
+}
+
+//fill the tables of transform from the curves of the image and its RGB to XYZ matrix, whose white is white
+static void build_tables(color_transform* transform, const transfer_curve* curves, const double* to_xyz, const double* white)
+{
+	//image RGB -> XYZ -> adapted to D65 -> sRGB
+	double srgb_to_xyz[9];
+	double xyz_to_srgb[9];
+	double srgb_white[3];
+	double adapt[9];
+	double adapted[9];
+	double mix[9];
+	primaries_to_xyz(srgb_primaries, srgb_to_xyz);
+	invert(srgb_to_xyz, xyz_to_srgb);
+	xy_to_xyz(srgb_primaries[6], srgb_primaries[7], srgb_white);
+	adapt_white(white, srgb_white, adapt);
+	multiply(adapt, to_xyz, adapted);
+	multiply(xyz_to_srgb, adapted, mix);
+
+	//sRGB primaries (an sRGB icc profile, or cHRM with the usual numbers) leave the channels apart
+	int separate = 1;
+	for (int i = 0; i < 9; i++)
+	{
+		double expected = (i % 4 == 0) ? 1 : 0;
+		if (fabs(mix[i] - expected) > 1.0 / 1024)
+		{
+			separate = 0;
+		}
+	}
+
+	if (separate)
+	{
+		int identity = 1;
+		for (int c = 0; c < 3; c++)
+		{
+			for (int value = 0; value < 256; value++)
+			{
+				double linear = curve_value(&curves[c], value / 255.0);
+				linear = (linear < 0) ? 0 : ((linear > 1) ? 1 : linear);
+				transform->curves[c][value] = (uint8_t)lround(srgb_encode(linear) * 255);
+				identity = identity && transform->curves[c][value] == value;
+			}
+		}
+		transform->kind = identity ? COLOR_IDENTITY : COLOR_CURVES;
+		return;
+	}
+
+	transform->kind = COLOR_MATRIX;
+	for (int c = 0; c < 3; c++)
+	{
+		for (int value = 0; value < 256; value++)
+		{
+			double linear = curve_value(&curves[c], value / 255.0);
+			linear = (linear < 0) ? 0 : ((linear > 1) ? 1 : linear);
+			transform->linear[c][value] = (uint16_t)lround(linear * COLOR_LINEAR_MAX);
+		}
+	}
+
+	//coefficients past 8 only come from broken chunks. keeping them small keeps the sums of apply_color in 32 bits
+	for (int i = 0; i < 9; i++)
+	{
+		double coefficient = (mix[i] > 8) ? 8 : ((mix[i] < -8) ? -8 : mix[i]);
+		transform->matrix[i] = (int32_t)lround(coefficient * (1 << COLOR_MATRIX_BITS));
+	}
+	for (int i = 0; i <= COLOR_LINEAR_MAX; i++)
+	{
+		transform->encode[i] = (uint8_t)lround(srgb_encode((double)i / COLOR_LINEAR_MAX) * 255);
+	}
+}
+
+//numbers in chunks and icc profiles are big endian
+static uint32_t read_u32(const uint8_t* data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
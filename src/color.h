@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+
+//linear light is kept as a fixed point fraction with this many bits between the two tables of a matrix transform.
+//that's enough for every 8-bit sRGB value (even the darkest) to come back out where it went in
+#define COLOR_LINEAR_BITS 14
+#define COLOR_LINEAR_MAX (1 << COLOR_LINEAR_BITS)
+
+//fraction bits of the matrix coefficients
+#define COLOR_MATRIX_BITS 12
+
+//which chunk the colors of a png were taken from
+typedef enum Color_source
+{
+	//no color chunks (or none that could be used), the image is taken to be sRGB already
+	COLOR_FROM_NONE = 0,
+	COLOR_FROM_SRGB = 1,
+	COLOR_FROM_ICC = 2,
+
+	//gAMA, cHRM or both
+	COLOR_FROM_GAMMA = 3
+}color_source;
+
+typedef enum Color_kind
+{
+	//the image is sRGB already
+	COLOR_IDENTITY = 0,
+
+	//every channel on its own: one 256 entry table each (gAMA alone, or primaries that are sRGB's)
+	COLOR_CURVES = 1,
+
+	//other primaries mix the channels: each one goes through a table to linear light, then through the matrix,
+	//then through one table back to sRGB
+	COLOR_MATRIX = 2
+}color_kind;
+
+//what it takes to bring the colors of a png to sRGB, worked out once per image. alpha is never touched
+typedef struct Color_transform
+{
+	color_source source;
+	color_kind kind;
+
+	//COLOR_CURVES
+	uint8_t curves[3][256];
+
+	//COLOR_MATRIX. linear values go from 0 to COLOR_LINEAR_MAX, rows of the matrix give red, green and blue
+	uint16_t linear[3][256];
+	int32_t matrix[9];
+	uint8_t encode[COLOR_LINEAR_MAX + 1];
+}color_transform;
+
+//build the transform for the last decode from its chunks (only the index is needed, so this works after
+//decoder_read_info too). iCCP comes first, then sRGB, then gAMA and cHRM, like the png spec asks. icc profiles
+//have to be RGB matrix/TRC ones, anything else (and chunks that are invalid) is skipped for the next chunk in line
+void build_color_transform(png_decoder* decoder, color_transform* transform);
+
+//correct pixel_count RGB or RGBA pixels from input into output (which may be input)
+void apply_color(const color_transform* transform, const uint8_t* input, uint8_t* output, uint64_t pixel_count, uint8_t bytes_per_pixel);
+
+const char* color_source_name(color_source source);
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "thread_pool.h"
+
+//images with more pixel bytes than this are compressed in fixed size strips on every core
+#define CORPUS_STRIP_IMAGE (4 << 20)
+#define CORPUS_STRIP_BYTES (1 << 20)
+
+static const int corpus_sizes[] = {16, 64, 256, 1024, 4096, 16384};
+static const char* filter_names[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+static const char* mode_names[] = {"stored", "fixed", "dynamic"};
+
+static int add_entry(corpus_entry* entries, int count, int max_count, corpus_content content, int size, uint8_t bytes_per_pixel, encode_mode mode, uint8_t filter, uint32_t idat_size);
+static void photo_pixels(uint8_t* pixels, int size, uint8_t bytes_per_pixel, uint32_t seed);
+static void flat_pixels(uint8_t* pixels, int size, uint8_t bytes_per_pixel, uint32_t seed);
+static uint32_t next_random(uint32_t* state);
+static uint32_t hash_name(const char* name);
+
+int corpus_entries(int max_size, corpus_entry* entries, int max_count)
+{
+	uint32_t default_idat = default_encode_options().idat_size;
+	int count = 0;
+
+	//every size gets photo and flat content in both color types
+	for (int i = 0; i < sizeof(corpus_sizes) / sizeof(corpus_sizes[0]); i++)
+	{
+		int size = corpus_sizes[i];
+		if (size > max_size)
+		{
+			break;
+		}
+
+		count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 3, ENCODE_DYNAMIC, FILTER_ADAPTIVE, default_idat);
+		count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 4, ENCODE_DYNAMIC, FILTER_ADAPTIVE, default_idat);
+		count = add_entry(entries, count, max_count, CONTENT_FLAT, size, 3, ENCODE_DYNAMIC, FILTER_ADAPTIVE, default_idat);
+		count = add_entry(entries, count, max_count, CONTENT_FLAT, size, 4, ENCODE_DYNAMIC, FILTER_ADAPTIVE, default_idat);
+	}
+
+	//the rest are mid sized images that each exercise one decoder path
+	int size = 512;
+	if (size > max_size)
+	{
+		return count;
+	}
+
+	//every filter type on its own
+	for (uint8_t filter = FILTER_NONE; filter <= FILTER_PAETH; filter++)
+	{
+		count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 3, ENCODE_DYNAMIC, filter, default_idat);
+		count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 4, ENCODE_DYNAMIC, filter, default_idat);
+	}
+
+	//stored and fixed huffman blocks only (dynamic mode mixes all three block types)
+	count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 3, ENCODE_STORED, FILTER_ADAPTIVE, default_idat);
+	count = add_entry(entries, count, max_count, CONTENT_FLAT, size, 4, ENCODE_STORED, FILTER_ADAPTIVE, default_idat);
+	count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 3, ENCODE_FAST, FILTER_ADAPTIVE, default_idat);
+	count = add_entry(entries, count, max_count, CONTENT_FLAT, size, 4, ENCODE_FAST, FILTER_ADAPTIVE, default_idat);
+
+	//compressed data split over many IDAT chunks
+	count = add_entry(entries, count, max_count, CONTENT_PHOTO, size, 4, ENCODE_DYNAMIC, FILTER_ADAPTIVE, 4096);
+	count = add_entry(entries, count, max_count, CONTENT_FLAT, size, 3, ENCODE_DYNAMIC, FILTER_ADAPTIVE, 256);
+
+	return count;
+}
+
+static int add_entry(corpus_entry* entries, int count, int max_count, corpus_content content, int size, uint8_t bytes_per_pixel, encode_mode mode, uint8_t filter, uint32_t idat_size)
+{
+	if (count >= max_count)
+	{
+		return count;
+	}
+
+	corpus_entry* entry = &entries[count];
+	entry->content = content;
+	entry->size = size;
+	entry->bytes_per_pixel = bytes_per_pixel;
+	entry->mode = mode;
+	entry->filter = filter;
+	entry->idat_size = idat_size;
+
+	return count + 1;
+}
+
+void corpus_name(const corpus_entry* entry, char* output, uint64_t output_size)
+{
+	char idat[32] = "";
+	if (entry->idat_size != default_encode_options().idat_size)
+	{
+		snprintf(idat, sizeof(idat), "_idat%u", entry->idat_size);
+	}
+
+	snprintf(output, output_size, "%s_%s_%s_%s_%dx%d%s.png",
+		entry->content == CONTENT_PHOTO ? "photo" : "flat",
+		entry->bytes_per_pixel == 4 ? "rgba" : "rgb",
+		mode_names[entry->mode],
+		filter_names[entry->filter],
+		entry->size, entry->size, idat);
+}
+
+png* corpus_image(const corpus_entry* entry)
+{
+	uint64_t pixel_bytes = (uint64_t)entry->size * entry->size * entry->bytes_per_pixel;
+
+	png* to_return = calloc(1, sizeof(png));
+	to_return->pixel_data = create_array();
+	if (!array_reserve(to_return->pixel_data, pixel_bytes))
+	{
+		fprintf(stderr, "corpus: unable to allocate %lu bytes of pixels\n", pixel_bytes);
+		return to_return;
+	}
+
+	to_return->w = entry->size;
+	to_return->h = entry->size;
+	to_return->bytes_per_pixel = entry->bytes_per_pixel;
+	to_return->bits_per_pixel = 8;
+	to_return->color_type = (entry->bytes_per_pixel == 4) ? 6 : 2;
+	to_return->pixel_data->count = pixel_bytes;
+
+	//the seed comes from the name so an entry doesn't change when others are added
+	char name[256];
+	corpus_name(entry, name, sizeof(name));
+	uint32_t seed = hash_name(name);
+
+	if (entry->content == CONTENT_PHOTO)
+	{
+		photo_pixels(to_return->pixel_data->data, entry->size, entry->bytes_per_pixel, seed);
+	}
+	else
+	{
+		flat_pixels(to_return->pixel_data->data, entry->size, entry->bytes_per_pixel, seed);
+	}
+
+	to_return->is_valid = 1;
+	return to_return;
+}
+
+int generate_corpus(const char* directory, int max_size)
+{
+	if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "corpus: failed to create directory %s\n", directory);
+		return 0;
+	}
+
+	corpus_entry entries[CORPUS_MAX_ENTRIES];
+	int count = corpus_entries(max_size, entries, CORPUS_MAX_ENTRIES);
+
+	for (int i = 0; i < count; i++)
+	{
+		char name[256];
+		char path[4096];
+		corpus_name(&entries[i], name, sizeof(name));
+		snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+		png* image = corpus_image(&entries[i]);
+		if (!image->is_valid)
+		{
+			free_png(image);
+			return 0;
+		}
+
+		//big images are split into fixed strips so the file doesn't depend on the number of cores
+		encode_options options = default_encode_options();
+		options.mode = entries[i].mode;
+		options.filter = entries[i].filter;
+		options.idat_size = entries[i].idat_size;
+		uint64_t row_size = (uint64_t)image->w * image->bytes_per_pixel + 1;
+		if (row_size * image->h > CORPUS_STRIP_IMAGE)
+		{
+			options.threads = core_count();
+			options.strip_rows = CORPUS_STRIP_BYTES / row_size;
+		}
+
+		fprintf(stderr, "corpus: writing %s\n", path);
+		int written = write_png(image, path, &options);
+		free_png(image);
+
+		if (!written)
+		{
+			fprintf(stderr, "corpus: failed to write %s\n", path);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+//value noise (random values on a coarse grid, blended between grid points) plus a little grain
+static void photo_pixels(uint8_t* pixels, int size, uint8_t bytes_per_pixel, uint32_t seed)
+{
+	int cell = (size < 256) ? 8 : 64;
+	int grid_w = size / cell + 2;
+
+	uint8_t* grid = malloc((uint64_t)grid_w * grid_w * bytes_per_pixel);
+	for (uint64_t i = 0; i < (uint64_t)grid_w * grid_w * bytes_per_pixel; i++)
+	{
+		grid[i] = next_random(&seed);
+	}
+
+	for (int y = 0; y < size; y++)
+	{
+		int gy = y / cell;
+		int fy = y % cell;
+		uint8_t* row = pixels + (uint64_t)y * size * bytes_per_pixel;
+
+		for (int x = 0; x < size; x++)
+		{
+			int gx = x / cell;
+			int fx = x % cell;
+			uint32_t grain = next_random(&seed);
+
+			for (int c = 0; c < bytes_per_pixel; c++)
+			{
+				int32_t a = grid[((uint64_t)gy * grid_w + gx) * bytes_per_pixel + c];
+				int32_t b = grid[((uint64_t)gy * grid_w + gx + 1) * bytes_per_pixel + c];
+				int32_t d = grid[((uint64_t)(gy + 1) * grid_w + gx) * bytes_per_pixel + c];
+				int32_t e = grid[((uint64_t)(gy + 1) * grid_w + gx + 1) * bytes_per_pixel + c];
+
+				int32_t value = (a * (cell - fx) * (cell - fy) + b * fx * (cell - fy) + d * (cell - fx) * fy + e * fx * fy) / (cell * cell);
+
+				//alpha is kept mostly opaque and smooth, color channels get 3 bits of grain
+				if (c == 3)
+				{
+					value = 128 + value / 2;
+				}
+				else
+				{
+					value += (int32_t)((grain >> (c * 3)) & 7) - 3;
+				}
+
+				if (value < 0)
+				{
+					value = 0;
+				}
+				if (value > 255)
+				{
+					value = 255;
+				}
+				row[x * bytes_per_pixel + c] = value;
+			}
+		}
+	}
+
+	free(grid);
+}
+
+//a background with solid (sometimes translucent) rectangles drawn over it
+static void flat_pixels(uint8_t* pixels, int size, uint8_t bytes_per_pixel, uint32_t seed)
+{
+	uint8_t color[4];
+	for (int i = 0; i < 24; i++)
+	{
+		uint32_t value = next_random(&seed);
+		color[0] = value;
+		color[1] = value >> 8;
+		color[2] = value >> 16;
+		color[3] = ((value >> 24) & 3) == 0 ? (value >> 24) : 255;
+
+		//the first rectangle is the background
+		int x0 = 0;
+		int y0 = 0;
+		int w = size;
+		int h = size;
+		if (i > 0)
+		{
+			x0 = next_random(&seed) % size;
+			y0 = next_random(&seed) % size;
+			w = 1 + next_random(&seed) % (size / 2 + 1);
+			h = 1 + next_random(&seed) % (size / 2 + 1);
+			if (x0 + w > size)
+			{
+				w = size - x0;
+			}
+			if (y0 + h > size)
+			{
+				h = size - y0;
+			}
+		}
+
+		for (int y = y0; y < y0 + h; y++)
+		{
+			uint8_t* row = pixels + ((uint64_t)y * size + x0) * bytes_per_pixel;
+			for (int x = 0; x < w; x++)
+			{
+				memcpy(row + x * bytes_per_pixel, color, bytes_per_pixel);
+			}
+		}
+	}
+}
+
+//xorshift32
+static uint32_t next_random(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+//fnv-1a (never 0, which xorshift can't start from)
+static uint32_t hash_name(const char* name)
+{
+	uint32_t to_return = 2166136261u;
+	for (const char* cur = name; *cur != 0; cur++)
+	{
+		to_return ^= (uint8_t)*cur;
+		to_return *= 16777619u;
+	}
+
+	return to_return != 0 ? to_return : 1;
+}
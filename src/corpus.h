@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+#include "png_encoder.h"
+
+//deterministic test images for the benchmarks. the same entry always produces the same pixels and file
+
+//largest image generated unless asked for more (a 16k x 16k RGBA image is 1GB of pixels)
+#define CORPUS_DEFAULT_MAX_SIZE 4096
+#define CORPUS_MAX_ENTRIES 64
+
+typedef enum Corpus_content
+{
+	//smooth noise with a little grain, compresses like a photo
+	CONTENT_PHOTO = 0,
+
+	//solid rectangles on a background, compresses like a screenshot
+	CONTENT_FLAT = 1
+}corpus_content;
+
+typedef struct Corpus_entry
+{
+	corpus_content content;
+
+	//images are square
+	int size;
+	uint8_t bytes_per_pixel;
+
+	//how the image is written (mode picks stored/fixed/dynamic blocks)
+	encode_mode mode;
+	uint8_t filter;
+	uint32_t idat_size;
+}corpus_entry;
+
+//fill entries with every image up to max_size pixels wide. returns the number of entries
+int corpus_entries(int max_size, corpus_entry* entries, int max_count);
+
+//file name for an entry, e.g. photo_rgba_dynamic_adaptive_1024x1024.png
+void corpus_name(const corpus_entry* entry, char* output, uint64_t output_size);
+
+//pixels for an entry (free with free_png)
+png* corpus_image(const corpus_entry* entry);
+
+//write every entry up to max_size into directory. 1 is success, 0 is failure
+int generate_corpus(const char* directory, int max_size);
@@ -0,0 +1,89 @@
+#include "decode_stats.h"
+
+static const char* block_names[] = {"stored", "fixed", "dynamic"};
+static const char* filter_names[] = {"none", "sub", "up", "average", "paeth"};
+
+static double milliseconds(uint64_t nanoseconds)
+{
+	return nanoseconds / 1e6;
+}
+
+static void print_text(const decode_stats* stats, FILE* output)
+{
+	fprintf(output, "stats: total    %10.3f ms\n", milliseconds(stats->total_nanoseconds));
+	fprintf(output, "stats: read     %10.3f ms  %lu bytes\n", milliseconds(stats->read_nanoseconds), stats->file_bytes);
+	fprintf(output, "stats: chunks   %10.3f ms  %lu chunks\n", milliseconds(stats->chunk_nanoseconds), stats->chunks);
+	fprintf(output, "stats: idat     %10.3f ms  %lu chunks, %lu bytes\n", milliseconds(stats->idat_nanoseconds), stats->idat_chunks, stats->idat_bytes);
+
+	for (int i = 0; i < 3; i++)
+	{
+		const block_stats* block = &stats->blocks[i];
+		if (block->blocks == 0)
+		{
+			continue;
+		}
+		fprintf(output, "stats: %-8s %10.3f ms  %lu blocks, %lu bytes in, %lu bytes out, %lu literals, %lu matches (%lu bytes)\n",
+			block_names[i], milliseconds(block->nanoseconds), block->blocks, block->bits_in / 8, block->bytes_out,
+			block->literals, block->matches, block->match_bytes);
+	}
+
+	uint64_t lookups = stats->table_cache_hits + stats->table_cache_misses;
+	fprintf(output, "stats: trees    %10.3f ms  %lu trees, tables of %lu of %lu dynamic blocks reused (%.1f%%)\n",
+		milliseconds(stats->tree_nanoseconds), stats->trees_built, stats->table_cache_hits, lookups,
+		lookups > 0 ? 100.0 * stats->table_cache_hits / lookups : 0.0);
+	fprintf(output, "stats: filter   %10.3f ms  rows:", milliseconds(stats->filter_nanoseconds));
+	for (int i = 0; i < 5; i++)
+	{
+		fprintf(output, " %s %lu", filter_names[i], stats->filter_rows[i]);
+	}
+	fprintf(output, "\n");
+	fprintf(output, "stats: buffers  %lu reallocations, %lu bytes copied, %lu bytes held\n", stats->reallocations, stats->bytes_copied, stats->buffer_bytes);
+	fprintf(output, "stats: output   %10.3f ms  %lu bytes\n", milliseconds(stats->output_nanoseconds), stats->output_bytes);
+}
+
+static void print_json(const decode_stats* stats, FILE* output)
+{
+	fprintf(output, "{\"total_ns\":%lu,", stats->total_nanoseconds);
+	fprintf(output, "\"read\":{\"ns\":%lu,\"bytes\":%lu},", stats->read_nanoseconds, stats->file_bytes);
+	fprintf(output, "\"chunks\":{\"ns\":%lu,\"count\":%lu},", stats->chunk_nanoseconds, stats->chunks);
+	fprintf(output, "\"idat\":{\"ns\":%lu,\"chunks\":%lu,\"bytes\":%lu},", stats->idat_nanoseconds, stats->idat_chunks, stats->idat_bytes);
+
+	fprintf(output, "\"blocks\":{");
+	for (int i = 0; i < 3; i++)
+	{
+		const block_stats* block = &stats->blocks[i];
+		fprintf(output, "%s\"%s\":{\"ns\":%lu,\"count\":%lu,\"bits_in\":%lu,\"bytes_out\":%lu,\"literals\":%lu,\"matches\":%lu,\"match_bytes\":%lu}",
+			i > 0 ? "," : "", block_names[i], block->nanoseconds, block->blocks, block->bits_in, block->bytes_out,
+			block->literals, block->matches, block->match_bytes);
+	}
+	fprintf(output, "},");
+
+	fprintf(output, "\"trees\":{\"ns\":%lu,\"count\":%lu,\"cache_hits\":%lu,\"cache_misses\":%lu},",
+		stats->tree_nanoseconds, stats->trees_built, stats->table_cache_hits, stats->table_cache_misses);
+	fprintf(output, "\"filter\":{\"ns\":%lu,\"rows\":{", stats->filter_nanoseconds);
+	for (int i = 0; i < 5; i++)
+	{
+		fprintf(output, "%s\"%s\":%lu", i > 0 ? "," : "", filter_names[i], stats->filter_rows[i]);
+	}
+	fprintf(output, "}},");
+	fprintf(output, "\"buffers\":{\"reallocations\":%lu,\"bytes_copied\":%lu,\"bytes_held\":%lu},", stats->reallocations, stats->bytes_copied, stats->buffer_bytes);
+	fprintf(output, "\"output\":{\"ns\":%lu,\"bytes\":%lu}}\n", stats->output_nanoseconds, stats->output_bytes);
+}
+
+void print_stats(const decode_stats* stats, FILE* output, int json)
+{
+	if (!STATS_ENABLED)
+	{
+		fprintf(output, "stats: not collected (build with -DPNG_STATS=ON)\n");
+		return;
+	}
+
+	if (json)
+	{
+		print_json(stats, output);
+	}
+	else
+	{
+		print_text(stats, output);
+	}
+}
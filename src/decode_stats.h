@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+//per-stage timings and counters for one decode. collected when built with PNG_STATS defined,
+//otherwise every STATS_ macro below expands to nothing and the struct stays zeroed
+
+//counters for one kind of deflate block (index is the block type: 0 stored, 1 fixed, 2 dynamic)
+typedef struct Block_stats
+{
+	uint64_t blocks;
+	uint64_t bits_in;
+	uint64_t bytes_out;
+	uint64_t literals;
+	uint64_t matches;
+	uint64_t match_bytes;
+	uint64_t nanoseconds;
+}block_stats;
+
+typedef struct Decode_stats
+{
+	//whole decode, from opening the file to the last unfiltered row
+	uint64_t total_nanoseconds;
+
+	//reading the file into memory
+	uint64_t file_bytes;
+	uint64_t read_nanoseconds;
+
+	//walking the chunks (not counting the time spent copying IDAT data)
+	uint64_t chunks;
+	uint64_t chunk_nanoseconds;
+
+	//gathering IDAT data into one buffer
+	uint64_t idat_chunks;
+	uint64_t idat_bytes;
+	uint64_t idat_nanoseconds;
+
+	//inflate, split by block type. dynamic block time includes building their trees
+	block_stats blocks[3];
+
+	//huffman trees built for dynamic blocks (code length, literal and distance trees)
+	uint64_t trees_built;
+	uint64_t tree_nanoseconds;
+
+	//dynamic blocks whose literal and distance tables were found in the decoder's cache, and the ones that built them
+	uint64_t table_cache_hits;
+	uint64_t table_cache_misses;
+
+	//unfiltering, with the number of rows that used each filter type
+	uint64_t filter_rows[5];
+	uint64_t filter_nanoseconds;
+
+	//times the decoder's buffers had to be reallocated and the bytes moved by it (0 once the decoder is warm)
+	uint64_t reallocations;
+	uint64_t bytes_copied;
+
+	//bytes the decoder's buffers hold after the decode. they only grow, so for a new decoder that's their peak
+	uint64_t buffer_bytes;
+
+	//filled in by whoever writes the decoded image out
+	uint64_t output_bytes;
+	uint64_t output_nanoseconds;
+}decode_stats;
+
+#ifdef PNG_STATS
+
+#define STATS_ENABLED 1
+
+//start a timer
+#define STATS_NOW(name) uint64_t name = stats_now()
+
+//add value to a counter
+#define STATS_ADD(stats, field, value) ((stats)->field += (value))
+
+//add the time since a timer was started
+#define STATS_ELAPSED(stats, field, start) ((stats)->field += stats_now() - (start))
+
+//code that only exists to feed the stats (no commas outside of parentheses)
+#define STATS_ONLY(code) code
+
+#else
+
+#define STATS_ENABLED 0
+#define STATS_NOW(name)
+#define STATS_ADD(stats, field, value)
+#define STATS_ELAPSED(stats, field, start)
+#define STATS_ONLY(code)
+
+#endif
+
+static inline uint64_t stats_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//print stats as readable text or as a single JSON object
+void print_stats(const decode_stats* stats, FILE* output, int json);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+//lookup tables shared by the inflate (png.c) and deflate (png_encoder.c) sides
+
+//symbols 257-285 (lengths)
+extern const uint32_t length_values[29];
+extern const uint32_t length_extra_bits[29];
+
+//distance codes 0-29
+extern const uint32_t distance_values[30];
+extern const uint32_t distance_extra_bits[30];
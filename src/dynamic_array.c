@@ -1,144 +1,136 @@
 #include "dynamic_array.h"
 
-static int expand_array(dynamic_array* to_expand, uint64_t count);
+static int expand_array(dynamic_array* to_expand, uint64_t capacity);
 
-//initialize new array
+//initialize new array (nothing is allocated until the first byte is stored)
 dynamic_array* create_array()
 {
-	dynamic_array* to_return = calloc(1, sizeof(dynamic_array));
+	return create_array_using(NULL);
+}
 
-	to_return->data = calloc(25, 1);
-	to_return->max_size = 25;
+//the hooks are copied, so only their user pointer has to outlive the array
+dynamic_array* create_array_using(const mem_allocator* allocator)
+{
+	dynamic_array* to_return = mem_calloc(allocator, sizeof(dynamic_array));
+	if(to_return != NULL && allocator != NULL)
+	{
+		to_return->allocator = *allocator;
+	}
 
-	to_return->bit_position = 0;
-	to_return->byte_position = 0;
 	return to_return;
 }
 
 //add items to array(auto expands when necessary)
-void array_add(dynamic_array* arr, void* data, uint64_t count)
+int array_add(dynamic_array* arr, const void* data, uint64_t count)
 {
-	uint64_t free_slots = (arr->max_size - arr->count);
-
-	//check if array needs to be expanded
-	if(count > free_slots)
+	if(count > arr->capacity - arr->count && !array_grow(arr, count))
 	{
-		//check for failure in array resize
-		if(!expand_array(arr, (arr->max_size + count + 10000)))
-		{
-			fprintf(stderr, "dynamic_array: unable to allocate new memory. data copy of size %lu has been aborted\n", count);
-			return;
-		}
+		fprintf(stderr, "dynamic_array: unable to allocate new memory. data copy of size %lu has been aborted\n", count);
+		return 0;
 	}
 
 	memcpy(arr->data + arr->count, data, count);
 	arr->count += count;
+	return 1;
 }
 
-void push_byte(dynamic_array* arr, uint8_t data)
+//capacity doubles (at least) so appending n bytes costs O(n) copies in total
+int array_grow(dynamic_array* arr, uint64_t extra)
 {
-	uint64_t free_slots = (arr->max_size - arr->count);
-
-	//check if array needs to be expanded
-	if(free_slots < 1)
+	if(extra > UINT64_MAX - arr->count)
 	{
-		//check for failure in array resize
-		if(!expand_array(arr, (arr->max_size + 10000)))
-		{
-			fprintf(stderr, "dynamic_array: unable to allocate new memory. data copy of size %d has been aborted\n", 1);
-			return;
-		}
+		return 0;
 	}
 
-	memcpy(arr->data + arr->count, &data, 1);
-	arr->count++;
-}
+	uint64_t needed = arr->count + extra;
+	if(needed <= arr->capacity)
+	{
+		return 1;
+	}
 
-//attempt to resize the array. 0 is failure, 1 is success
-static int expand_array(dynamic_array* to_expand, uint64_t count)
-{
-	uint8_t* temp = realloc(to_expand->data, count);
-	if(temp == NULL)
+	uint64_t capacity = (arr->capacity < ARRAY_MIN_CAPACITY) ? ARRAY_MIN_CAPACITY : arr->capacity;
+	while(capacity < needed)
 	{
-		return 0;
+		capacity = (capacity > UINT64_MAX / 2) ? needed : capacity * 2;
 	}
 
-	to_expand->data = temp;
-	to_expand->max_size = count;
-	return 1;
+	return expand_array(arr, capacity);
 }
 
-//free all dynamically allocated memory (avoiding double free())
-void free_array(dynamic_array* to_free)
+int array_reserve(dynamic_array* arr, uint64_t capacity)
 {
-	if(to_free != NULL)
+	if(capacity <= arr->capacity)
 	{
-		if(to_free->data != NULL)
-		{
-			free(to_free->data);
-		}
-		free(to_free);
+		return 1;
 	}
-	
+
+	return expand_array(arr, capacity);
 }
 
-//return pointer to element at index
-uint8_t array_get(dynamic_array* arr, uint64_t index)
+int array_resize(dynamic_array* arr, uint64_t count)
 {
-	if(index > arr->max_size)
+	if(count > arr->capacity && !array_grow(arr, count - arr->count))
 	{
-		fprintf(stderr, "dynamic array: Unable to fetch index: %lu. Max index is: %lu. First element has been returned.\n", index, arr->max_size);
-		return *(arr->data);
+		return 0;
 	}
 
-	return *(arr->data + index);
+	arr->count = count;
+	return 1;
+}
+
+void array_clear(dynamic_array* arr)
+{
+	arr->count = 0;
 }
 
-//pull a single bit out of the bit stream. keeps track of position
-char pull_bit(dynamic_array* to_pull)
+//attempt to resize the array. 0 is failure, 1 is success
+static int expand_array(dynamic_array* to_expand, uint64_t capacity)
 {
-	uint8_t data = array_get(to_pull, to_pull->byte_position);
-	uint8_t to_and = 1;
-	to_and <<= (to_pull->bit_position);
+	if(capacity > SIZE_MAX)
+	{
+		return 0;
+	}
 
-	//increment bit counter
-	to_pull->bit_position++;
+	uint8_t* old_data = to_expand->data;
+	uint8_t* temp = mem_realloc(&to_expand->allocator, to_expand->data, to_expand->capacity, capacity);
+	if(temp == NULL)
+	{
+		return 0;
+	}
 
-	//move to the next boundry once the end of the byte is reached
-	if(to_pull->bit_position == 8)
+	if(old_data != NULL)
 	{
-		next_boundry(to_pull);
+		to_expand->reallocations++;
+		if(temp != old_data)
+		{
+			to_expand->bytes_copied += to_expand->count;
+		}
 	}
 
-	return ((data & to_and) > 0);
+	to_expand->data = temp;
+	to_expand->capacity = capacity;
+	return 1;
 }
 
-//pull length number of bits from the current position in the bit stream
-//original bit order is preserved (for interpretation as a number)
-uint32_t pull_bits(dynamic_array* to_pull, uint8_t length)
+//free all dynamically allocated memory (avoiding double free())
+void free_array(dynamic_array* to_free)
 {
-	uint32_t to_return = 0;
-	uint32_t to_add = 1;
-	to_add <<= (length - 1);
-	for(int i = 0; i < length; i++)
+	if(to_free != NULL)
 	{
-		if(pull_bit(to_pull) > 0)
-		{
-			to_return += to_add;
-		}
-
-		if(i < (length - 1))
-		{
-			to_return >>= 1;
-		}
+		mem_allocator allocator = to_free->allocator;
+		mem_free(&allocator, to_free->data, to_free->capacity);
+		mem_free(&allocator, to_free, sizeof(dynamic_array));
 	}
-
-	return to_return;
 }
 
-//skip the rest of the unread bits in a byte
-void next_boundry(dynamic_array* cur)
+//return element at index
+uint8_t array_get(dynamic_array* arr, uint64_t index)
 {
-	cur->bit_position = 0;
-	cur->byte_position++;
-}
\ No newline at end of file
+	if(index >= arr->count)
+	{
+		fprintf(stderr, "dynamic array: Unable to fetch index: %lu. Array holds %lu bytes. 0 has been returned.\n", index, arr->count);
+		return 0;
+	}
+
+	return arr->data[index];
+}
@@ -6,30 +6,71 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "allocator.h"
+
+//smallest allocation an array grows to
+#define ARRAY_MIN_CAPACITY 64
+
 //only holds arrays of uint8_t(bytes)
 typedef struct Dynamic_array
 {
-	//raw byte pointer to data
+	//raw byte pointer to data (NULL until something is stored)
 	uint8_t* data;
 
-	//information about the number of objects stored in array
+	//bytes in use and bytes allocated
 	uint64_t count;
-	uint64_t max_size;
+	uint64_t capacity;
 
-	//position in the bit stream (for PNG decoding)
-	uint64_t byte_position;
-	uint64_t bit_position;
+	//how often the buffer was reallocated and how many bytes had to move because of it
+	uint64_t reallocations;
+	uint64_t bytes_copied;
 
+	//where data (and the array itself) comes from. zeroed means libc
+	mem_allocator allocator;
 }	dynamic_array;
 
 //generic array functions
 dynamic_array* create_array();
+dynamic_array* create_array_using(const mem_allocator* allocator);
 void free_array(dynamic_array* to_free);
-void array_add(dynamic_array* arr, void* data, uint64_t count);
-void push_byte(dynamic_array* arr, uint8_t data);
+
+//make room for at least capacity bytes without changing the contents (exact size, no extra growth). 1 is success, 0 is failure
+int array_reserve(dynamic_array* arr, uint64_t capacity);
+
+//set count, growing geometrically if needed. bytes past the old count are not initialized. 1 is success, 0 is failure
+int array_resize(dynamic_array* arr, uint64_t count);
+
+//empty the array. the memory is kept for reuse
+void array_clear(dynamic_array* arr);
+
+//append count bytes (grows geometrically). 1 is success, 0 is failure
+int array_add(dynamic_array* arr, const void* data, uint64_t count);
+
+//grow so at least extra more bytes fit. used by the inline functions below. 1 is success, 0 is failure
+int array_grow(dynamic_array* arr, uint64_t extra);
+
+//checked access. out of range reads print an error and return 0
 uint8_t array_get(dynamic_array* arr, uint64_t index);
 
-//helper functions for bit streams
-char pull_bit(dynamic_array* to_pull);
-uint32_t pull_bits(dynamic_array* to_pull, uint8_t length);
-void next_boundry(dynamic_array* cur);
\ No newline at end of file
+//unchecked access for hot loops where the index is already known to be in range
+static inline uint8_t array_at(const dynamic_array* arr, uint64_t index)
+{
+	return arr->data[index];
+}
+
+//append one byte (grows when full)
+static inline void push_byte(dynamic_array* arr, uint8_t data)
+{
+	if(arr->count == arr->capacity && !array_grow(arr, 1))
+	{
+		return;
+	}
+
+	arr->data[arr->count++] = data;
+}
+
+//append one byte without a capacity check (array_reserve first)
+static inline void push_byte_unchecked(dynamic_array* arr, uint8_t data)
+{
+	arr->data[arr->count++] = data;
+}
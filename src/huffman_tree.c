@@ -1,13 +1,27 @@
 #include "huffman_tree.h"
+#include "deflate_tables.h"
 
 //this lookup table is required because the alphabet code lengths are stored in a very strange manner
 static uint32_t alphabet_indexes[] = {3, 17, 15, 13, 11, 9, 7, 5, 4, 6, 8, 10, 12, 14, 16, 18, 0, 1, 2};
 static uint32_t reverse_bits(uint32_t input, uint32_t num_bits);
-static uint32_t* generate_codes(uint32_t* code_lengths, uint32_t num_codes);
+static void generate_codes(uint32_t* code_lengths, uint32_t num_codes, uint32_t* next_code);
+static node* new_node(node_pool* pool);
+static node* reset_pool(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes);
+static void insert_node(node_pool* pool, node* root, uint32_t symbol, uint32_t code, uint32_t code_length);
+static node* build_dynamic_tree(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes);
+static node* build_alphabet(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes);
+static uint32_t table_entry(uint32_t symbol, uint32_t code_length, int alphabet);
+static uint32_t make_entry(uint32_t code_length, uint32_t kind, uint32_t extra_bits, uint32_t value);
 
 //adds a new node to the tree given a code and length
 void add_node(node* root, uint32_t symbol, uint32_t code, uint32_t code_length)
-{	
+{
+	insert_node(NULL, root, symbol, code, code_length);
+}
+
+//nodes come from the pool if there is one, otherwise from malloc
+static void insert_node(node_pool* pool, node* root, uint32_t symbol, uint32_t code, uint32_t code_length)
+{
 	node* cur = root;
 
 	for(int i = 0; i < code_length; i++)
@@ -20,7 +34,7 @@ void add_node(node* root, uint32_t symbol, uint32_t code, uint32_t code_length)
 			}
 			else
 			{
-				cur->right = create_node();
+				cur->right = new_node(pool);
 				cur = cur->right;
 			}
 		}
@@ -33,7 +47,7 @@ void add_node(node* root, uint32_t symbol, uint32_t code, uint32_t code_length)
 			}
 			else
 			{
-				cur->left = create_node();
+				cur->left = new_node(pool);
 				cur = cur->left;
 			}
 		}
@@ -45,31 +59,18 @@ void add_node(node* root, uint32_t symbol, uint32_t code, uint32_t code_length)
 	return;
 }
 
-//traverse one level of a node (does not check if leaf)
-void traverse(node** cur, char bit)
+//traverse one level of a node (does not check if leaf). 1 is success, 0 if the branch doesn't exist
+int traverse(node** cur, char bit)
 {
-	if(bit)
-	{
-		if((*cur)->right != NULL)
-		{
-			*cur = (*cur)->right;
-		}
-		else
-		{
-			fprintf(stderr, "Decoding errors detected - program attempted to access a node that is set to null\n");
-		}
-	}
-	else
+	node* next = bit ? (*cur)->right : (*cur)->left;
+	if(next == NULL)
 	{
-		if((*cur)->left != NULL)
-		{
-			*cur = (*cur)->left;
-		}
-		else
-		{
-			fprintf(stderr, "Decoding errors detected - program attempted to access a node that is set to null\n");
-		}
+		fprintf(stderr, "Decoding errors detected - program attempted to access a node that is set to null\n");
+		return 0;
 	}
+
+	*cur = next;
+	return 1;
 }
 
 //helper function to simplify syntax
@@ -82,6 +83,51 @@ node* create_node()
 	return to_return;
 }
 
+static node* new_node(node_pool* pool)
+{
+	if(pool == NULL)
+	{
+		return create_node();
+	}
+
+	node* to_return = &pool->nodes[pool->count++];
+	memset(to_return, 0, sizeof(node));
+	return to_return;
+}
+
+//empty the pool, make sure it can hold a whole tree for these code lengths and return the root
+//every code adds at most one node per bit, so 1 + the sum of the lengths is always enough
+static node* reset_pool(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes)
+{
+	uint32_t needed = 1;
+	for(uint32_t i = 0; i < num_codes; i++)
+	{
+		needed += code_lengths[i];
+	}
+
+	if(needed > pool->capacity)
+	{
+		node* temp = mem_realloc(&pool->allocator, pool->nodes, pool->capacity * sizeof(node), needed * sizeof(node));
+		if(temp == NULL)
+		{
+			return NULL;
+		}
+		pool->nodes = temp;
+		pool->capacity = needed;
+	}
+
+	pool->count = 0;
+	return new_node(pool);
+}
+
+void free_node_pool(node_pool* pool)
+{
+	mem_free(&pool->allocator, pool->nodes, pool->capacity * sizeof(node));
+	pool->nodes = NULL;
+	pool->count = 0;
+	pool->capacity = 0;
+}
+
 //recursive free (avoids double free())
 void free_tree(node* root)
 {
@@ -168,72 +214,76 @@ static uint32_t reverse_bits(uint32_t input, uint32_t num_bits)
     return to_return;
 }
 
-//traverse tree until symbol is found
-int32_t get_symbol(dynamic_array* cur, node* root)
+//traverse tree until symbol is found. returns -1 if the bits don't lead to a symbol
+int32_t get_symbol(bit_stream* cur, node* root)
 {
 	node* tree = root;
 
 	while(!tree->is_leaf)
 	{
-		traverse(&tree, pull_bit(cur));
+		if(!traverse(&tree, pull_bit(cur)))
+		{
+			return -1;
+		}
 	}
 	return tree->symbol;
 }
 
-//generate the huffman codes given code lengths
-static uint32_t* generate_codes(uint32_t* code_lengths, uint32_t num_codes)
+//generate the starting code for each code length. next_code needs room for MAX_CODE_LENGTH + 1 entries
+static void generate_codes(uint32_t* code_lengths, uint32_t num_codes, uint32_t* next_code)
 {
-	/*count how many of each code lengths we have
-	 *it is presumed that no code length can be over 32 bits in length
-	 *since that would sort of defeat the point of huffman coding*/
-	uint32_t code_max_bits = 32;
-	uint32_t array_max = 0;
-	uint32_t* bl_count = calloc((code_max_bits + 1), sizeof(uint32_t));
-
+	//count how many of each code lengths we have
+	uint32_t bl_count[MAX_CODE_LENGTH + 1] = {0};
 	for(int i = 0; i < num_codes; i++)
 	{
-		if(code_lengths[i] > array_max)
-		{
-			array_max = code_lengths[i];
-		}
-
 		bl_count[code_lengths[i]]++;
 	}
 
 	//find out the numerical value for each starting code
-	uint32_t* next_code = calloc((array_max + 1), sizeof(uint32_t));
 	uint32_t code = 0;
-    bl_count[0] = 0;
-    for (uint32_t bits = 1; bits <= array_max; bits++) 
+	bl_count[0] = 0;
+	next_code[0] = 0;
+	for (uint32_t bits = 1; bits <= MAX_CODE_LENGTH; bits++)
 	{
-        code = (code + bl_count[bits-1]) << 1;
-        next_code[bits] = code;
-    }
-
-	free(bl_count);
-
-	return next_code;
+		code = (code + bl_count[bits-1]) << 1;
+		next_code[bits] = code;
+	}
 }
 
 //make tree given a list of code lengths
 node* create_dynamic_tree(uint32_t* code_lengths, uint32_t num_codes)
 {
-	node* to_return = create_node();
-	uint32_t* next_code = generate_codes(code_lengths, num_codes);
-	
+	return build_dynamic_tree(NULL, code_lengths, num_codes);
+}
+
+node* pool_dynamic_tree(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes)
+{
+	return build_dynamic_tree(pool, code_lengths, num_codes);
+}
+
+static node* build_dynamic_tree(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes)
+{
+	node* to_return = (pool == NULL) ? create_node() : reset_pool(pool, code_lengths, num_codes);
+	if(to_return == NULL)
+	{
+		return NULL;
+	}
+
+	uint32_t next_code[MAX_CODE_LENGTH + 1];
+	generate_codes(code_lengths, num_codes, next_code);
+
 	//assign values to tree
 	for(uint32_t i = 0; i < num_codes; i++)
-	{	
+	{
 		uint32_t length = code_lengths[i];
 
 		//exclude code lengths that are 0
 		if(length > 0)
 		{
-			add_node(to_return, i, reverse_bits(next_code[length], length), length);
+			insert_node(pool, to_return, i, reverse_bits(next_code[length], length), length);
 			next_code[length]++;
 		}
 	}
-	free(next_code);
 
 	return to_return;
 }
@@ -241,8 +291,25 @@ node* create_dynamic_tree(uint32_t* code_lengths, uint32_t num_codes)
 //this has to be a special function because of the strange indexes on the code length alphabet
 node *create_alphabet(uint32_t *code_lengths, uint32_t num_codes)
 {
-	node *to_return = create_node();
-	uint32_t* next_code = generate_codes(code_lengths, num_codes);
+	return build_alphabet(NULL, code_lengths, num_codes);
+}
+
+node* pool_alphabet(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes)
+{
+	return build_alphabet(pool, code_lengths, num_codes);
+}
+
+static node* build_alphabet(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes)
+{
+	//all 19 lengths are looked at below, so the pool has to be sized for all of them
+	node *to_return = (pool == NULL) ? create_node() : reset_pool(pool, code_lengths, 19);
+	if(to_return == NULL)
+	{
+		return NULL;
+	}
+
+	uint32_t next_code[MAX_CODE_LENGTH + 1];
+	generate_codes(code_lengths, num_codes, next_code);
 
 	uint32_t biggest_length = 0;
 	for(int i = 0; i < num_codes; i++)
@@ -260,12 +327,166 @@ node *create_alphabet(uint32_t *code_lengths, uint32_t num_codes)
 		{
 			if (code_lengths[alphabet_indexes[x]] == i && code_lengths[alphabet_indexes[x]] != 0)
 			{
-				add_node(to_return, x, reverse_bits(next_code[i], i), i);
+				insert_node(pool, to_return, x, reverse_bits(next_code[i], i), i);
 				next_code[i] += 1;
 			}
 		}
 	}
-	free(next_code);
 
 	return to_return;
-}
\ No newline at end of file
+}
+
+int build_huffman_table(uint32_t* table, const uint32_t* code_lengths, uint32_t num_codes, int alphabet)
+{
+	uint32_t table_bits = (alphabet == LITERAL_ALPHABET) ? LITERAL_TABLE_BITS : DISTANCE_TABLE_BITS;
+	uint32_t table_size = (alphabet == LITERAL_ALPHABET) ? LITERAL_TABLE_SIZE : DISTANCE_TABLE_SIZE;
+	uint32_t primary_size = 1 << table_bits;
+	if(num_codes > 288)
+	{
+		return 0;
+	}
+
+	//a code may leave bit patterns unused, but it can't hand out more codes than there are
+	uint32_t bl_count[MAX_CODE_LENGTH + 1] = {0};
+	for(uint32_t i = 0; i < num_codes; i++)
+	{
+		if(code_lengths[i] > MAX_CODE_LENGTH)
+		{
+			return 0;
+		}
+		bl_count[code_lengths[i]]++;
+	}
+	bl_count[0] = 0;
+
+	int32_t left = 1;
+	for(uint32_t bits = 1; bits <= MAX_CODE_LENGTH; bits++)
+	{
+		left = (left << 1) - bl_count[bits];
+		if(left < 0)
+		{
+			return 0;
+		}
+	}
+
+	//symbols in the order canonical codes are handed out (by length, then by symbol), each with its code
+	uint32_t next_code[MAX_CODE_LENGTH + 1];
+	uint32_t offsets[MAX_CODE_LENGTH + 1];
+	uint32_t code = 0;
+	uint32_t total = 0;
+	next_code[0] = 0;
+	for(uint32_t bits = 1; bits <= MAX_CODE_LENGTH; bits++)
+	{
+		code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code;
+		offsets[bits] = total;
+		total += bl_count[bits];
+	}
+
+	uint32_t sorted[288];
+	uint32_t codes[288];
+	for(uint32_t i = 0; i < num_codes; i++)
+	{
+		uint32_t length = code_lengths[i];
+		if(length > 0)
+		{
+			sorted[offsets[length]] = i;
+			codes[offsets[length]] = next_code[length]++;
+			offsets[length]++;
+		}
+	}
+
+	memset(table, 0, primary_size * sizeof(uint32_t));
+	uint32_t table_end = primary_size;
+	uint32_t subtable_start = 0;
+	uint32_t subtable_bits = 0;
+	int64_t subtable_prefix = -1;
+	for(uint32_t i = 0; i < total; i++)
+	{
+		uint32_t length = code_lengths[sorted[i]];
+		uint32_t entry = table_entry(sorted[i], length, alphabet);
+
+		//the stream delivers codes starting from their first bit, so tables are indexed by the reversed code
+		uint32_t reversed = reverse_bits(codes[i], length);
+		if(length <= table_bits)
+		{
+			for(uint32_t index = reversed; index < primary_size; index += 1 << length)
+			{
+				table[index] = entry;
+			}
+			continue;
+		}
+
+		//codes that share their first table_bits bits are next to each other in canonical order, the longest last
+		uint32_t prefix = reversed & (primary_size - 1);
+		if(prefix != subtable_prefix)
+		{
+			uint32_t last = i;
+			while(last + 1 < total && (codes[last + 1] >> (code_lengths[sorted[last + 1]] - table_bits)) == (codes[i] >> (length - table_bits)))
+			{
+				last++;
+			}
+			subtable_bits = code_lengths[sorted[last]] - table_bits;
+			subtable_start = table_end;
+			table_end += 1 << subtable_bits;
+			if(table_end > table_size)
+			{
+				return 0;
+			}
+
+			memset(table + subtable_start, 0, ((uint32_t)1 << subtable_bits) * sizeof(uint32_t));
+			table[prefix] = make_entry(table_bits, HUFFMAN_SUBTABLE, subtable_bits, subtable_start);
+			subtable_prefix = prefix;
+		}
+
+		for(uint32_t index = reversed >> table_bits; index < ((uint32_t)1 << subtable_bits); index += 1 << (length - table_bits))
+		{
+			table[subtable_start + index] = entry;
+		}
+	}
+
+	return 1;
+}
+
+void fixed_code_lengths(uint32_t* literal_lengths, uint32_t* distance_lengths)
+{
+	for(uint32_t i = 0; i < 288; i++)
+	{
+		literal_lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	for(uint32_t i = 0; i < 32; i++)
+	{
+		distance_lengths[i] = 5;
+	}
+}
+
+//what symbol decodes to, with everything the decoder needs to know about it in one entry
+static uint32_t table_entry(uint32_t symbol, uint32_t code_length, int alphabet)
+{
+	if(alphabet == DISTANCE_ALPHABET)
+	{
+		if(symbol >= 30)
+		{
+			return make_entry(code_length, HUFFMAN_INVALID, 0, 0);
+		}
+		return make_entry(code_length, HUFFMAN_DISTANCE, distance_extra_bits[symbol], distance_values[symbol]);
+	}
+
+	if(symbol < 256)
+	{
+		return make_entry(code_length, HUFFMAN_LITERAL, 0, symbol);
+	}
+	if(symbol == 256)
+	{
+		return make_entry(code_length, HUFFMAN_END, 0, 0);
+	}
+	if(symbol <= 285)
+	{
+		return make_entry(code_length, HUFFMAN_LENGTH, length_extra_bits[symbol - 257], length_values[symbol - 257]);
+	}
+	return make_entry(code_length, HUFFMAN_INVALID, 0, 0);
+}
+
+static uint32_t make_entry(uint32_t code_length, uint32_t kind, uint32_t extra_bits, uint32_t value)
+{
+	return code_length | (kind << 8) | (extra_bits << 12) | (value << 16);
+}
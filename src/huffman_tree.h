@@ -4,8 +4,48 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
-#include "dynamic_array.h"
+#include "bit_stream.h"
+#include "allocator.h"
+
+//deflate never uses codes longer than this
+#define MAX_CODE_LENGTH 15
+
+//decoding tables: the next LITERAL_TABLE_BITS (or DISTANCE_TABLE_BITS) bits of the stream index a primary table
+//in one lookup. codes longer than that continue in a subtable the primary entry links to
+#define LITERAL_TABLE_BITS 10
+#define DISTANCE_TABLE_BITS 8
+
+//worst case table sizes in entries (every symbol needing a subtable of its own)
+#define LITERAL_TABLE_SIZE ((1 << LITERAL_TABLE_BITS) + 288 * (1 << (MAX_CODE_LENGTH - LITERAL_TABLE_BITS)))
+#define DISTANCE_TABLE_SIZE ((1 << DISTANCE_TABLE_BITS) + 32 * (1 << (MAX_CODE_LENGTH - DISTANCE_TABLE_BITS)))
+
+//alphabets a table can be built for
+enum
+{
+	LITERAL_ALPHABET = 0,
+	DISTANCE_ALPHABET = 1
+};
+
+//what an entry decodes to. invalid entries are bit patterns no code starts with, or symbols deflate never uses
+enum
+{
+	HUFFMAN_INVALID = 0,
+	HUFFMAN_LITERAL = 1,
+	HUFFMAN_END = 2,
+	HUFFMAN_LENGTH = 3,
+	HUFFMAN_DISTANCE = 4,
+	HUFFMAN_SUBTABLE = 5
+};
+
+//an entry is one uint32_t: bits 0-7 are the code length (for subtable entries that includes the primary bits),
+//bits 8-11 the kind, bits 12-15 how many extra bits follow the code (for links: how many bits index the subtable)
+//and bits 16-31 the literal, base length, base distance or subtable offset
+#define ENTRY_LENGTH(entry) ((entry) & 0xFF)
+#define ENTRY_KIND(entry) (((entry) >> 8) & 0x0F)
+#define ENTRY_EXTRA(entry) (((entry) >> 12) & 0x0F)
+#define ENTRY_VALUE(entry) ((entry) >> 16)
 
 //only need a basic binary tree data structure for huffman coding
 typedef struct Node node;
@@ -18,17 +58,41 @@ typedef struct Node
 	int is_leaf;
 }node;
 
+//block of nodes that trees can be built in without a malloc per node
+//trees built in a pool are released by building the next tree in it, never with free_tree
+typedef struct Node_pool
+{
+	node* nodes;
+	uint32_t count;
+	uint32_t capacity;
+
+	//where the nodes come from. zeroed means libc
+	mem_allocator allocator;
+}node_pool;
+
 //assemble huffman tree
 node* create_node();
 void add_node(node* root, uint32_t symbol, uint32_t code, uint32_t code_length);
 void free_tree(node* root);
 
 //retrieve functions
-int32_t get_symbol(dynamic_array* cur, node* root);
-void traverse(node** cur, char bit);
+int32_t get_symbol(bit_stream* cur, node* root);
+int traverse(node** cur, char bit);
 
 //tree generation helper functions
 node* static_symbol();
 node* static_distance();
 node* create_dynamic_tree(uint32_t* code_lengths, uint32_t num_codes);
-node *create_alphabet(uint32_t *code_lengths, uint32_t num_codes);
\ No newline at end of file
+node *create_alphabet(uint32_t *code_lengths, uint32_t num_codes);
+
+//same as above, but every node comes from the pool (which only grows when a tree needs more nodes than it has)
+node* pool_dynamic_tree(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes);
+node* pool_alphabet(node_pool* pool, uint32_t* code_lengths, uint32_t num_codes);
+void free_node_pool(node_pool* pool);
+
+//build the decoding table of a code (LITERAL_TABLE_SIZE or DISTANCE_TABLE_SIZE entries for alphabet)
+//1 is success, 0 if the code lengths describe more codes than fit (incomplete codes are fine)
+int build_huffman_table(uint32_t* table, const uint32_t* code_lengths, uint32_t num_codes, int alphabet);
+
+//code lengths of the fixed huffman codes (288 literal/length and 32 distance codes)
+void fixed_code_lengths(uint32_t* literal_lengths, uint32_t* distance_lengths);
\ No newline at end of file
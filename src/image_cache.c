@@ -0,0 +1,445 @@
+#include <sys/stat.h>
+
+#include "image_cache.h"
+
+//the bucket array doubles whenever there are more entries than buckets
+#define INITIAL_BUCKETS 64
+
+//state of an entry. misses on an entry that is still decoding wait for it instead of decoding again
+enum
+{
+	ENTRY_DECODING = 0,
+	ENTRY_READY = 1,
+	ENTRY_FAILED = 2
+};
+
+static cached_image* get_entry(image_cache* cache, const cached_image* key, const char* filename, const uint8_t* data);
+static void release_entry(image_cache* cache, cached_image* entry);
+static void free_entry(cached_image* entry);
+static void evict(image_cache* cache);
+
+static cached_image* find_entry(image_cache* cache, const cached_image* key);
+static void insert_entry(image_cache* cache, cached_image* entry);
+static void remove_entry(image_cache* cache, cached_image* entry);
+static int grow_buckets(image_cache* cache);
+static uint64_t hash_key(const cached_image* key);
+static uint64_t hash_memory(const uint8_t* data, uint64_t size);
+static uint64_t mix(uint64_t hash, uint64_t value);
+static int same_key(const cached_image* a, const cached_image* b);
+
+static void lru_remove(image_cache* cache, cached_image* entry);
+static void lru_push(image_cache* cache, cached_image* entry);
+
+static png_decoder* take_decoder(image_cache* cache);
+static void return_decoder(image_cache* cache, png_decoder* decoder);
+
+image_cache* create_image_cache(uint64_t budget)
+{
+	image_cache* to_return = calloc(1, sizeof(image_cache));
+	to_return->budget = budget;
+	to_return->bucket_count = INITIAL_BUCKETS;
+	to_return->buckets = calloc(INITIAL_BUCKETS, sizeof(cached_image*));
+	pthread_mutex_init(&to_return->lock, NULL);
+	pthread_cond_init(&to_return->decoded, NULL);
+
+	return to_return;
+}
+
+void free_image_cache(image_cache* cache)
+{
+	if (cache == NULL)
+	{
+		return;
+	}
+
+	for (uint64_t i = 0; i < cache->bucket_count; i++)
+	{
+		cached_image* entry = cache->buckets[i];
+		while (entry != NULL)
+		{
+			cached_image* next = entry->next_in_bucket;
+			if (entry->references > 0)
+			{
+				fprintf(stderr, "free_image_cache: %s is still in use\n", entry->path != NULL ? entry->path : "an image from memory");
+			}
+			free_entry(entry);
+			entry = next;
+		}
+	}
+
+	for (int i = 0; i < cache->idle_count; i++)
+	{
+		free_decoder(cache->idle_decoders[i]);
+	}
+	free(cache->idle_decoders);
+	free(cache->buckets);
+	pthread_mutex_destroy(&cache->lock);
+	pthread_cond_destroy(&cache->decoded);
+	free(cache);
+}
+
+cached_image* cache_get(image_cache* cache, const char* filename)
+{
+	struct stat info;
+	if (stat(filename, &info) != 0)
+	{
+		fprintf(stderr, "cache_get: unable to open %s\n", filename);
+		return NULL;
+	}
+
+	cached_image key;
+	memset(&key, 0, sizeof(cached_image));
+	key.path = (char*)filename;
+	key.size = info.st_size;
+	key.modified_nanoseconds = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+
+	return get_entry(cache, &key, filename, NULL);
+}
+
+cached_image* cache_get_memory(image_cache* cache, const uint8_t* data, uint64_t size)
+{
+	cached_image key;
+	memset(&key, 0, sizeof(cached_image));
+	key.size = size;
+	key.hash = hash_memory(data, size);
+
+	return get_entry(cache, &key, NULL, data);
+}
+
+void cache_release(cached_image* entry)
+{
+	if (entry == NULL)
+	{
+		return;
+	}
+
+	image_cache* cache = entry->cache;
+	pthread_mutex_lock(&cache->lock);
+	release_entry(cache, entry);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+cache_stats get_cache_stats(image_cache* cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	cache_stats to_return = cache->stats;
+	to_return.bytes = cache->bytes;
+	pthread_mutex_unlock(&cache->lock);
+
+	return to_return;
+}
+
+//look the key up, or decode it (outside the lock) if nobody has yet
+static cached_image* get_entry(image_cache* cache, const cached_image* key, const char* filename, const uint8_t* data)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	cached_image* entry = find_entry(cache, key);
+	if (entry != NULL)
+	{
+		if (entry->references == 0)
+		{
+			lru_remove(cache, entry);
+		}
+		entry->references++;
+
+		if (entry->state == ENTRY_DECODING)
+		{
+			cache->stats.shared_misses++;
+			while (entry->state == ENTRY_DECODING)
+			{
+				pthread_cond_wait(&cache->decoded, &cache->lock);
+			}
+		}
+		else
+		{
+			cache->stats.hits++;
+		}
+
+		if (entry->state == ENTRY_FAILED)
+		{
+			release_entry(cache, entry);
+			entry = NULL;
+		}
+		pthread_mutex_unlock(&cache->lock);
+		return entry;
+	}
+
+	//the entry goes in before the decode so that other misses on the key find it and wait
+	cache->stats.misses++;
+	entry = calloc(1, sizeof(cached_image));
+	*entry = *key;
+	entry->path = (key->path != NULL) ? strdup(key->path) : NULL;
+	entry->cache = cache;
+	entry->references = 1;
+	entry->state = ENTRY_DECODING;
+	insert_entry(cache, entry);
+	png_decoder* decoder = take_decoder(cache);
+	pthread_mutex_unlock(&cache->lock);
+
+	png* decoded = NULL;
+	if (decoder != NULL)
+	{
+		decoder_set_limits(decoder, &cache->limits);
+		png* image = (filename != NULL) ? decoder_read(decoder, filename) : decoder_read_memory(decoder, data, key->size);
+		if (image->is_valid)
+		{
+			decoded = decoder_detach(decoder);
+		}
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	return_decoder(cache, decoder);
+
+	if (decoded != NULL)
+	{
+		entry->image = decoded;
+		entry->bytes = sizeof(cached_image) + sizeof(png) + decoded->pixel_data->capacity;
+		entry->state = ENTRY_READY;
+		cache->bytes += entry->bytes;
+		evict(cache);
+	}
+	else
+	{
+		//failures aren't cached, the next request for the key tries again
+		entry->state = ENTRY_FAILED;
+		remove_entry(cache, entry);
+	}
+	pthread_cond_broadcast(&cache->decoded);
+
+	if (entry->state == ENTRY_FAILED)
+	{
+		release_entry(cache, entry);
+		entry = NULL;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return entry;
+}
+
+//drop one reference (lock held). an entry nobody holds anymore can be evicted
+static void release_entry(image_cache* cache, cached_image* entry)
+{
+	entry->references--;
+	if (entry->references > 0)
+	{
+		return;
+	}
+
+	if (entry->state == ENTRY_FAILED)
+	{
+		free_entry(entry);
+		return;
+	}
+
+	lru_push(cache, entry);
+	evict(cache);
+}
+
+static void free_entry(cached_image* entry)
+{
+	free_png(entry->image);
+	free(entry->path);
+	free(entry);
+}
+
+//drop the least recently used entries nobody holds until the cache fits its budget (lock held)
+static void evict(image_cache* cache)
+{
+	while (cache->bytes > cache->budget && cache->oldest != NULL)
+	{
+		cached_image* entry = cache->oldest;
+		lru_remove(cache, entry);
+		remove_entry(cache, entry);
+		cache->bytes -= entry->bytes;
+		cache->stats.evictions++;
+		free_entry(entry);
+	}
+}
+
+static cached_image* find_entry(image_cache* cache, const cached_image* key)
+{
+	cached_image* entry = cache->buckets[hash_key(key) & (cache->bucket_count - 1)];
+	while (entry != NULL && !same_key(entry, key))
+	{
+		entry = entry->next_in_bucket;
+	}
+	return entry;
+}
+
+static void insert_entry(image_cache* cache, cached_image* entry)
+{
+	//a failed grow just means longer chains
+	if (cache->stats.entries >= cache->bucket_count)
+	{
+		grow_buckets(cache);
+	}
+
+	cached_image** bucket = &cache->buckets[hash_key(entry) & (cache->bucket_count - 1)];
+	entry->next_in_bucket = *bucket;
+	*bucket = entry;
+	cache->stats.entries++;
+}
+
+static void remove_entry(image_cache* cache, cached_image* entry)
+{
+	cached_image** link = &cache->buckets[hash_key(entry) & (cache->bucket_count - 1)];
+	while (*link != NULL && *link != entry)
+	{
+		link = &(*link)->next_in_bucket;
+	}
+	if (*link == entry)
+	{
+		*link = entry->next_in_bucket;
+		entry->next_in_bucket = NULL;
+		cache->stats.entries--;
+	}
+}
+
+static int grow_buckets(image_cache* cache)
+{
+	uint64_t new_count = cache->bucket_count * 2;
+	cached_image** buckets = calloc(new_count, sizeof(cached_image*));
+	if (buckets == NULL)
+	{
+		return 0;
+	}
+
+	for (uint64_t i = 0; i < cache->bucket_count; i++)
+	{
+		cached_image* entry = cache->buckets[i];
+		while (entry != NULL)
+		{
+			cached_image* next = entry->next_in_bucket;
+			cached_image** bucket = &buckets[hash_key(entry) & (new_count - 1)];
+			entry->next_in_bucket = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = new_count;
+	return 1;
+}
+
+static uint64_t hash_key(const cached_image* key)
+{
+	uint64_t hash = mix(key->hash, key->size);
+	hash = mix(hash, key->modified_nanoseconds);
+	if (key->path != NULL)
+	{
+		for (const char* c = key->path; *c != '\0'; c++)
+		{
+			hash = (hash ^ (uint8_t)*c) * 0x100000001B3;
+		}
+	}
+	return mix(hash, 0);
+}
+
+//content hash of png data, 8 bytes at a time. it is only ever compared together with the size
+static uint64_t hash_memory(const uint8_t* data, uint64_t size)
+{
+	uint64_t hash = 0x9E3779B97F4A7C15;
+	uint64_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = mix(hash, word);
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, data + i, size - i);
+	return mix(hash, tail);
+}
+
+static uint64_t mix(uint64_t hash, uint64_t value)
+{
+	hash = (hash ^ value) * 0xFF51AFD7ED558CCD;
+	return hash ^ (hash >> 32);
+}
+
+static int same_key(const cached_image* a, const cached_image* b)
+{
+	if (a->size != b->size || a->hash != b->hash || a->modified_nanoseconds != b->modified_nanoseconds)
+	{
+		return 0;
+	}
+	if (a->path == NULL || b->path == NULL)
+	{
+		return a->path == b->path;
+	}
+	return strcmp(a->path, b->path) == 0;
+}
+
+static void lru_remove(image_cache* cache, cached_image* entry)
+{
+	if (entry->newer != NULL)
+	{
+		entry->newer->older = entry->older;
+	}
+	else
+	{
+		cache->newest = entry->older;
+	}
+
+	if (entry->older != NULL)
+	{
+		entry->older->newer = entry->newer;
+	}
+	else
+	{
+		cache->oldest = entry->newer;
+	}
+
+	entry->newer = NULL;
+	entry->older = NULL;
+}
+
+static void lru_push(image_cache* cache, cached_image* entry)
+{
+	entry->newer = NULL;
+	entry->older = cache->newest;
+	if (cache->newest != NULL)
+	{
+		cache->newest->newer = entry;
+	}
+	cache->newest = entry;
+	if (cache->oldest == NULL)
+	{
+		cache->oldest = entry;
+	}
+}
+
+//decoders are kept between decodes so their buffers don't have to grow again (lock held)
+static png_decoder* take_decoder(image_cache* cache)
+{
+	if (cache->idle_count > 0)
+	{
+		return cache->idle_decoders[--cache->idle_count];
+	}
+	return create_decoder();
+}
+
+static void return_decoder(image_cache* cache, png_decoder* decoder)
+{
+	if (decoder == NULL)
+	{
+		return;
+	}
+
+	if (cache->idle_count == cache->idle_capacity)
+	{
+		int new_capacity = (cache->idle_capacity == 0) ? 4 : cache->idle_capacity * 2;
+		png_decoder** grown = realloc(cache->idle_decoders, new_capacity * sizeof(png_decoder*));
+		if (grown == NULL)
+		{
+			free_decoder(decoder);
+			return;
+		}
+		cache->idle_decoders = grown;
+		cache->idle_capacity = new_capacity;
+	}
+	cache->idle_decoders[cache->idle_count++] = decoder;
+}
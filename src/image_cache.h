@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "png.h"
+
+typedef struct Image_cache image_cache;
+
+//one decoded image in the cache. image is shared by everyone holding the entry and must not be changed
+typedef struct Cached_image cached_image;
+typedef struct Cached_image
+{
+	png* image;
+
+	//key: path, size and modification time of a file, or size and content hash of memory (path is NULL)
+	char* path;
+	uint64_t size;
+	int64_t modified_nanoseconds;
+	uint64_t hash;
+
+	//bytes charged against the budget
+	uint64_t bytes;
+
+	//everything below belongs to the cache (and its lock)
+	image_cache* cache;
+	int references;
+	int state;
+
+	//hash bucket chain, and the least recently used list (only entries nobody holds are on it)
+	cached_image* next_in_bucket;
+	cached_image* newer;
+	cached_image* older;
+}cached_image;
+
+typedef struct Cache_stats
+{
+	uint64_t hits;
+	uint64_t misses;
+
+	//misses that waited for a decode another thread had already started instead of decoding again
+	uint64_t shared_misses;
+
+	uint64_t evictions;
+	uint64_t entries;
+	uint64_t bytes;
+}cache_stats;
+
+typedef struct Image_cache
+{
+	//images nobody holds are evicted (least recently used first) while the cache holds more than budget bytes
+	uint64_t budget;
+	uint64_t bytes;
+
+	pthread_mutex_t lock;
+	pthread_cond_t decoded;
+
+	cached_image** buckets;
+	uint64_t bucket_count;
+
+	cached_image* newest;
+	cached_image* oldest;
+
+	//limits of every decode (zeroed is none). a decode stopped by them fails like a corrupt png and isn't cached
+	decode_limits limits;
+
+	//decoders that aren't decoding right now (decodes happen outside the lock, one decoder each)
+	png_decoder** idle_decoders;
+	int idle_count;
+	int idle_capacity;
+
+	cache_stats stats;
+}image_cache;
+
+image_cache* create_image_cache(uint64_t budget);
+
+//every entry has to be released first
+void free_image_cache(image_cache* cache);
+
+//decoded image for a file or for png data in memory. concurrent misses on the same key decode only once
+//the entry stays valid (and its pixels in place) until cache_release. NULL if the png can't be decoded
+cached_image* cache_get(image_cache* cache, const char* filename);
+cached_image* cache_get_memory(image_cache* cache, const uint8_t* data, uint64_t size);
+
+void cache_release(cached_image* entry);
+
+cache_stats get_cache_stats(image_cache* cache);
@@ -1,21 +1,733 @@
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
 
 #include "png.h"
 #include "bmp.h"
+#include "png_encoder.h"
+#include "batch.h"
+#include "apng.h"
+#include "metadata.h"
+#include "png_index.h"
+#include "server.h"
+#include "pixel_stream.h"
+#include "mapped_output.h"
 
-int main(int argc, char* argv[])
+static void print_usage()
+{
+	fprintf(stderr, "Example usage: png_decoder [--stats | --stats=json] [--low-memory] [--pipelined] [--color] [input.png] [output.bmp]\n");
+	fprintf(stderr, "               png_decoder [--stats | --stats=json] [--pipelined] [--color] [--format raw|pam|ppm] [input.png] -\n");
+	fprintf(stderr, "               png_decoder [--stats | --stats=json] --mapped [--format raw|pam|ppm] [input.png] [output]\n");
+	fprintf(stderr, "               png_decoder [encode options] [input.bmp] [output.png]\n");
+	fprintf(stderr, "               png_decoder --batch [--jobs N] [--io auto|uring|threads|sync] [--io-depth N] [--max-memory N] (--dir in_dir out_dir | --manifest file | in1.png out1.bmp ...)\n");
+	fprintf(stderr, "               png_decoder --info input.png\n");
+	fprintf(stderr, "               png_decoder --rows first count [--index file] input.png output.bmp\n");
+	fprintf(stderr, "               png_decoder --frames [--jobs N] input.png output_prefix\n");
+	fprintf(stderr, "               png_decoder --serve socket [--jobs N] [--max-bytes N] [--max-pixels N] [--timeout seconds] [--cache-bytes N] [--max-decode-ms N] [--max-memory N]\n");
+	fprintf(stderr, "  --low-memory      write the bmp row by row as the png is decoded (memory use doesn't grow with the image)\n");
+	fprintf(stderr, "  --pipelined       unfilter rows on a second thread while the first one inflates (big images only)\n");
+	fprintf(stderr, "  --color           convert the colors to sRGB as the iCCP, sRGB, gAMA and cHRM chunks say\n");
+	fprintf(stderr, "  -                 stream the pixels to stdout row by row as they are decoded, as a pam (default),\n");
+	fprintf(stderr, "                    ppm (alpha dropped) or raw RGB/RGBA rows\n");
+	fprintf(stderr, "  --mapped          decode straight into a mapping of the output file (pam by default) instead of memory,\n");
+	fprintf(stderr, "                    for images bigger than RAM\n");
+	fprintf(stderr, "  --info            list the chunks and metadata of a png without decoding (or even reading) the image data\n");
+	fprintf(stderr, "  --rows            write only rows [first, first + count). --index resumes from the index in file, or\n");
+	fprintf(stderr, "                    builds it with a full decode when file doesn't exist yet\n");
+	fprintf(stderr, "  --frames          write every frame of an animated png to output_prefix_0000.bmp, output_prefix_0001.bmp, ...\n");
+	fprintf(stderr, "  --io              how batch files are read and written (auto uses io_uring when available)\n");
+	fprintf(stderr, "  --io-depth N      files read ahead of the decoders and written behind them\n");
+	fprintf(stderr, "  --max-memory N    only start decodes while the memory they are predicted to need stays under N bytes\n");
+	fprintf(stderr, "encode options:\n");
+	fprintf(stderr, "  --stored          no compression\n");
+	fprintf(stderr, "  --fast            fixed huffman codes (fastest)\n");
+	fprintf(stderr, "  --filter N        filter every row with filter N (0-4) or 'adaptive'\n");
+	fprintf(stderr, "  --threads N       compress row strips on N threads\n");
+}
+
+//case insensitive check of a file extension
+static int has_extension(const char* filename, const char* extension)
+{
+	size_t name_length = strlen(filename);
+	size_t extension_length = strlen(extension);
+	if (name_length < extension_length)
+	{
+		return 0;
+	}
+
+	return strcasecmp(filename + name_length - extension_length, extension) == 0;
+}
+
+static int convert_bmp(const char* input, const char* output, const encode_options* options)
+{
+	bmp* source = read_bmp(input);
+	if (!source->is_valid)
+	{
+		free_bmp(source);
+		return 1;
+	}
+
+	png* to_write = png_from_bmp(source);
+	free_bmp(source);
+
+	int to_return = write_png(to_write, output, options) ? 0 : 1;
+	free_png(to_write);
+	return to_return;
+}
+
+//row callback for --low-memory. the bmp is opened with the first row, once the header is known
+typedef struct Row_conversion
 {
-	if(argc < 3)
+	png_decoder* decoder;
+	const char* output;
+	bmp_writer* writer;
+}row_conversion;
+
+static int write_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length)
+{
+	row_conversion* conversion = user;
+	png* image = &conversion->decoder->image;
+	if (conversion->writer == NULL)
 	{
-		fprintf(stderr, "Invalid arguments. Example usage: png_decoder [input.png] [output.bmp].\n");
+		conversion->writer = open_bmp_writer_using(conversion->output, image->w, image->h, &conversion->decoder->allocator);
+		if (conversion->writer == NULL)
+		{
+			return 0;
+		}
 	}
 
-	png* to_convert = read_png(argv[1]);
+	return bmp_writer_row(conversion->writer, row, image->bytes_per_pixel, row_index);
+}
+
+static int convert_whole_png(png_decoder* decoder, const char* input, const char* output)
+{
+	png* to_convert = decoder_read(decoder, input);
+	int to_return = 1;
 	if(to_convert->is_valid)
 	{
-		write_bmp(to_convert->pixel_data->data, to_convert->w, to_convert->h, argv[2]);
+		STATS_NOW(write_start);
+		write_bmp(to_convert->pixel_data->data, to_convert->w, to_convert->h, to_convert->bytes_per_pixel, output);
+		STATS_ELAPSED(&decoder->stats, output_nanoseconds, write_start);
+		STATS_ADD(&decoder->stats, output_bytes, bmp_file_size(to_convert->w, to_convert->h));
+		to_return = 0;
+	}
+
+	return to_return;
+}
+
+//row callback for output to stdout. like the bmp writer, the stream is opened with the first row
+typedef struct Row_stream
+{
+	png_decoder* decoder;
+	stream_format format;
+	pixel_stream* stream;
+}row_stream;
+
+static int stream_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length)
+{
+	row_stream* output = user;
+	png* image = &output->decoder->image;
+	if (output->stream == NULL)
+	{
+		output->stream = open_pixel_stream(fileno(stdout), output->format, image->w, image->h, image->bytes_per_pixel);
+		if (output->stream == NULL)
+		{
+			return 0;
+		}
+	}
+
+	return pixel_stream_row(output->stream, row);
+}
+
+static int stream_png(png_decoder* decoder, const char* input, stream_format format)
+{
+	row_stream output = {decoder, format, NULL};
+	png* converted = decoder_read_rows(decoder, input, stream_row, &output);
+	if (output.stream == NULL)
+	{
+		return 1;
+	}
+
+	//counted before the stream is closed (and freed). the bytes still buffered are written by the close
+	STATS_ADD(&decoder->stats, output_bytes, output.stream->bytes_written + output.stream->used);
+	int written = close_pixel_stream(output.stream);
+	return (converted->is_valid && written) ? 0 : 1;
+}
+
+static int map_png(png_decoder* decoder, const char* input, const char* output, stream_format format)
+{
+	mapped_image* image = decode_to_mapped_file(decoder, input, output, format);
+	if (image == NULL)
+	{
+		return 1;
 	}
 
-	free_png(to_convert);
+	int to_return = image->is_valid ? 0 : 1;
+	STATS_ADD(&decoder->stats, output_bytes, image->size);
+	close_mapped_image(image);
+	return to_return;
+}
+
+//stats is -1 for none, 0 for text and 1 for json. an output of - streams to stdout in format, and so does mapped into the output file
+static int convert_png(const char* input, const char* output, int stats, int low_memory, int mapped, int pipelined, int color, stream_format format)
+{
+	png_decoder* decoder = create_decoder();
+	decoder_set_pipelined(decoder, pipelined);
+	decoder_set_color_management(decoder, color);
+	int to_return = 1;
+
+	if (strcmp(output, "-") == 0)
+	{
+		//the stream is written during the decode, so its time is part of the block timings
+		to_return = stream_png(decoder, input, format);
+	}
+	else if (mapped)
+	{
+		to_return = map_png(decoder, input, output, format);
+	}
+	else if (low_memory)
+	{
+		//writing happens during the decode, so its time is part of the block timings
+		row_conversion conversion = {decoder, output, NULL};
+		png* converted = decoder_read_rows(decoder, input, write_row, &conversion);
+		int written = (conversion.writer != NULL) && close_bmp_writer(conversion.writer);
+		if (converted->is_valid && written)
+		{
+			STATS_ADD(&decoder->stats, output_bytes, bmp_file_size(converted->w, converted->h));
+			to_return = 0;
+		}
+		else if (conversion.writer != NULL)
+		{
+			remove(output);
+		}
+	}
+	else
+	{
+		to_return = convert_whole_png(decoder, input, output);
+	}
+
+	if (stats >= 0)
+	{
+		print_stats(&decoder->stats, stderr, stats);
+	}
+
+	free_decoder(decoder);
+	return to_return;
+}
+
+//convert many files in one process on a work stealing pool
+static int batch_main(int argc, char* argv[])
+{
+	batch* to_convert = create_batch();
+	batch_options options = default_batch_options();
+	const char* pending_input = NULL;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "auto") == 0)
+			{
+				options.io = IO_AUTO;
+			}
+			else if (strcmp(argv[i], "uring") == 0)
+			{
+				options.io = IO_URING;
+			}
+			else if (strcmp(argv[i], "threads") == 0)
+			{
+				options.io = IO_THREADS;
+			}
+			else if (strcmp(argv[i], "sync") == 0)
+			{
+				options.io = IO_SYNC;
+			}
+			else
+			{
+				fprintf(stderr, "Invalid io backend: %s\n", argv[i]);
+				free_batch(to_convert);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--io-depth") == 0 && i + 1 < argc)
+		{
+			options.io_depth = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc)
+		{
+			options.max_memory_bytes = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--dir") == 0 && i + 2 < argc)
+		{
+			if (!batch_add_directory(to_convert, argv[i + 1], argv[i + 2]))
+			{
+				free_batch(to_convert);
+				return 1;
+			}
+			i += 2;
+		}
+		else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+		{
+			if (!batch_add_manifest(to_convert, argv[++i]))
+			{
+				free_batch(to_convert);
+				return 1;
+			}
+		}
+		else if (argv[i][0] != '-')
+		{
+			if (pending_input == NULL)
+			{
+				pending_input = argv[i];
+			}
+			else
+			{
+				batch_add(to_convert, pending_input, argv[i]);
+				pending_input = NULL;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			print_usage();
+			free_batch(to_convert);
+			return 1;
+		}
+	}
+
+	if (pending_input != NULL)
+	{
+		fprintf(stderr, "Invalid arguments. %s has no output file.\n", pending_input);
+		free_batch(to_convert);
+		return 1;
+	}
+
+	uint64_t total = to_convert->count;
+	uint64_t failed = run_batch(to_convert, &options);
+	fprintf(stderr, "batch: converted %lu of %lu files\n", total - failed, total);
+
+	free_batch(to_convert);
+	return failed > 0 ? 1 : 0;
+}
+
+//row callback for --rows. rows go into the bmp counted from the first one asked for
+typedef struct Band_output
+{
+	bmp_writer* writer;
+	uint8_t bytes_per_pixel;
+	uint32_t first_row;
+}band_output;
+
+static int write_band_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length)
+{
+	band_output* band = user;
+	return bmp_writer_row(band->writer, row, band->bytes_per_pixel, row_index - band->first_row);
+}
+
+//decode a band of rows, using (or building) a checkpoint index so the decode doesn't start at the first byte
+static int rows_main(int argc, char* argv[])
+{
+	const char* index_file = NULL;
+	const char* files[2] = {NULL, NULL};
+	int file_count = 0;
+	uint32_t first_row = 0;
+	uint32_t row_count = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (i == 2 && i + 1 < argc)
+		{
+			first_row = strtoul(argv[i], NULL, 10);
+			row_count = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+		{
+			index_file = argv[++i];
+		}
+		else if (file_count < 2 && argv[i][0] != '-')
+		{
+			files[file_count++] = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			print_usage();
+			return 1;
+		}
+	}
+
+	png* header = calloc(1, sizeof(png));
+	if (file_count < 2 || row_count == 0 || !probe_png(files[0], header) || first_row >= (uint32_t)header->h)
+	{
+		fprintf(stderr, "Invalid arguments. --rows needs a row range inside the image, an input and an output file.\n");
+		free(header);
+		return 1;
+	}
+	if (row_count > (uint32_t)header->h - first_row)
+	{
+		row_count = header->h - first_row;
+	}
+
+	png_decoder* decoder = create_decoder();
+	png_index* index = (index_file != NULL) ? load_png_index(index_file) : NULL;
+	band_output band = {NULL, header->bytes_per_pixel, first_row};
+	band.writer = open_bmp_writer(files[1], header->w, row_count);
+	int to_return = 1;
+
+	if (band.writer == NULL)
+	{
+		fprintf(stderr, "Unable to create %s\n", files[1]);
+	}
+
+	//first use of an index file: decode everything once, write the index, and take the rows from the full image
+	else if (index_file != NULL && index == NULL)
+	{
+		png* image = decoder_read(decoder, files[0]);
+		index = image->is_valid ? decoder_build_index(decoder, 0) : NULL;
+		if (index != NULL && save_png_index(index, index_file))
+		{
+			fprintf(stderr, "rows: wrote %lu checkpoints to %s\n", index->count, index_file);
+			uint64_t scanline_size = (uint64_t)image->w * image->bytes_per_pixel;
+			to_return = 0;
+			for (uint32_t i = 0; i < row_count; i++)
+			{
+				write_band_row(&band, first_row + i, image->pixel_data->data + (first_row + i) * scanline_size, scanline_size);
+			}
+		}
+	}
+	else
+	{
+		png* image = decoder_read_row_range(decoder, files[0], index, first_row, row_count, write_band_row, &band);
+		to_return = image->is_valid ? 0 : 1;
+	}
+
+	if (band.writer != NULL && !close_bmp_writer(band.writer))
+	{
+		to_return = 1;
+	}
+	if (to_return != 0 && band.writer != NULL)
+	{
+		remove(files[1]);
+	}
+
+	free_png_index(index);
+	free_decoder(decoder);
+	free(header);
+	return to_return;
+}
+
+//print the chunk index and the metadata that can be read from it
+static int info_main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Invalid arguments. --info needs exactly one input file.\n");
+		print_usage();
+		return 1;
+	}
+
+	png_decoder* decoder = create_decoder();
+	png* image = decoder_read_info(decoder, argv[2]);
+	if (!image->is_valid)
+	{
+		free_decoder(decoder);
+		return 1;
+	}
+
+	static const char* crc_names[] = {"unchecked", "ok", "BAD", "not read"};
+	printf("%s: %dx%d, color type %d, %d bytes per pixel\n", argv[2], image->w, image->h, image->color_type, image->bytes_per_pixel);
+	for (uint64_t i = 0; i < decoder_chunk_count(decoder); i++)
+	{
+		png_chunk* chunk = decoder_chunk(decoder, i);
+		printf("chunk %s  offset %10lu  length %10u  crc %s\n", chunk->type, chunk->offset, chunk->length, crc_names[png_check_crc(decoder, i)]);
+	}
+
+	dynamic_array* buffer = create_array();
+	png_text text;
+	for (int64_t i = png_find_text(decoder, 0); i >= 0; i = png_find_text(decoder, i + 1))
+	{
+		if (png_get_text(decoder, i, &text, buffer))
+		{
+			printf("text: %s%s%s = %.*s%s\n", text.keyword, text.language[0] != '\0' ? " / " : "", text.language,
+				text.text_length > 200 ? 200 : (int)text.text_length, text.text, text.text_length > 200 ? "..." : "");
+		}
+	}
+
+	png_physical physical;
+	if (png_get_physical(decoder, &physical))
+	{
+		printf("pixels per unit: %u x %u%s\n", physical.x_pixels_per_unit, physical.y_pixels_per_unit, physical.unit == 1 ? " (meter)" : " (aspect ratio)");
+	}
+
+	png_icc_profile profile;
+	if (png_get_icc_profile(decoder, &profile, buffer))
+	{
+		printf("icc profile: %s, %lu bytes\n", profile.name, profile.length);
+	}
+
+	uint32_t gamma;
+	if (png_get_gamma(decoder, &gamma))
+	{
+		printf("gamma: %.5f\n", gamma / 100000.0);
+	}
+
+	png_chromaticities chromaticities;
+	if (png_get_chromaticities(decoder, &chromaticities))
+	{
+		printf("chromaticities: white %.5f %.5f, red %.5f %.5f, green %.5f %.5f, blue %.5f %.5f\n",
+			chromaticities.white_x / 100000.0, chromaticities.white_y / 100000.0, chromaticities.red_x / 100000.0, chromaticities.red_y / 100000.0,
+			chromaticities.green_x / 100000.0, chromaticities.green_y / 100000.0, chromaticities.blue_x / 100000.0, chromaticities.blue_y / 100000.0);
+	}
+
+	uint8_t intent;
+	if (png_get_srgb(decoder, &intent))
+	{
+		printf("srgb: rendering intent %u\n", intent);
+	}
+
+	const uint8_t* exif;
+	uint64_t exif_length;
+	if (png_get_exif(decoder, &exif, &exif_length))
+	{
+		printf("exif: %lu bytes\n", exif_length);
+	}
+
+	free_array(buffer);
+	free_decoder(decoder);
+	return 0;
+}
+
+//frame callback for --frames. each frame is written as a bmp of the whole canvas
+typedef struct Frame_output
+{
+	const char* prefix;
+	char* filename;
+}frame_output;
+
+static int write_frame(void* user, const apng_frame* frame)
+{
+	frame_output* output = user;
+	const png* header = &frame->info->header;
+	sprintf(output->filename, "%s_%04u.bmp", output->prefix, frame->index);
+
+	return write_bmp(frame->canvas, header->w, header->h, header->bytes_per_pixel, output->filename);
+}
+
+//decode every frame of an apng (frames are decompressed in parallel)
+static int frames_main(int argc, char* argv[])
+{
+	int threads = 0;
+	const char* files[2] = {NULL, NULL};
+	int file_count = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (file_count < 2 && argv[i][0] != '-')
+		{
+			files[file_count++] = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (file_count < 2)
+	{
+		fprintf(stderr, "Invalid arguments. --frames needs an input file and an output prefix.\n");
+		print_usage();
+		return 1;
+	}
+
+	frame_output output;
+	output.prefix = files[1];
+	output.filename = malloc(strlen(files[1]) + 32);
+
+	apng_info info;
+	int decoded = read_apng(files[0], threads, write_frame, &output, &info);
+	free(output.filename);
+	if (!decoded)
+	{
+		return 1;
+	}
+
+	fprintf(stderr, "frames: %u frames of %dx%d, %u plays%s\n", info.frame_count, info.header.w, info.header.h, info.play_count,
+		info.default_is_frame ? "" : " (default image not shown)");
 	return 0;
-}
\ No newline at end of file
+}
+
+//long running decode server on a unix socket
+static int serve_main(int argc, char* argv[])
+{
+	server_options options = default_server_options();
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc)
+		{
+			options.max_input_bytes = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--max-pixels") == 0 && i + 1 < argc)
+		{
+			options.max_pixels = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+		{
+			options.timeout_seconds = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cache-bytes") == 0 && i + 1 < argc)
+		{
+			options.cache_bytes = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--max-decode-ms") == 0 && i + 1 < argc)
+		{
+			options.max_decode_milliseconds = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc)
+		{
+			options.max_memory_bytes = strtoull(argv[++i], NULL, 10);
+		}
+		else if (options.socket_path == NULL && argv[i][0] != '-')
+		{
+			options.socket_path = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (options.socket_path == NULL)
+	{
+		fprintf(stderr, "Invalid arguments. --serve needs a socket path.\n");
+		print_usage();
+		return 1;
+	}
+
+	return run_server(&options);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+	{
+		return batch_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--rows") == 0)
+	{
+		return rows_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--info") == 0)
+	{
+		return info_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--frames") == 0)
+	{
+		return frames_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+	{
+		return serve_main(argc, argv);
+	}
+
+	encode_options options = default_encode_options();
+	const char* files[2] = {NULL, NULL};
+	int file_count = 0;
+	int stats = -1;
+	int low_memory = 0;
+	int mapped = 0;
+	int pipelined = 0;
+	int color = 0;
+	stream_format format = STREAM_PAM;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--stored") == 0)
+		{
+			options.mode = ENCODE_STORED;
+		}
+		else if (strcmp(argv[i], "--fast") == 0)
+		{
+			options.mode = ENCODE_FAST;
+		}
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+		{
+			i++;
+			options.filter = (strcmp(argv[i], "adaptive") == 0) ? FILTER_ADAPTIVE : atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0)
+		{
+			stats = 0;
+		}
+		else if (strcmp(argv[i], "--stats=json") == 0)
+		{
+			stats = 1;
+		}
+		else if (strcmp(argv[i], "--low-memory") == 0)
+		{
+			low_memory = 1;
+		}
+		else if (strcmp(argv[i], "--mapped") == 0)
+		{
+			mapped = 1;
+		}
+		else if (strcmp(argv[i], "--pipelined") == 0)
+		{
+			pipelined = 1;
+		}
+		else if (strcmp(argv[i], "--color") == 0)
+		{
+			color = 1;
+		}
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && parse_stream_format(argv[i + 1]) >= 0)
+		{
+			format = parse_stream_format(argv[++i]);
+		}
+		else if (file_count < 2 && (argv[i][0] != '-' || (file_count == 1 && strcmp(argv[i], "-") == 0)))
+		{
+			files[file_count++] = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			print_usage();
+			return 1;
+		}
+	}
+
+	if(file_count < 2)
+	{
+		fprintf(stderr, "Invalid arguments.\n");
+		print_usage();
+		return 1;
+	}
+
+	if (has_extension(files[0], ".bmp"))
+	{
+		return convert_bmp(files[0], files[1], &options);
+	}
+
+	return convert_png(files[0], files[1], stats, low_memory, mapped, pipelined, color, format);
+}
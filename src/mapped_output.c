@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapped_output.h"
+
+//writeback of the rows is started every this many bytes. the span before it is waited for at the same time,
+//so at most two spans of the output are dirty at once and the kernel never has to throttle the decode to catch up
+#define WRITEBACK_BYTES (64ull << 20)
+
+//state of one decode, handed to the row callback
+typedef struct Mapped_decode
+{
+	png_decoder* decoder;
+	mapped_image* image;
+	const char* filename;
+
+	//bytes of the file whose writeback has been started, and the ones known to be on disk
+	uint64_t started;
+	uint64_t waited;
+	uint64_t filled;
+}mapped_decode;
+
+static int map_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length);
+static int create_output(mapped_decode* state);
+static void write_back(mapped_decode* state, int wait);
+
+mapped_image* decode_to_mapped_file(png_decoder* decoder, const char* input, const char* output, stream_format format)
+{
+	mapped_image* to_return = calloc(1, sizeof(mapped_image));
+	if (to_return == NULL)
+	{
+		return NULL;
+	}
+	to_return->format = format;
+	to_return->fd = -1;
+
+	//the png is read through a mapping as well, so the file isn't copied into memory before the decode
+	int file = open(input, O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		fprintf(stderr, "decode_to_mapped_file: unable to open %s\n", input);
+		if (file >= 0)
+		{
+			close(file);
+		}
+		return to_return;
+	}
+
+	uint8_t* source = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (source == MAP_FAILED)
+	{
+		fprintf(stderr, "decode_to_mapped_file: unable to map %s: %s\n", input, strerror(errno));
+		return to_return;
+	}
+	madvise(source, info.st_size, MADV_SEQUENTIAL);
+
+	mapped_decode state = {decoder, to_return, output, 0, 0, 0};
+	png* decoded = decoder_read_memory_rows(decoder, source, info.st_size, map_row, &state);
+	munmap(source, info.st_size);
+
+	if (decoded->is_valid && to_return->data != NULL)
+	{
+		write_back(&state, 0);
+		to_return->is_valid = 1;
+		return to_return;
+	}
+
+	//the file was created with the first row, a decode that fails before that never made one
+	if (to_return->data != NULL)
+	{
+		munmap(to_return->data, to_return->size);
+		close(to_return->fd);
+		remove(output);
+		to_return->data = NULL;
+		to_return->pixels = NULL;
+		to_return->fd = -1;
+	}
+	return to_return;
+}
+
+void close_mapped_image(mapped_image* image)
+{
+	if (image == NULL)
+	{
+		return;
+	}
+
+	if (image->data != NULL)
+	{
+		munmap(image->data, image->size);
+	}
+	if (image->fd >= 0)
+	{
+		close(image->fd);
+	}
+	free(image);
+}
+
+//the file is made with the first row, once the header is known
+static int map_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length)
+{
+	mapped_decode* state = user;
+	mapped_image* image = state->image;
+	if (image->data == NULL && !create_output(state))
+	{
+		return 0;
+	}
+
+	uint64_t row_size = (uint64_t)image->w * image->bytes_per_pixel;
+	uint8_t* output = image->pixels + row_index * row_size;
+	if (image->bytes_per_pixel == state->decoder->image.bytes_per_pixel)
+	{
+		memcpy(output, row, row_size);
+	}
+	else
+	{
+		//ppm has no alpha channel, so the row is packed down to RGB
+		for (int x = 0; x < image->w; x++)
+		{
+			output[0] = row[0];
+			output[1] = row[1];
+			output[2] = row[2];
+			output += 3;
+			row += state->decoder->image.bytes_per_pixel;
+		}
+	}
+
+	state->filled = (image->pixels - image->data) + (row_index + 1) * row_size;
+	if (state->filled - state->started >= WRITEBACK_BYTES)
+	{
+		write_back(state, 1);
+	}
+	return 1;
+}
+
+static int create_output(mapped_decode* state)
+{
+	mapped_image* image = state->image;
+	png* header = &state->decoder->image;
+	image->w = header->w;
+	image->h = header->h;
+	image->bytes_per_pixel = (image->format == STREAM_PPM) ? 3 : header->bytes_per_pixel;
+
+	char text[STREAM_HEADER_MAX];
+	int header_length = stream_header(text, image->format, image->w, image->h, image->bytes_per_pixel);
+	uint64_t size = header_length + (uint64_t)image->w * image->h * image->bytes_per_pixel;
+
+	image->fd = open(state->filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (image->fd < 0)
+	{
+		fprintf(stderr, "decode_to_mapped_file: unable to create %s: %s\n", state->filename, strerror(errno));
+		return 0;
+	}
+
+	//the blocks are allocated up front: a full disk is an error here instead of a SIGBUS halfway through the rows.
+	//file systems without fallocate get a sparse file
+	int allocated = fallocate(image->fd, 0, 0, size) == 0;
+	if (!allocated && (errno == EOPNOTSUPP || errno == ENOSYS))
+	{
+		allocated = ftruncate(image->fd, size) == 0;
+	}
+	void* data = allocated ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0) : MAP_FAILED;
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "decode_to_mapped_file: unable to map %lu bytes of %s: %s\n", size, state->filename, strerror(errno));
+		close(image->fd);
+		image->fd = -1;
+		remove(state->filename);
+		return 0;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	image->data = data;
+	image->size = size;
+	image->pixels = image->data + header_length;
+	memcpy(image->data, text, header_length);
+	return 1;
+}
+
+//start writeback of everything filled so far. with wait the span started last time is waited for too
+static void write_back(mapped_decode* state, int wait)
+{
+	int fd = state->image->fd;
+	sync_file_range(fd, state->started, state->filled - state->started, SYNC_FILE_RANGE_WRITE);
+	if (wait && state->started > state->waited)
+	{
+		sync_file_range(fd, state->waited, state->started - state->waited, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		state->waited = state->started;
+	}
+	state->started = state->filled;
+}
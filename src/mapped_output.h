@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+#include "pixel_stream.h"
+
+//a decoded image that lives in a shared mapping of a file instead of memory: the header of format followed by the rows,
+//top to bottom, exactly as the file holds them. dirty pages are written back as the decode goes, so an image much bigger
+//than RAM decodes at about the speed the disk writes. the png itself is mapped too (only its compressed data is copied)
+typedef struct Mapped_image
+{
+	int w;
+	int h;
+
+	//of the pixels in the file (3 for ppm, whatever the png has otherwise)
+	uint8_t bytes_per_pixel;
+	stream_format format;
+
+	//the whole file, and where its first row starts
+	uint8_t* data;
+	uint64_t size;
+	uint8_t* pixels;
+
+	int fd;
+	int is_valid;
+}mapped_image;
+
+//decode the png in input into a new file at output (replaced if it exists). a failed decode removes the file
+//and returns an image with is_valid 0. NULL only if nothing could be allocated
+mapped_image* decode_to_mapped_file(png_decoder* decoder, const char* input, const char* output, stream_format format);
+
+//unmap and close the file. it keeps its contents
+void close_mapped_image(mapped_image* image);
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "png.h"
+#include "png_encoder.h"
+#include "corpus.h"
+
+//checks estimate_decode_memory against the memory full decodes really take (the decoder's buffers, from the stats).
+//the estimate may be over by a little, never under. returns the number of images that failed
+
+#define MAX_SIZE 1024
+
+//how far over the estimate may be: the slack the buffers grow by, and a little for small images
+#define ALLOWED_FRACTION 8
+#define ALLOWED_BYTES (64 << 10)
+
+static int check_decode(const char* name, const png* header, uint64_t size, png* decoded, png_decoder* decoder, int from_file)
+{
+	const char* source = from_file ? "file" : "memory";
+	if (!decoded->is_valid)
+	{
+		printf("FAIL %s (%s): decode failed\n", name, source);
+		return 0;
+	}
+
+	uint64_t estimate = estimate_decode_memory(decoder, header, size, DECODE_MODE_FULL, from_file);
+	uint64_t held = decoder->stats.buffer_bytes;
+	if (held > estimate || estimate - held > held / ALLOWED_FRACTION + ALLOWED_BYTES)
+	{
+		printf("FAIL %s (%s): estimated %lu bytes, the decode held %lu\n", name, source, estimate, held);
+		return 0;
+	}
+
+	printf("ok   %s (%s): estimated %lu bytes, the decode held %lu\n", name, source, estimate, held);
+	return 1;
+}
+
+int main()
+{
+	if (!STATS_ENABLED)
+	{
+		fprintf(stderr, "memory_test: needs a build with PNG_STATS\n");
+		return 1;
+	}
+
+	char path[] = "/tmp/png_memory_test_XXXXXX";
+	int file = mkstemp(path);
+	if (file < 0)
+	{
+		fprintf(stderr, "memory_test: unable to create a temporary file\n");
+		return 1;
+	}
+	close(file);
+
+	corpus_entry entries[CORPUS_MAX_ENTRIES];
+	int count = corpus_entries(MAX_SIZE, entries, CORPUS_MAX_ENTRIES);
+	dynamic_array* encoded = create_array();
+	int failed = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		char name[256];
+		corpus_name(&entries[i], name, sizeof(name));
+
+		encode_options options = default_encode_options();
+		options.mode = entries[i].mode;
+		options.filter = entries[i].filter;
+		options.idat_size = entries[i].idat_size;
+
+		png* image = corpus_image(&entries[i]);
+		array_clear(encoded);
+		png header;
+		if (!image->is_valid || !encode_png(image, &options, encoded) || !probe_png_memory(encoded->data, encoded->count, &header))
+		{
+			printf("FAIL %s: unable to encode\n", name);
+			free_png(image);
+			failed++;
+			continue;
+		}
+		free_png(image);
+
+		//a new decoder every time, so its buffers hold what this decode needed and no more
+		png_decoder* decoder = create_decoder();
+		failed += !check_decode(name, &header, encoded->count, decoder_read_memory(decoder, encoded->data, encoded->count), decoder, 0);
+		free_decoder(decoder);
+
+		FILE* output = fopen(path, "wb");
+		int written = output != NULL && fwrite(encoded->data, 1, encoded->count, output) == encoded->count;
+		if (output != NULL && fclose(output) != 0)
+		{
+			written = 0;
+		}
+		if (!written)
+		{
+			printf("FAIL %s: unable to write %s\n", name, path);
+			failed++;
+			continue;
+		}
+
+		decoder = create_decoder();
+		failed += !check_decode(name, &header, encoded->count, decoder_read(decoder, path), decoder, 1);
+		free_decoder(decoder);
+	}
+
+	free_array(encoded);
+	remove(path);
+	printf("%d of %d decodes within the estimate\n", 2 * count - failed, 2 * count);
+	return failed;
+}
@@ -0,0 +1,265 @@
+#include "metadata.h"
+#include "checksum.h"
+
+static uint64_t string_length(const uint8_t* data, uint64_t size);
+static uint32_t read_u32(const uint8_t* data);
+
+int64_t png_find_text(png_decoder* decoder, uint64_t first)
+{
+	uint64_t count = decoder_chunk_count(decoder);
+	for (uint64_t i = first; i < count; i++)
+	{
+		const char* type = decoder_chunk(decoder, i)->type;
+		if (strcmp(type, "tEXt") == 0 || strcmp(type, "zTXt") == 0 || strcmp(type, "iTXt") == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+//buffer ends up as keyword\0language\0translated keyword\0text\0 (the strings point into it once it's done)
+int png_get_text(png_decoder* decoder, uint64_t index, png_text* text, dynamic_array* buffer)
+{
+	png_chunk* chunk = decoder_chunk(decoder, index);
+	const uint8_t* data = decoder_chunk_data(decoder, index);
+	if (chunk == NULL || data == NULL)
+	{
+		return 0;
+	}
+	uint64_t size = chunk->length;
+
+	//keyword is 1-79 bytes followed by a NUL
+	uint64_t keyword_length = string_length(data, size);
+	if (keyword_length == 0 || keyword_length > 79 || keyword_length == size)
+	{
+		fprintf(stderr, "png_get_text: %s chunk has no valid keyword\n", chunk->type);
+		return 0;
+	}
+	uint64_t position = keyword_length + 1;
+
+	int compressed = 0;
+	uint64_t language_offset = 0;
+	uint64_t language_length = 0;
+	uint64_t translated_offset = 0;
+	uint64_t translated_length = 0;
+	if (strcmp(chunk->type, "zTXt") == 0)
+	{
+		//compression method (only 0, zlib)
+		if (position >= size || data[position] != 0)
+		{
+			fprintf(stderr, "png_get_text: zTXt chunk uses an unknown compression method\n");
+			return 0;
+		}
+		compressed = 1;
+		position++;
+	}
+	else if (strcmp(chunk->type, "iTXt") == 0)
+	{
+		//compression flag and method, then the language tag and translated keyword (both NUL terminated)
+		if (size - position < 2 || data[position] > 1 || data[position + 1] != 0)
+		{
+			fprintf(stderr, "png_get_text: iTXt chunk has an unknown compression flag or method\n");
+			return 0;
+		}
+		compressed = data[position];
+		position += 2;
+
+		language_offset = position;
+		language_length = string_length(data + position, size - position);
+		position += language_length + 1;
+		translated_offset = position;
+		translated_length = (position < size) ? string_length(data + position, size - position) : 0;
+		position += translated_length + 1;
+		if (position > size)
+		{
+			fprintf(stderr, "png_get_text: iTXt chunk is cut off\n");
+			return 0;
+		}
+	}
+	else if (strcmp(chunk->type, "tEXt") != 0)
+	{
+		return 0;
+	}
+
+	//the decompressed text goes first so inflating doesn't have to work around the other strings
+	array_clear(buffer);
+	uint64_t text_length = size - position;
+	if (compressed)
+	{
+		if (!decoder_inflate(decoder, data + position, size - position, buffer, METADATA_MAX_BYTES))
+		{
+			return 0;
+		}
+		text_length = buffer->count;
+	}
+	else if (!array_add(buffer, data + position, text_length))
+	{
+		return 0;
+	}
+
+	uint8_t end = 0;
+	uint64_t keyword_at = buffer->count + 1;
+	uint64_t language_at = keyword_at + keyword_length + 1;
+	uint64_t translated_at = language_at + language_length + 1;
+	int added = array_add(buffer, &end, 1)
+		&& array_add(buffer, data, keyword_length) && array_add(buffer, &end, 1)
+		&& array_add(buffer, data + language_offset, language_length) && array_add(buffer, &end, 1)
+		&& array_add(buffer, data + translated_offset, translated_length) && array_add(buffer, &end, 1);
+	if (!added)
+	{
+		return 0;
+	}
+
+	text->text = (const char*)buffer->data;
+	text->text_length = text_length;
+	text->keyword = (const char*)buffer->data + keyword_at;
+	text->language = (const char*)buffer->data + language_at;
+	text->translated_keyword = (const char*)buffer->data + translated_at;
+	return 1;
+}
+
+int png_get_icc_profile(png_decoder* decoder, png_icc_profile* profile, dynamic_array* buffer)
+{
+	int64_t index = decoder_find_chunk(decoder, "iCCP", 0);
+	const uint8_t* data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (data == NULL)
+	{
+		return 0;
+	}
+	uint64_t size = decoder_chunk(decoder, index)->length;
+
+	//profile name, NUL, compression method (only 0), zlib stream
+	uint64_t name_length = string_length(data, size);
+	if (name_length == 0 || name_length > 79 || size - name_length < 2 || data[name_length + 1] != 0)
+	{
+		fprintf(stderr, "png_get_icc_profile: iCCP chunk has no valid name or an unknown compression method\n");
+		return 0;
+	}
+
+	//the name goes after the profile
+	uint8_t end = 0;
+	if (!decoder_inflate(decoder, data + name_length + 2, size - name_length - 2, buffer, METADATA_MAX_BYTES))
+	{
+		return 0;
+	}
+	uint64_t length = buffer->count;
+	if (!array_add(buffer, data, name_length) || !array_add(buffer, &end, 1))
+	{
+		return 0;
+	}
+
+	profile->profile = buffer->data;
+	profile->length = length;
+	profile->name = (const char*)buffer->data + length;
+	return 1;
+}
+
+int png_get_physical(png_decoder* decoder, png_physical* physical)
+{
+	int64_t index = decoder_find_chunk(decoder, "pHYs", 0);
+	const uint8_t* data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (data == NULL || decoder_chunk(decoder, index)->length != 9)
+	{
+		return 0;
+	}
+
+	physical->x_pixels_per_unit = read_u32(data);
+	physical->y_pixels_per_unit = read_u32(data + 4);
+	physical->unit = data[8];
+	return 1;
+}
+
+int png_get_chromaticities(png_decoder* decoder, png_chromaticities* chromaticities)
+{
+	int64_t index = decoder_find_chunk(decoder, "cHRM", 0);
+	const uint8_t* data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (data == NULL || decoder_chunk(decoder, index)->length != 32)
+	{
+		return 0;
+	}
+
+	chromaticities->white_x = read_u32(data);
+	chromaticities->white_y = read_u32(data + 4);
+	chromaticities->red_x = read_u32(data + 8);
+	chromaticities->red_y = read_u32(data + 12);
+	chromaticities->green_x = read_u32(data + 16);
+	chromaticities->green_y = read_u32(data + 20);
+	chromaticities->blue_x = read_u32(data + 24);
+	chromaticities->blue_y = read_u32(data + 28);
+	return 1;
+}
+
+int png_get_gamma(png_decoder* decoder, uint32_t* gamma)
+{
+	int64_t index = decoder_find_chunk(decoder, "gAMA", 0);
+	const uint8_t* data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (data == NULL || decoder_chunk(decoder, index)->length != 4 || read_u32(data) == 0)
+	{
+		return 0;
+	}
+
+	*gamma = read_u32(data);
+	return 1;
+}
+
+int png_get_srgb(png_decoder* decoder, uint8_t* intent)
+{
+	int64_t index = decoder_find_chunk(decoder, "sRGB", 0);
+	const uint8_t* data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (data == NULL || decoder_chunk(decoder, index)->length != 1 || data[0] > 3)
+	{
+		return 0;
+	}
+
+	*intent = data[0];
+	return 1;
+}
+
+int png_get_exif(png_decoder* decoder, const uint8_t** data, uint64_t* length)
+{
+	int64_t index = decoder_find_chunk(decoder, "eXIf", 0);
+	const uint8_t* chunk_data = (index >= 0) ? decoder_chunk_data(decoder, index) : NULL;
+	if (chunk_data == NULL)
+	{
+		return 0;
+	}
+
+	*data = chunk_data;
+	*length = decoder_chunk(decoder, index)->length;
+	return 1;
+}
+
+int png_check_crc(png_decoder* decoder, uint64_t index)
+{
+	png_chunk* chunk = decoder_chunk(decoder, index);
+	if (chunk == NULL)
+	{
+		return CHUNK_CRC_MISSING;
+	}
+
+	//the CRC covers the type and the data, and sits right after the data
+	const uint8_t* data = decoder_chunk_data(decoder, index);
+	if (data == NULL || decoder->source_size - chunk->offset - chunk->length < 4)
+	{
+		chunk->crc_status = CHUNK_CRC_MISSING;
+		return chunk->crc_status;
+	}
+
+	uint32_t crc = crc32_update(0, data - 4, chunk->length + 4);
+	chunk->crc_status = (crc == read_u32(data + chunk->length)) ? CHUNK_CRC_OK : CHUNK_CRC_BAD;
+	return chunk->crc_status;
+}
+
+//length of the NUL terminated string at data (size if there is no NUL)
+static uint64_t string_length(const uint8_t* data, uint64_t size)
+{
+	const uint8_t* end = memchr(data, 0, size);
+	return (end != NULL) ? (uint64_t)(end - data) : size;
+}
+
+//numbers in chunks are big endian
+static uint32_t read_u32(const uint8_t* data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
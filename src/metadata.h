@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+
+//lazy access to the ancillary chunks of the last decode. nothing is parsed or decompressed until one of these is called
+//everything works after decoder_read_info, which skips the image data entirely
+
+//compressed metadata (zTXt, iTXt, iCCP) is refused past this size
+#define METADATA_MAX_BYTES (64 << 20)
+
+//a tEXt, zTXt or iTXt chunk. the strings are NUL terminated and live in the buffer passed in
+typedef struct Png_text
+{
+	const char* keyword;
+
+	//iTXt only (empty for the other two)
+	const char* language;
+	const char* translated_keyword;
+
+	//latin-1 for tEXt and zTXt, utf-8 for iTXt. always decompressed
+	const char* text;
+	uint64_t text_length;
+}png_text;
+
+//iCCP chunk. the profile is decompressed into the buffer passed in
+typedef struct Png_icc_profile
+{
+	const char* name;
+	const uint8_t* profile;
+	uint64_t length;
+}png_icc_profile;
+
+//pHYs chunk. unit 1 is meters, 0 means only the aspect ratio is known
+typedef struct Png_physical
+{
+	uint32_t x_pixels_per_unit;
+	uint32_t y_pixels_per_unit;
+	uint8_t unit;
+}png_physical;
+
+//cHRM chunk: CIE xy chromaticities of the white point and the three primaries, as stored times 100000
+typedef struct Png_chromaticities
+{
+	uint32_t white_x;
+	uint32_t white_y;
+	uint32_t red_x;
+	uint32_t red_y;
+	uint32_t green_x;
+	uint32_t green_y;
+	uint32_t blue_x;
+	uint32_t blue_y;
+}png_chromaticities;
+
+//index of the next text chunk (tEXt, zTXt or iTXt) at or after first, -1 if there is none
+int64_t png_find_text(png_decoder* decoder, uint64_t first);
+
+//read the text chunk at index (from png_find_text) into text. 1 is success, 0 is failure
+int png_get_text(png_decoder* decoder, uint64_t index, png_text* text, dynamic_array* buffer);
+
+//1 if the chunk is there and valid, 0 otherwise
+int png_get_icc_profile(png_decoder* decoder, png_icc_profile* profile, dynamic_array* buffer);
+int png_get_physical(png_decoder* decoder, png_physical* physical);
+int png_get_chromaticities(png_decoder* decoder, png_chromaticities* chromaticities);
+
+//gAMA chunk: the gamma the image was encoded with, times 100000 (45455 is 1 / 2.2)
+int png_get_gamma(png_decoder* decoder, uint32_t* gamma);
+
+//sRGB chunk: the rendering intent (0 perceptual, 1 relative colorimetric, 2 saturation, 3 absolute colorimetric)
+int png_get_srgb(png_decoder* decoder, uint8_t* intent);
+
+//eXIf data points straight into the file data (valid until the next decode)
+int png_get_exif(png_decoder* decoder, const uint8_t** data, uint64_t* length);
+
+//check the CRC of the chunk at index (the result is kept in the index). returns the new crc_status
+int png_check_crc(png_decoder* decoder, uint64_t index);
@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+//the decoder's static helpers are benchmarked directly, so png.c is compiled into this file
+#include "png.c"
+
+//microbenchmarks for the decoder's inner loops. each case is warmed up once, then timed over
+//several runs on a pinned cpu. output is one JSON object per line with the min and median cost per unit
+
+#define STREAM_BYTES (1 << 20)
+#define FILTER_WIDTH 1024
+#define FILTER_HEIGHT 256
+
+typedef void (*micro_function)(void* state);
+
+typedef struct Micro_options
+{
+	int runs;
+	const char* only;
+}micro_options;
+
+//state for the bit reading and huffman cases
+typedef struct Bit_state
+{
+	dynamic_array* data;
+	bit_stream stream;
+	uint8_t width;
+	node* tree;
+	const uint32_t* table;
+	uint32_t table_bits;
+	uint64_t symbols;
+}bit_state;
+
+typedef struct Tree_state
+{
+	uint32_t* code_lengths;
+	node_pool pool;
+	int use_pool;
+	uint32_t* table;
+}tree_state;
+
+typedef struct Copy_state
+{
+	dynamic_array* output;
+	const int32_t* lengths;
+	const int32_t* distances;
+	int count;
+	uint64_t copied;
+}copy_state;
+
+typedef struct Filter_state
+{
+	png image;
+	dynamic_array* filtered;
+	decode_stats stats;
+}filter_state;
+
+static double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+//xorshift32, seeded the same way every time so runs are comparable
+static uint32_t next_random(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static dynamic_array* random_stream(uint64_t size, uint32_t seed)
+{
+	dynamic_array* to_return = create_array();
+	array_reserve(to_return, size);
+	for (uint64_t i = 0; i < size; i++)
+	{
+		to_return->data[i] = next_random(&seed);
+	}
+	to_return->count = size;
+	return to_return;
+}
+
+//random fixed distance codes (5 bits each, read most significant bit first). codes 30 and 31 don't exist,
+//so random bits can't be used for this tree
+static dynamic_array* distance_stream(uint64_t size, uint32_t seed)
+{
+	dynamic_array* to_return = create_array();
+	array_reserve(to_return, size);
+
+	uint32_t buffer = 0;
+	uint32_t buffered_bits = 0;
+	while (to_return->count < size)
+	{
+		uint32_t code = next_random(&seed) % 30;
+		for (int bit = 4; bit >= 0; bit--)
+		{
+			buffer |= ((code >> bit) & 1) << buffered_bits;
+			buffered_bits++;
+		}
+
+		while (buffered_bits >= 8 && to_return->count < size)
+		{
+			to_return->data[to_return->count++] = buffer;
+			buffer >>= 8;
+			buffered_bits -= 8;
+		}
+	}
+
+	return to_return;
+}
+
+//run once to warm up, then time options->runs runs. units is the work done by one run
+static void measure(const micro_options* options, const char* bench, const char* name, const char* unit, micro_function function, void* state, const uint64_t* units)
+{
+	if (options->only != NULL && strstr(bench, options->only) == NULL)
+	{
+		return;
+	}
+
+	function(state);
+
+	double* times = malloc(options->runs * sizeof(double));
+	for (int i = 0; i < options->runs; i++)
+	{
+		double start = now_seconds();
+		function(state);
+		times[i] = now_seconds() - start;
+	}
+	qsort(times, options->runs, sizeof(double), compare_doubles);
+
+	//units is read after the runs for cases that only know their work once they have run
+	double scale = 1e9 / (double)*units;
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"unit\":\"%s\",\"units\":%lu,\"runs\":%d,\"ns_per_unit_min\":%.4f,\"ns_per_unit_median\":%.4f}\n",
+		bench, name, unit, *units, options->runs, times[0] * scale, times[options->runs / 2] * scale);
+	fflush(stdout);
+	free(times);
+}
+
+static void pull_bits_run(void* arg)
+{
+	bit_state* state = arg;
+	bit_stream* stream = &state->stream;
+	bits_init(stream, state->data->data, state->data->count);
+
+	//the sum keeps the compiler from dropping the calls
+	volatile uint32_t sink = 0;
+	uint32_t sum = 0;
+	uint64_t end = stream->size - 4;
+	while (stream->byte_position < end)
+	{
+		sum += pull_bits(stream, state->width);
+	}
+	sink = sum;
+	(void)sink;
+}
+
+static void get_symbol_run(void* arg)
+{
+	bit_state* state = arg;
+	bit_stream* stream = &state->stream;
+	bits_init(stream, state->data->data, state->data->count);
+
+	uint64_t symbols = 0;
+	uint64_t end = stream->size - 4;
+	while (stream->byte_position < end)
+	{
+		if (get_symbol(stream, state->tree) < 0)
+		{
+			break;
+		}
+		symbols++;
+	}
+	state->symbols = symbols;
+}
+
+static void table_symbol_run(void* arg)
+{
+	bit_state* state = arg;
+	bit_stream* stream = &state->stream;
+	bits_init(stream, state->data->data, state->data->count);
+
+	uint64_t symbols = 0;
+	uint64_t end = stream->size - 4;
+	while (stream->byte_position < end)
+	{
+		//only bit patterns no code starts with have no length (symbols like 286 still count)
+		if (ENTRY_LENGTH(read_entry(stream, state->table, state->table_bits)) == 0)
+		{
+			break;
+		}
+		symbols++;
+	}
+	state->symbols = symbols;
+}
+
+static void table_run(void* arg)
+{
+	tree_state* state = arg;
+	for (int i = 0; i < 100; i++)
+	{
+		build_huffman_table(state->table, state->code_lengths, 286, LITERAL_ALPHABET);
+	}
+}
+
+static void tree_run(void* arg)
+{
+	tree_state* state = arg;
+	for (int i = 0; i < 100; i++)
+	{
+		if (state->use_pool)
+		{
+			pool_dynamic_tree(&state->pool, state->code_lengths, 286);
+		}
+		else
+		{
+			free_tree(create_dynamic_tree(state->code_lengths, 286));
+		}
+	}
+}
+
+static void copy_run(void* arg)
+{
+	copy_state* state = arg;
+	dynamic_array* output = state->output;
+
+	//the first 32K is history for the copies to point back into
+	output->count = 32768;
+	state->copied = 0;
+	while (output->count + 258 < output->capacity)
+	{
+		for (int i = 0; i < state->count && output->count + 258 < output->capacity; i++)
+		{
+			handle_length_copy(output, state->lengths[i], state->distances[i]);
+			state->copied += state->lengths[i];
+		}
+	}
+}
+
+static void filter_run(void* arg)
+{
+	filter_state* state = arg;
+	array_clear(state->image.pixel_data);
+	handle_filter(&state->image, state->filtered, NULL, NULL, &state->stats);
+}
+
+static void bench_pull_bits(const micro_options* options)
+{
+	static const uint8_t widths[] = {1, 2, 3, 5, 7, 8, 13, 16};
+
+	bit_state state;
+	memset(&state, 0, sizeof(state));
+	state.data = random_stream(STREAM_BYTES, 1);
+
+	uint64_t units = STREAM_BYTES - 4;
+	for (int i = 0; i < sizeof(widths); i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "bits=%u", widths[i]);
+		state.width = widths[i];
+		measure(options, "pull_bits", name, "byte", pull_bits_run, &state, &units);
+	}
+
+	free_array(state.data);
+}
+
+//a complete code with a realistic spread of lengths: every symbol starts at 9 bits and the first ones are shortened
+//while the lengths still fit. random bits then decode to each symbol with probability 2^-length
+static void skewed_lengths(uint32_t* code_lengths, int count)
+{
+	int32_t remaining = 1 << MAX_CODE_LENGTH;
+	for (int i = 0; i < count; i++)
+	{
+		code_lengths[i] = 9;
+		remaining -= 1 << (MAX_CODE_LENGTH - 9);
+	}
+
+	while (remaining > 0)
+	{
+		for (int i = 0; i < count && remaining > 0; i++)
+		{
+			int32_t gain = 1 << (MAX_CODE_LENGTH - code_lengths[i]);
+			if (code_lengths[i] > 1 && gain <= remaining)
+			{
+				code_lengths[i]--;
+				remaining -= gain;
+			}
+		}
+	}
+}
+
+static void bench_get_symbol(const micro_options* options)
+{
+	bit_state state;
+	memset(&state, 0, sizeof(state));
+	state.data = random_stream(STREAM_BYTES, 2);
+
+	//the fixed literal code is complete, so random bits are always a valid stream of symbols
+	state.tree = static_symbol();
+	state.table = get_static_tables()->literal_table;
+	state.table_bits = LITERAL_TABLE_BITS;
+	measure(options, "get_symbol", "fixed_literal", "symbol", get_symbol_run, &state, &state.symbols);
+	measure(options, "table_symbol", "fixed_literal", "symbol", table_symbol_run, &state, &state.symbols);
+	free_tree(state.tree);
+
+	dynamic_array* random_bits = state.data;
+	state.data = distance_stream(STREAM_BYTES, 3);
+	state.tree = static_distance();
+	state.table = get_static_tables()->distance_table;
+	state.table_bits = DISTANCE_TABLE_BITS;
+	measure(options, "get_symbol", "fixed_distance", "symbol", get_symbol_run, &state, &state.symbols);
+	measure(options, "table_symbol", "fixed_distance", "symbol", table_symbol_run, &state, &state.symbols);
+	free_tree(state.tree);
+	free_array(state.data);
+	state.data = random_bits;
+
+	uint32_t* table = malloc(LITERAL_TABLE_SIZE * sizeof(uint32_t));
+	uint32_t code_lengths[286];
+	skewed_lengths(code_lengths, 286);
+	state.tree = create_dynamic_tree(code_lengths, 286);
+	build_huffman_table(table, code_lengths, 286, LITERAL_ALPHABET);
+	state.table = table;
+	state.table_bits = LITERAL_TABLE_BITS;
+	measure(options, "get_symbol", "dynamic_literal", "symbol", get_symbol_run, &state, &state.symbols);
+	measure(options, "table_symbol", "dynamic_literal", "symbol", table_symbol_run, &state, &state.symbols);
+	free_tree(state.tree);
+
+	skewed_lengths(code_lengths, 30);
+	state.tree = create_dynamic_tree(code_lengths, 30);
+	build_huffman_table(table, code_lengths, 30, DISTANCE_ALPHABET);
+	state.table_bits = DISTANCE_TABLE_BITS;
+	measure(options, "get_symbol", "dynamic_distance", "symbol", get_symbol_run, &state, &state.symbols);
+	measure(options, "table_symbol", "dynamic_distance", "symbol", table_symbol_run, &state, &state.symbols);
+	free_tree(state.tree);
+
+	free(table);
+	free_array(state.data);
+}
+
+static void bench_create_tree(const micro_options* options)
+{
+	uint32_t code_lengths[286];
+	skewed_lengths(code_lengths, 286);
+
+	tree_state state;
+	memset(&state, 0, sizeof(state));
+	state.code_lengths = code_lengths;
+
+	uint64_t units = 100;
+	state.use_pool = 0;
+	measure(options, "create_dynamic_tree", "malloc", "tree", tree_run, &state, &units);
+	state.use_pool = 1;
+	measure(options, "create_dynamic_tree", "node_pool", "tree", tree_run, &state, &units);
+	state.table = malloc(LITERAL_TABLE_SIZE * sizeof(uint32_t));
+	measure(options, "create_dynamic_tree", "table", "tree", table_run, &state, &units);
+	free(state.table);
+
+	free_node_pool(&state.pool);
+}
+
+static void bench_length_copy(const micro_options* options)
+{
+	//single byte runs, pixel sized repeats, short and long matches, and far matches at the edge of the window
+	static const int32_t rle_lengths[] = {258};
+	static const int32_t rle_distances[] = {1};
+	static const int32_t pixel_lengths[] = {12, 32, 64};
+	static const int32_t pixel_distances[] = {3, 4, 4};
+	static const int32_t short_lengths[] = {3, 4, 5, 6, 8};
+	static const int32_t short_distances[] = {100, 2000, 37, 900, 4000};
+	static const int32_t long_lengths[] = {258, 200, 130};
+	static const int32_t long_distances[] = {32768, 20000, 5000};
+
+	copy_state state;
+	memset(&state, 0, sizeof(state));
+	state.output = random_stream(32768, 3);
+	array_reserve(state.output, 32768 + STREAM_BYTES);
+
+	struct
+	{
+		const char* name;
+		const int32_t* lengths;
+		const int32_t* distances;
+		int count;
+	}mixes[] =
+	{
+		{"rle_d1_l258", rle_lengths, rle_distances, 1},
+		{"pixel_d3_d4", pixel_lengths, pixel_distances, 3},
+		{"short_l3_l8", short_lengths, short_distances, 5},
+		{"long_far", long_lengths, long_distances, 3}
+	};
+
+	for (int i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++)
+	{
+		state.lengths = mixes[i].lengths;
+		state.distances = mixes[i].distances;
+		state.count = mixes[i].count;
+		measure(options, "handle_length_copy", mixes[i].name, "byte", copy_run, &state, &state.copied);
+	}
+
+	free_array(state.output);
+}
+
+static void bench_filter(const micro_options* options)
+{
+	static const char* filter_names[] = {"none", "sub", "up", "average", "paeth"};
+
+	for (uint8_t bytes_per_pixel = 3; bytes_per_pixel <= 4; bytes_per_pixel++)
+	{
+		filter_state state;
+		memset(&state, 0, sizeof(state));
+		state.image.w = FILTER_WIDTH;
+		state.image.h = FILTER_HEIGHT;
+		state.image.bytes_per_pixel = bytes_per_pixel;
+		state.image.pixel_data = create_array();
+
+		uint64_t row_size = FILTER_WIDTH * bytes_per_pixel;
+		uint64_t units = row_size * FILTER_HEIGHT;
+		array_reserve(state.image.pixel_data, units);
+		state.filtered = random_stream((row_size + 1) * FILTER_HEIGHT, 4 + bytes_per_pixel);
+
+		for (uint8_t filter = FILTER_NONE; filter <= FILTER_PAETH; filter++)
+		{
+			for (int y = 0; y < FILTER_HEIGHT; y++)
+			{
+				state.filtered->data[y * (row_size + 1)] = filter;
+			}
+
+			char name[32];
+			snprintf(name, sizeof(name), "%s_bpp%u", filter_names[filter], bytes_per_pixel);
+			measure(options, "handle_filter", name, "byte", filter_run, &state, &units);
+		}
+
+		free_array(state.filtered);
+		free_array(state.image.pixel_data);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	micro_options options;
+	options.runs = 11;
+	options.only = NULL;
+	int cpu = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			options.runs = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc)
+		{
+			cpu = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+		{
+			options.only = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "Example usage: png_microbench [--runs N] [--cpu N] [--only bench_name]\n");
+			return 1;
+		}
+	}
+	if (options.runs < 1)
+	{
+		options.runs = 1;
+	}
+
+	//pinning keeps the scheduler from moving the benchmark between cores (and caches) mid run
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+	{
+		fprintf(stderr, "png_microbench: failed to pin to cpu %d, running unpinned\n", cpu);
+	}
+
+	bench_pull_bits(&options);
+	bench_get_symbol(&options);
+	bench_create_tree(&options);
+	bench_length_copy(&options);
+	bench_filter(&options);
+
+	return 0;
+}
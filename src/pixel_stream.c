@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "pixel_stream.h"
+
+//size of each buffer when the output isn't a pipe, and the pipe size asked for when it is
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+static int add_bytes(pixel_stream* stream, const uint8_t* data, uint64_t length);
+static int flush_buffer(pixel_stream* stream);
+static int write_all(int fd, const uint8_t* data, uint64_t length);
+static int splice_all(pixel_stream* stream, const uint8_t* data, uint64_t length);
+
+pixel_stream* open_pixel_stream(int fd, stream_format format, int width, int height, uint8_t bytes_per_pixel)
+{
+	pixel_stream* to_return = calloc(1, sizeof(pixel_stream));
+	if (to_return == NULL)
+	{
+		return NULL;
+	}
+
+	to_return->fd = fd;
+	to_return->format = format;
+	to_return->width = width;
+	to_return->height = height;
+	to_return->bytes_per_pixel = bytes_per_pixel;
+	to_return->buffer_size = STREAM_BUFFER_SIZE;
+	to_return->is_valid = 1;
+
+	//a spliced buffer is only safe to fill again once the pipe has taken a whole pipe's worth of data after it.
+	//with buffers exactly the size of the pipe, the other buffer going in completely means this one has been read
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode))
+	{
+		fcntl(fd, F_SETPIPE_SZ, STREAM_BUFFER_SIZE);
+		int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+		long page_size = sysconf(_SC_PAGESIZE);
+		if (pipe_size > 0 && page_size > 0 && pipe_size % page_size == 0)
+		{
+			to_return->buffer_size = pipe_size;
+			to_return->use_vmsplice = 1;
+		}
+	}
+
+	//buffers come straight from mmap: the pipe keeps its own references to spliced pages, so unmapping
+	//them at close is safe even if the reader hasn't gotten to them yet (handing them back to malloc is not)
+	for (int i = 0; i < 2; i++)
+	{
+		void* buffer = mmap(NULL, to_return->buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		to_return->buffers[i] = (buffer != MAP_FAILED) ? buffer : NULL;
+	}
+	if (format == STREAM_PPM && bytes_per_pixel != 3)
+	{
+		to_return->row = malloc((uint64_t)width * 3);
+	}
+	if (to_return->buffers[0] == NULL || to_return->buffers[1] == NULL || (format == STREAM_PPM && bytes_per_pixel != 3 && to_return->row == NULL))
+	{
+		fprintf(stderr, "open_pixel_stream: unable to allocate output buffers\n");
+		to_return->is_valid = 0;
+		close_pixel_stream(to_return);
+		return NULL;
+	}
+
+	char header[STREAM_HEADER_MAX];
+	int header_length = stream_header(header, format, width, height, bytes_per_pixel);
+	add_bytes(to_return, (const uint8_t*)header, header_length);
+
+	return to_return;
+}
+
+int pixel_stream_row(pixel_stream* stream, const void* pixels)
+{
+	if (!stream->is_valid || stream->rows_written >= stream->height)
+	{
+		stream->is_valid = 0;
+		return 0;
+	}
+	stream->rows_written++;
+
+	const uint8_t* source = pixels;
+	uint64_t row_size = (uint64_t)stream->width * stream->bytes_per_pixel;
+	if (stream->format != STREAM_PPM || stream->bytes_per_pixel == 3)
+	{
+		return add_bytes(stream, source, row_size);
+	}
+
+	//ppm has no alpha channel, so the row is packed down to RGB first
+	uint8_t* output = stream->row;
+	for (int x = 0; x < stream->width; x++)
+	{
+		output[0] = source[0];
+		output[1] = source[1];
+		output[2] = source[2];
+		output += 3;
+		source += stream->bytes_per_pixel;
+	}
+	return add_bytes(stream, stream->row, (uint64_t)stream->width * 3);
+}
+
+int close_pixel_stream(pixel_stream* stream)
+{
+	if (stream->is_valid && stream->used > 0)
+	{
+		flush_buffer(stream);
+	}
+
+	int to_return = stream->is_valid && stream->rows_written == stream->height;
+	for (int i = 0; i < 2; i++)
+	{
+		if (stream->buffers[i] != NULL)
+		{
+			munmap(stream->buffers[i], stream->buffer_size);
+		}
+	}
+	free(stream->row);
+	free(stream);
+
+	return to_return;
+}
+
+int stream_header(char* output, stream_format format, int width, int height, uint8_t bytes_per_pixel)
+{
+	if (format == STREAM_PAM)
+	{
+		return snprintf(output, STREAM_HEADER_MAX, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+			width, height, bytes_per_pixel, (bytes_per_pixel == 4) ? "RGB_ALPHA" : "RGB");
+	}
+	if (format == STREAM_PPM)
+	{
+		return snprintf(output, STREAM_HEADER_MAX, "P6\n%d %d\n255\n", width, height);
+	}
+	return 0;
+}
+
+int parse_stream_format(const char* name)
+{
+	if (strcmp(name, "raw") == 0)
+	{
+		return STREAM_RAW;
+	}
+	if (strcmp(name, "pam") == 0)
+	{
+		return STREAM_PAM;
+	}
+	if (strcmp(name, "ppm") == 0)
+	{
+		return STREAM_PPM;
+	}
+	return -1;
+}
+
+//copy into the buffers, sending each one off as soon as it is full (so every splice but the last is a full buffer)
+static int add_bytes(pixel_stream* stream, const uint8_t* data, uint64_t length)
+{
+	while (length > 0 && stream->is_valid)
+	{
+		uint64_t count = stream->buffer_size - stream->used;
+		if (count > length)
+		{
+			count = length;
+		}
+		memcpy(stream->buffers[stream->current] + stream->used, data, count);
+		stream->used += count;
+		data += count;
+		length -= count;
+
+		if (stream->used == stream->buffer_size)
+		{
+			flush_buffer(stream);
+		}
+	}
+
+	return stream->is_valid;
+}
+
+static int flush_buffer(pixel_stream* stream)
+{
+	const uint8_t* buffer = stream->buffers[stream->current];
+	int written = stream->use_vmsplice ? splice_all(stream, buffer, stream->used) : write_all(stream->fd, buffer, stream->used);
+	if (!written)
+	{
+		fprintf(stderr, "pixel_stream: write failed: %s\n", strerror(errno));
+		stream->is_valid = 0;
+		return 0;
+	}
+
+	stream->bytes_written += stream->used;
+	stream->used = 0;
+	stream->current ^= 1;
+	return 1;
+}
+
+static int write_all(int fd, const uint8_t* data, uint64_t length)
+{
+	while (length > 0)
+	{
+		ssize_t written = write(fd, data, length);
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (written <= 0)
+		{
+			return 0;
+		}
+		data += written;
+		length -= written;
+	}
+	return 1;
+}
+
+//pipes that don't support vmsplice (or a kernel without it) fall back to plain writes for the rest of the stream
+static int splice_all(pixel_stream* stream, const uint8_t* data, uint64_t length)
+{
+	while (length > 0)
+	{
+		struct iovec piece = {(void*)data, length};
+		ssize_t spliced = vmsplice(stream->fd, &piece, 1, 0);
+		if (spliced < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (spliced < 0 && (errno == EINVAL || errno == ENOSYS))
+		{
+			stream->use_vmsplice = 0;
+			return write_all(stream->fd, data, length);
+		}
+		if (spliced <= 0)
+		{
+			return 0;
+		}
+		data += spliced;
+		length -= spliced;
+	}
+	return 1;
+}
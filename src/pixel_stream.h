@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+//longest header stream_header writes, including the terminating 0
+#define STREAM_HEADER_MAX 128
+
+typedef enum Stream_format
+{
+	//pixels only, RGB or RGBA rows top to bottom
+	STREAM_RAW = 0,
+
+	//netpbm P7 header (RGB or RGB_ALPHA) followed by the raw pixels
+	STREAM_PAM = 1,
+
+	//netpbm P6 header followed by RGB pixels (alpha is dropped)
+	STREAM_PPM = 2
+}stream_format;
+
+//writes an image to a file descriptor one row at a time, in order, so nothing but a couple of buffers is in memory
+//rows are batched into large writes. when the descriptor is a pipe the buffers are handed to it with vmsplice
+//instead, so the consumer reads them without a copy and decoding overlaps with whatever reads the pipe
+typedef struct Pixel_stream
+{
+	int fd;
+	stream_format format;
+	int width;
+	int height;
+	uint8_t bytes_per_pixel;
+	int rows_written;
+
+	//two page aligned buffers of buffer_size bytes, current is being filled with used bytes
+	uint8_t* buffers[2];
+	int current;
+	uint64_t buffer_size;
+	uint64_t used;
+
+	//RGB copy of a row, only for ppm from RGBA
+	uint8_t* row;
+
+	//1 while buffers go to a pipe through vmsplice
+	int use_vmsplice;
+
+	uint64_t bytes_written;
+
+	//0 once any write failed
+	int is_valid;
+}pixel_stream;
+
+//fd stays open (and owned by the caller). NULL if the buffers can't be allocated
+pixel_stream* open_pixel_stream(int fd, stream_format format, int width, int height, uint8_t bytes_per_pixel);
+//pixels is the next RGB or RGBA row of the image. 1 is success, 0 is failure
+int pixel_stream_row(pixel_stream* stream, const void* pixels);
+//flush what's left. 1 if every row was written
+int close_pixel_stream(pixel_stream* stream);
+
+//write the header of format (nothing for raw) into output, which holds STREAM_HEADER_MAX bytes. returns its length
+int stream_header(char* output, stream_format format, int width, int height, uint8_t bytes_per_pixel);
+
+//"raw", "pam" or "ppm" to a format. -1 if name is none of them
+int parse_stream_format(const char* name);
@@ -1,38 +1,235 @@
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "png.h"
+#include "png_index.h"
+#include "color.h"
 
 //PNG file signature to compare against
 static const char png_signature[9] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
 
-//hand-coded lookup tables for symbols 257-285 (lengths)
-static uint32_t length_values[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
-static uint32_t length_extra_bits[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+//bytes needed to probe a png: signature, chunk length and type, IHDR and its CRC
+#define PROBE_BYTES 33
+
+//smallest amount of inflated data a row decode collects before it unfilters and hands out rows
+#define ROW_FLUSH_BYTES (1 << 18)
+
+//a pipelined decode keeps about this many bytes of filtered rows between its two threads (at least PIPELINE_MIN_SLOTS rows)
+#define PIPELINE_RING_BYTES (1 << 20)
+#define PIPELINE_MIN_SLOTS 4
+
+//smaller images aren't worth starting a thread for, they decode in about the time that takes
+#define PIPELINE_MIN_BYTES (1 << 20)
+
+//how many times a thread of a pipelined decode checks the ring again before it goes to sleep on it
+#define PIPELINE_SPINS 1024
+
+//how far parse_chunks goes: just IHDR, every chunk without the IDAT data, or everything
+enum
+{
+	PARSE_HEADER = 0,
+	PARSE_METADATA = 1,
+	PARSE_IMAGE = 2
+};
+
+//chunks are always read from memory (files are read in whole first)
+typedef struct Png_source
+{
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t position;
+}png_source;
+
+//limits of one running decode (see decode_limits). the clock and the flag are read once the inflated data passes
+//next_check and once the unfiltered rows pass next_row_check, both offsets into the filtered image
+typedef struct Decode_check
+{
+	const atomic_int *cancel;
+	uint64_t deadline;
+	uint64_t next_check;
+	uint64_t next_row_check;
+
+	//the decoder's stopped field
+	decode_stop *stopped;
+}decode_check;
+
+typedef struct Row_pipeline row_pipeline;
+
+//where inflated data goes. with a row callback, finished scanlines are unfiltered and handed out whenever the
+//buffer grows past limit, and only the deflate window and the unfinished row are kept
+//without one, limit is max_output and the whole filtered image stays in the buffer
+typedef struct Inflate_output
+{
+	dynamic_array *buffer;
+
+	//size of the filtered image, the point where rows are flushed and the bytes already dropped from the front of buffer
+	uint64_t max_output;
+	uint64_t limit;
+	uint64_t dropped;
+
+	png *image;
+	png_row_callback callback;
+	void *user;
 
-//hand-coded lookup tables for (length,distance) pairs
-static uint32_t distance_values[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
-static uint32_t distance_extra_bits[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+	//the row above and the row being unfiltered (both in the decoder's pixel buffer)
+	uint8_t *previous_row;
+	uint8_t *current_row;
+	uint32_t next_row;
+
+	//rows handed out are [first_row, end_row). finished is set once end_row is reached before the end of the image
+	uint32_t first_row;
+	uint32_t end_row;
+	int finished;
+
+	//where block boundaries are recorded (NULL for none)
+	dynamic_array *boundaries;
+
+	//limits of the decode (NULL for none)
+	decode_check *check;
+
+	//caller memory rows are unfiltered into (NULL when they go to the pixel buffer)
+	const png_destination *destination;
+
+	//with a pipeline, finished scanlines are only put into its ring and its thread does the rest (NULL for none)
+	row_pipeline *pipeline;
+
+	//color correction of the rows (NULL for none), and the row corrected copies for the callback go to
+	const color_transform *color;
+	uint8_t *color_row;
+
+	decode_stats *stats;
+}inflate_output;
+
+//the two threads of a pipelined decode (see decoder_set_pipelined). the decoding thread inflates and copies every
+//finished scanline into a ring, the pipeline thread takes them out in order, unfilters them and hands them on.
+//each counter is only written by one side, so the ring needs no lock. the lock is only for sleeping on it
+struct Row_pipeline
+{
+	//slot_count filtered scanlines (with their filter byte) of slot_size bytes, in the decoder's pipeline_rows
+	uint8_t *slots;
+	uint64_t slot_size;
+	uint64_t slot_count;
+
+	//scanlines put into the ring and scanlines taken out of it
+	atomic_uint_fast64_t produced;
+	atomic_uint_fast64_t consumed;
+
+	//done is set once no more scanlines come, failed once the pipeline thread gave up on one
+	atomic_int done;
+	atomic_int failed;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	atomic_int sleepers;
+
+	//the decode's output (only its fields that don't change during the decode are read) and the rows the pipeline
+	//thread unfilters into. it checks the limits on its own, so a stop it runs into is kept here until the end
+	inflate_output *output;
+	uint8_t *previous_row;
+	uint8_t *current_row;
+	decode_check check;
+	decode_stop stopped;
+
+	pthread_t thread;
+};
+
+//rows a row decode was asked for, and the index that can get it there faster (NULL means from the start)
+typedef struct Row_range
+{
+	const png_index *index;
+	uint32_t first_row;
+	uint32_t end_row;
+}row_range;
+
+//fixed huffman tables are the same for every png. they are built once and only ever read, so every thread shares them
+typedef struct Static_tables
+{
+	uint32_t literal_table[LITERAL_TABLE_SIZE];
+	uint32_t distance_table[DISTANCE_TABLE_SIZE];
+}static_tables;
+
+static static_tables fixed_tables;
+static pthread_once_t fixed_tables_once = PTHREAD_ONCE_INIT;
+
+//the fast inflate loop runs only while it can load 8 bytes of input and write the longest match (plus the
+//overrun of its 8 byte copies) without checking. closer to the end the careful path takes over
+#define FAST_INPUT_MARGIN 8
+#define FAST_OUTPUT_MARGIN (258 + 8)
+
+//result of decoding symbols of a huffman block
+enum
+{
+	SYMBOLS_MORE = 0,
+	SYMBOLS_END = 1,
+	SYMBOLS_CORRUPT = 2
+};
 
 //helper functions for file reading
-static int handle_chunk(png *png, int chunk_length, const char *chunk_header, FILE *png_file);
-static void handle_IDAT(png *png, int length, FILE *png_file);
-static int handle_IHDR(png *png, int length, FILE *png_file);
+static int source_read(png_source *source, void *output, uint64_t length);
+static int source_skip(png_source *source, uint64_t length);
+static int read_chunks(png *png, png_source *source, int mode, dynamic_array *index, decode_stats *stats);
+static int parse_chunks(png *png, png_source *source, int mode, dynamic_array *index, decode_stats *stats);
+static int add_to_index(dynamic_array *index, const char *chunk_type, uint64_t offset, uint32_t length);
+static int handle_chunk(png *png, int chunk_length, const char *chunk_header, png_source *source);
+static int handle_IDAT(png *png, int length, png_source *source);
+static int handle_IHDR(png *png, int length, png_source *source);
 static int is_required(char input);
 
 //decode encoded png data to pixel data
-static void decode_png(png *cur);
-static int handle_zlib(png *cur);
+static int decode_png(png_decoder *decoder, png_row_callback callback, void *user, const row_range *range, const png_destination *destination);
+static int resume_from_index(png_decoder *decoder, bit_stream *input, inflate_output *output, const row_range *range);
+static void reset_decoder(png_decoder *decoder);
+static void free_buffers(png_decoder *decoder);
+static png *decode_memory(png_decoder *decoder, const uint8_t *data, uint64_t size, png_row_callback callback, void *user, const row_range *range, const png_destination *destination);
+static png *decode_file(png_decoder *decoder, const char *filename, png_row_callback callback, void *user, const png_destination *destination);
+static png *decode_memory_timed(png_decoder *decoder, const uint8_t *data, uint64_t size, png_row_callback callback, void *user, const png_destination *destination);
+static png *read_memory_info(png_decoder *decoder, const uint8_t *data, uint64_t size);
+static int read_whole_fd(dynamic_array *output, int file);
+static int read_file_without_idat(dynamic_array *output, const char *filename);
+static int read_at(int file, uint8_t *output, uint64_t length, uint64_t offset);
+#ifdef PNG_STATS
+static void add_buffer_growth(png_decoder *decoder, int64_t sign);
+#endif
+static int handle_zlib(bit_stream *cur);
+static int inflate_blocks(png_decoder *decoder, bit_stream *input, inflate_output *output, decode_stats *stats);
+static static_tables *get_static_tables();
+static void build_static_tables();
 
 //helper functions for different compressed data block types
-static void uncompressed_block(dynamic_array *cur, dynamic_array *output_stream);
-static void huffman_block(dynamic_array *cur, dynamic_array *output_stream, node *literal_tree, node *distance_tree);
-static void handle_length_copy(dynamic_array *cur, dynamic_array *output_stream, int32_t length, int32_t distance);
+static int uncompressed_block(bit_stream *cur, inflate_output *output);
+static int huffman_block(bit_stream *cur, inflate_output *output, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats);
+static int fast_symbols(bit_stream *cur, dynamic_array *output_stream, uint64_t limit, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats);
+static int slow_symbol(bit_stream *cur, dynamic_array *output_stream, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats);
+static uint32_t read_entry(bit_stream *cur, const uint32_t *table, uint32_t table_bits);
+static uint64_t load_bits(const uint8_t *data);
+static int handle_length_copy(dynamic_array *output_stream, uint64_t length, uint64_t distance);
 
 //helper function for dynamic huffman trees
-static void generate_dynamic(dynamic_array *cur, node **literal_tree, node **distance_tree);
-static node *decode_dynamic_tree(node *alphabet, dynamic_array *cur, uint32_t num_codes);
+static const huffman_tables *generate_dynamic(png_decoder *decoder, bit_stream *cur);
+static huffman_tables *find_tables(png_decoder *decoder, const uint8_t *code_lengths, uint32_t literal_count, uint32_t distance_count, uint64_t hash);
+static int decode_code_lengths(node *alphabet, bit_stream *cur, uint32_t *code_lengths, uint32_t num_codes);
 
 //helper functions for reversing filter on decoded pixels
-static void handle_filter(png *cur, dynamic_array *output_stream);
-static int32_t paeth(int32_t a, int32_t b, int32_t c);
+static int handle_filter(png *cur, dynamic_array *output_stream, const color_transform *color, decode_check *check, decode_stats *stats);
+static void unfilter_row(uint8_t filter_method, const uint8_t *filtered, const uint8_t *previous, uint8_t *output, uint64_t size, uint8_t bytes_per_pixel);
+static int flush_rows(inflate_output *output);
+static int hand_out_row(inflate_output *output, uint8_t **previous_row, uint8_t **current_row, uint32_t row_index, const uint8_t *filtered, decode_check *check);
+
+//helper functions for pipelined decodes
+static int start_pipeline(png_decoder *decoder, inflate_output *output, row_pipeline *pipeline);
+static int finish_pipeline(png_decoder *decoder, row_pipeline *pipeline);
+static void *pipeline_thread(void *arg);
+static int put_row(row_pipeline *pipeline, const uint8_t *filtered);
+static void wait_for_ring(row_pipeline *pipeline, int for_row, uint64_t row);
+static int ring_ready(row_pipeline *pipeline, int for_row, uint64_t row);
+static void wake_other_side(row_pipeline *pipeline);
+static uint8_t *destination_row(const png_destination *destination, const png *image, uint32_t row);
+static void finish_rows(inflate_output *output, uint8_t *last_row);
+
+//helper function for decode limits
+static int within_limits(decode_check *check);
 
 //print all the relevant info about an (already read) png
 void png_info(png *to_print)
@@ -68,466 +265,2142 @@ void free_png(png *to_free)
 			to_free->pixel_data = NULL;
 		}
 
-		free(to_free);
+		mem_allocator allocator = to_free->allocator;
+		mem_free(&allocator, to_free, sizeof(png));
 		to_free = NULL;
 	}
 }
 
-//read and decode png from file name
-png *read_png(const char *filename)
+png_decoder *create_decoder()
 {
-	png *to_return = calloc(1, sizeof(png));
-
-	to_return->is_valid = 0;
-	to_return->pixel_data = create_array();
-	to_return->raw_data = create_array();
+	return create_decoder_using(NULL);
+}
 
-	FILE *png_file = fopen(filename, "rb");
-	if (png_file == NULL)
+png_decoder *create_decoder_using(const mem_allocator *allocator)
+{
+	png_decoder *to_return = mem_calloc(allocator, sizeof(png_decoder));
+	if (to_return == NULL || !decoder_set_allocator(to_return, allocator))
 	{
-		fprintf(stderr, "read_png: Failed to open file %s. PNG creation aborted.\n", filename);
-		return to_return;
+		fprintf(stderr, "create_decoder: unable to allocate the decoder\n");
+		mem_free(allocator, to_return, sizeof(png_decoder));
+		return NULL;
 	}
 
-	//check that file header matches PNG
-	char file_header[8];
-	if (fread(file_header, 1, 8, png_file) != 8)
+	to_return->created_with = to_return->allocator;
+	return to_return;
+}
+
+int decoder_set_allocator(png_decoder *decoder, const mem_allocator *allocator)
+{
+	mem_allocator hooks = {0};
+	if (allocator != NULL)
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return to_return;
+		hooks = *allocator;
 	}
-	if (strncmp(file_header, png_signature, 8) != 0)
+
+	//a new decoder has no buffers yet and always goes through
+	if (decoder->file_data != NULL && memcmp(&hooks, &decoder->allocator, sizeof(mem_allocator)) == 0)
 	{
-		fclose(png_file);
-		fprintf(stderr, "read_png: input file does not match PNG header. PNG creation aborted\n");
-		return to_return;
+		return 1;
 	}
 
-	//loop through chunks
-	while (!to_return->is_valid)
+	//make the new buffers first so a failure leaves the decoder as it was
+	dynamic_array *buffers[7] = {0};
+	for (int i = 0; i < 7; i++)
 	{
-		int chunk_length = 0;
-		char chunk_type[5];
-		chunk_type[4] = '\0';
-
-		if (fread(&chunk_length, 4, 1, png_file) != 1)
-		{
-			fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-			return to_return;
-		}
-
-		if (fread(&chunk_type, 4, 1, png_file) != 1)
-		{
-			fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-			return to_return;
-		}
-		//fix endian-ness (default stored in big endian)
-		if(check_endian())
-		{
-			chunk_length = byte_swap(chunk_length);
-		}
-
-		if (is_required(chunk_type[0]))
+		buffers[i] = create_array_using(&hooks);
+		if (buffers[i] == NULL)
 		{
-			if (!handle_chunk(to_return, chunk_length, chunk_type, png_file))
+			for (int j = 0; j < i; j++)
 			{
-				fprintf(stderr, "read_png: PNG contains features that are not supported in chunk: %s\n", chunk_type);
-				fclose(png_file);
-				return to_return;
+				free_array(buffers[j]);
 			}
+			return 0;
 		}
+	}
 
-		//unecessary chunks are ignored
-		else
+	free_buffers(decoder);
+	decoder->file_data = buffers[0];
+	decoder->compressed = buffers[1];
+	decoder->inflated = buffers[2];
+	decoder->pixels = buffers[3];
+	decoder->chunks = buffers[4];
+	decoder->boundaries = buffers[5];
+	decoder->pipeline_rows = buffers[6];
+	decoder->image.pixel_data = decoder->pixels;
+
+	decoder->alphabet_nodes.allocator = hooks;
+	decoder->allocator = hooks;
+	return 1;
+}
+
+void decoder_set_limits(png_decoder *decoder, const decode_limits *limits)
+{
+	if (limits == NULL)
+	{
+		memset(&decoder->limits, 0, sizeof(decode_limits));
+		return;
+	}
+	decoder->limits = *limits;
+}
+
+void decoder_set_pipelined(png_decoder *decoder, int enabled)
+{
+	//on a single core the two threads would only take turns
+	decoder->pipelined = enabled && sysconf(_SC_NPROCESSORS_ONLN) > 1;
+}
+
+void decoder_set_color_management(png_decoder *decoder, int enabled)
+{
+	decoder->color_managed = enabled;
+}
+
+void free_decoder(png_decoder *to_free)
+{
+	if (to_free != NULL)
+	{
+		free_buffers(to_free);
+		mem_allocator allocator = to_free->created_with;
+		mem_free(&allocator, to_free, sizeof(png_decoder));
+	}
+}
+
+//release every buffer (the arrays are NULL afterwards)
+static void free_buffers(png_decoder *decoder)
+{
+	free_array(decoder->file_data);
+	free_array(decoder->compressed);
+	free_array(decoder->inflated);
+	free_array(decoder->pixels);
+	free_array(decoder->chunks);
+	free_array(decoder->boundaries);
+	free_array(decoder->pipeline_rows);
+	decoder->file_data = NULL;
+	decoder->compressed = NULL;
+	decoder->inflated = NULL;
+	decoder->pixels = NULL;
+	decoder->chunks = NULL;
+	decoder->boundaries = NULL;
+	decoder->pipeline_rows = NULL;
+	decoder->source = NULL;
+	decoder->source_size = 0;
+	decoder->image.pixel_data = NULL;
+
+	free_node_pool(&decoder->alphabet_nodes);
+	for (int i = 0; i < HUFFMAN_CACHE_SIZE; i++)
+	{
+		huffman_tables *tables = &decoder->table_cache[i];
+		mem_free(&decoder->allocator, tables->literal_table, LITERAL_TABLE_SIZE * sizeof(uint32_t));
+		mem_free(&decoder->allocator, tables->distance_table, DISTANCE_TABLE_SIZE * sizeof(uint32_t));
+	}
+	memset(decoder->table_cache, 0, sizeof(decoder->table_cache));
+	decoder->table_uses = 0;
+
+	mem_free(&decoder->allocator, decoder->color, sizeof(color_transform));
+	decoder->color = NULL;
+}
+
+//forget the last image but keep every buffer
+static void reset_decoder(png_decoder *decoder)
+{
+	memset(&decoder->image, 0, sizeof(png));
+
+	array_clear(decoder->compressed);
+	array_clear(decoder->inflated);
+	array_clear(decoder->pixels);
+	array_clear(decoder->chunks);
+	array_clear(decoder->boundaries);
+	decoder->image.pixel_data = decoder->pixels;
+	decoder->source = NULL;
+	decoder->source_size = 0;
+	decoder->idat_loaded = 0;
+	decoder->stopped = DECODE_NOT_STOPPED;
+}
+
+//read and decode png from file name
+png *decoder_read(png_decoder *decoder, const char *filename)
+{
+	return decoder_read_rows(decoder, filename, NULL, NULL);
+}
+
+png *decoder_read_rows(png_decoder *decoder, const char *filename, png_row_callback callback, void *user)
+{
+	return decode_file(decoder, filename, callback, user, NULL);
+}
+
+png *decoder_read_into(png_decoder *decoder, const char *filename, const png_destination *destination)
+{
+	return decode_file(decoder, filename, NULL, NULL, destination);
+}
+
+static png *decode_file(png_decoder *decoder, const char *filename, png_row_callback callback, void *user, const png_destination *destination)
+{
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_ONLY(add_buffer_growth(decoder, -1));
+	STATS_NOW(start);
+
+	int file_read = read_whole_file(decoder->file_data, filename);
+	STATS_ELAPSED(&decoder->stats, read_nanoseconds, start);
+	STATS_ADD(&decoder->stats, file_bytes, decoder->file_data->count);
+
+	png *to_return = &decoder->image;
+	if (file_read)
+	{
+		to_return = decode_memory(decoder, decoder->file_data->data, decoder->file_data->count, callback, user, NULL, destination);
+	}
+	else
+	{
+		fprintf(stderr, "read_png: Failed to open file %s. PNG creation aborted.\n", filename);
+		reset_decoder(decoder);
+	}
+
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
+	STATS_ONLY(add_buffer_growth(decoder, 1));
+	return to_return;
+}
+
+//read and decode a png that is already in memory
+png *decoder_read_memory(png_decoder *decoder, const uint8_t *data, uint64_t size)
+{
+	return decoder_read_memory_rows(decoder, data, size, NULL, NULL);
+}
+
+png *decoder_read_memory_rows(png_decoder *decoder, const uint8_t *data, uint64_t size, png_row_callback callback, void *user)
+{
+	return decode_memory_timed(decoder, data, size, callback, user, NULL);
+}
+
+png *decoder_read_memory_into(png_decoder *decoder, const uint8_t *data, uint64_t size, const png_destination *destination)
+{
+	return decode_memory_timed(decoder, data, size, NULL, NULL, destination);
+}
+
+static png *decode_memory_timed(png_decoder *decoder, const uint8_t *data, uint64_t size, png_row_callback callback, void *user, const png_destination *destination)
+{
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_ONLY(add_buffer_growth(decoder, -1));
+	STATS_NOW(start);
+
+	png *to_return = decode_memory(decoder, data, size, callback, user, NULL, destination);
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
+	STATS_ONLY(add_buffer_growth(decoder, 1));
+	return to_return;
+}
+
+#ifdef PNG_STATS
+//add (sign 1) or subtract (sign -1) the growth counters of every buffer. doing both around a decode leaves the growth caused by that decode
+static void add_buffer_growth(png_decoder *decoder, int64_t sign)
+{
+	dynamic_array *buffers[] = {decoder->file_data, decoder->compressed, decoder->inflated, decoder->pixels, decoder->pipeline_rows};
+	for (int i = 0; i < 5; i++)
+	{
+		decoder->stats.reallocations += sign * buffers[i]->reallocations;
+		decoder->stats.bytes_copied += sign * buffers[i]->bytes_copied;
+		if (sign > 0)
 		{
-			fseek(png_file, chunk_length, SEEK_CUR);
+			decoder->stats.buffer_bytes += buffers[i]->capacity;
 		}
+	}
+}
+#endif
 
-		//skip CRC bytes (CRC check is unsupported)
-		fseek(png_file, 4, SEEK_CUR);
+static png *decode_memory(png_decoder *decoder, const uint8_t *data, uint64_t size, png_row_callback callback, void *user, const row_range *range, const png_destination *destination)
+{
+	reset_decoder(decoder);
+	png *image = &decoder->image;
+
+	//the IDAT data can't be bigger than the file, so this is the only time the buffer has to grow
+	if (!array_reserve(decoder->compressed, size))
+	{
+		fprintf(stderr, "read_png: unable to allocate %lu bytes for compressed data. PNG creation aborted.\n", size);
+		return image;
+	}
+
+	png_source source = {0};
+	source.data = data;
+	source.size = size;
+	decoder->source = data;
+	decoder->source_size = size;
+	decoder->idat_loaded = 1;
+
+	image->raw_data = decoder->compressed;
+	if (read_chunks(image, &source, PARSE_IMAGE, decoder->chunks, &decoder->stats))
+	{
+		image->is_valid = decode_png(decoder, callback, user, range, destination);
 	}
-	fclose(png_file);
 
-	decode_png(to_return);
+	//compressed data stays with the decoder
+	image->raw_data = NULL;
+
+	return image;
+}
+
+png *decoder_read_info(png_decoder *decoder, const char *filename)
+{
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_NOW(start);
+
+	int file_read = read_file_without_idat(decoder->file_data, filename);
+	STATS_ELAPSED(&decoder->stats, read_nanoseconds, start);
+	STATS_ADD(&decoder->stats, file_bytes, decoder->file_data->count);
 
-	//free unecessary data
-	free_array(to_return->raw_data);
-	to_return->raw_data = NULL;
+	png *to_return = &decoder->image;
+	if (file_read)
+	{
+		to_return = read_memory_info(decoder, decoder->file_data->data, decoder->file_data->count);
+		decoder->idat_loaded = 0;
+	}
+	else
+	{
+		fprintf(stderr, "read_png: Failed to open file %s. PNG creation aborted.\n", filename);
+		reset_decoder(decoder);
+	}
 
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
 	return to_return;
 }
 
-//helper function(for code clarity)
-//as per the png specification, bit 5(range 0 to 7) of the first byte denotes whether a chunk is critical or ancillary
-static int is_required(char input)
+png *decoder_read_memory_info(png_decoder *decoder, const uint8_t *data, uint64_t size)
 {
-	return ((input & 0x20) == 0);
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_NOW(start);
+
+	png *to_return = read_memory_info(decoder, data, size);
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
+	return to_return;
 }
 
-//copy the data to the raw_data buffer
-static void handle_IDAT(png *png, int length, FILE *png_file)
+static png *read_memory_info(png_decoder *decoder, const uint8_t *data, uint64_t size)
+{
+	reset_decoder(decoder);
+	png *image = &decoder->image;
+
+	png_source source = {0};
+	source.data = data;
+	source.size = size;
+	decoder->source = data;
+	decoder->source_size = size;
+	decoder->idat_loaded = 1;
+
+	image->is_valid = read_chunks(image, &source, PARSE_METADATA, decoder->chunks, &decoder->stats);
+	return image;
+}
+
+uint64_t decoder_chunk_count(const png_decoder *decoder)
+{
+	return decoder->chunks->count / sizeof(png_chunk);
+}
+
+png_chunk *decoder_chunk(png_decoder *decoder, uint64_t index)
 {
-	char *data = calloc(length, 1);
-	if (fread(data, 1, length, png_file) != length)
+	if (index >= decoder_chunk_count(decoder))
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return;
+		return NULL;
 	}
-	array_add(png->raw_data, data, length);
-	free(data);
+	return (png_chunk *)decoder->chunks->data + index;
 }
 
-//takes all the data from IHDR chunk and moves it to png object
-static int handle_IHDR(png *png, int length, FILE *png_file)
+int64_t decoder_find_chunk(png_decoder *decoder, const char *type, uint64_t first)
 {
-	if (fread(&png->w, 4, 1, png_file) != 1)
+	uint64_t count = decoder_chunk_count(decoder);
+	for (uint64_t i = first; i < count; i++)
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		if (memcmp(decoder_chunk(decoder, i)->type, type, 4) == 0)
+		{
+			return i;
+		}
 	}
+	return -1;
+}
 
-	if (fread(&png->h, 4, 1, png_file) != 1)
+const uint8_t *decoder_chunk_data(png_decoder *decoder, uint64_t index)
+{
+	png_chunk *chunk = decoder_chunk(decoder, index);
+	if (chunk == NULL || (!decoder->idat_loaded && memcmp(chunk->type, "IDAT", 4) == 0))
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		return NULL;
 	}
 
-	if (fread(&png->bytes_per_pixel, 1, 1, png_file) != 1)
+	//the last chunk of a truncated file can claim more than there is
+	if (chunk->length > decoder->source_size - chunk->offset)
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		return NULL;
 	}
+	return decoder->source + chunk->offset;
+}
+
+int decoder_inflate(png_decoder *decoder, const uint8_t *data, uint64_t size, dynamic_array *output, uint64_t max_output)
+{
+	array_clear(output);
 
-	if (fread(&png->color_type, 1, 1, png_file) != 1)
+	inflate_output stream = {0};
+	stream.buffer = output;
+	stream.max_output = max_output;
+	stream.limit = max_output;
+
+	//metadata isn't part of the image's stats
+	decode_stats stats = {0};
+	stream.stats = &stats;
+
+	bit_stream input;
+	bits_init(&input, data, size);
+	if (!handle_zlib(&input) || !inflate_blocks(decoder, &input, &stream, &stats))
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		fprintf(stderr, "decoder_inflate: corrupt compressed data (or more than %lu bytes of it).\n", max_output);
 		return 0;
 	}
+	return 1;
+}
+
+png *decoder_read_row_range(png_decoder *decoder, const char *filename, const png_index *index, uint32_t first_row, uint32_t row_count, png_row_callback callback, void *user)
+{
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_ONLY(add_buffer_growth(decoder, -1));
+	STATS_NOW(start);
+
+	int file_read = read_whole_file(decoder->file_data, filename);
+	STATS_ELAPSED(&decoder->stats, read_nanoseconds, start);
+	STATS_ADD(&decoder->stats, file_bytes, decoder->file_data->count);
+
+	png *to_return = &decoder->image;
+	if (file_read)
+	{
+		to_return = decoder_read_memory_row_range(decoder, decoder->file_data->data, decoder->file_data->count, index, first_row, row_count, callback, user);
+	}
+	else
+	{
+		fprintf(stderr, "read_png: Failed to open file %s. PNG creation aborted.\n", filename);
+		reset_decoder(decoder);
+	}
+
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
+	STATS_ONLY(add_buffer_growth(decoder, 1));
+	return to_return;
+}
 
-	if (fread(&png->compression_method, 1, 1, png_file) != 1)
+png *decoder_read_memory_row_range(png_decoder *decoder, const uint8_t *data, uint64_t size, const png_index *index, uint32_t first_row, uint32_t row_count, png_row_callback callback, void *user)
+{
+	if (callback == NULL || row_count == 0)
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		fprintf(stderr, "read_png: a row range needs a callback and at least one row.\n");
+		reset_decoder(decoder);
+		return &decoder->image;
 	}
 
-	if (fread(&png->filter_method, 1, 1, png_file) != 1)
+	row_range range;
+	range.index = index;
+	range.first_row = first_row;
+	range.end_row = (first_row + (uint64_t)row_count > UINT32_MAX) ? UINT32_MAX : first_row + row_count;
+	return decode_memory(decoder, data, size, callback, user, &range, NULL);
+}
+
+png *decoder_read_stream(png_decoder *decoder, const png *header, const uint8_t *data, uint64_t size)
+{
+	memset(&decoder->stats, 0, sizeof(decode_stats));
+	STATS_ONLY(add_buffer_growth(decoder, -1));
+	STATS_NOW(start);
+
+	reset_decoder(decoder);
+	png *image = &decoder->image;
+	image->w = header->w;
+	image->h = header->h;
+	image->bytes_per_pixel = header->bytes_per_pixel;
+	image->bits_per_pixel = header->bits_per_pixel;
+	image->color_type = header->color_type;
+	image->compression_method = header->compression_method;
+	image->filter_method = header->filter_method;
+	image->interlace_method = header->interlace_method;
+
+	if (image->w <= 0 || image->h <= 0 || !array_add(decoder->compressed, data, size))
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		fprintf(stderr, "read_png: unable to take %lu bytes of compressed data. PNG creation aborted.\n", size);
+	}
+	else
+	{
+		image->raw_data = decoder->compressed;
+		image->is_valid = decode_png(decoder, NULL, NULL, NULL, NULL);
+		image->raw_data = NULL;
 	}
 
-	if (fread(&png->interlace_method, 1, 1, png_file) != 1)
+	STATS_ADD(&decoder->stats, idat_bytes, size);
+	STATS_ELAPSED(&decoder->stats, total_nanoseconds, start);
+	STATS_ONLY(add_buffer_growth(decoder, 1));
+	return image;
+}
+
+png *decoder_detach(png_decoder *decoder)
+{
+	png *to_return = mem_alloc(&decoder->allocator, sizeof(png));
+	dynamic_array *pixels = create_array_using(&decoder->allocator);
+	if (to_return == NULL || pixels == NULL)
 	{
-		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
-		return 0;
+		fprintf(stderr, "decoder_detach: unable to allocate the image\n");
+		mem_free(&decoder->allocator, to_return, sizeof(png));
+		free_array(pixels);
+		return NULL;
 	}
 
-	//fix byte order of the multi-byte numbers
-	if(check_endian)
+	*to_return = decoder->image;
+	to_return->allocator = decoder->allocator;
+
+	decoder->pixels = pixels;
+	decoder->image.pixel_data = decoder->pixels;
+
+	return to_return;
+}
+
+png *read_png(const char *filename)
+{
+	return read_png_using(filename, NULL);
+}
+
+png *read_png_memory(const uint8_t *data, uint64_t size)
+{
+	return read_png_memory_using(data, size, NULL);
+}
+
+png *read_png_using(const char *filename, const mem_allocator *allocator)
+{
+	png_decoder *decoder = create_decoder_using(allocator);
+	if (decoder == NULL)
 	{
-		png->w = byte_swap(png->w);
-		png->h = byte_swap(png->h);
+		return NULL;
+	}
+
+	decoder_read(decoder, filename);
+	png *to_return = decoder_detach(decoder);
+	free_decoder(decoder);
+
+	return to_return;
+}
+
+png *read_png_memory_using(const uint8_t *data, uint64_t size, const mem_allocator *allocator)
+{
+	png_decoder *decoder = create_decoder_using(allocator);
+	if (decoder == NULL)
+	{
+		return NULL;
+	}
+
+	decoder_read_memory(decoder, data, size);
+	png *to_return = decoder_detach(decoder);
+	free_decoder(decoder);
+
+	return to_return;
+}
+
+//read a whole file into output (grows output only when the file is bigger than anything read before). 1 is success, 0 is failure
+int read_whole_file(dynamic_array *output, const char *filename)
+{
+	array_clear(output);
+
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		return 0;
+	}
+
+	int to_return = read_whole_fd(output, file);
+	return to_return;
+}
+
+static int read_whole_fd(dynamic_array *output, int file)
+{
+	//pipes and other special files report a size of 0 and are read until they end
+	struct stat info;
+	uint64_t expected = 0;
+	if (fstat(file, &info) == 0 && S_ISREG(info.st_mode))
+	{
+		expected = info.st_size;
+	}
+
+	int to_return = array_reserve(output, expected + 1);
+	while (to_return)
+	{
+		if (output->count == output->capacity && !array_grow(output, 1))
+		{
+			to_return = 0;
+			break;
+		}
+
+		ssize_t received = read(file, output->data + output->count, output->capacity - output->count);
+		if (received == 0)
+		{
+			break;
+		}
+		if (received < 0)
+		{
+			to_return = 0;
+			break;
+		}
+		output->count += received;
+	}
+
+	close(file);
+	return to_return;
+}
+
+//read a file like read_whole_file, but without the IDAT data. the bytes where it would be are left uninitialized,
+//so offsets are the same as in the file and the chunk index works the same way for both
+static int read_file_without_idat(dynamic_array *output, const char *filename)
+{
+	array_clear(output);
+
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		return 0;
+	}
+
+	//only regular files can be skipped through. anything else is read in whole (read_whole_fd closes the file)
+	struct stat info;
+	if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		return read_whole_fd(output, file);
+	}
+
+	uint64_t size = info.st_size;
+	if (!array_resize(output, size) || !read_at(file, output->data, (size < 8) ? size : 8, 0))
+	{
+		close(file);
+		return 0;
+	}
+
+	//the length and type of each chunk decide whether the rest of it is read
+	uint64_t position = 8;
+	while (position + 8 <= size)
+	{
+		uint8_t *chunk = output->data + position;
+		if (!read_at(file, chunk, 8, position))
+		{
+			close(file);
+			return 0;
+		}
+
+		uint64_t length = ((uint32_t)chunk[0] << 24) | ((uint32_t)chunk[1] << 16) | ((uint32_t)chunk[2] << 8) | chunk[3];
+		uint64_t end = position + 12 + length;
+		if (end > size)
+		{
+			end = size;
+		}
+
+		if (memcmp(chunk + 4, "IDAT", 4) != 0 && !read_at(file, chunk + 8, end - position - 8, position + 8))
+		{
+			close(file);
+			return 0;
+		}
+		if (memcmp(chunk + 4, "IEND", 4) == 0)
+		{
+			break;
+		}
+		position = end;
+	}
+
+	close(file);
+	return 1;
+}
+
+//read exactly length bytes at offset. 1 is success, 0 is failure
+static int read_at(int file, uint8_t *output, uint64_t length, uint64_t offset)
+{
+	while (length > 0)
+	{
+		ssize_t received = pread(file, output, length, offset);
+		if (received <= 0)
+		{
+			return 0;
+		}
+		output += received;
+		offset += received;
+		length -= received;
+	}
+	return 1;
+}
+
+//read only the signature and IHDR into header (nothing is allocated). 1 is success, 0 is failure
+int probe_png(const char *filename, png *header)
+{
+	memset(header, 0, sizeof(png));
+
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		return 0;
+	}
+
+	uint8_t data[PROBE_BYTES];
+	ssize_t size = read(file, data, PROBE_BYTES);
+	close(file);
+
+	return size > 0 && probe_png_memory(data, size, header);
+}
+
+int probe_png_memory(const uint8_t *data, uint64_t size, png *header)
+{
+	memset(header, 0, sizeof(png));
+
+	png_source source = {0};
+	source.data = data;
+	source.size = size;
+
+	//probes aren't reported anywhere
+	decode_stats stats = {0};
+	return read_chunks(header, &source, PARSE_HEADER, NULL, &stats);
+}
+
+//throughput of a full decode, measured on photos and flat images: every filtered byte costs about the same
+//(unfiltering and writing the output), and each compressed byte adds huffman decoding on top
+#define COST_NANOSECONDS_PER_OUTPUT_BYTE 3
+#define COST_NANOSECONDS_PER_INPUT_BYTE 15
+
+decode_cost estimate_decode_cost(const png *header, uint64_t size)
+{
+	uint64_t scanline_size = (uint64_t)header->w * header->bytes_per_pixel;
+	uint64_t filtered_size = (uint64_t)header->h * (scanline_size + 1);
+
+	decode_cost to_return;
+	to_return.nanoseconds = filtered_size * COST_NANOSECONDS_PER_OUTPUT_BYTE + size * COST_NANOSECONDS_PER_INPUT_BYTE;
+	to_return.memory_bytes = size + filtered_size + scanline_size * header->h;
+	return to_return;
+}
+
+uint64_t estimate_decode_memory(const png_decoder *decoder, const png *header, uint64_t size, decode_mode mode, int from_file)
+{
+	uint64_t scanline_size = (uint64_t)header->w * header->bytes_per_pixel;
+	uint64_t filtered_size = (uint64_t)header->h * (scanline_size + 1);
+	int pipelined = decoder != NULL && decoder->pipelined && filtered_size >= PIPELINE_MIN_BYTES;
+	int color_managed = decoder != NULL && decoder->color_managed;
+
+	//the file (when it's read by name, with the byte that finds its end) and the IDAT data copied out of it
+	uint64_t to_return = from_file ? 2 * size + 1 : size;
+
+	//everything but a plain full decode inflates through a window (see decode_png)
+	uint64_t window = ROW_FLUSH_BYTES + scanline_size + 65536;
+	if (mode == DECODE_MODE_FULL && !pipelined)
+	{
+		window = filtered_size;
+	}
+	to_return += ((window < filtered_size) ? window : filtered_size) + FAST_OUTPUT_MARGIN;
+
+	if (mode == DECODE_MODE_FULL)
+	{
+		to_return += scanline_size * header->h;
+	}
+	else if (mode == DECODE_MODE_ROWS)
+	{
+		to_return += (color_managed ? 3 : 2) * scanline_size;
+	}
+
+	if (pipelined)
+	{
+		uint64_t ring = PIPELINE_MIN_SLOTS * (scanline_size + 1);
+		to_return += (ring > PIPELINE_RING_BYTES) ? ring : PIPELINE_RING_BYTES;
+	}
+	if (color_managed)
+	{
+		to_return += sizeof(color_transform);
+	}
+	return to_return;
+}
+
+//time spent on chunks is counted without the time spent copying IDAT data (that has its own counter)
+//stats are zeroed before every decode, so all of idat_nanoseconds was spent in this call
+static int read_chunks(png *png, png_source *source, int mode, dynamic_array *index, decode_stats *stats)
+{
+	STATS_NOW(start);
+	int to_return = parse_chunks(png, source, mode, index, stats);
+	STATS_ELAPSED(stats, chunk_nanoseconds, start + stats->idat_nanoseconds);
+
+	return to_return;
+}
+
+//check the signature and loop through chunks until IEND (or IHDR if only the header is wanted)
+//every chunk goes into index (if there is one) on the way
+static int parse_chunks(png *png, png_source *source, int mode, dynamic_array *index, decode_stats *stats)
+{
+	//check that file header matches PNG
+	char file_header[8];
+	if (!source_read(source, file_header, 8))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+	if (strncmp(file_header, png_signature, 8) != 0)
+	{
+		fprintf(stderr, "read_png: input file does not match PNG header. PNG creation aborted\n");
+		return 0;
+	}
+
+	//loop through chunks
+	int found_end = 0;
+	while (!found_end)
+	{
+		int chunk_length = 0;
+		char chunk_type[5];
+		chunk_type[4] = '\0';
+
+		if (!source_read(source, &chunk_length, 4) || !source_read(source, &chunk_type, 4))
+		{
+			fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+			return 0;
+		}
+
+		//fix endian-ness (default stored in big endian)
+		if(check_endian())
+		{
+			chunk_length = byte_swap(chunk_length);
+		}
+		if (chunk_length < 0)
+		{
+			fprintf(stderr, "read_png: chunk %s has an invalid length. Png creation aborted\n", chunk_type);
+			return 0;
+		}
+
+		if (index != NULL && !add_to_index(index, chunk_type, source->position, chunk_length))
+		{
+			fprintf(stderr, "read_png: unable to allocate the chunk index. Png creation aborted\n");
+			return 0;
+		}
+
+		//IHDR has to be the first chunk
+		if (mode == PARSE_HEADER)
+		{
+			if (strncmp(chunk_type, "IHDR", 4) != 0 || !handle_IHDR(png, chunk_length, source))
+			{
+				fprintf(stderr, "read_png: PNG does not start with a supported IHDR chunk\n");
+				return 0;
+			}
+			return 1;
+		}
+
+		STATS_ADD(stats, chunks, 1);
+		if (mode == PARSE_METADATA && strncmp(chunk_type, "IDAT", 4) == 0)
+		{
+			source_skip(source, chunk_length);
+		}
+		else if (is_required(chunk_type[0]))
+		{
+			STATS_NOW(chunk_start);
+			if (!handle_chunk(png, chunk_length, chunk_type, source))
+			{
+				fprintf(stderr, "read_png: PNG contains features that are not supported in chunk: %s\n", chunk_type);
+				return 0;
+			}
+			found_end = (strncmp(chunk_type, "IEND", 4) == 0);
+
+			if (STATS_ENABLED && strncmp(chunk_type, "IDAT", 4) == 0)
+			{
+				STATS_ADD(stats, idat_chunks, 1);
+				STATS_ADD(stats, idat_bytes, chunk_length);
+				STATS_ELAPSED(stats, idat_nanoseconds, chunk_start);
+			}
+		}
+
+		//unecessary chunks are ignored (the index still knows where they are)
+		else
+		{
+			source_skip(source, chunk_length);
+		}
+
+		//skip CRC bytes (CRC check is unsupported)
+		source_skip(source, 4);
+	}
+
+	return 1;
+}
+
+static int add_to_index(dynamic_array *index, const char *chunk_type, uint64_t offset, uint32_t length)
+{
+	png_chunk entry;
+	memset(&entry, 0, sizeof(png_chunk));
+	memcpy(entry.type, chunk_type, 4);
+	entry.offset = offset;
+	entry.length = length;
+	entry.crc_status = CHUNK_CRC_UNCHECKED;
+
+	return array_add(index, &entry, sizeof(png_chunk));
+}
+
+static int source_read(png_source *source, void *output, uint64_t length)
+{
+	if (length > source->size - source->position)
+	{
+		return 0;
+	}
+	memcpy(output, source->data + source->position, length);
+	source->position += length;
+	return 1;
+}
+
+static int source_skip(png_source *source, uint64_t length)
+{
+	if (length > source->size - source->position)
+	{
+		source->position = source->size;
+		return 0;
+	}
+	source->position += length;
+	return 1;
+}
+
+//helper function(for code clarity)
+//as per the png specification, bit 5(range 0 to 7) of the first byte denotes whether a chunk is critical or ancillary
+static int is_required(char input)
+{
+	return ((input & 0x20) == 0);
+}
+
+//copy the data to the raw_data buffer
+static int handle_IDAT(png *png, int length, png_source *source)
+{
+	if (length > source->size - source->position)
+	{
+		fprintf(stderr, "read_png: IDAT chunk runs past the end of the data. Png creation aborted\n");
+		return 0;
+	}
+
+	array_add(png->raw_data, (void *)(source->data + source->position), length);
+	source->position += length;
+	return 1;
+}
+
+//takes all the data from IHDR chunk and moves it to png object
+static int handle_IHDR(png *png, int length, png_source *source)
+{
+	if (!source_read(source, &png->w, 4))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->h, 4))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->bytes_per_pixel, 1))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->color_type, 1))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->compression_method, 1))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->filter_method, 1))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	if (!source_read(source, &png->interlace_method, 1))
+	{
+		fprintf(stderr, "read_png: file read failed. Png creation aborted\n");
+		return 0;
+	}
+
+	//fix byte order of the multi-byte numbers
+	if(check_endian)
+	{
+		png->w = byte_swap(png->w);
+		png->h = byte_swap(png->h);
+	}
+
+	//unsupported options
+	if (png->w <= 0 || png->h <= 0)
+	{
+		return 0;
+	}
+	if (png->color_type != 2 && png->color_type != 6)
+	{
+		return 0;
+	}
+	if (png->bytes_per_pixel != 8)
+	{
+		return 0;
+	}
+	if (png->interlace_method != 0)
+	{
+		return 0;
+	}
+
+	//additional helpful info (for my brain anyways)
+	if (png->color_type == 2)
+	{
+		png->bytes_per_pixel = 3;
+	}
+	if (png->color_type == 6)
+	{
+		png->bytes_per_pixel = 4;
+	}
+
+	return 1;
+}
+
+//handle all necessary chunks to parse a basic png. 1 is success, 0 is failure
+//only color types 2 and 6 are supported. Any file containing PLTE chunk will error out
+static int handle_chunk(png *png, int chunk_length, const char *chunk_header, png_source *source)
+{
+	if (strncmp(chunk_header, "IHDR", 4) == 0)
+	{
+		if (!handle_IHDR(png, chunk_length, source))
+		{
+			return 0;
+		}
+		return 1;
+	}
+	if (strncmp(chunk_header, "IDAT", 4) == 0)
+	{
+		return handle_IDAT(png, chunk_length, source);
+	}
+	if (strncmp(chunk_header, "IEND", 4) == 0)
+	{
+		//an IEND without IHDR means there is nothing to decode
+		return png->w > 0 && png->h > 0;
+	}
+
+	return 0;
+}
+
+//decode a png that has been read into the decoder. 1 is success, 0 is failure
+//with a callback the rows are handed out as they are inflated and pixel_data stays empty (range limits which rows)
+//with a destination they are unfiltered straight into it the same way
+static int decode_png(png_decoder *decoder, png_row_callback callback, void *user, const row_range *range, const png_destination *destination)
+{
+	png *cur = &decoder->image;
+	uint64_t scanline_size = (uint64_t)cur->w * cur->bytes_per_pixel;
+	int by_rows = callback != NULL || destination != NULL;
+
+	inflate_output output = {0};
+	output.buffer = decoder->inflated;
+	output.image = cur;
+	output.callback = callback;
+	output.user = user;
+	output.destination = destination;
+	output.stats = &decoder->stats;
+
+	if (destination != NULL && (destination->pixels == NULL || destination->stride < scanline_size || (uint64_t)(cur->h - 1) * destination->stride + scanline_size > destination->size))
+	{
+		fprintf(stderr, "decode_png: a %dx%d image needs rows of %lu bytes, the destination has %lu bytes with a stride of %lu. Cannot decode data.\n", cur->w, cur->h, scanline_size, destination->size, destination->stride);
+		return 0;
+	}
+
+	//the tables only depend on the chunks, so they are ready before the first row is
+	if (decoder->color_managed)
+	{
+		if (decoder->color == NULL)
+		{
+			decoder->color = mem_alloc(&decoder->allocator, sizeof(color_transform));
+		}
+		if (decoder->color == NULL)
+		{
+			fprintf(stderr, "decode_png: unable to allocate the color transform. Cannot decode data.\n");
+			return 0;
+		}
+		build_color_transform(decoder, decoder->color);
+		output.color = (decoder->color->kind != COLOR_IDENTITY) ? decoder->color : NULL;
+	}
+
+	//the budget starts with the inflating, the time spent reading the file doesn't count
+	decode_check check = {0};
+	if (decoder->limits.time_budget_nanoseconds != 0 || decoder->limits.cancel != NULL)
+	{
+		check.cancel = decoder->limits.cancel;
+		check.deadline = (decoder->limits.time_budget_nanoseconds != 0) ? stats_now() + decoder->limits.time_budget_nanoseconds : 0;
+		check.stopped = &decoder->stopped;
+		output.check = &check;
+	}
+
+	//the filtered image is one filter byte plus one row of pixels per scanline
+	output.max_output = cur->h * (scanline_size + 1);
+	output.limit = output.max_output;
+	output.end_row = cur->h;
+	if (range != NULL)
+	{
+		if (range->first_row >= (uint32_t)cur->h)
+		{
+			fprintf(stderr, "decode_png: row %u is past the end of a %d row image. Cannot decode data.\n", range->first_row, cur->h);
+			return 0;
+		}
+		output.first_row = range->first_row;
+		if (range->end_row < (uint32_t)cur->h)
+		{
+			output.end_row = range->end_row;
+		}
+	}
+
+	//deflate can't expand data by more than 1032:1, so a header that claims more than that isn't trusted with a big allocation
+	uint64_t reserve_size = output.max_output;
+	if (reserve_size > cur->raw_data->count * 1032 + 1032)
+	{
+		reserve_size = cur->raw_data->count * 1032 + 1032;
+	}
+
+	//a pipelined full decode is a row decode into the pixel buffer (big enough images only, with a header that can be trusted)
+	int pipelined = decoder->pipelined && range == NULL && output.max_output >= PIPELINE_MIN_BYTES && reserve_size == output.max_output;
+	png_destination pixel_destination;
+	if (pipelined && !by_rows)
+	{
+		uint64_t first_output = cur->pixel_data->count;
+		if (!array_reserve(cur->pixel_data, first_output + scanline_size * cur->h))
+		{
+			fprintf(stderr, "decode_png: unable to allocate %lu bytes for pixel data. Cannot decode data.\n", scanline_size * cur->h);
+			return 0;
+		}
+		pixel_destination.pixels = cur->pixel_data->data + first_output;
+		pixel_destination.size = scanline_size * cur->h;
+		pixel_destination.stride = scanline_size;
+		pixel_destination.flip = 0;
+		destination = &pixel_destination;
+		output.destination = destination;
+		by_rows = 1;
+	}
+
+	//a row decode only needs the window, a flush worth of data and a stored block (the most one block adds between checks)
+	if (by_rows)
+	{
+		output.limit = ROW_FLUSH_BYTES + scanline_size;
+		if (reserve_size > output.limit + 65536)
+		{
+			reserve_size = output.limit + 65536;
+		}
+
+		//rows unfiltered into a destination don't need a buffer of their own. a callback with color correction gets a third row
+		if (destination == NULL)
+		{
+			uint64_t row_count = (output.color != NULL) ? 3 : 2;
+			if (!array_reserve(decoder->pixels, row_count * scanline_size))
+			{
+				fprintf(stderr, "decode_png: unable to allocate %lu bytes for pixel rows. Cannot decode data.\n", row_count * scanline_size);
+				return 0;
+			}
+			output.previous_row = decoder->pixels->data;
+			output.current_row = decoder->pixels->data + scanline_size;
+			output.color_row = decoder->pixels->data + 2 * scanline_size;
+		}
+	}
+
+	//the fast loop needs FAST_OUTPUT_MARGIN bytes of room past the data, so the last rows don't have to grow the buffer
+	reserve_size += FAST_OUTPUT_MARGIN;
+	if (!array_reserve(decoder->inflated, reserve_size))
+	{
+		fprintf(stderr, "decode_png: unable to allocate %lu bytes for decoded data. Cannot decode data.\n", reserve_size);
+		return 0;
+	}
+
+	bit_stream input;
+	bits_init(&input, cur->raw_data->data, cur->raw_data->count);
+
+	//there is exactly 1 zlib header at the start of the compressed data
+	if (!handle_zlib(&input))
+	{
+		fprintf(stderr, "decode_png: compressed data stream contains flags that are not supported by PNG specification. Cannot decode data.\n");
+		return 0;
+	}
+
+	//a full decode remembers where blocks start so an index can be built from it afterwards
+	if (!by_rows)
+	{
+		output.boundaries = decoder->boundaries;
+	}
+	else if (range != NULL && range->index != NULL && !resume_from_index(decoder, &input, &output, range))
+	{
+		return 0;
+	}
+
+	row_pipeline pipeline;
+	if (pipelined && !start_pipeline(decoder, &output, &pipeline))
+	{
+		return 0;
+	}
+
+	//array our output will be copied to
+	dynamic_array *output_stream = decoder->inflated;
+	decode_stats *stats = &decoder->stats;
+	int inflated = inflate_blocks(decoder, &input, &output, stats);
+
+	//hand out the rows that are left
+	if (by_rows)
+	{
+		if (inflated && !output.finished && !flush_rows(&output) && !output.finished)
+		{
+			inflated = 0;
+		}
+
+		//the pipeline thread is stopped whether the decode failed or not
+		if (pipelined && !finish_pipeline(decoder, &pipeline))
+		{
+			inflated = 0;
+		}
+		if (!inflated)
+		{
+			return 0;
+		}
+
+		if (output.next_row < output.end_row)
+		{
+			fprintf(stderr, "decode_png: compressed data holds %u of %d rows. Cannot decode data.\n", output.next_row, cur->h);
+			return 0;
+		}
+		if (!pipelined)
+		{
+			finish_rows(&output, output.previous_row);
+		}
+		if (destination == &pixel_destination)
+		{
+			cur->pixel_data->count += pixel_destination.size;
+		}
+		return 1;
+	}
+
+	if (!inflated)
+	{
+		return 0;
+	}
+
+	if (output_stream->count < output.max_output)
+	{
+		fprintf(stderr, "decode_png: compressed data holds %lu bytes but the image needs %lu. Cannot decode data.\n", output_stream->count, output.max_output);
+		return 0;
+	}
+
+	//remove filtering from output data(converts it to pixel data)
+	STATS_NOW(filter_start);
+	int to_return = handle_filter(cur, output_stream, output.color, output.check, stats);
+	STATS_ELAPSED(stats, filter_nanoseconds, filter_start);
+
+	return to_return;
+}
+
+//skip ahead to the last checkpoint at or before the first row of range. an index that doesn't belong to the image is
+//ignored (the decode starts at the beginning). 1 is success, 0 is failure
+static int resume_from_index(png_decoder *decoder, bit_stream *input, inflate_output *output, const row_range *range)
+{
+	const png_index *index = range->index;
+	png *cur = &decoder->image;
+	if (index->w != cur->w || index->h != cur->h || index->bytes_per_pixel != cur->bytes_per_pixel || index->compressed_size != cur->raw_data->count)
+	{
+		fprintf(stderr, "decode_png: index was built for another image, decoding from the start.\n");
+		return 1;
+	}
+
+	const png_checkpoint *checkpoint = NULL;
+	for (uint64_t i = 0; i < index->count && index->checkpoints[i].row <= range->first_row; i++)
+	{
+		checkpoint = &index->checkpoints[i];
+	}
+	if (checkpoint == NULL || checkpoint->bit_offset / 8 >= input->size)
+	{
+		return 1;
+	}
+
+	//the window goes back into the buffer as if everything before it had been flushed
+	uint64_t scanline_size = (uint64_t)cur->w * cur->bytes_per_pixel;
+	const uint8_t *data = index->data->data + checkpoint->data_offset;
+	array_clear(output->buffer);
+	if (!array_add(output->buffer, data, checkpoint->window_length))
+	{
+		return 0;
+	}
+	if (checkpoint->row > 0)
+	{
+		memcpy(output->previous_row, data + checkpoint->window_length, scanline_size);
+	}
+
+	output->dropped = checkpoint->output_offset - checkpoint->window_length;
+	output->next_row = checkpoint->row;
+	output->limit = output->buffer->count + ROW_FLUSH_BYTES;
+	input->byte_position = checkpoint->bit_offset / 8;
+	input->bit_position = checkpoint->bit_offset % 8;
+	return 1;
+}
+
+//inflate deflate blocks from input until the final one. 1 is success, 0 is failure
+static int inflate_blocks(png_decoder *decoder, bit_stream *input, inflate_output *output, decode_stats *stats)
+{
+	//these tables are the same for every block (and every png), so they are built once
+	static_tables *tables = get_static_tables();
+
+	//iterate through blocks
+	char is_final = 0;
+	while (!is_final)
+	{
+		if (input->byte_position >= input->size)
+		{
+			fprintf(stderr, "decode_png: compressed data ended before the final block. Cannot decode data.\n");
+			return 0;
+		}
+
+		if (output->check != NULL && !within_limits(output->check))
+		{
+			return 0;
+		}
+
+		STATS_NOW(block_start);
+		STATS_ONLY(uint64_t bits_before = input->byte_position * 8 + input->bit_position);
+		STATS_ONLY(uint64_t bytes_before = output->dropped + output->buffer->count);
+
+		//read block header
+		is_final = pull_bit(input);
+		char type = pull_bits(input, 2);
+
+		int block_ok = 0;
+
+		switch (type)
+		{
+		//uncompressed
+		case 0:
+			block_ok = uncompressed_block(input, output);
+			break;
+
+		//fixed huffman tree
+		case 1:
+			block_ok = huffman_block(input, output, tables->literal_table, tables->distance_table, &stats->blocks[1]);
+			break;
+
+		//dynamic huffman tree
+		case 2:
+		{
+			const huffman_tables *dynamic = generate_dynamic(decoder, input);
+			if (dynamic == NULL)
+			{
+				break;
+			}
+			block_ok = huffman_block(input, output, dynamic->literal_table, dynamic->distance_table, &stats->blocks[2]);
+			break;
+		}
+
+		//error
+		case 3:
+			fprintf(stderr, "decode_png: compressed data stream contains a block with type 3(error). Cannot decode data.\n");
+			break;
+		}
+
+		//a row range stops the decode once its last row is out
+		if (!block_ok && output->finished)
+		{
+			return 1;
+		}
+		if (!block_ok)
+		{
+			//a stop (or a pipeline thread that gave up) already said why
+			int stopped = (output->check != NULL && *output->check->stopped != DECODE_NOT_STOPPED) || (output->pipeline != NULL && atomic_load(&output->pipeline->failed));
+			if (!stopped)
+			{
+				fprintf(stderr, "decode_png: corrupt compressed data. Cannot decode data.\n");
+			}
+			return 0;
+		}
+
+		if (output->boundaries != NULL && !is_final)
+		{
+			deflate_boundary boundary;
+			boundary.bit_offset = input->byte_position * 8 + input->bit_position;
+			boundary.output_offset = output->dropped + output->buffer->count;
+			array_add(output->boundaries, &boundary, sizeof(deflate_boundary));
+		}
+
+		STATS_ADD(stats, blocks[(int)type].blocks, 1);
+		STATS_ADD(stats, blocks[(int)type].bits_in, input->byte_position * 8 + input->bit_position - bits_before);
+		STATS_ADD(stats, blocks[(int)type].bytes_out, output->dropped + output->buffer->count - bytes_before);
+		STATS_ELAPSED(stats, blocks[(int)type].nanoseconds, block_start);
+	}
+
+	return 1;
+}
+
+//unfilter and hand out every finished row, then drop what the deflate window doesn't need anymore
+//1 is success, 0 if there is more data than the image holds, a row is corrupt or the callback stopped the decode
+static int flush_rows(inflate_output *output)
+{
+	dynamic_array *buffer = output->buffer;
+	if ((output->callback == NULL && output->destination == NULL) || output->dropped + buffer->count > output->max_output)
+	{
+		return 0;
+	}
+
+	png *image = output->image;
+	uint64_t scanline_size = (uint64_t)image->w * image->bytes_per_pixel;
+	uint64_t row_end = (output->next_row + 1) * (scanline_size + 1);
+	while (output->next_row < output->end_row && row_end <= output->dropped + buffer->count)
+	{
+		const uint8_t *filtered = buffer->data + (row_end - scanline_size - 1 - output->dropped);
+		if (filtered[0] > FILTER_PAETH)
+		{
+			fprintf(stderr, "decode_png: scanline %u uses unknown filter type %d. Cannot decode data.\n", output->next_row, filtered[0]);
+			return 0;
+		}
+		STATS_ADD(output->stats, filter_rows[filtered[0]], 1);
+
+		if (output->pipeline != NULL)
+		{
+			if (!put_row(output->pipeline, filtered))
+			{
+				return 0;
+			}
+		}
+		else if (!hand_out_row(output, &output->previous_row, &output->current_row, output->next_row, filtered, output->check))
+		{
+			return 0;
+		}
+
+		output->next_row++;
+		row_end += scanline_size + 1;
+	}
+
+	//the rest of the data isn't needed
+	if (output->next_row == output->end_row && output->end_row < (uint32_t)image->h)
+	{
+		output->finished = 1;
+		return 0;
+	}
+
+	//keep the unfinished row and the last 32768 bytes (the furthest back a match can reach)
+	uint64_t keep_from = row_end - scanline_size - 1 - output->dropped;
+	uint64_t window_start = (buffer->count > 32768) ? buffer->count - 32768 : 0;
+	if (window_start < keep_from)
+	{
+		keep_from = window_start;
+	}
+
+	if (keep_from > 0)
+	{
+		memmove(buffer->data, buffer->data + keep_from, buffer->count - keep_from);
+		buffer->count -= keep_from;
+		output->dropped += keep_from;
+	}
+	output->limit = buffer->count + ROW_FLUSH_BYTES;
+
+	return 1;
+}
+
+//unfilter one scanline into current_row and hand it out, then make it the row above. 1 is success, 0 if the
+//limits are hit or the callback stopped the decode
+static int hand_out_row(inflate_output *output, uint8_t **previous_row, uint8_t **current_row, uint32_t row_index, const uint8_t *filtered, decode_check *check)
+{
+	png *image = output->image;
+	uint64_t scanline_size = (uint64_t)image->w * image->bytes_per_pixel;
+
+	//the row above is already in the destination too, so the two rows just swap below like they do in the pixel buffer
+	if (output->destination != NULL)
+	{
+		*current_row = destination_row(output->destination, image, row_index);
+	}
+
+	STATS_NOW(filter_start);
+	unfilter_row(filtered[0], filtered + 1, row_index > 0 ? *previous_row : NULL, *current_row, scanline_size, image->bytes_per_pixel);
+	STATS_ELAPSED(output->stats, filter_nanoseconds, filter_start);
+
+	//the next row is unfiltered against this one as it was, so the callback gets a corrected copy and destination
+	//rows are corrected a row late, once the row below them is done (finish_rows does the last one)
+	const uint8_t *row = *current_row;
+	if (output->color != NULL && output->callback != NULL)
+	{
+		apply_color(output->color, *current_row, output->color_row, image->w, image->bytes_per_pixel);
+		row = output->color_row;
+	}
+	else if (output->color != NULL && row_index > 0)
+	{
+		apply_color(output->color, *previous_row, *previous_row, image->w, image->bytes_per_pixel);
+	}
+
+	uint64_t row_end = ((uint64_t)row_index + 1) * (scanline_size + 1);
+	if (check != NULL && row_end >= check->next_row_check)
+	{
+		check->next_row_check = row_end + DECODE_CHECK_BYTES;
+		if (!within_limits(check))
+		{
+			return 0;
+		}
+	}
+
+	if (output->callback != NULL && row_index >= output->first_row && !output->callback(output->user, row_index, row, scanline_size))
+	{
+		fprintf(stderr, "decode_png: row callback stopped the decode at row %u.\n", row_index);
+		return 0;
+	}
+
+	uint8_t *temp = *previous_row;
+	*previous_row = *current_row;
+	*current_row = temp;
+	return 1;
+}
+
+//correct the last row of a destination decode, which hand_out_row leaves for after the end
+static void finish_rows(inflate_output *output, uint8_t *last_row)
+{
+	if (output->color != NULL && output->callback == NULL)
+	{
+		apply_color(output->color, last_row, last_row, output->image->w, output->image->bytes_per_pixel);
+	}
+}
+
+//where row of image starts in destination
+static uint8_t *destination_row(const png_destination *destination, const png *image, uint32_t row)
+{
+	uint64_t y = destination->flip ? (uint32_t)image->h - 1 - row : row;
+	return destination->pixels + y * destination->stride;
+}
+
+//set up the ring and start the thread that empties it. 1 is success, 0 is failure (nothing is running then)
+static int start_pipeline(png_decoder *decoder, inflate_output *output, row_pipeline *pipeline)
+{
+	png *image = output->image;
+	uint64_t slot_size = (uint64_t)image->w * image->bytes_per_pixel + 1;
+
+	memset(pipeline, 0, sizeof(row_pipeline));
+	pipeline->slot_size = slot_size;
+	pipeline->slot_count = (PIPELINE_RING_BYTES / slot_size > PIPELINE_MIN_SLOTS) ? PIPELINE_RING_BYTES / slot_size : PIPELINE_MIN_SLOTS;
+	if (!array_reserve(decoder->pipeline_rows, pipeline->slot_count * slot_size))
+	{
+		fprintf(stderr, "decode_png: unable to allocate %lu bytes for the row pipeline. Cannot decode data.\n", pipeline->slot_count * slot_size);
+		return 0;
+	}
+	pipeline->slots = decoder->pipeline_rows->data;
+
+	atomic_init(&pipeline->produced, 0);
+	atomic_init(&pipeline->consumed, 0);
+	atomic_init(&pipeline->done, 0);
+	atomic_init(&pipeline->failed, 0);
+	atomic_init(&pipeline->sleepers, 0);
+
+	pipeline->output = output;
+	pipeline->previous_row = output->previous_row;
+	pipeline->current_row = output->current_row;
+	if (output->check != NULL)
+	{
+		pipeline->check = *output->check;
+		pipeline->check.stopped = &pipeline->stopped;
+	}
+
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->changed, NULL);
+	if (pthread_create(&pipeline->thread, NULL, pipeline_thread, pipeline) != 0)
+	{
+		fprintf(stderr, "decode_png: unable to start the row pipeline. Cannot decode data.\n");
+		pthread_mutex_destroy(&pipeline->lock);
+		pthread_cond_destroy(&pipeline->changed);
+		return 0;
+	}
+	output->pipeline = pipeline;
+	return 1;
+}
+
+//no more rows come: wait for the pipeline thread to hand out the ones in the ring. 1 if it handed out every row
+static int finish_pipeline(png_decoder *decoder, row_pipeline *pipeline)
+{
+	atomic_store(&pipeline->done, 1);
+	wake_other_side(pipeline);
+	pthread_join(pipeline->thread, NULL);
+	pthread_mutex_destroy(&pipeline->lock);
+	pthread_cond_destroy(&pipeline->changed);
+
+	if (decoder->stopped == DECODE_NOT_STOPPED)
+	{
+		decoder->stopped = pipeline->stopped;
+	}
+	return !atomic_load(&pipeline->failed);
+}
+
+static void *pipeline_thread(void *arg)
+{
+	row_pipeline *pipeline = arg;
+	decode_check *check = (pipeline->output->check != NULL) ? &pipeline->check : NULL;
+
+	for (uint64_t row = 0; ; row++)
+	{
+		wait_for_ring(pipeline, 1, row);
+		if (atomic_load(&pipeline->produced) == row)
+		{
+			//done, and every row is out
+			if (row == (uint64_t)pipeline->output->image->h)
+			{
+				finish_rows(pipeline->output, pipeline->previous_row);
+			}
+			break;
+		}
+
+		const uint8_t *filtered = pipeline->slots + (row % pipeline->slot_count) * pipeline->slot_size;
+		if (!hand_out_row(pipeline->output, &pipeline->previous_row, &pipeline->current_row, row, filtered, check))
+		{
+			atomic_store(&pipeline->failed, 1);
+			wake_other_side(pipeline);
+			break;
+		}
+
+		atomic_store(&pipeline->consumed, row + 1);
+		wake_other_side(pipeline);
+	}
+	return NULL;
+}
+
+//copy a finished scanline into the ring, once there's room. 0 if the pipeline thread has given up
+static int put_row(row_pipeline *pipeline, const uint8_t *filtered)
+{
+	uint64_t row = atomic_load(&pipeline->produced);
+	wait_for_ring(pipeline, 0, row);
+	if (atomic_load(&pipeline->failed))
+	{
+		return 0;
+	}
+
+	memcpy(pipeline->slots + (row % pipeline->slot_count) * pipeline->slot_size, filtered, pipeline->slot_size);
+	atomic_store(&pipeline->produced, row + 1);
+	wake_other_side(pipeline);
+	return 1;
+}
+
+//wait until row is in the ring (for_row) or there's a free slot for it, or the other side is finished.
+//spins for a while first: with both threads running the other one usually gets there in well under a microsecond
+static void wait_for_ring(row_pipeline *pipeline, int for_row, uint64_t row)
+{
+	for (int i = 0; i < PIPELINE_SPINS; i++)
+	{
+		if (ring_ready(pipeline, for_row, row))
+		{
+			return;
+		}
+	}
+
+	//the other side checks sleepers after it changes a counter. every access is sequentially consistent, so either it
+	//sees this thread sleeping or this thread sees the new counter before it sleeps
+	pthread_mutex_lock(&pipeline->lock);
+	atomic_fetch_add(&pipeline->sleepers, 1);
+	while (!ring_ready(pipeline, for_row, row))
+	{
+		pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+	}
+	atomic_fetch_sub(&pipeline->sleepers, 1);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+static int ring_ready(row_pipeline *pipeline, int for_row, uint64_t row)
+{
+	if (for_row)
+	{
+		return atomic_load(&pipeline->produced) > row || atomic_load(&pipeline->done);
+	}
+	return row - atomic_load(&pipeline->consumed) < pipeline->slot_count || atomic_load(&pipeline->failed);
+}
+
+static void wake_other_side(row_pipeline *pipeline)
+{
+	if (atomic_load(&pipeline->sleepers) > 0)
+	{
+		pthread_mutex_lock(&pipeline->lock);
+		pthread_cond_broadcast(&pipeline->changed);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+}
+
+//1 while the decode may go on. otherwise says why it stops and records that in the decoder
+static int within_limits(decode_check *check)
+{
+	if (check->cancel != NULL && atomic_load_explicit(check->cancel, memory_order_relaxed))
+	{
+		fprintf(stderr, "decode_png: decode was cancelled.\n");
+		*check->stopped = DECODE_CANCELLED;
+		return 0;
+	}
+	if (check->deadline != 0 && stats_now() > check->deadline)
+	{
+		fprintf(stderr, "decode_png: decode ran out of time.\n");
+		*check->stopped = DECODE_OUT_OF_TIME;
+		return 0;
+	}
+	return 1;
+}
+
+static static_tables *get_static_tables()
+{
+	pthread_once(&fixed_tables_once, build_static_tables);
+	return &fixed_tables;
+}
+
+static void build_static_tables()
+{
+	uint32_t literal_lengths[288];
+	uint32_t distance_lengths[32];
+	fixed_code_lengths(literal_lengths, distance_lengths);
+	build_huffman_table(fixed_tables.literal_table, literal_lengths, 288, LITERAL_ALPHABET);
+	build_huffman_table(fixed_tables.distance_table, distance_lengths, 32, DISTANCE_ALPHABET);
+}
+
+//will read zlib header to see if any special attention is needed
+static int handle_zlib(bit_stream *cur)
+{
+	if (cur->size < 2)
+	{
+		return 0;
+	}
+
+	uint8_t cmf = pull_bits(cur, 8);
+	uint8_t flg = pull_bits(cur, 8);
+
+	//png format only supports compression method 8 (DEFLATE)
+	uint8_t compression_method = cmf & 0x0F;
+	if (compression_method != 8)
+	{
+		return 0;
+	}
+
+	//check for dictionary to see how many bytes we need to skip
+	if ((flg & 0x20) > 0)
+	{
+		cur->byte_position += 4;
 	}
 
-	//unsupported options
-	if (png->color_type != 2 && png->color_type != 6)
+	return 1;
+}
+
+//copy data from uncompressed block
+static int uncompressed_block(bit_stream *cur, inflate_output *output)
+{
+	//stored blocks start on a byte boundary
+	if (cur->bit_position != 0)
 	{
-		return 0;
+		next_boundry(cur);
 	}
-	if (png->bytes_per_pixel != 8)
+
+	if (cur->byte_position + 4 > cur->size)
 	{
 		return 0;
 	}
-	if (png->interlace_method != 0)
+
+	//LEN is read LSB first, so it comes out in the right order on any host
+	uint32_t length = pull_bits(cur, 16);
+
+	//skip NLEN
+	cur->byte_position += 2;
+
+	dynamic_array *output_stream = output->buffer;
+	if (cur->byte_position + length > cur->size || output->dropped + output_stream->count + length > output->max_output)
 	{
 		return 0;
 	}
 
-	//additional helpful info (for my brain anyways)
-	if (png->color_type == 2)
-	{
-		png->bytes_per_pixel = 3;
-	}
-	if (png->color_type == 6)
+	array_add(output_stream, cur->data + cur->byte_position, length);
+	cur->byte_position += length;
+
+	if (output_stream->count > output->limit)
 	{
-		png->bytes_per_pixel = 4;
+		return flush_rows(output);
 	}
-
 	return 1;
 }
 
-//handle all necessary chunks to parse a basic png. 1 is success, 0 is failure
-//only color types 2 and 6 are supported. Any file containing PLTE chunk will error out
-static int handle_chunk(png *png, int chunk_length, const char *chunk_header, FILE *png_file)
+//decode a huffman block. symbols go through the fast loop while there is room for it, the rest one at a time
+static int huffman_block(bit_stream *cur, inflate_output *output, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats)
 {
-	if (strncmp(chunk_header, "IHDR", 4) == 0)
+	dynamic_array *output_stream = output->buffer;
+	while (1)
 	{
-		if (!handle_IHDR(png, chunk_length, png_file))
+		//past the limit rows are flushed (or, when the whole image is kept, the data holds more than the image)
+		if (output_stream->count > output->limit && !flush_rows(output))
 		{
 			return 0;
 		}
-		return 1;
-	}
-	if (strncmp(chunk_header, "IDAT", 4) == 0)
-	{
-		handle_IDAT(png, chunk_length, png_file);
-		return 1;
-	}
-	if (strncmp(chunk_header, "IEND", 4) == 0)
-	{
-		png->is_valid = 1;
-		return 1;
-	}
 
-	return 0;
+		//the output grows before the fast loop instead of on every byte inside it
+		if (output_stream->capacity - output_stream->count < FAST_OUTPUT_MARGIN && !array_grow(output_stream, FAST_OUTPUT_MARGIN))
+		{
+			return 0;
+		}
+
+		//with limits the fast loop also stops at the next check (a single block can be as big as the whole image)
+		uint64_t limit = output->limit;
+		decode_check *check = output->check;
+		if (check != NULL)
+		{
+			if (output->dropped + output_stream->count >= check->next_check)
+			{
+				check->next_check = output->dropped + output_stream->count + DECODE_CHECK_BYTES;
+				if (!within_limits(check))
+				{
+					return 0;
+				}
+			}
+			if (check->next_check - output->dropped < limit)
+			{
+				limit = check->next_check - output->dropped;
+			}
+		}
+
+		int result = fast_symbols(cur, output_stream, limit, literal_table, distance_table, stats);
+		if (result == SYMBOLS_MORE && output_stream->count <= limit)
+		{
+			result = slow_symbol(cur, output_stream, literal_table, distance_table, stats);
+		}
+
+		if (result == SYMBOLS_END)
+		{
+			return 1;
+		}
+		if (result == SYMBOLS_CORRUPT)
+		{
+			return 0;
+		}
+	}
 }
 
-//decode a png that has been read into memory
-static void decode_png(png *cur)
+//decode symbols without any bounds checks while FAST_INPUT_MARGIN bytes of input and FAST_OUTPUT_MARGIN bytes of
+//output space are left and the output is within limit. bits are kept in a 64 bit buffer that is refilled once per
+//symbol, which always leaves room for the longest length/distance pair (15 + 5 + 15 + 13 bits)
+static int fast_symbols(bit_stream *cur, dynamic_array *output_stream, uint64_t limit, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats)
 {
-	//array our output will be copied to
-	dynamic_array *output_stream = create_array();
-
-	//these trees are defined here since they will be the same for every block
-	node *static_literal_tree = static_symbol();
-	node *static_distance_tree = static_distance();
+	if (cur->byte_position + FAST_INPUT_MARGIN > cur->size)
+	{
+		return SYMBOLS_MORE;
+	}
 
-	//there is exactly 1 zlib header at the start of the compressed data
-	if (!handle_zlib(cur))
+	const uint8_t *in = cur->data + cur->byte_position;
+	const uint8_t *in_end = cur->data + cur->size - FAST_INPUT_MARGIN;
+	uint8_t *out_start = output_stream->data;
+	uint8_t *out = out_start + output_stream->count;
+	uint8_t *out_end = out_start + output_stream->capacity - FAST_OUTPUT_MARGIN;
+	if (limit < output_stream->capacity - FAST_OUTPUT_MARGIN)
 	{
-		free_array(output_stream);
-		fprintf(stderr, "decode_png: compressed data stream contains flags that are not supported by PNG specification. Cannot decode data.\n");
-		return;
+		out_end = out_start + limit;
 	}
 
-	//iterate through blocks
-	char is_final = 0;
-	while (!is_final)
+	//bits above available are either zero or already hold the stream's next bits, so refills can overlap
+	uint64_t bits = load_bits(in) >> cur->bit_position;
+	uint32_t available = 56 - cur->bit_position;
+	in += 7;
+
+	int result = SYMBOLS_MORE;
+	while (in <= in_end && out <= out_end)
 	{
-		//read block header
-		is_final = pull_bit(cur->raw_data);
-		char type = pull_bits(cur->raw_data, 2);
+		bits |= load_bits(in) << available;
+		in += (63 - available) >> 3;
+		available |= 56;
 
-		node *dynamic_literal_tree;
-		node *dynamic_distance_tree;
+		uint32_t entry = literal_table[bits & ((1 << LITERAL_TABLE_BITS) - 1)];
+		if (ENTRY_KIND(entry) == HUFFMAN_SUBTABLE)
+		{
+			entry = literal_table[ENTRY_VALUE(entry) + ((bits >> LITERAL_TABLE_BITS) & ((1 << ENTRY_EXTRA(entry)) - 1))];
+		}
+		bits >>= ENTRY_LENGTH(entry);
+		available -= ENTRY_LENGTH(entry);
 
-		switch (type)
+		if (ENTRY_KIND(entry) == HUFFMAN_LITERAL)
 		{
-		//uncompressed
-		case 0:
-			uncompressed_block(cur->raw_data, output_stream);
+			*out++ = ENTRY_VALUE(entry);
+			STATS_ADD(stats, literals, 1);
+			continue;
+		}
+		if (ENTRY_KIND(entry) == HUFFMAN_END)
+		{
+			result = SYMBOLS_END;
 			break;
-
-		//fixed huffman tree
-		case 1:
-			huffman_block(cur->raw_data, output_stream, static_literal_tree, static_distance_tree);
+		}
+		if (ENTRY_KIND(entry) != HUFFMAN_LENGTH)
+		{
+			result = SYMBOLS_CORRUPT;
 			break;
+		}
 
-		//dynamic huffman tree
-		case 2:
-			generate_dynamic(cur->raw_data, &dynamic_literal_tree, &dynamic_distance_tree);
-			huffman_block(cur->raw_data, output_stream, dynamic_literal_tree, dynamic_distance_tree);
-			free_tree(dynamic_literal_tree);
-			free_tree(dynamic_distance_tree);
-			break;
+		uint32_t length = ENTRY_VALUE(entry) + (bits & ((1 << ENTRY_EXTRA(entry)) - 1));
+		bits >>= ENTRY_EXTRA(entry);
+		available -= ENTRY_EXTRA(entry);
 
-		//error
-		case 3:
-			free_array(output_stream);
-			fprintf(stderr, "decode_png: compressed data stream contains a block with type 3(error). Cannot decode data.\n");
-			return;
+		entry = distance_table[bits & ((1 << DISTANCE_TABLE_BITS) - 1)];
+		if (ENTRY_KIND(entry) == HUFFMAN_SUBTABLE)
+		{
+			entry = distance_table[ENTRY_VALUE(entry) + ((bits >> DISTANCE_TABLE_BITS) & ((1 << ENTRY_EXTRA(entry)) - 1))];
+		}
+		bits >>= ENTRY_LENGTH(entry);
+		available -= ENTRY_LENGTH(entry);
+		if (ENTRY_KIND(entry) != HUFFMAN_DISTANCE)
+		{
+			result = SYMBOLS_CORRUPT;
 			break;
 		}
-	}
 
-	//clean up dynamic memory before moving on
-	free_tree(static_literal_tree);
-	free_tree(static_distance_tree);
+		uint64_t distance = ENTRY_VALUE(entry) + (bits & ((1 << ENTRY_EXTRA(entry)) - 1));
+		bits >>= ENTRY_EXTRA(entry);
+		available -= ENTRY_EXTRA(entry);
+		if (distance > (uint64_t)(out - out_start))
+		{
+			fprintf(stderr, "decode_png: corruption or error detected - distance has pointed to a location before the start of the output array. %lu\n", distance);
+			result = SYMBOLS_CORRUPT;
+			break;
+		}
 
-	//remove filtering from output data(converts it to pixel data)
-	handle_filter(cur, output_stream);
+		//matches at least 8 bytes back are copied 8 bytes at a time (overshooting into the margin), closer ones byte by byte
+		const uint8_t *from = out - distance;
+		uint8_t *end = out + length;
+		if (distance >= 8)
+		{
+			do
+			{
+				memcpy(out, from, 8);
+				out += 8;
+				from += 8;
+			} while (out < end);
+		}
+		else if (distance == 1)
+		{
+			memset(out, *from, length);
+		}
+		else
+		{
+			while (out < end)
+			{
+				*out++ = *from++;
+			}
+		}
+		out = end;
+		STATS_ADD(stats, matches, 1);
+		STATS_ADD(stats, match_bytes, length);
+	}
 
-	//free the decoded output stream
-	free_array(output_stream);
+	//hand the position back to the bit stream
+	uint64_t bit_offset = (uint64_t)(in - cur->data) * 8 - available;
+	cur->byte_position = bit_offset / 8;
+	cur->bit_position = bit_offset % 8;
+	output_stream->count = out - out_start;
+	return result;
 }
 
-//will read zlib header to see if any special attention is needed
-static int handle_zlib(png *cur)
+//decode one symbol with every check, for the end of the input or when the fast loop can't run
+static int slow_symbol(bit_stream *cur, dynamic_array *output_stream, const uint32_t *literal_table, const uint32_t *distance_table, block_stats *stats)
 {
-	uint8_t cmf = pull_bits(cur->raw_data, 8);
-	uint8_t flg = pull_bits(cur->raw_data, 8);
-
-	//png format only supports compression method 8 (DEFLATE)
-	uint8_t compression_method = cmf & 0x0F;
-	if (compression_method != 8)
+	//running out of input means the data is corrupt
+	if (cur->byte_position >= cur->size)
 	{
-		return 0;
+		return SYMBOLS_CORRUPT;
 	}
 
-	//check for dictionary to see how many bytes we need to skip
-	if ((flg & 0x20) > 0)
+	uint32_t entry = read_entry(cur, literal_table, LITERAL_TABLE_BITS);
+	int result = SYMBOLS_MORE;
+	switch (ENTRY_KIND(entry))
 	{
-		cur->raw_data->byte_position += 4;
-	}
-
-	return 1;
-}
+	case HUFFMAN_LITERAL:
+		push_byte(output_stream, ENTRY_VALUE(entry));
+		STATS_ADD(stats, literals, 1);
+		break;
 
-//copy data from uncompressed block
-static void uncompressed_block(dynamic_array *cur, dynamic_array *output_stream)
-{
-	printf("Uncompressed block has been reached\n");
-	next_boundry(cur);
+	case HUFFMAN_END:
+		result = SYMBOLS_END;
+		break;
 
-	uint32_t length = pull_bits(cur, 16);
-	if(!check_endian())
+	case HUFFMAN_LENGTH:
 	{
-		length = (uint32_t)byte_swap(length);
+		uint32_t length = ENTRY_VALUE(entry) + pull_bits(cur, ENTRY_EXTRA(entry));
+		entry = read_entry(cur, distance_table, DISTANCE_TABLE_BITS);
+		if (ENTRY_KIND(entry) != HUFFMAN_DISTANCE)
+		{
+			return SYMBOLS_CORRUPT;
+		}
+		uint32_t distance = ENTRY_VALUE(entry) + pull_bits(cur, ENTRY_EXTRA(entry));
+		if (!handle_length_copy(output_stream, length, distance))
+		{
+			return SYMBOLS_CORRUPT;
+		}
+		STATS_ADD(stats, matches, 1);
+		STATS_ADD(stats, match_bytes, length);
+		break;
 	}
 
-	cur->byte_position += 2;
-	array_add(output_stream, cur->data + cur->byte_position, length);
-	cur->byte_position += length + 4;
+	default:
+		return SYMBOLS_CORRUPT;
+	}
+
+	//reads past the end come back as zero bits, so a symbol that needed them is cut off
+	if (cur->byte_position > cur->size || (cur->byte_position == cur->size && cur->bit_position > 0))
+	{
+		return SYMBOLS_CORRUPT;
+	}
+	return result;
 }
 
-//helper function to decode huffman-encoded block
-static void huffman_block(dynamic_array *cur, dynamic_array *output_stream, node *literal_tree, node *distance_tree)
+//look the next code up in table and step over it (bits past the end of the data read as 0)
+static uint32_t read_entry(bit_stream *cur, const uint32_t *table, uint32_t table_bits)
 {
-	while (1)
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < 3 && cur->byte_position + i < cur->size; i++)
 	{
-		int32_t symbol = get_symbol(cur, literal_tree);
-
-		if (symbol < 256)
-		{
-			uint8_t temp = (uint8_t)symbol;
-			push_byte(output_stream, temp);
-		}
-		if (symbol == 256)
-		{
-			break;
-		}
-		if (symbol > 256)
-		{
-			//calculate the length
-			int32_t index = symbol - 257;
-			int32_t length_bits = length_extra_bits[index];
-			int32_t length = length_values[index];
-			length += pull_bits(cur, length_bits);
-
-			//retreive distance from table
-			int32_t distance_code = get_symbol(cur, distance_tree);
-			int32_t distance_bits = distance_extra_bits[distance_code];
-			int32_t distance = distance_values[distance_code] + pull_bits(cur, distance_bits);
+		bits |= (uint32_t)cur->data[cur->byte_position + i] << (8 * i);
+	}
+	bits >>= cur->bit_position;
 
-			handle_length_copy(cur, output_stream, length, distance);
-		}
+	uint32_t entry = table[bits & ((1 << table_bits) - 1)];
+	if (ENTRY_KIND(entry) == HUFFMAN_SUBTABLE)
+	{
+		entry = table[ENTRY_VALUE(entry) + ((bits >> table_bits) & ((1 << ENTRY_EXTRA(entry)) - 1))];
 	}
+
+	uint64_t bit_offset = cur->bit_position + ENTRY_LENGTH(entry);
+	cur->byte_position += bit_offset / 8;
+	cur->bit_position = bit_offset % 8;
+	return entry;
 }
 
-static void handle_length_copy(dynamic_array *cur, dynamic_array *output_stream, int32_t length, int32_t distance)
+//8 bytes of the stream as a little endian number
+static uint64_t load_bits(const uint8_t *data)
 {
-	int32_t max = output_stream->count;
-	int32_t current_position = max - distance;
+	uint64_t to_return;
+	memcpy(&to_return, data, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	to_return = __builtin_bswap64(to_return);
+#endif
+	return to_return;
+}
 
-	//hard crash to avoid undefined behavior if we see values that would result in memory access violations
-	if (current_position < 0)
+static int handle_length_copy(dynamic_array *output_stream, uint64_t length, uint64_t distance)
+{
+	//refuse distances that would point to memory before the start of the output array
+	if (distance == 0 || distance > output_stream->count)
 	{
-		fprintf(stderr, "decode_png: corruption or error detected - distance has pointed to a location before the start of the output array. %d\n", distance);
-		abort();
+		fprintf(stderr, "decode_png: corruption or error detected - distance has pointed to a location before the start of the output array. %lu\n", distance);
+		return 0;
 	}
 
-	int32_t counter = 0;
-	while (counter < length)
+	//room for the whole match is made once, so the copy itself doesn't need any checks
+	if (!array_grow(output_stream, length))
 	{
-		int8_t data_temp = array_get(output_stream, current_position);
-		push_byte(output_stream, data_temp);
-		counter++;
-		current_position++;
+		return 0;
+	}
 
-		if (current_position >= max)
-		{
-			current_position = max - distance;
-		}
+	//byte by byte, because a match is allowed to overlap the bytes it is producing
+	uint8_t *data = output_stream->data;
+	uint64_t position = output_stream->count;
+	for (uint64_t i = 0; i < length; i++)
+	{
+		data[position + i] = data[position + i - distance];
 	}
+	output_stream->count += length;
+
+	return 1;
 }
 
-static void handle_filter(png *cur, dynamic_array *output_stream)
+//output_stream has to hold every scanline (decode_png checks this), so reads don't need bounds checks
+static int handle_filter(png *cur, dynamic_array *output_stream, const color_transform *color, decode_check *check, decode_stats *stats)
 {
-	int32_t scanline_size = cur->w * cur->bytes_per_pixel;
+	uint64_t scanline_size = (uint64_t)cur->w * cur->bytes_per_pixel;
+	uint64_t first_output = cur->pixel_data->count;
+
+	if (!array_reserve(cur->pixel_data, first_output + scanline_size * cur->h))
+	{
+		fprintf(stderr, "decode_png: unable to allocate %lu bytes for pixel data. Cannot decode data.\n", scanline_size * cur->h);
+		return 0;
+	}
 
 	//iterate through scanlines
-	int32_t scanline_counter = 0;
-	while (scanline_counter < cur->h)
+	for (uint64_t scanline_counter = 0; scanline_counter < cur->h; scanline_counter++)
 	{
-		int32_t position = (scanline_counter * scanline_size) + scanline_counter;
-		int32_t output_position = (scanline_counter * scanline_size);
+		const uint8_t *filtered = output_stream->data + scanline_counter * (scanline_size + 1);
+		uint8_t *output = cur->pixel_data->data + first_output + scanline_counter * scanline_size;
 
-		uint8_t filter_method = array_get(output_stream, position);
+		uint8_t filter_method = filtered[0];
+		if (filter_method > FILTER_PAETH)
+		{
+			fprintf(stderr, "decode_png: scanline %lu uses unknown filter type %d. Cannot decode data.\n", scanline_counter, filter_method);
+			return 0;
+		}
+		STATS_ADD(stats, filter_rows[filter_method], 1);
 
-		//iterate through scanline
-		for (int i = 0; i < scanline_size; i++)
+		uint64_t row_end = (scanline_counter + 1) * (scanline_size + 1);
+		if (check != NULL && row_end >= check->next_row_check)
 		{
-			uint8_t x = 0;
+			check->next_row_check = row_end + DECODE_CHECK_BYTES;
+			if (!within_limits(check))
+			{
+				return 0;
+			}
+		}
 
-			uint8_t a = 0;
-			uint8_t b = 0;
-			uint8_t c = 0;
+		unfilter_row(filter_method, filtered + 1, scanline_counter > 0 ? output - scanline_size : NULL, output, scanline_size, cur->bytes_per_pixel);
+		cur->pixel_data->count += scanline_size;
 
-			x = array_get(output_stream, (position + i) + 1);
+		//the row above is corrected once this one no longer needs it as it was
+		if (color != NULL && scanline_counter > 0)
+		{
+			apply_color(color, output - scanline_size, output - scanline_size, cur->w, cur->bytes_per_pixel);
+		}
+	}
 
-			if ((i >= (cur->bytes_per_pixel)) && (scanline_counter > 0))
-			{
-				c = array_get(cur->pixel_data, (output_position + i - scanline_size - cur->bytes_per_pixel));
-			}
-			if (scanline_counter > 0)
-			{
-				b = array_get(cur->pixel_data, (output_position + i - scanline_size));
-			}
-			if (i >= (cur->bytes_per_pixel))
-			{
-				a = array_get(cur->pixel_data, (output_position + i - cur->bytes_per_pixel));
-			}
+	if (color != NULL && cur->h > 0)
+	{
+		uint8_t *last_row = cur->pixel_data->data + first_output + (cur->h - 1) * scanline_size;
+		apply_color(color, last_row, last_row, cur->w, cur->bytes_per_pixel);
+	}
+	return 1;
+}
 
-			int32_t to_add = 0;
-			//calculate output pixel
-			switch (filter_method)
-			{
-			//none
-			case 0:
-				push_byte(cur->pixel_data, x);
-				break;
+//undo the filter of one scanline. previous is the unfiltered row above (NULL for the first row, where it counts as 0)
+static void unfilter_row(uint8_t filter_method, const uint8_t *filtered, const uint8_t *previous, uint8_t *output, uint64_t size, uint8_t bytes_per_pixel)
+{
+	uint64_t first = (bytes_per_pixel < size) ? bytes_per_pixel : size;
 
-			//sub
-			case 1:
-				to_add = (x + a);
-				push_byte(cur->pixel_data, to_add);
-				break;
+	//paeth without a row above always picks the left pixel, which is sub
+	if (filter_method == FILTER_PAETH && previous == NULL)
+	{
+		filter_method = FILTER_SUB;
+	}
 
-			//up
-			case 2:
-				to_add = (x + b);
-				push_byte(cur->pixel_data, to_add);
-				break;
+	switch (filter_method)
+	{
+	case FILTER_NONE:
+		memcpy(output, filtered, size);
+		break;
 
-			//average
-			case 3:
-				to_add = x + floor((a + b) / 2);
-				push_byte(cur->pixel_data, to_add);
-				break;
+	case FILTER_SUB:
+		memcpy(output, filtered, first);
+		for (uint64_t i = first; i < size; i++)
+		{
+			output[i] = filtered[i] + output[i - bytes_per_pixel];
+		}
+		break;
 
-			//paeth
-			case 4:
-				to_add = x + paeth(a, b, c);
-				push_byte(cur->pixel_data, to_add);
-				break;
-			}
+	case FILTER_UP:
+		if (previous == NULL)
+		{
+			memcpy(output, filtered, size);
+			break;
+		}
+		for (uint64_t i = 0; i < size; i++)
+		{
+			output[i] = filtered[i] + previous[i];
+		}
+		break;
+
+	case FILTER_AVERAGE:
+		for (uint64_t i = 0; i < size; i++)
+		{
+			uint32_t a = (i >= bytes_per_pixel) ? output[i - bytes_per_pixel] : 0;
+			uint32_t b = (previous != NULL) ? previous[i] : 0;
+			output[i] = filtered[i] + ((a + b) >> 1);
 		}
+		break;
 
-		scanline_counter++;
+	case FILTER_PAETH:
+		//the left and upper left pixels are 0 for the first pixel, so paeth picks the one above
+		for (uint64_t i = 0; i < first; i++)
+		{
+			output[i] = filtered[i] + previous[i];
+		}
+		for (uint64_t i = first; i < size; i++)
+		{
+			output[i] = filtered[i] + paeth(output[i - bytes_per_pixel], previous[i], previous[i - bytes_per_pixel]);
+		}
+		break;
 	}
 }
 
-static int32_t paeth(int32_t a, int32_t b, int32_t c)
+//paeth predictor (shared with the encoder)
+int32_t paeth(int32_t a, int32_t b, int32_t c)
 {
 	int32_t p = a + b - c;
 	int32_t pa = abs(p - a);
@@ -545,16 +2418,22 @@ static int32_t paeth(int32_t a, int32_t b, int32_t c)
 	return c;
 }
 
-//generate literal and static huffman trees for dynamic block
-static void generate_dynamic(dynamic_array *cur, node **literal_tree, node **distance_tree)
+//decoding tables for the dynamic block header at cur, from the cache when the same code lengths were seen recently
+//NULL if the header is corrupt or the tables can't be allocated. the tables stay valid until the next dynamic block
+static const huffman_tables *generate_dynamic(png_decoder *decoder, bit_stream *cur)
 {
 	//pull info about block header from data stream
 	uint32_t HLIT = (pull_bits(cur, 5) + 257);
 	uint32_t HDIST = (pull_bits(cur, 5) + 1);
 	uint32_t HCLEN = (pull_bits(cur, 4) + 4);
 
+	if (HLIT > 286 || HDIST > 30)
+	{
+		return NULL;
+	}
+
 	//pull code lengths from data stream
-	uint32_t *alphabet_code_lengths = calloc(19, sizeof(uint32_t));
+	uint32_t alphabet_code_lengths[19] = {0};
 	for (int i = 0; i < HCLEN; i++)
 	{
 		alphabet_code_lengths[i] = pull_bits(cur, 3);
@@ -562,76 +2441,160 @@ static void generate_dynamic(dynamic_array *cur, node **literal_tree, node **dis
 
 	//create tree for "alphabet", used to decode the two other trees
 	//this needs it's own special function because of the funky order of the code lengths
-	node *alphabet_tree = create_alphabet(alphabet_code_lengths, HCLEN);
+	STATS_NOW(tree_start);
+	node *alphabet_tree = pool_alphabet(&decoder->alphabet_nodes, alphabet_code_lengths, HCLEN);
+	STATS_ELAPSED(&decoder->stats, tree_nanoseconds, tree_start);
+	STATS_ADD(&decoder->stats, trees_built, 1);
+
+	//both trees are stored as one sequence of code lengths (repeats are allowed to cross from one to the other)
+	uint32_t code_lengths[286 + 30];
+	if (alphabet_tree == NULL || !decode_code_lengths(alphabet_tree, cur, code_lengths, HLIT + HDIST))
+	{
+		return NULL;
+	}
+
+	//code lengths are at most 15, so a byte each is enough to compare them with the cached ones
+	uint8_t packed_lengths[286 + 30];
+	uint64_t hash = 0xCBF29CE484222325 ^ (HLIT << 8) ^ HDIST;
+	for (uint32_t i = 0; i < HLIT + HDIST; i++)
+	{
+		packed_lengths[i] = code_lengths[i];
+		hash = (hash ^ code_lengths[i]) * 0x100000001B3;
+	}
+
+	huffman_tables *tables = find_tables(decoder, packed_lengths, HLIT, HDIST, hash);
+	if (tables == NULL || tables->literal_count != 0)
+	{
+		return tables;
+	}
+
+	STATS_NOW(trees_start);
+	int built = build_huffman_table(tables->literal_table, code_lengths, HLIT, LITERAL_ALPHABET)
+		&& build_huffman_table(tables->distance_table, code_lengths + HLIT, HDIST, DISTANCE_ALPHABET);
+	STATS_ELAPSED(&decoder->stats, tree_nanoseconds, trees_start);
+	STATS_ADD(&decoder->stats, trees_built, 2);
+	if (!built)
+	{
+		return NULL;
+	}
+
+	tables->hash = hash;
+	tables->literal_count = HLIT;
+	tables->distance_count = HDIST;
+	memcpy(tables->code_lengths, packed_lengths, HLIT + HDIST);
+	return tables;
+}
 
-	//decode the two dynamic trees we need from data stream (order matters)
-	*literal_tree = decode_dynamic_tree(alphabet_tree, cur, HLIT);
-	*distance_tree = decode_dynamic_tree(alphabet_tree, cur, HDIST);
+//the cached tables built from these code lengths, or else the least recently used slot, emptied (literal_count 0)
+//for the caller to build them in. NULL if the slot's tables can't be allocated
+static huffman_tables *find_tables(png_decoder *decoder, const uint8_t *code_lengths, uint32_t literal_count, uint32_t distance_count, uint64_t hash)
+{
+	decoder->table_uses++;
+	huffman_tables *oldest = &decoder->table_cache[0];
+	for (int i = 0; i < HUFFMAN_CACHE_SIZE; i++)
+	{
+		huffman_tables *tables = &decoder->table_cache[i];
+		if (tables->literal_count == literal_count && tables->distance_count == distance_count && tables->hash == hash
+			&& memcmp(tables->code_lengths, code_lengths, literal_count + distance_count) == 0)
+		{
+			tables->last_used = decoder->table_uses;
+			STATS_ADD(&decoder->stats, table_cache_hits, 1);
+			return tables;
+		}
+		if (tables->last_used < oldest->last_used)
+		{
+			oldest = tables;
+		}
+	}
+	STATS_ADD(&decoder->stats, table_cache_misses, 1);
 
-	free_tree(alphabet_tree);
-	free(alphabet_code_lengths);
+	//slots get their tables the first time they are needed
+	oldest->literal_count = 0;
+	oldest->last_used = decoder->table_uses;
+	if (oldest->literal_table == NULL)
+	{
+		oldest->literal_table = mem_alloc(&decoder->allocator, LITERAL_TABLE_SIZE * sizeof(uint32_t));
+		oldest->distance_table = mem_alloc(&decoder->allocator, DISTANCE_TABLE_SIZE * sizeof(uint32_t));
+		if (oldest->literal_table == NULL || oldest->distance_table == NULL)
+		{
+			mem_free(&decoder->allocator, oldest->literal_table, LITERAL_TABLE_SIZE * sizeof(uint32_t));
+			mem_free(&decoder->allocator, oldest->distance_table, DISTANCE_TABLE_SIZE * sizeof(uint32_t));
+			oldest->literal_table = NULL;
+			oldest->distance_table = NULL;
+			return NULL;
+		}
+	}
+	return oldest;
 }
 
-//given an alphabet tree, decode the code lengths of the tree
-static node *decode_dynamic_tree(node *alphabet, dynamic_array *cur, uint32_t num_codes)
+//given an alphabet tree, decode num_codes code lengths. 1 is success, 0 is failure
+static int decode_code_lengths(node *alphabet, bit_stream *cur, uint32_t *code_lengths, uint32_t num_codes)
 {
-	uint32_t *code_lengths = calloc(num_codes, sizeof(uint32_t));
 	int length_index = 0;
 
 	//decode loop for code lengths of literal alphabet
-	uint32_t result = 0;
+	int32_t result = 0;
 	uint32_t previous_code = 0;
-	while (length_index != num_codes && length_index < num_codes)
+	while (length_index < num_codes)
 	{
-		result = 0;
+		if (cur->byte_position >= cur->size)
+		{
+			return 0;
+		}
+
 		result = get_symbol(cur, alphabet);
 
-		uint32_t extra_arg = 0;
+		uint32_t repeat = 0;
+		uint32_t value = 0;
 		switch (result)
 		{
-		//copy last value 3 - 6 times (2 extra bits)
+		//copy last value 3 - 6 times (2 extra bits). after a run of nulls the last value is 0
 		case 16:
-			extra_arg = pull_bits(cur, 2);
-			for (int x = 0; x < (3 + extra_arg); x++)
+			if (length_index == 0)
 			{
-				code_lengths[length_index] = previous_code;
-				length_index++;
+				return 0;
 			}
+			repeat = 3 + pull_bits(cur, 2);
+			value = previous_code;
 			break;
 
 		//copy null 3-11 times (3 exta bits)
 		case 17:
-			extra_arg = pull_bits(cur, 3);
-			for (int x = 0; x < (3 + extra_arg); x++)
-			{
-				code_lengths[length_index] = 0;
-				length_index++;
-			}
+			repeat = 3 + pull_bits(cur, 3);
+			previous_code = 0;
 			break;
 
 		//copy null 11-138 times (7 exta bits)
 		case 18:
-			extra_arg = pull_bits(cur, 7);
-			for (int x = 0; x < (11 + extra_arg); x++)
-			{
-				code_lengths[length_index] = 0;
-				length_index++;
-			}
+			repeat = 11 + pull_bits(cur, 7);
+			previous_code = 0;
 			break;
 
 		//default value (copy value)
 		default:
-			code_lengths[length_index] = result;
+			if (result < 0 || result > 15)
+			{
+				return 0;
+			}
+			repeat = 1;
+			value = result;
 			previous_code = result;
-			length_index++;
 			break;
 		}
-	}
 
-	node *to_return = create_dynamic_tree(code_lengths, num_codes);
-	free(code_lengths);
+		//repeats can't run past the end of the code lengths
+		if (length_index + repeat > num_codes)
+		{
+			return 0;
+		}
+		for (uint32_t x = 0; x < repeat; x++)
+		{
+			code_lengths[length_index] = value;
+			length_index++;
+		}
+	}
 
-	return to_return;
+	return 1;
 }
 
 //check if host system is little_endian or big_endian
@@ -652,7 +2615,7 @@ int32_t byte_swap(int32_t to_swap)
 {
 	int32_t to_return = 0;
 
-	to_return += ((to_swap & 0x000000FF) << 24);
+	to_return += ((uint32_t)(to_swap & 0x000000FF) << 24);
 	to_return += ((to_swap & 0x0000FF00) << 8);
 	to_return += ((to_swap & 0x00FF0000) >> 8);
 	to_return += ((to_swap & 0xFF000000) >> 24);
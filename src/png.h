@@ -3,9 +3,22 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #include "dynamic_array.h"
 #include "huffman_tree.h"
+#include "deflate_tables.h"
+#include "decode_stats.h"
+
+//scanline filter types (same numbering as the filter byte in front of each scanline)
+enum
+{
+	FILTER_NONE = 0,
+	FILTER_SUB = 1,
+	FILTER_UP = 2,
+	FILTER_AVERAGE = 3,
+	FILTER_PAETH = 4
+};
 
 typedef struct Png
 {
@@ -29,12 +42,280 @@ typedef struct Png
 
 	//flag to show whether a PNG has been read correctly or not
 	int is_valid;
+
+	//allocator the png struct itself came from (free_png uses it). zeroed means libc
+	mem_allocator allocator;
 }png;
 
+//crc_status of a chunk (checked only when asked for)
+enum
+{
+	CHUNK_CRC_UNCHECKED = 0,
+	CHUNK_CRC_OK = 1,
+	CHUNK_CRC_BAD = 2,
+
+	//the chunk data wasn't read (IDAT after a metadata-only read) or is cut off
+	CHUNK_CRC_MISSING = 3
+};
+
+//one entry of the chunk index a decode builds while it walks the file
+typedef struct Png_chunk
+{
+	//NUL terminated chunk type
+	char type[5];
+	uint8_t crc_status;
+
+	//where the chunk data starts in the file and how many bytes it has
+	uint64_t offset;
+	uint32_t length;
+}png_chunk;
+
+//a point between two deflate blocks of the image data, where inflating can start again (see png_index.h)
+typedef struct Deflate_boundary
+{
+	//bits of compressed data (counted from the zlib header) and filtered bytes inflated before the boundary
+	uint64_t bit_offset;
+	uint64_t output_offset;
+}deflate_boundary;
+
+typedef struct Png_index png_index;
+typedef struct Color_transform color_transform;
+
+//why the last decode of a decoder stopped before the end (DECODE_NOT_STOPPED if it didn't, or failed on its own)
+typedef enum Decode_stop
+{
+	DECODE_NOT_STOPPED = 0,
+	DECODE_CANCELLED = 1,
+	DECODE_OUT_OF_TIME = 2
+}decode_stop;
+
+//limits a decoder applies to every decode (a zeroed struct is none). they are checked at every deflate block,
+//every DECODE_CHECK_BYTES of inflated data and between unfiltered rows
+typedef struct Decode_limits
+{
+	//time a decode may take from the start of inflating. 0 is no limit
+	uint64_t time_budget_nanoseconds;
+
+	//the decode stops at the next check once this is nonzero. may be set from any thread, NULL is none
+	const atomic_int* cancel;
+}decode_limits;
+
+#define DECODE_CHECK_BYTES (1 << 18)
+
+//rough cost of a full decode (see estimate_decode_cost)
+typedef struct Decode_cost
+{
+	uint64_t nanoseconds;
+
+	//compressed copy, filtered scanlines and pixels. decoding from a file name adds the file itself
+	uint64_t memory_bytes;
+}decode_cost;
+
+//kinds of decode, for estimate_decode_memory
+typedef enum Decode_mode
+{
+	//decoder_read: the whole filtered image and the pixels
+	DECODE_MODE_FULL = 0,
+
+	//decoder_read_rows: a window of filtered data and a few rows of pixels
+	DECODE_MODE_ROWS = 1,
+
+	//decoder_read_into: a window of filtered data, the pixels go to memory the caller already has
+	DECODE_MODE_INTO = 2
+}decode_mode;
+
+//dynamic blocks with the same code lengths as a recent block reuse its tables instead of building them again.
+//encoders often start a new block with the same codes, and building the tables costs as much as a few thousand symbols
+#define HUFFMAN_CACHE_SIZE 4
+
+//decoding tables of a dynamic block (LITERAL_TABLE_SIZE and DISTANCE_TABLE_SIZE entries) and the code lengths they were built from
+typedef struct Huffman_tables
+{
+	//literal_count is 0 while the slot holds no valid tables
+	uint64_t hash;
+	uint32_t literal_count;
+	uint32_t distance_count;
+	uint8_t code_lengths[286 + 30];
+
+	uint32_t* literal_table;
+	uint32_t* distance_table;
+
+	//value of the decoder's table_uses when the tables were last used (the oldest slot is replaced on a miss)
+	uint64_t last_used;
+}huffman_tables;
+
+//decoder state that is kept between images. every buffer only ever grows, so once the decoder
+//has seen an image of a given size, decoding more images like it doesn't touch the allocator
+typedef struct Png_decoder
+{
+	//the last image decoded. its pixel_data belongs to the decoder
+	png image;
+
+	//whole input file (only used when decoding from a file name)
+	dynamic_array* file_data;
+
+	//IDAT data, inflated scanlines and unfiltered pixels
+	dynamic_array* compressed;
+	dynamic_array* inflated;
+	dynamic_array* pixels;
+
+	//every chunk of the last decode (png_chunk entries) and the data they point into. that's file_data for
+	//decoder_read and the caller's memory otherwise. idat_loaded is 0 after decoder_read_info
+	dynamic_array* chunks;
+	const uint8_t* source;
+	uint64_t source_size;
+	int idat_loaded;
+
+	//deflate_boundary entries between the blocks of the last full decode (decoder_build_index picks checkpoints from them)
+	dynamic_array* boundaries;
+
+	//see decoder_set_pipelined. pipeline_rows is the ring of scanlines between the two threads
+	int pipelined;
+	dynamic_array* pipeline_rows;
+
+	//see decoder_set_color_management. color is the transform of the last decode (allocated by the first one that needs it)
+	int color_managed;
+	color_transform* color;
+
+	//nodes for the code length tree, and the tables of the last few distinct dynamic blocks. the tables only
+	//depend on the code lengths, so they stay valid from one image to the next
+	node_pool alphabet_nodes;
+	huffman_tables table_cache[HUFFMAN_CACHE_SIZE];
+	uint64_t table_uses;
+
+	//timings and counters for the last decode (all zero unless built with PNG_STATS)
+	decode_stats stats;
+
+	//see decoder_set_limits. stopped tells whether the last decode hit them
+	decode_limits limits;
+	decode_stop stopped;
+
+	//every buffer above and detached images come from allocator. the decoder struct stays with the one it was created with
+	mem_allocator allocator;
+	mem_allocator created_with;
+}png_decoder;
+
+//caller memory a decode writes its pixels into (see decoder_read_into). row y of the image starts at
+//pixels + y * stride, or at pixels + (h - 1 - y) * stride with flip (bottom up, like bmp or GL textures)
+typedef struct Png_destination
+{
+	uint8_t* pixels;
+	uint64_t size;
+
+	//bytes from one row to the next, at least w * bytes_per_pixel. the bytes past a row are left alone
+	uint64_t stride;
+	int flip;
+}png_destination;
+
+//gets every scanline of a row decode as soon as it is unfiltered. row is only valid during the call
+//return 1 to keep going or 0 to stop the decode
+typedef int (*png_row_callback)(void* user, uint32_t row_index, const uint8_t* row, uint64_t length);
+
+png_decoder* create_decoder();
+void free_decoder(png_decoder* to_free);
+
+//decoder whose memory comes from allocator (NULL is libc). the hooks are copied, their user pointer has to
+//outlive the decoder and any image detached from it. NULL if the decoder couldn't be allocated
+png_decoder* create_decoder_using(const mem_allocator* allocator);
+
+//use another allocator from the next decode on. the buffers from the old one are released (nothing happens
+//if the hooks are the same). 1 is success, 0 is failure (the decoder keeps the old allocator)
+int decoder_set_allocator(png_decoder* decoder, const mem_allocator* allocator);
+
+//apply limits to every later decode (NULL removes them). a decode that hits one prints why, returns a png with
+//is_valid 0 and sets decoder->stopped. like after any failed decode, the decoder keeps its buffers for the next one
+void decoder_set_limits(png_decoder* decoder, const decode_limits* limits);
+
+//with enabled, big images (a megabyte of pixels or more) are decoded on two threads: this one inflates while another one
+//unfilters the rows right behind it, so a decode takes about as long as the slower of the two instead of both. it stays
+//off on a single core. this covers every kind of decode but row ranges. row callbacks then run on the other thread
+//(still one at a time and in order), and a full decode no longer keeps the filtered image, so no index can be built from it
+void decoder_set_pipelined(png_decoder* decoder, int enabled);
+
+//with enabled, every later decode brings its colors to sRGB as its iCCP, sRGB, gAMA and cHRM chunks say (see color.h).
+//the tables are built once per image and every row is corrected right after it is unfiltered, while it is still in
+//cache, so there's no second pass over the image. pngs without those chunks (or that are sRGB already) cost nothing
+void decoder_set_color_management(png_decoder* decoder, int enabled);
+
+//decode into the decoder's buffers. the returned png belongs to the decoder and is overwritten by the next decode
+png* decoder_read(png_decoder* decoder, const char* filename);
+png* decoder_read_memory(png_decoder* decoder, const uint8_t* data, uint64_t size);
+
+//decode without keeping the image: rows go to callback top to bottom and only the row above and the deflate window
+//stay in memory. the returned png has the header but no pixels. is_valid is 0 if the data is corrupt or callback stopped it
+//a NULL callback is the same as decoder_read
+png* decoder_read_rows(png_decoder* decoder, const char* filename, png_row_callback callback, void* user);
+png* decoder_read_memory_rows(png_decoder* decoder, const uint8_t* data, uint64_t size, png_row_callback callback, void* user);
+
+//decode straight into destination: every row is unfiltered in place there, using the row above it in destination,
+//so the image is never allocated or copied by the decoder (only the deflate window and a flush worth of data are kept)
+//destination should be ordinary memory, since rows are read back from it. the returned png has the header but no
+//pixels. is_valid is 0 if the data is corrupt or destination is too small for the image (rows may be written either way)
+png* decoder_read_into(png_decoder* decoder, const char* filename, const png_destination* destination);
+png* decoder_read_memory_into(png_decoder* decoder, const uint8_t* data, uint64_t size, const png_destination* destination);
+
+//read only the header and the chunk index, without touching any IDAT data (it isn't even read from the file)
+//the returned png has the header but no pixels. see metadata.h for what can be read from the chunks
+png* decoder_read_info(png_decoder* decoder, const char* filename);
+png* decoder_read_memory_info(png_decoder* decoder, const uint8_t* data, uint64_t size);
+
+//chunk index of the last decode (any kind). chunk pointers are valid until the next decode
+uint64_t decoder_chunk_count(const png_decoder* decoder);
+png_chunk* decoder_chunk(png_decoder* decoder, uint64_t index);
+
+//index of the first chunk of type at or after first, -1 if there is none
+int64_t decoder_find_chunk(png_decoder* decoder, const char* type, uint64_t first);
+
+//data of a chunk (length bytes, followed by the CRC). NULL if it isn't available
+const uint8_t* decoder_chunk_data(png_decoder* decoder, uint64_t index);
+
+//inflate a whole zlib stream (metadata like zTXt and iCCP) into output. more than max_output bytes counts as corrupt
+//1 is success, 0 is failure
+int decoder_inflate(png_decoder* decoder, const uint8_t* data, uint64_t size, dynamic_array* output, uint64_t max_output);
+
+//decode a bare zlib stream of filtered scanlines (what the IDAT chunks of an image hold) with the size and format of header
+//used for apng frames, whose data isn't a png of its own. the returned png belongs to the decoder like above
+png* decoder_read_stream(png_decoder* decoder, const png* header, const uint8_t* data, uint64_t size);
+
+//decode only rows [first_row, first_row + row_count) to callback. with an index (built from this image, NULL is none)
+//inflating starts at the last checkpoint before first_row instead of the start of the data. the rows in between are
+//still unfiltered (they are needed for the next row) but aren't handed out, and the decode stops after the last row
+png* decoder_read_row_range(png_decoder* decoder, const char* filename, const png_index* index, uint32_t first_row, uint32_t row_count, png_row_callback callback, void* user);
+png* decoder_read_memory_row_range(png_decoder* decoder, const uint8_t* data, uint64_t size, const png_index* index, uint32_t first_row, uint32_t row_count, png_row_callback callback, void* user);
+
+//hand the last decoded image over to the caller (free it with free_png). the decoder starts a new pixel buffer
+//NULL if the allocator fails
+png* decoder_detach(png_decoder* decoder);
+
+//one-off decodes (a decoder is created and thrown away for each call)
 png* read_png(const char* filename);
+png* read_png_memory(const uint8_t* data, uint64_t size);
+png* read_png_using(const char* filename, const mem_allocator* allocator);
+png* read_png_memory_using(const uint8_t* data, uint64_t size, const mem_allocator* allocator);
+
+//read a whole file into output (the array only grows). 1 is success, 0 is failure
+int read_whole_file(dynamic_array* output, const char* filename);
+
+//fill header with the IHDR info of a png without decoding it. 1 is success, 0 is failure
+int probe_png(const char* filename, png* header);
+int probe_png_memory(const uint8_t* data, uint64_t size, png* header);
+
 void png_info(png* to_print);
 void free_png(png* to_free);
 
+//estimate what a full decode of a png with header's IHDR and size bytes of data costs, without decoding anything,
+//so work can be turned away before it starts. the time is for one core and rough: images that are mostly paeth
+//filtered can take a few times longer
+decode_cost estimate_decode_cost(const png* header, uint64_t size);
+
+//peak bytes a decode of a png with header's IHDR and size bytes of data allocates in mode. decoder (NULL is a new one)
+//gives the settings that change it (pipelining, color management). from_file adds the copy of the file a decode by name
+//reads first. the buffers of a decoder only grow, so it can hold this much after the decode too
+uint64_t estimate_decode_memory(const png_decoder* decoder, const png* header, uint64_t size, decode_mode mode, int from_file);
+
+//paeth predictor used by FILTER_PAETH
+int32_t paeth(int32_t a, int32_t b, int32_t c);
+
 //returns 1 if little endian, 0 if big endian
 int check_endian();
 int32_t byte_swap(int32_t to_swap);
\ No newline at end of file
@@ -0,0 +1,1082 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "png_encoder.h"
+#include "checksum.h"
+
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define WINDOW_SIZE 32768
+#define MIN_MATCH 4
+#define MAX_MATCH 258
+
+//number of lz77 symbols gathered before a block is emitted
+#define BLOCK_SYMBOLS 32768
+
+//size of a row strip in threaded mode, and the most a single strip may hold otherwise
+#define STRIP_BYTES (1 << 18)
+#define MAX_STRIP_BYTES (1 << 30)
+
+//PNG file signature
+static const uint8_t png_signature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+
+//order the code length alphabet is written in (inverse of alphabet_indexes in huffman_tree.c)
+static const uint8_t alphabet_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+//lookup tables from match length/distance to deflate code (built once per process)
+static uint8_t length_code[MAX_MATCH + 1];
+static uint8_t distance_code[512];
+static uint8_t fixed_literal_lengths[288];
+static uint16_t fixed_literal_codes[288];
+static uint8_t fixed_distance_lengths[30];
+static uint16_t fixed_distance_codes[30];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+//deflate output is written LSB first through a 64 bit accumulator
+typedef struct Bit_writer
+{
+	uint8_t* data;
+	uint64_t position;
+	uint64_t bits;
+	uint32_t count;
+}bit_writer;
+
+//per-thread state, reused for every strip the thread compresses
+typedef struct Strip_encoder
+{
+	uint32_t* hash_table;
+
+	//lz77 output for the current block. distance 0 means symbol_length holds a literal
+	uint16_t* symbol_length;
+	uint16_t* symbol_distance;
+
+	//filtered scanlines of the current strip
+	uint8_t* filtered;
+	uint8_t* scratch_row;
+}strip_encoder;
+
+//a group of rows that is compressed into its own byte-aligned piece of the zlib stream
+typedef struct Strip
+{
+	uint32_t first_row;
+	uint32_t row_count;
+
+	uint8_t* data;
+	uint64_t size;
+
+	//adler32 of the filtered data in this strip
+	uint32_t adler;
+	uint64_t filtered_size;
+}strip;
+
+typedef struct Encode_job
+{
+	png* image;
+	const encode_options* options;
+	uint64_t row_size;
+	uint32_t strip_rows;
+
+	strip* strips;
+	uint32_t strip_count;
+	atomic_uint next_strip;
+	atomic_int failed;
+}encode_job;
+
+static void generate_tables();
+static void build_lengths(const uint32_t* freq, int num_symbols, int max_bits, uint8_t* lengths);
+static void build_codes(const uint8_t* lengths, int num_symbols, uint16_t* codes);
+static uint32_t reverse_code(uint32_t code, uint32_t length);
+
+static void filter_row(const uint8_t* row, const uint8_t* previous, uint64_t row_size, uint8_t bpp, uint8_t filter, uint8_t* output);
+static uint64_t filter_cost(const uint8_t* filtered, uint64_t row_size);
+
+static void* encode_worker(void* arg);
+static int encode_strip(strip_encoder* enc, encode_job* job, strip* cur, int is_first, int is_last);
+static void compress_strip(strip_encoder* enc, encode_mode mode, const uint8_t* data, uint64_t size, int is_last, bit_writer* w);
+static void flush_block(strip_encoder* enc, encode_mode mode, uint32_t count, const uint8_t* block_data, uint64_t block_size, int is_final, bit_writer* w);
+static void stored_block(bit_writer* w, const uint8_t* data, uint64_t size, int is_final);
+static void write_chunk(dynamic_array* output, const char* type, const uint8_t* data, uint32_t length);
+
+static inline uint32_t get_distance_code(uint32_t distance)
+{
+	distance--;
+	if (distance < 256)
+	{
+		return distance_code[distance];
+	}
+	return distance_code[256 + (distance >> 7)];
+}
+
+static inline uint32_t load32(const uint8_t* data)
+{
+	uint32_t to_return;
+	memcpy(&to_return, data, 4);
+	return to_return;
+}
+
+static inline void put_bits(bit_writer* w, uint64_t value, uint32_t length)
+{
+	w->bits |= value << w->count;
+	w->count += length;
+
+	if (w->count >= 32)
+	{
+		w->data[w->position] = (uint8_t)w->bits;
+		w->data[w->position + 1] = (uint8_t)(w->bits >> 8);
+		w->data[w->position + 2] = (uint8_t)(w->bits >> 16);
+		w->data[w->position + 3] = (uint8_t)(w->bits >> 24);
+		w->position += 4;
+		w->bits >>= 32;
+		w->count -= 32;
+	}
+}
+
+//flush any partial byte so the stream is byte aligned
+static void align_bits(bit_writer* w)
+{
+	while (w->count > 0)
+	{
+		w->data[w->position++] = (uint8_t)w->bits;
+		w->bits >>= 8;
+		w->count = (w->count > 8) ? w->count - 8 : 0;
+	}
+	w->bits = 0;
+}
+
+encode_options default_encode_options()
+{
+	encode_options to_return;
+
+	to_return.mode = ENCODE_DYNAMIC;
+	to_return.filter = FILTER_UP;
+	to_return.threads = 1;
+	to_return.strip_rows = 0;
+	to_return.idat_size = 1 << 20;
+
+	return to_return;
+}
+
+png* png_from_bmp(bmp* source)
+{
+	png* to_return = calloc(1, sizeof(png));
+	to_return->pixel_data = create_array();
+
+	if (source == NULL || !source->is_valid)
+	{
+		return to_return;
+	}
+
+	to_return->w = source->w;
+	to_return->h = source->h;
+	to_return->color_type = 2;
+	to_return->bytes_per_pixel = 3;
+	to_return->bits_per_pixel = 8;
+
+	array_add(to_return->pixel_data, source->pixel_data, (uint64_t)source->w * source->h * 3);
+	to_return->is_valid = 1;
+
+	return to_return;
+}
+
+int write_png(png* image, const char* filename, const encode_options* options)
+{
+	dynamic_array* output = create_array();
+	if (!encode_png(image, options, output))
+	{
+		free_array(output);
+		return 0;
+	}
+
+	FILE* out = fopen(filename, "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "write_png: Failed to open file %s for writing.\n", filename);
+		free_array(output);
+		return 0;
+	}
+
+	int to_return = (fwrite(output->data, 1, output->count, out) == output->count);
+	if (fclose(out) != 0)
+	{
+		to_return = 0;
+	}
+	if (!to_return)
+	{
+		fprintf(stderr, "write_png: file write failed for %s.\n", filename);
+	}
+
+	free_array(output);
+	return to_return;
+}
+
+int encode_png(png* image, const encode_options* options, dynamic_array* output)
+{
+	encode_options defaults = default_encode_options();
+	if (options == NULL)
+	{
+		options = &defaults;
+	}
+
+	if (image == NULL || !image->is_valid || image->w <= 0 || image->h <= 0)
+	{
+		fprintf(stderr, "encode_png: image is invalid. Encoding aborted.\n");
+		return 0;
+	}
+	if ((image->color_type != 2 || image->bytes_per_pixel != 3) && (image->color_type != 6 || image->bytes_per_pixel != 4))
+	{
+		fprintf(stderr, "encode_png: only 8 bit RGB and RGBA images are supported. Encoding aborted.\n");
+		return 0;
+	}
+	if (options->filter > FILTER_ADAPTIVE)
+	{
+		fprintf(stderr, "encode_png: invalid filter type %d. Encoding aborted.\n", options->filter);
+		return 0;
+	}
+
+	uint64_t row_size = (uint64_t)image->w * image->bytes_per_pixel;
+	if (image->pixel_data == NULL || image->pixel_data->count < row_size * image->h)
+	{
+		fprintf(stderr, "encode_png: pixel data is smaller than %dx%d. Encoding aborted.\n", image->w, image->h);
+		return 0;
+	}
+
+	pthread_once(&tables_once, generate_tables);
+
+	//split the image into strips (a single thread still uses strips so hash positions fit in 32 bits)
+	int threads = options->threads > 1 ? options->threads : 1;
+	uint64_t strip_rows = options->strip_rows;
+	if (strip_rows == 0)
+	{
+		strip_rows = ((threads > 1) ? STRIP_BYTES : MAX_STRIP_BYTES) / (row_size + 1);
+	}
+	if (strip_rows > MAX_STRIP_BYTES / (row_size + 1))
+	{
+		strip_rows = MAX_STRIP_BYTES / (row_size + 1);
+	}
+	if (strip_rows < 1)
+	{
+		strip_rows = 1;
+	}
+
+	encode_job job;
+	job.image = image;
+	job.options = options;
+	job.row_size = row_size;
+	job.strip_rows = strip_rows;
+	job.strip_count = (image->h + strip_rows - 1) / strip_rows;
+	job.strips = calloc(job.strip_count, sizeof(strip));
+	atomic_init(&job.next_strip, 0);
+	atomic_init(&job.failed, 0);
+
+	for (uint32_t i = 0; i < job.strip_count; i++)
+	{
+		job.strips[i].first_row = i * strip_rows;
+		job.strips[i].row_count = (i == job.strip_count - 1) ? image->h - job.strips[i].first_row : strip_rows;
+	}
+
+	if (threads > job.strip_count)
+	{
+		threads = job.strip_count;
+	}
+
+	//the calling thread works as well, so only threads - 1 are spawned
+	pthread_t* workers = calloc(threads, sizeof(pthread_t));
+	int spawned = 0;
+	for (int i = 1; i < threads; i++)
+	{
+		if (pthread_create(&workers[spawned], NULL, encode_worker, &job) != 0)
+		{
+			break;
+		}
+		spawned++;
+	}
+	encode_worker(&job);
+	for (int i = 0; i < spawned; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	int to_return = !atomic_load(&job.failed);
+	if (to_return)
+	{
+		//stitch the per-strip checksums together and finish the zlib stream
+		uint32_t adler = job.strips[0].adler;
+		for (uint32_t i = 1; i < job.strip_count; i++)
+		{
+			adler = adler32_combine(adler, job.strips[i].adler, job.strips[i].filtered_size);
+		}
+
+		strip* last = &job.strips[job.strip_count - 1];
+		last->data[last->size++] = (uint8_t)(adler >> 24);
+		last->data[last->size++] = (uint8_t)(adler >> 16);
+		last->data[last->size++] = (uint8_t)(adler >> 8);
+		last->data[last->size++] = (uint8_t)adler;
+
+		array_add(output, (void*)png_signature, 8);
+
+		uint8_t ihdr[13];
+		uint32_t w = image->w;
+		uint32_t h = image->h;
+		for (int i = 0; i < 4; i++)
+		{
+			ihdr[i] = (uint8_t)(w >> (24 - i * 8));
+			ihdr[4 + i] = (uint8_t)(h >> (24 - i * 8));
+		}
+		ihdr[8] = 8;
+		ihdr[9] = image->color_type;
+		ihdr[10] = 0;
+		ihdr[11] = 0;
+		ihdr[12] = 0;
+		write_chunk(output, "IHDR", ihdr, 13);
+
+		uint32_t idat_size = options->idat_size > 0 ? options->idat_size : (1 << 20);
+		for (uint32_t i = 0; i < job.strip_count; i++)
+		{
+			for (uint64_t offset = 0; offset < job.strips[i].size; offset += idat_size)
+			{
+				uint64_t remaining = job.strips[i].size - offset;
+				write_chunk(output, "IDAT", job.strips[i].data + offset, remaining < idat_size ? remaining : idat_size);
+			}
+		}
+
+		write_chunk(output, "IEND", NULL, 0);
+	}
+	else
+	{
+		fprintf(stderr, "encode_png: failed to allocate memory for compression. Encoding aborted.\n");
+	}
+
+	for (uint32_t i = 0; i < job.strip_count; i++)
+	{
+		free(job.strips[i].data);
+	}
+	free(job.strips);
+
+	return to_return;
+}
+
+//length (4 bytes BE), type, data, crc of type + data
+static void write_chunk(dynamic_array* output, const char* type, const uint8_t* data, uint32_t length)
+{
+	uint8_t header[8];
+	header[0] = (uint8_t)(length >> 24);
+	header[1] = (uint8_t)(length >> 16);
+	header[2] = (uint8_t)(length >> 8);
+	header[3] = (uint8_t)length;
+	memcpy(header + 4, type, 4);
+	array_add(output, header, 8);
+
+	uint32_t crc = crc32_update(0, header + 4, 4);
+	if (length > 0)
+	{
+		array_add(output, (void*)data, length);
+		crc = crc32_update(crc, data, length);
+	}
+
+	uint8_t footer[4];
+	footer[0] = (uint8_t)(crc >> 24);
+	footer[1] = (uint8_t)(crc >> 16);
+	footer[2] = (uint8_t)(crc >> 8);
+	footer[3] = (uint8_t)crc;
+	array_add(output, footer, 4);
+}
+
+static void* encode_worker(void* arg)
+{
+	encode_job* job = arg;
+
+	strip_encoder enc;
+	enc.hash_table = malloc(HASH_SIZE * sizeof(uint32_t));
+	enc.symbol_length = malloc(BLOCK_SYMBOLS * sizeof(uint16_t));
+	enc.symbol_distance = malloc(BLOCK_SYMBOLS * sizeof(uint16_t));
+	enc.filtered = malloc((uint64_t)job->strip_rows * (job->row_size + 1));
+	enc.scratch_row = malloc(job->row_size + 1);
+
+	if (enc.hash_table == NULL || enc.symbol_length == NULL || enc.symbol_distance == NULL || enc.filtered == NULL || enc.scratch_row == NULL)
+	{
+		atomic_store(&job->failed, 1);
+	}
+
+	while (!atomic_load(&job->failed))
+	{
+		uint32_t index = atomic_fetch_add(&job->next_strip, 1);
+		if (index >= job->strip_count)
+		{
+			break;
+		}
+
+		if (!encode_strip(&enc, job, &job->strips[index], index == 0, index == job->strip_count - 1))
+		{
+			atomic_store(&job->failed, 1);
+		}
+	}
+
+	free(enc.hash_table);
+	free(enc.symbol_length);
+	free(enc.symbol_distance);
+	free(enc.filtered);
+	free(enc.scratch_row);
+
+	return NULL;
+}
+
+//filter and compress one strip. every strip except the last ends in a full flush so they can be concatenated
+static int encode_strip(strip_encoder* enc, encode_job* job, strip* cur, int is_first, int is_last)
+{
+	png* image = job->image;
+	uint64_t row_size = job->row_size;
+	const uint8_t* pixels = image->pixel_data->data;
+
+	//filtering only looks at unfiltered pixels, so strips never depend on each other
+	for (uint32_t y = 0; y < cur->row_count; y++)
+	{
+		uint64_t row = cur->first_row + y;
+		const uint8_t* previous = (row > 0) ? pixels + (row - 1) * row_size : NULL;
+		uint8_t* output = enc->filtered + y * (row_size + 1);
+
+		if (job->options->filter == FILTER_ADAPTIVE)
+		{
+			uint64_t best_cost = UINT64_MAX;
+			for (uint8_t filter = FILTER_NONE; filter <= FILTER_PAETH; filter++)
+			{
+				filter_row(pixels + row * row_size, previous, row_size, image->bytes_per_pixel, filter, enc->scratch_row);
+
+				uint64_t cost = filter_cost(enc->scratch_row, row_size);
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					memcpy(output, enc->scratch_row, row_size + 1);
+				}
+			}
+		}
+		else
+		{
+			filter_row(pixels + row * row_size, previous, row_size, image->bytes_per_pixel, job->options->filter, output);
+		}
+	}
+
+	cur->filtered_size = (uint64_t)cur->row_count * (row_size + 1);
+	cur->adler = adler32_update(1, enc->filtered, cur->filtered_size);
+
+	//stored blocks are the worst case, plus room for the zlib header/trailer and flush markers
+	uint64_t bound = cur->filtered_size + (cur->filtered_size >> 10) + 1024;
+	cur->data = malloc(bound);
+	if (cur->data == NULL)
+	{
+		return 0;
+	}
+
+	bit_writer w;
+	w.data = cur->data;
+	w.position = 0;
+	w.bits = 0;
+	w.count = 0;
+
+	//zlib header: deflate with a 32K window, no dictionary
+	if (is_first)
+	{
+		w.data[w.position++] = 0x78;
+		w.data[w.position++] = 0x01;
+	}
+
+	compress_strip(enc, job->options->mode, enc->filtered, cur->filtered_size, is_last, &w);
+
+	//full flush: an empty stored block leaves the stream byte aligned with no pending state
+	if (!is_last)
+	{
+		stored_block(&w, NULL, 0, 0);
+	}
+	align_bits(&w);
+
+	cur->size = w.position;
+	return 1;
+}
+
+//apply one filter to a scanline. output[0] is the filter type byte
+static void filter_row(const uint8_t* row, const uint8_t* previous, uint64_t row_size, uint8_t bpp, uint8_t filter, uint8_t* output)
+{
+	output[0] = filter;
+	output++;
+
+	//the first row has no row above it
+	if (previous == NULL && filter == FILTER_UP)
+	{
+		filter = FILTER_NONE;
+	}
+
+	switch (filter)
+	{
+	case FILTER_NONE:
+		memcpy(output, row, row_size);
+		break;
+
+	case FILTER_SUB:
+		memcpy(output, row, bpp);
+		for (uint64_t i = bpp; i < row_size; i++)
+		{
+			output[i] = row[i] - row[i - bpp];
+		}
+		break;
+
+	case FILTER_UP:
+		for (uint64_t i = 0; i < row_size; i++)
+		{
+			output[i] = row[i] - previous[i];
+		}
+		break;
+
+	case FILTER_AVERAGE:
+		for (uint64_t i = 0; i < row_size; i++)
+		{
+			uint32_t a = (i >= bpp) ? row[i - bpp] : 0;
+			uint32_t b = (previous != NULL) ? previous[i] : 0;
+			output[i] = row[i] - ((a + b) >> 1);
+		}
+		break;
+
+	case FILTER_PAETH:
+		for (uint64_t i = 0; i < row_size; i++)
+		{
+			int32_t a = (i >= bpp) ? row[i - bpp] : 0;
+			int32_t b = (previous != NULL) ? previous[i] : 0;
+			int32_t c = (previous != NULL && i >= bpp) ? previous[i - bpp] : 0;
+			output[i] = row[i] - paeth(a, b, c);
+		}
+		break;
+	}
+}
+
+//minimum sum of absolute differences heuristic (from the PNG specification)
+static uint64_t filter_cost(const uint8_t* filtered, uint64_t row_size)
+{
+	uint64_t to_return = 0;
+	for (uint64_t i = 1; i <= row_size; i++)
+	{
+		int8_t value = (int8_t)filtered[i];
+		to_return += (value < 0) ? -value : value;
+	}
+	return to_return;
+}
+
+//single probe lz77 over a strip. matches never reach back before the start of the strip
+static void compress_strip(strip_encoder* enc, encode_mode mode, const uint8_t* data, uint64_t size, int is_last, bit_writer* w)
+{
+	if (mode == ENCODE_STORED)
+	{
+		stored_block(w, data, size, is_last);
+		return;
+	}
+
+	memset(enc->hash_table, 0, HASH_SIZE * sizeof(uint32_t));
+
+	uint64_t position = 0;
+	uint64_t block_start = 0;
+	uint32_t count = 0;
+
+	while (position < size)
+	{
+		int matched = 0;
+
+		if (position + MIN_MATCH <= size)
+		{
+			uint32_t value = load32(data + position);
+			uint32_t hash = (value * 2654435761u) >> (32 - HASH_BITS);
+
+			//positions are stored + 1 so 0 can mean empty
+			uint32_t candidate = enc->hash_table[hash];
+			enc->hash_table[hash] = (uint32_t)position + 1;
+
+			if (candidate != 0)
+			{
+				uint64_t match_position = candidate - 1;
+				uint64_t distance = position - match_position;
+
+				if (distance <= WINDOW_SIZE && load32(data + match_position) == value)
+				{
+					uint64_t max = size - position;
+					if (max > MAX_MATCH)
+					{
+						max = MAX_MATCH;
+					}
+
+					uint64_t length = MIN_MATCH;
+					while (length < max && data[match_position + length] == data[position + length])
+					{
+						length++;
+					}
+
+					enc->symbol_length[count] = (uint16_t)length;
+					enc->symbol_distance[count] = (uint16_t)distance;
+					position += length;
+					matched = 1;
+				}
+			}
+		}
+
+		if (!matched)
+		{
+			enc->symbol_length[count] = data[position];
+			enc->symbol_distance[count] = 0;
+			position++;
+		}
+		count++;
+
+		if (count == BLOCK_SYMBOLS)
+		{
+			flush_block(enc, mode, count, data + block_start, position - block_start, is_last && position == size, w);
+			block_start = position;
+			count = 0;
+		}
+	}
+
+	//the last strip always needs a final block, even if it ends up empty
+	if (count > 0 || (is_last && block_start == 0 && size == 0))
+	{
+		flush_block(enc, mode, count, data + block_start, position - block_start, is_last, w);
+	}
+}
+
+//write the buffered symbols as whichever block type (stored, fixed or dynamic) is smallest
+static void flush_block(strip_encoder* enc, encode_mode mode, uint32_t count, const uint8_t* block_data, uint64_t block_size, int is_final, bit_writer* w)
+{
+	uint32_t literal_freq[288] = {0};
+	uint32_t distance_freq[30] = {0};
+	uint64_t extra_bits = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (enc->symbol_distance[i] == 0)
+		{
+			literal_freq[enc->symbol_length[i]]++;
+		}
+		else
+		{
+			uint32_t length = length_code[enc->symbol_length[i]];
+			uint32_t distance = get_distance_code(enc->symbol_distance[i]);
+			literal_freq[257 + length]++;
+			distance_freq[distance]++;
+			extra_bits += length_extra_bits[length] + distance_extra_bits[distance];
+		}
+	}
+	literal_freq[256] = 1;
+
+	//cost of each block type in bits
+	uint64_t stored_cost = block_size * 8 + ((block_size / 65535) + 1) * 40 + 7;
+
+	uint64_t fixed_cost = 3 + extra_bits;
+	for (int i = 0; i < 288; i++)
+	{
+		fixed_cost += (uint64_t)literal_freq[i] * fixed_literal_lengths[i];
+	}
+	for (int i = 0; i < 30; i++)
+	{
+		fixed_cost += (uint64_t)distance_freq[i] * 5;
+	}
+
+	uint8_t literal_lengths[288] = {0};
+	uint8_t distance_lengths[30] = {0};
+	uint8_t alphabet_lengths[19] = {0};
+	uint8_t tokens[320];
+	uint8_t token_extra[320];
+	uint32_t token_count = 0;
+	uint32_t hlit = 0;
+	uint32_t hdist = 0;
+	uint32_t hclen = 0;
+	uint64_t dynamic_cost = UINT64_MAX;
+
+	if (mode == ENCODE_DYNAMIC)
+	{
+		build_lengths(literal_freq, 286, 15, literal_lengths);
+		build_lengths(distance_freq, 30, 15, distance_lengths);
+
+		hlit = 286;
+		while (hlit > 257 && literal_lengths[hlit - 1] == 0)
+		{
+			hlit--;
+		}
+		hdist = 30;
+		while (hdist > 1 && distance_lengths[hdist - 1] == 0)
+		{
+			hdist--;
+		}
+
+		//run length encode both code length arrays with symbols 16, 17 and 18
+		uint8_t lengths[316];
+		memcpy(lengths, literal_lengths, hlit);
+		memcpy(lengths + hlit, distance_lengths, hdist);
+
+		uint32_t total = hlit + hdist;
+		uint32_t i = 0;
+		while (i < total)
+		{
+			uint8_t value = lengths[i];
+			uint32_t run = 1;
+			while (i + run < total && lengths[i + run] == value)
+			{
+				run++;
+			}
+			i += run;
+
+			if (value == 0)
+			{
+				while (run >= 11)
+				{
+					uint32_t repeat = run > 138 ? 138 : run;
+					tokens[token_count] = 18;
+					token_extra[token_count++] = repeat - 11;
+					run -= repeat;
+				}
+				if (run >= 3)
+				{
+					tokens[token_count] = 17;
+					token_extra[token_count++] = run - 3;
+					run = 0;
+				}
+			}
+			else
+			{
+				tokens[token_count] = value;
+				token_extra[token_count++] = 0;
+				run--;
+
+				while (run >= 3)
+				{
+					uint32_t repeat = run > 6 ? 6 : run;
+					tokens[token_count] = 16;
+					token_extra[token_count++] = repeat - 3;
+					run -= repeat;
+				}
+			}
+
+			while (run > 0)
+			{
+				tokens[token_count] = value;
+				token_extra[token_count++] = 0;
+				run--;
+			}
+		}
+
+		uint32_t alphabet_freq[19] = {0};
+		for (uint32_t t = 0; t < token_count; t++)
+		{
+			alphabet_freq[tokens[t]]++;
+		}
+		build_lengths(alphabet_freq, 19, 7, alphabet_lengths);
+
+		hclen = 19;
+		while (hclen > 4 && alphabet_lengths[alphabet_order[hclen - 1]] == 0)
+		{
+			hclen--;
+		}
+
+		dynamic_cost = 3 + 14 + hclen * 3 + extra_bits;
+		for (uint32_t t = 0; t < token_count; t++)
+		{
+			dynamic_cost += alphabet_lengths[tokens[t]];
+			dynamic_cost += (tokens[t] == 16) ? 2 : (tokens[t] == 17) ? 3 : (tokens[t] == 18) ? 7 : 0;
+		}
+		for (int s = 0; s < 286; s++)
+		{
+			dynamic_cost += (uint64_t)literal_freq[s] * literal_lengths[s];
+		}
+		for (int s = 0; s < 30; s++)
+		{
+			dynamic_cost += (uint64_t)distance_freq[s] * distance_lengths[s];
+		}
+	}
+
+	if (stored_cost <= fixed_cost && stored_cost <= dynamic_cost)
+	{
+		stored_block(w, block_data, block_size, is_final);
+		return;
+	}
+
+	const uint8_t* lit_lengths = fixed_literal_lengths;
+	const uint16_t* lit_codes = fixed_literal_codes;
+	const uint8_t* dist_lengths = fixed_distance_lengths;
+	const uint16_t* dist_codes = fixed_distance_codes;
+	uint16_t literal_codes[288];
+	uint16_t distance_codes[30];
+
+	if (dynamic_cost < fixed_cost)
+	{
+		uint16_t alphabet_codes[19];
+		build_codes(literal_lengths, 286, literal_codes);
+		build_codes(distance_lengths, 30, distance_codes);
+		build_codes(alphabet_lengths, 19, alphabet_codes);
+
+		put_bits(w, is_final ? 1 : 0, 1);
+		put_bits(w, 2, 2);
+		put_bits(w, hlit - 257, 5);
+		put_bits(w, hdist - 1, 5);
+		put_bits(w, hclen - 4, 4);
+		for (uint32_t i = 0; i < hclen; i++)
+		{
+			put_bits(w, alphabet_lengths[alphabet_order[i]], 3);
+		}
+		for (uint32_t t = 0; t < token_count; t++)
+		{
+			put_bits(w, alphabet_codes[tokens[t]], alphabet_lengths[tokens[t]]);
+			if (tokens[t] == 16)
+			{
+				put_bits(w, token_extra[t], 2);
+			}
+			else if (tokens[t] == 17)
+			{
+				put_bits(w, token_extra[t], 3);
+			}
+			else if (tokens[t] == 18)
+			{
+				put_bits(w, token_extra[t], 7);
+			}
+		}
+
+		lit_lengths = literal_lengths;
+		lit_codes = literal_codes;
+		dist_lengths = distance_lengths;
+		dist_codes = distance_codes;
+	}
+	else
+	{
+		put_bits(w, is_final ? 1 : 0, 1);
+		put_bits(w, 1, 2);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t length = enc->symbol_length[i];
+		uint32_t distance = enc->symbol_distance[i];
+
+		if (distance == 0)
+		{
+			put_bits(w, lit_codes[length], lit_lengths[length]);
+			continue;
+		}
+
+		//code and extra bits go out in one write (at most 15 + 13 bits each)
+		uint32_t lcode = length_code[length];
+		uint32_t symbol = 257 + lcode;
+		put_bits(w, lit_codes[symbol] | ((uint64_t)(length - length_values[lcode]) << lit_lengths[symbol]), lit_lengths[symbol] + length_extra_bits[lcode]);
+
+		uint32_t dcode = get_distance_code(distance);
+		put_bits(w, dist_codes[dcode] | ((uint64_t)(distance - distance_values[dcode]) << dist_lengths[dcode]), dist_lengths[dcode] + distance_extra_bits[dcode]);
+	}
+
+	//end of block
+	put_bits(w, lit_codes[256], lit_lengths[256]);
+}
+
+//split data into stored blocks of at most 65535 bytes. size 0 writes an empty block (used for flushing)
+static void stored_block(bit_writer* w, const uint8_t* data, uint64_t size, int is_final)
+{
+	do
+	{
+		uint32_t piece = size > 65535 ? 65535 : (uint32_t)size;
+		size -= piece;
+
+		put_bits(w, (is_final && size == 0) ? 1 : 0, 3);
+		align_bits(w);
+
+		w->data[w->position++] = (uint8_t)piece;
+		w->data[w->position++] = (uint8_t)(piece >> 8);
+		w->data[w->position++] = (uint8_t)~piece;
+		w->data[w->position++] = (uint8_t)(~piece >> 8);
+
+		if (piece > 0)
+		{
+			memcpy(w->data + w->position, data, piece);
+			w->position += piece;
+			data += piece;
+		}
+	} while (size > 0);
+}
+
+static int compare_keys(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+//length limited huffman code lengths. symbols with a frequency of 0 get length 0
+static void build_lengths(const uint32_t* freq, int num_symbols, int max_bits, uint8_t* lengths)
+{
+	memset(lengths, 0, num_symbols);
+
+	//sort used symbols by frequency (symbol number in the low bits keeps the order stable)
+	uint64_t keys[288];
+	int used = 0;
+	for (int i = 0; i < num_symbols; i++)
+	{
+		if (freq[i] > 0)
+		{
+			keys[used++] = ((uint64_t)freq[i] << 9) | i;
+		}
+	}
+
+	//a single code still needs a complete tree, so pair it with another symbol
+	if (used < 2)
+	{
+		int first = (used == 1) ? (int)(keys[0] & 0x1FF) : 0;
+		lengths[first] = 1;
+		lengths[first == 0 ? 1 : 0] = 1;
+		return;
+	}
+
+	qsort(keys, used, sizeof(uint64_t), compare_keys);
+
+	//two queue huffman construction: leaves are sorted, internal nodes are created in increasing order
+	uint64_t weight[576];
+	uint32_t parent[576];
+	uint32_t depth[576];
+	for (int i = 0; i < used; i++)
+	{
+		weight[i] = keys[i] >> 9;
+	}
+
+	int leaf = 0;
+	int inner = used;
+	for (int next = used; next < 2 * used - 1; next++)
+	{
+		uint64_t sum = 0;
+		for (int k = 0; k < 2; k++)
+		{
+			int pick;
+			if (leaf < used && (inner >= next || weight[leaf] <= weight[inner]))
+			{
+				pick = leaf++;
+			}
+			else
+			{
+				pick = inner++;
+			}
+			sum += weight[pick];
+			parent[pick] = next;
+		}
+		weight[next] = sum;
+	}
+
+	int root = 2 * used - 2;
+	depth[root] = 0;
+	for (int i = root - 1; i >= 0; i--)
+	{
+		depth[i] = depth[parent[i]] + 1;
+	}
+
+	//count code lengths, clamping anything that is too long and then fixing up the kraft sum
+	uint32_t bl_count[16] = {0};
+	for (int i = 0; i < used; i++)
+	{
+		bl_count[depth[i] > (uint32_t)max_bits ? max_bits : depth[i]]++;
+	}
+
+	uint64_t total = 0;
+	for (int i = 1; i <= max_bits; i++)
+	{
+		total += (uint64_t)bl_count[i] << (max_bits - i);
+	}
+	while (total > (1ULL << max_bits))
+	{
+		bl_count[max_bits]--;
+		for (int i = max_bits - 1; i > 0; i--)
+		{
+			if (bl_count[i] > 0)
+			{
+				bl_count[i]--;
+				bl_count[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	//least frequent symbols get the longest codes
+	int k = 0;
+	for (int length = max_bits; length > 0; length--)
+	{
+		for (uint32_t c = 0; c < bl_count[length]; c++)
+		{
+			lengths[keys[k++] & 0x1FF] = length;
+		}
+	}
+}
+
+//canonical huffman codes, bit reversed since deflate writes codes MSB first into an LSB first stream
+static void build_codes(const uint8_t* lengths, int num_symbols, uint16_t* codes)
+{
+	uint32_t bl_count[16] = {0};
+	uint32_t next_code[16] = {0};
+
+	for (int i = 0; i < num_symbols; i++)
+	{
+		bl_count[lengths[i]]++;
+	}
+	bl_count[0] = 0;
+
+	uint32_t code = 0;
+	for (int bits = 1; bits < 16; bits++)
+	{
+		code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+
+	for (int i = 0; i < num_symbols; i++)
+	{
+		codes[i] = 0;
+		if (lengths[i] > 0)
+		{
+			codes[i] = reverse_code(next_code[lengths[i]]++, lengths[i]);
+		}
+	}
+}
+
+static uint32_t reverse_code(uint32_t code, uint32_t length)
+{
+	uint32_t to_return = 0;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		to_return = (to_return << 1) | (code & 1);
+		code >>= 1;
+	}
+	return to_return;
+}
+
+static void generate_tables()
+{
+	for (uint32_t code = 0; code < 28; code++)
+	{
+		for (uint32_t n = 0; n < (1u << length_extra_bits[code]); n++)
+		{
+			length_code[length_values[code] + n] = code;
+		}
+	}
+	length_code[258] = 28;
+
+	for (uint32_t code = 0; code < 30; code++)
+	{
+		for (uint32_t n = 0; n < (1u << distance_extra_bits[code]); n++)
+		{
+			uint32_t distance = distance_values[code] + n - 1;
+			if (distance < 256)
+			{
+				distance_code[distance] = code;
+			}
+			else
+			{
+				distance_code[256 + (distance >> 7)] = code;
+			}
+		}
+	}
+
+	for (int i = 0; i < 288; i++)
+	{
+		fixed_literal_lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	for (int i = 0; i < 30; i++)
+	{
+		fixed_distance_lengths[i] = 5;
+	}
+	build_codes(fixed_literal_lengths, 288, fixed_literal_codes);
+	build_codes(fixed_distance_lengths, 30, fixed_distance_codes);
+}
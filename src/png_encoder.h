@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+#include "bmp.h"
+
+//how much effort the encoder spends on compression
+typedef enum Encode_mode
+{
+	//stored deflate blocks only (no compression at all)
+	ENCODE_STORED = 0,
+
+	//single probe lz77 + fixed huffman codes (fpng style)
+	ENCODE_FAST = 1,
+
+	//single probe lz77 + one dynamic huffman table per block
+	ENCODE_DYNAMIC = 2
+}encode_mode;
+
+//filter value that picks the cheapest filter for every scanline
+#define FILTER_ADAPTIVE 5
+
+typedef struct Encode_options
+{
+	encode_mode mode;
+
+	//filter applied to every scanline (FILTER_NONE - FILTER_PAETH or FILTER_ADAPTIVE)
+	uint8_t filter;
+
+	//number of threads used to compress row strips. 0 or 1 compresses the whole image in one stream
+	int threads;
+
+	//rows compressed per strip in threaded mode. 0 picks a size based on the row length
+	uint32_t strip_rows;
+
+	//maximum size of a single IDAT chunk
+	uint32_t idat_size;
+}encode_options;
+
+encode_options default_encode_options();
+
+//encode a png (only needs w, h, color_type, bytes_per_pixel and pixel_data) to a complete png file in memory
+//returns 1 on success, 0 on failure
+int encode_png(png* image, const encode_options* options, dynamic_array* output);
+int write_png(png* image, const char* filename, const encode_options* options);
+
+//wrap the pixels of a bmp in a png that can be handed to the encoder
+png* png_from_bmp(bmp* source);
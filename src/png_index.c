@@ -0,0 +1,195 @@
+#include <sys/stat.h>
+
+#include "png_index.h"
+
+//start of an index file, changed whenever the layout changes
+static const char index_signature[8] = {'P', 'N', 'G', 'I', 'D', 'X', '0', '1'};
+
+static int add_checkpoint(png_index* index, uint64_t* capacity, const png_checkpoint* checkpoint);
+
+png_index* decoder_build_index(png_decoder* decoder, uint64_t span)
+{
+	png* image = &decoder->image;
+	uint64_t scanline_size = (uint64_t)image->w * image->bytes_per_pixel;
+	uint64_t filtered_size = (uint64_t)image->h * (scanline_size + 1);
+
+	//the windows come from the filtered data, which only a full decode keeps
+	if (!image->is_valid || decoder->inflated->count < filtered_size || image->pixel_data->count < scanline_size * image->h)
+	{
+		fprintf(stderr, "decoder_build_index: the decoder doesn't hold a fully decoded image.\n");
+		return NULL;
+	}
+
+	if (span == 0)
+	{
+		span = DEFAULT_CHECKPOINT_SPAN;
+	}
+
+	png_index* to_return = calloc(1, sizeof(png_index));
+	to_return->data = create_array();
+	to_return->w = image->w;
+	to_return->h = image->h;
+	to_return->bytes_per_pixel = image->bytes_per_pixel;
+	to_return->compressed_size = decoder->compressed->count;
+	to_return->span = span;
+
+	const deflate_boundary* boundaries = (const deflate_boundary*)decoder->boundaries->data;
+	uint64_t boundary_count = decoder->boundaries->count / sizeof(deflate_boundary);
+	uint64_t capacity = 0;
+	uint64_t last_offset = 0;
+	for (uint64_t i = 0; i < boundary_count; i++)
+	{
+		const deflate_boundary* boundary = &boundaries[i];
+		if (boundary->output_offset - last_offset < span || boundary->output_offset >= filtered_size)
+		{
+			continue;
+		}
+
+		//the window has to reach back 32 KiB and to the start of the unfinished row
+		png_checkpoint checkpoint;
+		memset(&checkpoint, 0, sizeof(png_checkpoint));
+		checkpoint.bit_offset = boundary->bit_offset;
+		checkpoint.output_offset = boundary->output_offset;
+		checkpoint.row = boundary->output_offset / (scanline_size + 1);
+		uint64_t row_start = checkpoint.row * (scanline_size + 1);
+		uint64_t window_start = (boundary->output_offset > 32768) ? boundary->output_offset - 32768 : 0;
+		if (row_start < window_start)
+		{
+			window_start = row_start;
+		}
+		checkpoint.data_offset = to_return->data->count;
+		checkpoint.window_length = boundary->output_offset - window_start;
+
+		int added = array_add(to_return->data, decoder->inflated->data + window_start, checkpoint.window_length);
+		if (added && checkpoint.row > 0)
+		{
+			added = array_add(to_return->data, image->pixel_data->data + (checkpoint.row - 1) * scanline_size, scanline_size);
+		}
+		if (!added || !add_checkpoint(to_return, &capacity, &checkpoint))
+		{
+			fprintf(stderr, "decoder_build_index: unable to allocate the index.\n");
+			free_png_index(to_return);
+			return NULL;
+		}
+		last_offset = boundary->output_offset;
+	}
+
+	return to_return;
+}
+
+static int add_checkpoint(png_index* index, uint64_t* capacity, const png_checkpoint* checkpoint)
+{
+	if (index->count == *capacity)
+	{
+		uint64_t new_capacity = (*capacity < 16) ? 16 : *capacity * 2;
+		png_checkpoint* grown = realloc(index->checkpoints, new_capacity * sizeof(png_checkpoint));
+		if (grown == NULL)
+		{
+			return 0;
+		}
+		index->checkpoints = grown;
+		*capacity = new_capacity;
+	}
+
+	index->checkpoints[index->count++] = *checkpoint;
+	return 1;
+}
+
+//signature, the header fields, the checkpoints and the data they point into
+int save_png_index(const png_index* index, const char* filename)
+{
+	FILE* output = fopen(filename, "wb");
+	if (output == NULL)
+	{
+		fprintf(stderr, "save_png_index: unable to create %s\n", filename);
+		return 0;
+	}
+
+	uint32_t size[3] = {index->w, index->h, index->bytes_per_pixel};
+	uint64_t counts[4] = {index->compressed_size, index->span, index->count, index->data->count};
+	int to_return = fwrite(index_signature, 1, 8, output) == 8
+		&& fwrite(size, sizeof(size), 1, output) == 1
+		&& fwrite(counts, sizeof(counts), 1, output) == 1
+		&& fwrite(index->checkpoints, sizeof(png_checkpoint), index->count, output) == index->count
+		&& fwrite(index->data->data, 1, index->data->count, output) == index->data->count;
+
+	if (fclose(output) != 0)
+	{
+		to_return = 0;
+	}
+	if (!to_return)
+	{
+		fprintf(stderr, "save_png_index: unable to write %s\n", filename);
+		remove(filename);
+	}
+	return to_return;
+}
+
+png_index* load_png_index(const char* filename)
+{
+	FILE* input = fopen(filename, "rb");
+	if (input == NULL)
+	{
+		return NULL;
+	}
+
+	char signature[8];
+	uint32_t size[3];
+	uint64_t counts[4];
+	if (fread(signature, 1, 8, input) != 8 || memcmp(signature, index_signature, 8) != 0
+		|| fread(size, sizeof(size), 1, input) != 1 || fread(counts, sizeof(counts), 1, input) != 1)
+	{
+		fprintf(stderr, "load_png_index: %s is not an index file\n", filename);
+		fclose(input);
+		return NULL;
+	}
+
+	png_index* to_return = calloc(1, sizeof(png_index));
+	to_return->w = size[0];
+	to_return->h = size[1];
+	to_return->bytes_per_pixel = size[2];
+	to_return->compressed_size = counts[0];
+	to_return->span = counts[1];
+	to_return->count = counts[2];
+	to_return->data = create_array();
+
+	//a corrupt count would fail to read long before it could claim much memory, so the sizes are checked against the file
+	struct stat info;
+	int to_read = fstat(fileno(input), &info) == 0 && counts[2] < (uint64_t)info.st_size / sizeof(png_checkpoint) + 1 && counts[3] <= (uint64_t)info.st_size;
+	to_return->checkpoints = to_read ? malloc(counts[2] * sizeof(png_checkpoint) + 1) : NULL;
+	to_read = to_read && to_return->checkpoints != NULL && array_resize(to_return->data, counts[3])
+		&& fread(to_return->checkpoints, sizeof(png_checkpoint), counts[2], input) == counts[2]
+		&& fread(to_return->data->data, 1, counts[3], input) == counts[3];
+	fclose(input);
+
+	//every checkpoint has to point inside the data, with its row behind the window
+	uint64_t scanline_size = (uint64_t)to_return->w * to_return->bytes_per_pixel;
+	for (uint64_t i = 0; to_read && i < to_return->count; i++)
+	{
+		const png_checkpoint* checkpoint = &to_return->checkpoints[i];
+		uint64_t length = checkpoint->window_length + (checkpoint->row > 0 ? scanline_size : 0);
+		to_read = checkpoint->data_offset <= counts[3] && length <= counts[3] - checkpoint->data_offset
+			&& checkpoint->window_length <= checkpoint->output_offset
+			&& checkpoint->output_offset - checkpoint->window_length <= checkpoint->row * (scanline_size + 1)
+			&& checkpoint->row < (uint32_t)to_return->h
+			&& checkpoint->output_offset <= (uint64_t)to_return->h * (scanline_size + 1);
+	}
+
+	if (!to_read)
+	{
+		fprintf(stderr, "load_png_index: %s is corrupt\n", filename);
+		free_png_index(to_return);
+		return NULL;
+	}
+	return to_return;
+}
+
+void free_png_index(png_index* to_free)
+{
+	if (to_free != NULL)
+	{
+		free_array(to_free->data);
+		free(to_free->checkpoints);
+		free(to_free);
+	}
+}
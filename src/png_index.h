@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+
+//spacing of checkpoints (in bytes of filtered image data) when none is given
+#define DEFAULT_CHECKPOINT_SPAN (4 << 20)
+
+//everything needed to start inflating in the middle of an image's data
+typedef struct Png_checkpoint
+{
+	//where the next deflate block starts, in bits from the zlib header
+	uint64_t bit_offset;
+
+	//filtered bytes inflated before that block, and the row those bytes end in (rows before it are finished)
+	uint64_t output_offset;
+	uint32_t row;
+
+	//filtered bytes right before output_offset: the 32 KiB deflate window, and at least everything of row
+	//followed by the unfiltered row above row (nothing when row is 0). both live in the index data
+	uint64_t data_offset;
+	uint64_t window_length;
+}png_checkpoint;
+
+typedef struct Png_index
+{
+	//image the index was built for. it is only used with data that matches
+	int w;
+	int h;
+	uint8_t bytes_per_pixel;
+	uint64_t compressed_size;
+
+	uint64_t span;
+	png_checkpoint* checkpoints;
+	uint64_t count;
+
+	//windows and rows of every checkpoint
+	dynamic_array* data;
+}png_index;
+
+//build an index from the last full decode of decoder (decoder_read or decoder_read_memory, before decoder_detach)
+//checkpoints are at least span bytes of filtered data apart (0 is DEFAULT_CHECKPOINT_SPAN). NULL on failure
+png_index* decoder_build_index(png_decoder* decoder, uint64_t span);
+
+//the file is in host byte order and only meant for the machine that wrote it. 1 is success, 0 is failure
+int save_png_index(const png_index* index, const char* filename);
+png_index* load_png_index(const char* filename);
+
+void free_png_index(png_index* to_free);
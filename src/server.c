@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "thread_pool.h"
+#include "png.h"
+#include "bmp.h"
+#include "image_cache.h"
+#include "admission.h"
+
+//with a memory budget a request only counts while it's served, so a worker doesn't keep a decoder that grew past this
+#define RETAINED_BYTES (16 << 20)
+
+//state kept warm by each worker between requests
+typedef struct Server_worker
+{
+	png_decoder* decoder;
+	uint8_t* input;
+	uint64_t input_capacity;
+}server_worker;
+
+typedef struct Server_state
+{
+	const server_options* options;
+	server_worker* workers;
+
+	//NULL when options->cache_bytes is 0
+	image_cache* cache;
+
+	//applied to every decoder (from options->max_decode_milliseconds)
+	decode_limits limits;
+
+	//NULL when options->max_memory_bytes is 0
+	admission* admission;
+}server_state;
+
+typedef struct Connection
+{
+	server_state* server;
+	int socket;
+}connection;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal(int signal_number);
+static void connection_task(void* arg, int worker);
+static int handle_request(server_state* server, server_worker* state, int socket, const server_request* request);
+static int send_error(int socket, server_status status, const char* message);
+static int respond(server_state* server, server_worker* state, int socket, const server_request* request, const char* output_path);
+static int check_limits(const server_options* options, const png* header, uint64_t size, uint64_t memory_bytes, char* message, size_t message_size);
+
+server_options default_server_options()
+{
+	server_options to_return;
+
+	to_return.socket_path = NULL;
+	to_return.threads = 0;
+	to_return.max_input_bytes = 256 << 20;
+	to_return.max_pixels = 1 << 28;
+	to_return.timeout_seconds = 30;
+	to_return.max_decode_milliseconds = 0;
+	to_return.cache_bytes = 0;
+	to_return.max_memory_bytes = 0;
+
+	return to_return;
+}
+
+int run_server(const server_options* options)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (options->socket_path == NULL || strlen(options->socket_path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "server: socket path is missing or too long\n");
+		return 1;
+	}
+	strcpy(address.sun_path, options->socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+	{
+		fprintf(stderr, "server: failed to create socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	//a socket file left behind by a previous run would make bind fail
+	unlink(options->socket_path);
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+	{
+		fprintf(stderr, "server: failed to listen on %s: %s\n", options->socket_path, strerror(errno));
+		close(listener);
+		return 1;
+	}
+
+	//no SA_RESTART so accept() returns when a signal arrives
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	//workers inherit a blocked mask so the signals always interrupt the accept loop
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	thread_pool* pool = create_pool(options->threads);
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+	if (pool == NULL)
+	{
+		close(listener);
+		unlink(options->socket_path);
+		return 1;
+	}
+
+	server_state server;
+	server.options = options;
+	server.workers = calloc(pool->thread_count, sizeof(server_worker));
+	memset(&server.limits, 0, sizeof(decode_limits));
+	server.limits.time_budget_nanoseconds = options->max_decode_milliseconds * 1000000;
+	server.cache = (options->cache_bytes > 0) ? create_image_cache(options->cache_bytes) : NULL;
+	if (server.cache != NULL)
+	{
+		server.cache->limits = server.limits;
+	}
+	server.admission = (options->max_memory_bytes > 0) ? create_admission(NULL, options->max_memory_bytes) : NULL;
+
+	fprintf(stderr, "server: listening on %s with %d workers\n", options->socket_path, pool->thread_count);
+
+	while (!stop_requested)
+	{
+		int client = accept(listener, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno != EINTR)
+			{
+				fprintf(stderr, "server: accept failed: %s\n", strerror(errno));
+			}
+			continue;
+		}
+
+		//idle or stalled clients don't get to hold a worker forever
+		if (options->timeout_seconds > 0)
+		{
+			struct timeval timeout;
+			timeout.tv_sec = options->timeout_seconds;
+			timeout.tv_usec = 0;
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		}
+
+		connection* cur = malloc(sizeof(connection));
+		cur->server = &server;
+		cur->socket = client;
+		pool_submit(pool, connection_task, cur);
+	}
+
+	fprintf(stderr, "server: shutting down\n");
+	close(listener);
+	unlink(options->socket_path);
+
+	//connections that are still open finish (or time out) before the workers exit
+	int thread_count = pool->thread_count;
+	free_pool(pool);
+	for (int i = 0; i < thread_count; i++)
+	{
+		free_decoder(server.workers[i].decoder);
+		free(server.workers[i].input);
+	}
+	free(server.workers);
+
+	if (server.cache != NULL)
+	{
+		cache_stats stats = get_cache_stats(server.cache);
+		fprintf(stderr, "server: cache %lu hits, %lu misses (%lu shared), %lu evictions, %lu images in %lu bytes\n",
+			stats.hits, stats.misses, stats.shared_misses, stats.evictions, stats.entries, stats.bytes);
+		free_image_cache(server.cache);
+	}
+	if (server.admission != NULL)
+	{
+		fprintf(stderr, "server: memory budget %lu MB, at most %lu MB predicted at once, %lu requests waited for memory\n",
+			server.admission->budget >> 20, server.admission->peak >> 20, server.admission->waited);
+		free_admission(server.admission);
+	}
+
+	return 0;
+}
+
+static void handle_signal(int signal_number)
+{
+	stop_requested = 1;
+}
+
+//serve requests on one connection until the client hangs up
+static void connection_task(void* arg, int worker)
+{
+	connection* cur = arg;
+	server_worker* state = &cur->server->workers[worker];
+
+	server_request request;
+	while (receive_all(cur->socket, &request, sizeof(request)))
+	{
+		if (!handle_request(cur->server, state, cur->socket, &request))
+		{
+			break;
+		}
+	}
+
+	close(cur->socket);
+	free(cur);
+}
+
+//returns 0 when the connection can't be used any further
+static int handle_request(server_state* server, server_worker* state, int socket, const server_request* request)
+{
+	const server_options* options = server->options;
+	int is_path = (request->command == SERVER_DECODE_PATH || request->command == SERVER_CONVERT_PATH);
+	int is_convert = (request->command == SERVER_CONVERT_PATH || request->command == SERVER_CONVERT_BYTES);
+
+	if (request->magic != SERVER_MAGIC || request->command < SERVER_DECODE_PATH || request->command > SERVER_CONVERT_BYTES)
+	{
+		send_error(socket, SERVER_BAD_REQUEST, "unknown request");
+		return 0;
+	}
+	if ((is_path && request->input_length > SERVER_MAX_PATH) || (is_convert && (request->output_length == 0 || request->output_length > SERVER_MAX_PATH)) || (!is_convert && request->output_length != 0))
+	{
+		send_error(socket, SERVER_BAD_REQUEST, "invalid path length");
+		return 0;
+	}
+
+	//the rest of an oversized request is never read, so the connection is closed after the error.
+	//whatever the limits are, the lengths have to fit in the buffer size worked out below without wrapping
+	if (request->input_length > SIZE_MAX - SERVER_MAX_PATH - 2)
+	{
+		send_error(socket, SERVER_TOO_LARGE, "input is larger than the server can hold");
+		return 0;
+	}
+	if (!is_path && options->max_input_bytes > 0 && request->input_length > options->max_input_bytes)
+	{
+		send_error(socket, SERVER_TOO_LARGE, "input is larger than the server allows");
+		return 0;
+	}
+
+	//input and output path are kept together in the worker's buffer (+2 for the terminators)
+	uint64_t needed = request->input_length + request->output_length + 2;
+	if (needed > state->input_capacity)
+	{
+		uint8_t* temp = realloc(state->input, needed);
+		if (temp == NULL)
+		{
+			send_error(socket, SERVER_TOO_LARGE, "out of memory");
+			return 0;
+		}
+		state->input = temp;
+		state->input_capacity = needed;
+	}
+
+	char* output_path = (char*)state->input + request->input_length + 1;
+	if (!receive_all(socket, state->input, request->input_length) || !receive_all(socket, output_path, request->output_length))
+	{
+		return 0;
+	}
+	state->input[request->input_length] = 0;
+	output_path[request->output_length] = 0;
+
+	//check the header against the limits before spending any time decoding
+	char message[256];
+	png header;
+	uint64_t size = request->input_length;
+	if (is_path)
+	{
+		struct stat info;
+		if (stat((char*)state->input, &info) != 0)
+		{
+			return send_error(socket, SERVER_DECODE_FAILED, "input file does not exist");
+		}
+		if (options->max_input_bytes > 0 && (uint64_t)info.st_size > options->max_input_bytes)
+		{
+			return send_error(socket, SERVER_TOO_LARGE, "input file is larger than the server allows");
+		}
+		if (!probe_png((char*)state->input, &header))
+		{
+			return send_error(socket, SERVER_DECODE_FAILED, "input is not a supported png");
+		}
+		size = info.st_size;
+	}
+	else if (!probe_png_memory(state->input, request->input_length, &header))
+	{
+		return send_error(socket, SERVER_DECODE_FAILED, "input is not a supported png");
+	}
+
+	//a full decode, plus the bmp when converting (cache hits need less, but can't be told apart yet)
+	uint64_t memory_bytes = estimate_decode_memory(state->decoder, &header, size, DECODE_MODE_FULL, is_path);
+	if (is_convert)
+	{
+		memory_bytes += bmp_file_size(header.w, header.h);
+	}
+
+	if (!check_limits(options, &header, size, memory_bytes, message, sizeof(message)))
+	{
+		return send_error(socket, SERVER_TOO_LARGE, message);
+	}
+
+	if (server->admission == NULL)
+	{
+		return respond(server, state, socket, request, output_path);
+	}
+
+	admission_wait(server->admission, memory_bytes);
+	int to_return = respond(server, state, socket, request, output_path);
+	admission_release(server->admission, memory_bytes);
+
+	if (memory_bytes >= RETAINED_BYTES)
+	{
+		free_decoder(state->decoder);
+		state->decoder = NULL;
+	}
+	return to_return;
+}
+
+//decode the request's png (already checked against the limits) and send the response
+static int respond(server_state* server, server_worker* state, int socket, const server_request* request, const char* output_path)
+{
+	int is_path = (request->command == SERVER_DECODE_PATH || request->command == SERVER_CONVERT_PATH);
+	int is_convert = (request->command == SERVER_CONVERT_PATH || request->command == SERVER_CONVERT_BYTES);
+
+	//cached images are shared and read only, so they are held until the response is out
+	png* image = NULL;
+	cached_image* entry = NULL;
+	if (server->cache != NULL)
+	{
+		entry = is_path ? cache_get(server->cache, (char*)state->input) : cache_get_memory(server->cache, state->input, request->input_length);
+		image = (entry != NULL) ? entry->image : NULL;
+	}
+	else
+	{
+		if (state->decoder == NULL)
+		{
+			state->decoder = create_decoder();
+			decoder_set_limits(state->decoder, &server->limits);
+		}
+		image = is_path ? decoder_read(state->decoder, (char*)state->input) : decoder_read_memory(state->decoder, state->input, request->input_length);
+		if (!image->is_valid && state->decoder->stopped == DECODE_OUT_OF_TIME)
+		{
+			return send_error(socket, SERVER_OUT_OF_TIME, "decode took longer than the server allows");
+		}
+	}
+	if (image == NULL || !image->is_valid)
+	{
+		return send_error(socket, SERVER_DECODE_FAILED, "png could not be decoded");
+	}
+
+	server_response response;
+	memset(&response, 0, sizeof(response));
+	response.magic = SERVER_MAGIC;
+	response.status = SERVER_OK;
+	response.width = image->w;
+	response.height = image->h;
+	response.bytes_per_pixel = image->bytes_per_pixel;
+
+	int to_return = 1;
+	if (is_convert)
+	{
+		if (!write_bmp(image->pixel_data->data, image->w, image->h, image->bytes_per_pixel, output_path))
+		{
+			cache_release(entry);
+			return send_error(socket, SERVER_WRITE_FAILED, "output file could not be written");
+		}
+		to_return = send_all(socket, &response, sizeof(response));
+	}
+	else
+	{
+		response.data_length = (uint64_t)image->w * image->h * image->bytes_per_pixel;
+		to_return = send_all(socket, &response, sizeof(response)) && send_all(socket, image->pixel_data->data, response.data_length);
+	}
+
+	cache_release(entry);
+	return to_return;
+}
+
+static int check_limits(const server_options* options, const png* header, uint64_t size, uint64_t memory_bytes, char* message, size_t message_size)
+{
+	uint64_t pixels = (uint64_t)header->w * header->h;
+	if (options->max_pixels > 0 && pixels > options->max_pixels)
+	{
+		snprintf(message, message_size, "image is %dx%d, the server allows at most %lu pixels", header->w, header->h, options->max_pixels);
+		return 0;
+	}
+
+	//shed work that would only be stopped halfway through anyway
+	decode_cost cost = estimate_decode_cost(header, size);
+	if (options->max_decode_milliseconds > 0 && cost.nanoseconds / 1000000 > options->max_decode_milliseconds)
+	{
+		snprintf(message, message_size, "image would take about %lu ms to decode, the server allows %lu ms", cost.nanoseconds / 1000000, options->max_decode_milliseconds);
+		return 0;
+	}
+
+	//it would never fit under the budget, not even alone
+	if (options->max_memory_bytes > 0 && memory_bytes > options->max_memory_bytes)
+	{
+		snprintf(message, message_size, "image would need about %lu MB to decode, the server allows %lu MB", memory_bytes >> 20, options->max_memory_bytes >> 20);
+		return 0;
+	}
+	return 1;
+}
+
+//error responses carry a message instead of pixels. the connection stays usable
+static int send_error(int socket, server_status status, const char* message)
+{
+	server_response response;
+	memset(&response, 0, sizeof(response));
+	response.magic = SERVER_MAGIC;
+	response.status = status;
+	response.data_length = strlen(message);
+
+	return send_all(socket, &response, sizeof(response)) && send_all(socket, message, response.data_length);
+}
+
+int send_all(int socket, const void* data, uint64_t length)
+{
+	const uint8_t* position = data;
+	while (length > 0)
+	{
+		ssize_t sent = send(socket, position, length, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (sent <= 0)
+		{
+			return 0;
+		}
+		position += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+int receive_all(int socket, void* data, uint64_t length)
+{
+	uint8_t* position = data;
+	while (length > 0)
+	{
+		ssize_t received = recv(socket, position, length, 0);
+		if (received < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (received <= 0)
+		{
+			return 0;
+		}
+		position += received;
+		length -= received;
+	}
+	return 1;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+//every request and response starts with this value
+#define SERVER_MAGIC 0x44474E50
+
+//largest path a request may carry
+#define SERVER_MAX_PATH 4096
+
+typedef enum Server_command
+{
+	//decode the png at a path and send the pixels back
+	SERVER_DECODE_PATH = 1,
+
+	//decode png bytes sent with the request and send the pixels back
+	SERVER_DECODE_BYTES = 2,
+
+	//decode the png at a path and write it to the output path as bmp
+	SERVER_CONVERT_PATH = 3,
+
+	//decode png bytes sent with the request and write them to the output path as bmp
+	SERVER_CONVERT_BYTES = 4
+}server_command;
+
+typedef enum Server_status
+{
+	SERVER_OK = 0,
+	SERVER_BAD_REQUEST = 1,
+	SERVER_TOO_LARGE = 2,
+	SERVER_DECODE_FAILED = 3,
+	SERVER_WRITE_FAILED = 4,
+
+	//the decode was stopped because it took longer than the server allows
+	SERVER_OUT_OF_TIME = 5
+}server_status;
+
+//sent by the client, followed by input_length bytes (path or png data) and output_length bytes (output path)
+//the socket is local, so fields are in host byte order
+typedef struct Server_request
+{
+	uint32_t magic;
+	uint32_t command;
+	uint64_t input_length;
+	uint64_t output_length;
+}server_request;
+
+//sent by the server, followed by data_length bytes (pixels on success, an error message otherwise)
+typedef struct Server_response
+{
+	uint32_t magic;
+	uint32_t status;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytes_per_pixel;
+	uint32_t reserved;
+	uint64_t data_length;
+}server_response;
+
+typedef struct Server_options
+{
+	const char* socket_path;
+
+	//worker threads (each serves one connection at a time). <= 0 uses every core
+	int threads;
+
+	//per-request limits (0 means unlimited)
+	uint64_t max_input_bytes;
+	uint64_t max_pixels;
+
+	//connections that send nothing for this long are closed
+	int timeout_seconds;
+
+	//decodes are stopped after this long, and images estimated to take longer are refused before decoding (0 means unlimited)
+	uint64_t max_decode_milliseconds;
+
+	//decoded images are kept (and shared between workers) up to this many bytes. 0 turns the cache off
+	uint64_t cache_bytes;
+
+	//decodes only start while the memory of every decode in progress (predicted from the headers) stays under this.
+	//requests that don't fit yet wait, smaller ones may go first, and images that need more on their own are refused.
+	//0 is no budget
+	uint64_t max_memory_bytes;
+}server_options;
+
+server_options default_server_options();
+
+//listen on options->socket_path until SIGINT/SIGTERM. returns 0 on a clean shutdown
+int run_server(const server_options* options);
+
+//helpers shared with the client. 1 is success, 0 is failure (or end of stream)
+int send_all(int socket, const void* data, uint64_t length);
+int receive_all(int socket, void* data, uint64_t length);
@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include "tensor_output.h"
+
+//state of one decode, handed to the row callback
+typedef struct Tensor_decode
+{
+	png_decoder* decoder;
+	const tensor_options* options;
+	uint8_t* output;
+	uint64_t output_size;
+
+	//planes written, and the first of them that the png doesn't have (filled instead of converted)
+	int channels;
+	int converted;
+
+	//half precision of every value of each channel (float16 only)
+	uint16_t half_values[4][256];
+}tensor_decode;
+
+static int tensor_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length);
+static int start_tensor(tensor_decode* state);
+static void convert_row(const tensor_decode* state, const uint8_t* row, uint64_t offset);
+static void fill_row(const tensor_decode* state, uint64_t offset);
+
+tensor_options default_tensor_options(tensor_type type)
+{
+	tensor_options to_return;
+	memset(&to_return, 0, sizeof(tensor_options));
+	to_return.type = type;
+	for (int c = 0; c < 4; c++)
+	{
+		to_return.scale[c] = 1.0f / 255.0f;
+	}
+
+	return to_return;
+}
+
+uint64_t tensor_size(const png* header, const tensor_options* options)
+{
+	static const uint64_t element_sizes[] = {1, 4, 2};
+	int channels = (options->channels > 0) ? options->channels : header->bytes_per_pixel;
+	return (uint64_t)header->w * header->h * channels * element_sizes[options->type];
+}
+
+png* decoder_read_tensor(png_decoder* decoder, const char* filename, const tensor_options* options, void* output, uint64_t output_size)
+{
+	tensor_decode state;
+	memset(&state, 0, sizeof(tensor_decode));
+	state.decoder = decoder;
+	state.options = options;
+	state.output = output;
+	state.output_size = output_size;
+
+	return decoder_read_rows(decoder, filename, tensor_row, &state);
+}
+
+png* decoder_read_memory_tensor(png_decoder* decoder, const uint8_t* data, uint64_t size, const tensor_options* options, void* output, uint64_t output_size)
+{
+	tensor_decode state;
+	memset(&state, 0, sizeof(tensor_decode));
+	state.decoder = decoder;
+	state.options = options;
+	state.output = output;
+	state.output_size = output_size;
+
+	return decoder_read_memory_rows(decoder, data, size, tensor_row, &state);
+}
+
+uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	//infinity stays infinity and NaN stays NaN
+	if (exponent == 0xFF - 127 + 15)
+	{
+		return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+	}
+	if (exponent >= 31)
+	{
+		return sign | 0x7C00;
+	}
+
+	//too small for a normal half: the mantissa (with its implicit 1) is shifted down to a subnormal, or to 0
+	uint32_t shift = 13;
+	uint32_t half = 0;
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+		{
+			return sign;
+		}
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+	}
+	else
+	{
+		half = (uint32_t)exponent << 10;
+	}
+
+	//round to nearest even. a carry out of the mantissa moves into the exponent, which is still right (up to infinity)
+	half |= mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1)))
+	{
+		half++;
+	}
+	return sign | half;
+}
+
+static int tensor_row(void* user, uint32_t row_index, const uint8_t* row, uint64_t length)
+{
+	tensor_decode* state = user;
+	if (row_index == 0 && !start_tensor(state))
+	{
+		return 0;
+	}
+
+	uint64_t offset = (uint64_t)row_index * state->decoder->image.w;
+	convert_row(state, row, offset);
+	fill_row(state, offset);
+	return 1;
+}
+
+//check the options and the output against the header (known once the first row is out)
+static int start_tensor(tensor_decode* state)
+{
+	const tensor_options* options = state->options;
+	png* header = &state->decoder->image;
+	state->channels = (options->channels > 0) ? options->channels : header->bytes_per_pixel;
+	state->converted = (state->channels < header->bytes_per_pixel) ? state->channels : header->bytes_per_pixel;
+
+	if (state->channels > 4 || options->type > TENSOR_FLOAT16)
+	{
+		fprintf(stderr, "decoder_read_tensor: %d channels of type %d are not supported.\n", state->channels, options->type);
+		return 0;
+	}
+	if (state->output_size < tensor_size(header, options))
+	{
+		fprintf(stderr, "decoder_read_tensor: a %dx%d image needs %lu bytes, the output has %lu.\n", header->w, header->h, tensor_size(header, options), state->output_size);
+		return 0;
+	}
+
+	//every channel only has 256 values, so their halves are worked out once
+	if (options->type == TENSOR_FLOAT16)
+	{
+		for (int c = 0; c < state->channels; c++)
+		{
+			for (int value = 0; value < 256; value++)
+			{
+				state->half_values[c][value] = float_to_half(value * options->scale[c] + options->bias[c]);
+			}
+		}
+	}
+	return 1;
+}
+
+//one row of interleaved pixels into count planes, starting at element offset of each. bytes_per_pixel and count are
+//constants wherever this is inlined, so every channel of a pixel is loaded as one group and the loops vectorize
+static inline __attribute__((always_inline)) void split_row(const tensor_decode* state, const uint8_t* restrict row, uint64_t offset, int bytes_per_pixel, int count)
+{
+	uint64_t width = state->decoder->image.w;
+	uint64_t plane_size = width * state->decoder->image.h;
+	const tensor_options* options = state->options;
+
+	if (options->type == TENSOR_UINT8)
+	{
+		uint8_t* restrict p0 = state->output + offset;
+		uint8_t* restrict p1 = (count > 1) ? p0 + plane_size : NULL;
+		uint8_t* restrict p2 = (count > 2) ? p1 + plane_size : NULL;
+		uint8_t* restrict p3 = (count > 3) ? p2 + plane_size : NULL;
+		for (uint64_t x = 0; x < width; x++)
+		{
+			const uint8_t* pixel = row + x * bytes_per_pixel;
+			p0[x] = pixel[0];
+			if (count > 1)
+			{
+				p1[x] = pixel[1];
+			}
+			if (count > 2)
+			{
+				p2[x] = pixel[2];
+			}
+			if (count > 3)
+			{
+				p3[x] = pixel[3];
+			}
+		}
+	}
+	else if (options->type == TENSOR_FLOAT32)
+	{
+		float* restrict p0 = (float*)state->output + offset;
+		float* restrict p1 = (count > 1) ? p0 + plane_size : NULL;
+		float* restrict p2 = (count > 2) ? p1 + plane_size : NULL;
+		float* restrict p3 = (count > 3) ? p2 + plane_size : NULL;
+		float s0 = options->scale[0], s1 = options->scale[1], s2 = options->scale[2], s3 = options->scale[3];
+		float b0 = options->bias[0], b1 = options->bias[1], b2 = options->bias[2], b3 = options->bias[3];
+		for (uint64_t x = 0; x < width; x++)
+		{
+			const uint8_t* pixel = row + x * bytes_per_pixel;
+			p0[x] = pixel[0] * s0 + b0;
+			if (count > 1)
+			{
+				p1[x] = pixel[1] * s1 + b1;
+			}
+			if (count > 2)
+			{
+				p2[x] = pixel[2] * s2 + b2;
+			}
+			if (count > 3)
+			{
+				p3[x] = pixel[3] * s3 + b3;
+			}
+		}
+	}
+	else
+	{
+		uint16_t* restrict p0 = (uint16_t*)state->output + offset;
+		uint16_t* restrict p1 = (count > 1) ? p0 + plane_size : NULL;
+		uint16_t* restrict p2 = (count > 2) ? p1 + plane_size : NULL;
+		uint16_t* restrict p3 = (count > 3) ? p2 + plane_size : NULL;
+		const uint16_t (*values)[256] = state->half_values;
+		for (uint64_t x = 0; x < width; x++)
+		{
+			const uint8_t* pixel = row + x * bytes_per_pixel;
+			p0[x] = values[0][pixel[0]];
+			if (count > 1)
+			{
+				p1[x] = values[1][pixel[1]];
+			}
+			if (count > 2)
+			{
+				p2[x] = values[2][pixel[2]];
+			}
+			if (count > 3)
+			{
+				p3[x] = values[3][pixel[3]];
+			}
+		}
+	}
+}
+
+static void convert_row(const tensor_decode* state, const uint8_t* row, uint64_t offset)
+{
+	int bytes_per_pixel = state->decoder->image.bytes_per_pixel;
+	switch (bytes_per_pixel * 8 + state->converted)
+	{
+	case 3 * 8 + 1:
+		split_row(state, row, offset, 3, 1);
+		break;
+	case 3 * 8 + 2:
+		split_row(state, row, offset, 3, 2);
+		break;
+	case 3 * 8 + 3:
+		split_row(state, row, offset, 3, 3);
+		break;
+	case 4 * 8 + 1:
+		split_row(state, row, offset, 4, 1);
+		break;
+	case 4 * 8 + 2:
+		split_row(state, row, offset, 4, 2);
+		break;
+	case 4 * 8 + 3:
+		split_row(state, row, offset, 4, 3);
+		break;
+	case 4 * 8 + 4:
+		split_row(state, row, offset, 4, 4);
+		break;
+	}
+}
+
+//planes past the png's channels (alpha of an RGB image) are opaque
+static void fill_row(const tensor_decode* state, uint64_t offset)
+{
+	const tensor_options* options = state->options;
+	uint64_t width = state->decoder->image.w;
+	uint64_t plane_size = width * state->decoder->image.h;
+
+	for (int c = state->converted; c < state->channels; c++)
+	{
+		uint64_t start = c * plane_size + offset;
+		if (options->type == TENSOR_UINT8)
+		{
+			memset(state->output + start, 255, width);
+		}
+		else if (options->type == TENSOR_FLOAT32)
+		{
+			float* plane = (float*)state->output + start;
+			float value = 255 * options->scale[c] + options->bias[c];
+			for (uint64_t x = 0; x < width; x++)
+			{
+				plane[x] = value;
+			}
+		}
+		else
+		{
+			uint16_t* plane = (uint16_t*)state->output + start;
+			for (uint64_t x = 0; x < width; x++)
+			{
+				plane[x] = state->half_values[c][255];
+			}
+		}
+	}
+}
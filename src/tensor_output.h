@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "png.h"
+
+typedef enum Tensor_type
+{
+	TENSOR_UINT8 = 0,
+	TENSOR_FLOAT32 = 1,
+
+	//IEEE half precision, stored as uint16_t
+	TENSOR_FLOAT16 = 2
+}tensor_type;
+
+//how a decode is written as planes (CHW): every value of channel 0 row by row, then channel 1, ...
+typedef struct Tensor_options
+{
+	tensor_type type;
+
+	//planes to write, 1 to 4 (0 is every channel of the image). channels the png doesn't have are written as 255 (opaque)
+	int channels;
+
+	//float planes hold value * scale[c] + bias[c] for the 0-255 value of channel c. ignored for uint8
+	//normalizing with a mean and standard deviation (of values in 0-1) is scale = 1 / (255 * std), bias = -mean / std
+	float scale[4];
+	float bias[4];
+}tensor_options;
+
+//every channel of the image, values scaled to 0-1 for the float types
+tensor_options default_tensor_options(tensor_type type);
+
+//bytes the planes of an image with header's size take
+uint64_t tensor_size(const png* header, const tensor_options* options);
+
+//decode straight into the planes at output (output_size bytes, see tensor_size). rows are converted as soon as they are
+//unfiltered, so there's no interleaved copy of the image and no second pass over it. returns the decoder's png
+//like decoder_read_rows (header only). is_valid is 0 if the png is corrupt or output is too small for it
+png* decoder_read_tensor(png_decoder* decoder, const char* filename, const tensor_options* options, void* output, uint64_t output_size);
+png* decoder_read_memory_tensor(png_decoder* decoder, const uint8_t* data, uint64_t size, const tensor_options* options, void* output, uint64_t output_size);
+
+//float to IEEE half precision (round to nearest even)
+uint16_t float_to_half(float value);
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+//which pool/worker the current thread belongs to (-1 for threads outside the pool)
+static __thread thread_pool* current_pool = NULL;
+static __thread int current_worker = -1;
+
+typedef struct Worker_start
+{
+	thread_pool* pool;
+	int index;
+}worker_start;
+
+static void* worker_main(void* arg);
+static void deque_push(task_deque* deque, task to_push);
+static int deque_pop(task_deque* deque, task* output);
+static int deque_steal(task_deque* deque, task* output, int wait);
+static int find_task(thread_pool* pool, int worker, task* output);
+
+int core_count()
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cores > 0) ? (int)cores : 1;
+}
+
+thread_pool* create_pool(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = core_count();
+	}
+
+	thread_pool* to_return = calloc(1, sizeof(thread_pool));
+	to_return->thread_count = threads;
+	to_return->threads = calloc(threads, sizeof(pthread_t));
+	to_return->deques = calloc(threads, sizeof(task_deque));
+	pthread_mutex_init(&to_return->injected.lock, NULL);
+	to_return->injected.capacity = 64;
+	to_return->injected.tasks = calloc(64, sizeof(task));
+
+	atomic_init(&to_return->queued, 0);
+	atomic_init(&to_return->pending, 0);
+	pthread_mutex_init(&to_return->lock, NULL);
+	pthread_cond_init(&to_return->work_ready, NULL);
+	pthread_cond_init(&to_return->all_done, NULL);
+
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_mutex_init(&to_return->deques[i].lock, NULL);
+		to_return->deques[i].capacity = 64;
+		to_return->deques[i].tasks = calloc(64, sizeof(task));
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_start* start = malloc(sizeof(worker_start));
+		start->pool = to_return;
+		start->index = i;
+
+		if (pthread_create(&to_return->threads[i], NULL, worker_main, start) != 0)
+		{
+			free(start);
+			to_return->thread_count = i;
+			break;
+		}
+	}
+
+	//the deques of workers that never started are never used, so they go right away
+	for (int i = to_return->thread_count; i < threads; i++)
+	{
+		pthread_mutex_destroy(&to_return->deques[i].lock);
+		free(to_return->deques[i].tasks);
+	}
+
+	if (to_return->thread_count == 0)
+	{
+		fprintf(stderr, "thread_pool: failed to start any workers\n");
+		free_pool(to_return);
+		return NULL;
+	}
+	if (to_return->thread_count < threads)
+	{
+		fprintf(stderr, "thread_pool: failed to start worker %d, continuing with %d workers\n", to_return->thread_count, to_return->thread_count);
+	}
+
+	return to_return;
+}
+
+void free_pool(thread_pool* pool)
+{
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	pool_wait(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutting_down = 1;
+	pthread_cond_broadcast(&pool->work_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->thread_count; i++)
+	{
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	for (int i = 0; i < pool->thread_count; i++)
+	{
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].tasks);
+	}
+	pthread_mutex_destroy(&pool->injected.lock);
+	free(pool->injected.tasks);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_cond_destroy(&pool->all_done);
+
+	free(pool->deques);
+	free(pool->threads);
+	free(pool);
+}
+
+void pool_submit(thread_pool* pool, task_function function, void* arg)
+{
+	task to_push;
+	to_push.function = function;
+	to_push.arg = arg;
+
+	//work created by a worker stays local to it. outside work goes in one queue that is taken in order, so tasks
+	//submitted in a particular order (like the biggest files of a batch first) also start in that order
+	task_deque* queue = &pool->injected;
+	if (current_pool == pool && current_worker >= 0)
+	{
+		queue = &pool->deques[current_worker];
+	}
+
+	atomic_fetch_add(&pool->pending, 1);
+	deque_push(queue, to_push);
+	atomic_fetch_add(&pool->queued, 1);
+
+	//signal under the lock so a worker about to sleep can't miss it
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->work_ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(thread_pool* pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (atomic_load(&pool->pending) > 0)
+	{
+		pthread_cond_wait(&pool->all_done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_main(void* arg)
+{
+	worker_start* start = arg;
+	thread_pool* pool = start->pool;
+	int worker = start->index;
+	free(start);
+
+	current_pool = pool;
+	current_worker = worker;
+
+	while (1)
+	{
+		task to_run;
+		if (find_task(pool, worker, &to_run))
+		{
+			to_run.function(to_run.arg, worker);
+
+			if (atomic_fetch_sub(&pool->pending, 1) == 1)
+			{
+				pthread_mutex_lock(&pool->lock);
+				pthread_cond_broadcast(&pool->all_done);
+				pthread_mutex_unlock(&pool->lock);
+			}
+			continue;
+		}
+
+		//nothing to run or steal, sleep until something is submitted
+		pthread_mutex_lock(&pool->lock);
+		while (atomic_load(&pool->queued) == 0 && !pool->shutting_down)
+		{
+			pthread_cond_wait(&pool->work_ready, &pool->lock);
+		}
+		int done = pool->shutting_down && atomic_load(&pool->queued) == 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (done)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+//own deque first (newest task, still hot in cache), then the oldest outside task, then steal the oldest task from the others
+static int find_task(thread_pool* pool, int worker, task* output)
+{
+	if (deque_pop(&pool->deques[worker], output) || deque_steal(&pool->injected, output, 1))
+	{
+		atomic_fetch_sub(&pool->queued, 1);
+		return 1;
+	}
+
+	for (int i = 1; i < pool->thread_count; i++)
+	{
+		int victim = (worker + i) % pool->thread_count;
+		if (deque_steal(&pool->deques[victim], output, 0))
+		{
+			atomic_fetch_sub(&pool->queued, 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void deque_push(task_deque* deque, task to_push)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	//ring buffer is full, double it and unwrap the contents
+	if (deque->tail - deque->head == deque->capacity)
+	{
+		uint64_t new_capacity = deque->capacity * 2;
+		task* new_tasks = malloc(new_capacity * sizeof(task));
+		for (uint64_t i = deque->head; i < deque->tail; i++)
+		{
+			new_tasks[i % new_capacity] = deque->tasks[i % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = new_tasks;
+		deque->capacity = new_capacity;
+	}
+
+	deque->tasks[deque->tail % deque->capacity] = to_push;
+	deque->tail++;
+
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static int deque_pop(task_deque* deque, task* output)
+{
+	int to_return = 0;
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->tail > deque->head)
+	{
+		deque->tail--;
+		*output = deque->tasks[deque->tail % deque->capacity];
+		to_return = 1;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+	return to_return;
+}
+
+//take the oldest task. without wait a deque that is busy counts as empty
+static int deque_steal(task_deque* deque, task* output, int wait)
+{
+	int to_return = 0;
+
+	if (wait)
+	{
+		pthread_mutex_lock(&deque->lock);
+	}
+	else if (pthread_mutex_trylock(&deque->lock) != 0)
+	{
+		//don't queue up behind the owner, just try the next victim
+		return 0;
+	}
+
+	if (deque->tail > deque->head)
+	{
+		*output = deque->tasks[deque->head % deque->capacity];
+		deque->head++;
+		to_return = 1;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+	return to_return;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+//tasks get the index of the worker running them so they can use per-worker state
+typedef void (*task_function)(void* arg, int worker);
+
+typedef struct Task
+{
+	task_function function;
+	void* arg;
+}task;
+
+//each worker owns a deque. the owner pushes/pops at the tail, idle workers steal from the head
+typedef struct Task_deque
+{
+	pthread_mutex_t lock;
+	task* tasks;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t capacity;
+}task_deque;
+
+typedef struct Thread_pool
+{
+	int thread_count;
+	pthread_t* threads;
+	task_deque* deques;
+
+	//tasks sitting in a deque, and tasks submitted but not finished yet
+	atomic_uint_fast64_t queued;
+	atomic_uint_fast64_t pending;
+
+	//used to put idle workers to sleep and to wait for the pool to drain
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t all_done;
+
+	//tasks submitted from outside the pool, taken oldest first by whichever worker has nothing of its own
+	task_deque injected;
+	int shutting_down;
+}thread_pool;
+
+//threads <= 0 uses one thread per online core. NULL if not even one worker could be started
+thread_pool* create_pool(int threads);
+void free_pool(thread_pool* pool);
+
+//tasks submitted from inside a worker go to that worker's own deque
+void pool_submit(thread_pool* pool, task_function function, void* arg);
+
+//block until every submitted task (including tasks submitted by tasks) has finished
+void pool_wait(thread_pool* pool);
+
+//number of online cores
+int core_count();